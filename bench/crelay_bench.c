@@ -0,0 +1,719 @@
+/******************************************************************************
+ *
+ * Relay card control utility: HTTP API benchmark
+ *
+ * Description:
+ *   This program generates HTTP load on the crelay daemon and reports the
+ *   achieved throughput and latency percentiles. It can optionally start
+ *   the daemon itself (built with the simulated relay card driver) with a
+ *   given per-operation latency and jitter, so that every measurement is
+ *   done under the same conditions without real hardware.
+ *
+ *   Load can be generated in closed loop (every connection sends the next
+ *   request as soon as the previous response arrived) or in open loop
+ *   (requests are sent at a fixed rate and latency is measured from the
+ *   scheduled send time, so queueing delay is not hidden).
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Build instructions:
+ *   make
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <ftw.h>
+
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT 8000
+#define API_URL "/gpio"
+
+#define MAX_CONNS 256
+#define MAX_SIM_OPTS 16
+#define RESP_BUF_LEN 8192
+#define STARTUP_TIMEOUT_MS 5000
+#define LEASE_MS 10000   /* duration of leased sets, later requests renew them */
+
+typedef enum
+{
+   OP_STATUS=0,
+   OP_SET,
+   OP_PULSE,
+   OP_LEASE,
+   NUM_OPS
+} op_t;
+
+static const char* op_names[NUM_OPS] = { "status", "set", "pulse", "lease" };
+
+/* Latency samples in ns */
+typedef struct
+{
+   uint64_t *v;
+   size_t    n;
+   size_t    cap;
+} samples_t;
+
+typedef struct
+{
+   int          id;
+   pthread_t    thread;
+   unsigned int seed;
+   int          fd;
+   samples_t    lat[NUM_OPS];
+   uint64_t     errors[NUM_OPS];
+   uint64_t     connects;
+} worker_t;
+
+/* Command line options */
+static const char* host = DEFAULT_HOST;
+static int      port = DEFAULT_PORT;
+static int      num_conns = 1;
+static double   rate = 0;          /* requests/s, 0 means closed loop */
+static int      duration = 5;      /* s */
+static int      warmup = 1;        /* s */
+static int      keepalive = 0;
+static int      num_relays = 8;
+static int      num_cards = 0;      /* 0 means no serial parameter */
+static int      emulated_cards = 0; /* EMUxx serials instead of SIMx */
+static unsigned mix[NUM_OPS] = { 100, 0, 0, 0 };
+static unsigned mix_total = 100;
+static const char* mix_str = "status:100";
+
+/* Daemon spawned by us (if any) */
+static const char* daemon_path = NULL;
+static uint32_t sim_latency_us = 1000;
+static uint32_t sim_jitter_us = 0;
+static const char* sim_profile = "fixed";
+static const char* sim_opts[MAX_SIM_OPTS];
+static int      num_sim_opts = 0;
+static pid_t    daemon_pid = -1;
+static char     work_dir[] = "/tmp/crelay-bench-XXXXXX";  /* config and state files */
+static char     conf_path[sizeof(work_dir)+16];
+static char     shm_name[32];
+
+static struct sockaddr_in server_addr;
+static uint64_t t_start, t_measure, t_end;
+
+
+static uint64_t now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+static void sleep_until_ns(uint64_t t)
+{
+   struct timespec ts;
+   ts.tv_sec  = t / 1000000000ULL;
+   ts.tv_nsec = t % 1000000000ULL;
+   while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+
+static void samples_add(samples_t *s, uint64_t v)
+{
+   if (s->n == s->cap)
+   {
+      s->cap = s->cap ? 2*s->cap : 4096;
+      s->v = realloc(s->v, s->cap*sizeof(uint64_t));
+      if (s->v == NULL)
+      {
+         fprintf(stderr, "out of memory\n");
+         exit(EXIT_FAILURE);
+      }
+   }
+   s->v[s->n++] = v;
+}
+
+
+static int cmp_u64(const void *a, const void *b)
+{
+   uint64_t x = *(const uint64_t*)a;
+   uint64_t y = *(const uint64_t*)b;
+   return (x > y) - (x < y);
+}
+
+
+/* Value at percentile p (0..1) of a sorted sample set, in us */
+static double percentile_us(const samples_t *s, double p)
+{
+   size_t i;
+
+   if (s->n == 0) return 0;
+   i = (size_t)(p * s->n + 0.999999);
+   if (i > 0) i--;
+   if (i >= s->n) i = s->n-1;
+   return s->v[i] / 1000.0;
+}
+
+
+/**********************************************************
+ * Function parse_mix()
+ *
+ * Description: Parse the request mix string, e.g.
+ *              "status:80,set:18,pulse:2"
+ *
+ * Return:  0 - success
+ *         -1 - invalid mix
+ *********************************************************/
+static int parse_mix(const char *str)
+{
+   char buf[128];
+   char *tok, *save, *colon;
+   int i;
+
+   strncpy(buf, str, sizeof(buf)-1);
+   buf[sizeof(buf)-1] = 0;
+   memset(mix, 0, sizeof(mix));
+   mix_total = 0;
+
+   for (tok=strtok_r(buf, ",", &save); tok; tok=strtok_r(NULL, ",", &save))
+   {
+      colon = strchr(tok, ':');
+      if (colon == NULL) return -1;
+      *colon = 0;
+      for (i=0; i<NUM_OPS; i++)
+      {
+         if (!strcmp(tok, op_names[i])) break;
+      }
+      if (i == NUM_OPS) return -1;
+      mix[i] = atoi(colon+1);
+      mix_total += mix[i];
+   }
+
+   return (mix_total > 0) ? 0 : -1;
+}
+
+
+static op_t pick_op(worker_t *w)
+{
+   unsigned r = rand_r(&w->seed) % mix_total;
+   int i;
+
+   for (i=0; i<NUM_OPS-1; i++)
+   {
+      if (r < mix[i]) break;
+      r -= mix[i];
+   }
+   return i;
+}
+
+
+static int connect_server(void)
+{
+   int fd, one=1;
+
+   fd = socket(AF_INET, SOCK_STREAM, 0);
+   if (fd < 0) return -1;
+   setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+   if (connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0)
+   {
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+
+/* Find a header value in the response header block (case insensitive) */
+static const char* find_header(const char *hdr, const char *name)
+{
+   const char *p = hdr;
+   size_t len = strlen(name);
+
+   while ((p = strchr(p, '\n')) != NULL)
+   {
+      p++;
+      if (!strncasecmp(p, name, len) && p[len] == ':')
+      {
+         p += len+1;
+         while (*p == ' ') p++;
+         return p;
+      }
+   }
+   return NULL;
+}
+
+
+/**********************************************************
+ * Function do_request()
+ *
+ * Description: Send one request to the server and wait
+ *              for the complete response. The connection
+ *              is kept open if keep-alive is enabled and
+ *              the server allows it.
+ *
+ * Return:  0 - success (HTTP 200)
+ *         -1 - fail
+ *********************************************************/
+static int do_request(worker_t *w, op_t op)
+{
+   char req[256];
+   char card[32] = "";
+   char resp[RESP_BUF_LEN];
+   const char *hdr_end, *val;
+   int len, n, got=0, status;
+   long body_len=-1;
+   int reuse;
+
+   /* Spread the requests over the simulated cards SIM0, SIM1, ...
+    * or the emulated cards EMU00, EMU01, ... */
+   if (num_cards > 0)
+   {
+      if (emulated_cards)
+         snprintf(card, sizeof(card), "serial=EMU%02d", rand_r(&w->seed)%num_cards);
+      else
+         snprintf(card, sizeof(card), "serial=SIM%d", rand_r(&w->seed)%num_cards);
+   }
+
+   switch (op)
+   {
+      case OP_SET:
+         len = snprintf(req, sizeof(req), "GET %s?pin=%d&status=%d%s%s HTTP/1.1\r\n",
+                        API_URL, 1+rand_r(&w->seed)%num_relays, rand_r(&w->seed)%2,
+                        card[0] ? "&" : "", card);
+         break;
+      case OP_PULSE:
+         len = snprintf(req, sizeof(req), "GET %s?pin=%d&status=2%s%s HTTP/1.1\r\n",
+                        API_URL, 1+rand_r(&w->seed)%num_relays, card[0] ? "&" : "", card);
+         break;
+      case OP_LEASE:
+         len = snprintf(req, sizeof(req), "GET %s?pin=%d&status=1&lease_ms=%d%s%s HTTP/1.1\r\n",
+                        API_URL, 1+rand_r(&w->seed)%num_relays, LEASE_MS, card[0] ? "&" : "", card);
+         break;
+      default:
+         len = snprintf(req, sizeof(req), "GET %s%s%s HTTP/1.1\r\n",
+                        API_URL, card[0] ? "?" : "", card);
+         break;
+   }
+   len += snprintf(req+len, sizeof(req)-len, "Host: %s\r\nConnection: %s\r\n\r\n",
+                   host, keepalive ? "keep-alive" : "close");
+
+   if (w->fd < 0)
+   {
+      if ((w->fd = connect_server()) < 0) return -1;
+      w->connects++;
+   }
+
+   if (write(w->fd, req, len) != len)
+   {
+      goto fail;
+   }
+
+   /* Read until the end of the response header */
+   hdr_end = NULL;
+   while (hdr_end == NULL)
+   {
+      if (got >= (int)sizeof(resp)-1) goto fail;
+      n = read(w->fd, resp+got, sizeof(resp)-1-got);
+      if (n <= 0) goto fail;
+      got += n;
+      resp[got] = 0;
+      hdr_end = strstr(resp, "\r\n\r\n");
+   }
+
+   if (sscanf(resp, "HTTP/%*d.%*d %d", &status) != 1) goto fail;
+
+   val = find_header(resp, "Content-Length");
+   if (val) body_len = atol(val);
+   val = find_header(resp, "Connection");
+   reuse = keepalive && body_len >= 0 && !(val && !strncasecmp(val, "close", 5));
+
+   if (reuse)
+   {
+      /* Read exactly the announced body */
+      long have = got - (hdr_end + 4 - resp);
+      while (have < body_len)
+      {
+         n = read(w->fd, resp, sizeof(resp));
+         if (n <= 0) goto fail;
+         have += n;
+      }
+   }
+   else
+   {
+      /* Read until the server closes the connection */
+      while ((n = read(w->fd, resp, sizeof(resp))) > 0);
+      close(w->fd);
+      w->fd = -1;
+   }
+
+   return (status == 200) ? 0 : -1;
+
+ fail:
+   close(w->fd);
+   w->fd = -1;
+   return -1;
+}
+
+
+static void* worker_main(void *arg)
+{
+   worker_t *w = arg;
+   uint64_t t0, t1, next=0, interval=0;
+   op_t op;
+   int rc;
+
+   if (rate > 0)
+   {
+      /* Every connection gets an equal share of the rate,
+       * staggered so the requests are evenly spread */
+      interval = (uint64_t)(1e9 * num_conns / rate);
+      next = t_start + w->id * interval / num_conns;
+   }
+
+   while (1)
+   {
+      if (rate > 0)
+      {
+         if (next >= t_end) break;
+         sleep_until_ns(next);
+         t0 = next;
+         next += interval;
+      }
+      else
+      {
+         t0 = now_ns();
+         if (t0 >= t_end) break;
+      }
+
+      op = pick_op(w);
+      rc = do_request(w, op);
+      t1 = now_ns();
+
+      if (t0 < t_measure) continue;
+      if (rc == 0)
+         samples_add(&w->lat[op], t1-t0);
+      else
+         w->errors[op]++;
+   }
+
+   if (w->fd >= 0) close(w->fd);
+   return NULL;
+}
+
+
+/**********************************************************
+ * Function spawn_daemon()
+ *
+ * Description: Start the daemon in foreground with a
+ *              generated config file for the simulated
+ *              driver and wait until it accepts
+ *              connections. All files the daemon writes
+ *              (journal, history, statistics, unix socket)
+ *              are kept in a temporary directory, and the
+ *              shared memory segment gets its own name, so
+ *              a running production daemon is not touched.
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+static int spawn_daemon(void)
+{
+   FILE *f;
+   int fd, i;
+
+   if (mkdtemp(work_dir) == NULL)
+   {
+      perror(work_dir);
+      return -1;
+   }
+   snprintf(conf_path, sizeof(conf_path), "%s/crelay.conf", work_dir);
+   snprintf(shm_name, sizeof(shm_name), "/crelay-bench-%d", (int)getpid());
+   if ((f = fopen(conf_path, "w")) == NULL)
+   {
+      perror(conf_path);
+      return -1;
+   }
+   fprintf(f, "[HTTP server]\n");
+   fprintf(f, "server_iface = %s\n", host);
+   fprintf(f, "server_port = %d\n", port);
+   fprintf(f, "pulse_duration = 1\n");
+   fprintf(f, "[Unix socket]\n");
+   fprintf(f, "socket_path = %s/crelay.sock\n", work_dir);
+   fprintf(f, "[Shared memory]\n");
+   fprintf(f, "name = %s\n", shm_name);
+   fprintf(f, "[State journal]\n");
+   fprintf(f, "path = %s/state.journal\n", work_dir);
+   fprintf(f, "[History]\n");
+   fprintf(f, "dir = %s/history\n", work_dir);
+   fprintf(f, "[Statistics]\n");
+   fprintf(f, "path = %s/stats.dat\n", work_dir);
+   fprintf(f, "[Simulated drv]\n");
+   fprintf(f, "num_relays = %d\n", num_relays);
+   fprintf(f, "latency_us = %u\n", sim_latency_us);
+   fprintf(f, "jitter_us = %u\n", sim_jitter_us);
+   fprintf(f, "profile = %s\n", sim_profile);
+   if (num_cards > 0) fprintf(f, "num_cards = %d\n", num_cards);
+   for (i=0; i<num_sim_opts; i++)
+   {
+      fprintf(f, "%s\n", sim_opts[i]);
+   }
+   fclose(f);
+
+   daemon_pid = fork();
+   if (daemon_pid < 0)
+   {
+      perror("fork");
+      return -1;
+   }
+   if (daemon_pid == 0)
+   {
+      execl(daemon_path, daemon_path, "-d", "-c", conf_path, (char*)NULL);
+      perror(daemon_path);
+      _exit(EXIT_FAILURE);
+   }
+
+   for (i=0; i<STARTUP_TIMEOUT_MS/10; i++)
+   {
+      if ((fd = connect_server()) >= 0)
+      {
+         close(fd);
+         return 0;
+      }
+      if (waitpid(daemon_pid, NULL, WNOHANG) == daemon_pid)
+      {
+         daemon_pid = -1;
+         break;
+      }
+      usleep(10000);
+   }
+
+   fprintf(stderr, "daemon %s did not start listening on port %d\n", daemon_path, port);
+   return -1;
+}
+
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+   (void)st; (void)type; (void)ftw;
+   remove(path);
+   return 0;
+}
+
+
+static void stop_daemon(void)
+{
+   if (daemon_pid > 0)
+   {
+      kill(daemon_pid, SIGTERM);
+      waitpid(daemon_pid, NULL, 0);
+      daemon_pid = -1;
+   }
+   if (daemon_path && shm_name[0])
+   {
+      shm_unlink(shm_name);
+      nftw(work_dir, remove_entry, 8, FTW_DEPTH|FTW_PHYS);
+   }
+}
+
+
+static void print_row(const char *name, samples_t *s, uint64_t errors, double secs)
+{
+   qsort(s->v, s->n, sizeof(uint64_t), cmp_u64);
+   printf("  %-8s %9zu %7llu %10.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+          name, s->n, (unsigned long long)errors, s->n/secs,
+          percentile_us(s, 0), percentile_us(s, 0.5), percentile_us(s, 0.99),
+          percentile_us(s, 0.999), percentile_us(s, 1));
+}
+
+
+static void print_usage(void)
+{
+   printf("crelay-bench: HTTP load generator for the crelay daemon\n\n");
+   printf("Usage:\n");
+   printf("    crelay-bench [options]\n\n");
+   printf("       -H <host>     server address (default %s)\n", DEFAULT_HOST);
+   printf("       -p <port>     server port (default %d)\n", DEFAULT_PORT);
+   printf("       -c <n>        number of concurrent connections (default 1)\n");
+   printf("       -r <rate>     open loop with total rate in requests/s (default: closed loop)\n");
+   printf("       -t <secs>     measurement duration (default 5)\n");
+   printf("       -w <secs>     warmup before measuring (default 1)\n");
+   printf("       -k            request HTTP keep-alive; the daemon closes the connection\n");
+   printf("                     after every response, so each request still connects\n");
+   printf("       -m <mix>      request mix, e.g. status:80,set:18,pulse:2 (default status:100),\n");
+   printf("                     lease switches a relay on with a lease of %d ms, which the\n", LEASE_MS);
+   printf("                     following lease requests of the relay renew\n");
+   printf("       -n <relays>   number of relays addressed by set/pulse/lease (default 8)\n");
+   printf("       -C <cards>    spread requests over simulated cards SIM0..SIM<cards-1>\n");
+   printf("       -E <cards>    spread requests over emulated cards EMU00..EMU<cards-1>\n");
+   printf("                     created by crelay-uhid\n\n");
+   printf("       -S <daemon>   start the given daemon binary (built with the simulated\n");
+   printf("                     driver) for the duration of the benchmark\n");
+   printf("       -L <us>       simulated per-operation latency (with -S, default 1000)\n");
+   printf("       -J <us>       simulated per-operation jitter (with -S, default 0)\n");
+   printf("       -P <profile>  simulated timing profile: fixed, cp2104, ftdi, hid (with -S)\n");
+   printf("       -o <n=v>      additional [Simulated drv] parameter, e.g. -o timeout_rate=0.1\n");
+   printf("                     (with -S, can be repeated)\n\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+   worker_t *workers;
+   samples_t total = { NULL, 0, 0 };
+   uint64_t total_err = 0, connects = 0;
+   struct hostent *he;
+   double secs;
+   int c, i, j;
+
+   while ((c = getopt(argc, argv, "H:p:c:r:t:w:km:n:C:E:S:L:J:P:o:h")) != -1)
+   {
+      switch (c)
+      {
+         case 'H': host = optarg; break;
+         case 'p': port = atoi(optarg); break;
+         case 'c': num_conns = atoi(optarg); break;
+         case 'r': rate = atof(optarg); break;
+         case 't': duration = atoi(optarg); break;
+         case 'w': warmup = atoi(optarg); break;
+         case 'k': keepalive = 1; break;
+         case 'm': mix_str = optarg; break;
+         case 'n': num_relays = atoi(optarg); break;
+         case 'S': daemon_path = optarg; break;
+         case 'L': sim_latency_us = atoi(optarg); break;
+         case 'J': sim_jitter_us = atoi(optarg); break;
+         case 'C': num_cards = atoi(optarg); break;
+         case 'E':
+            num_cards = atoi(optarg);
+            emulated_cards = 1;
+            break;
+         case 'P': sim_profile = optarg; break;
+         case 'o':
+            if (num_sim_opts < MAX_SIM_OPTS) sim_opts[num_sim_opts++] = optarg;
+            break;
+         default:
+            print_usage();
+            exit(EXIT_FAILURE);
+      }
+   }
+
+   if (num_conns < 1 || num_conns > MAX_CONNS || duration < 1 || warmup < 0 ||
+       num_relays < 1 || parse_mix(mix_str) < 0)
+   {
+      print_usage();
+      exit(EXIT_FAILURE);
+   }
+
+   signal(SIGPIPE, SIG_IGN);
+
+   if ((he = gethostbyname(host)) == NULL)
+   {
+      fprintf(stderr, "unknown host %s\n", host);
+      exit(EXIT_FAILURE);
+   }
+   memset(&server_addr, 0, sizeof(server_addr));
+   server_addr.sin_family = AF_INET;
+   server_addr.sin_port = htons(port);
+   memcpy(&server_addr.sin_addr, he->h_addr_list[0], sizeof(server_addr.sin_addr));
+
+   if (daemon_path && spawn_daemon() < 0)
+   {
+      stop_daemon();
+      exit(EXIT_FAILURE);
+   }
+
+   workers = calloc(num_conns, sizeof(worker_t));
+   t_start   = now_ns();
+   t_measure = t_start + warmup*1000000000ULL;
+   t_end     = t_measure + duration*1000000000ULL;
+
+   for (i=0; i<num_conns; i++)
+   {
+      workers[i].id = i;
+      workers[i].fd = -1;
+      workers[i].seed = 0x5eed + i;
+      pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+   }
+   for (i=0; i<num_conns; i++)
+   {
+      pthread_join(workers[i].thread, NULL);
+   }
+   secs = (now_ns() - t_measure) / 1e9;
+
+   stop_daemon();
+
+   printf("crelay-bench: %d conn%s, %s, keep-alive %s, mix %s, %d s",
+          num_conns, num_conns>1 ? "s" : "",
+          rate > 0 ? "open loop" : "closed loop",
+          keepalive ? "on" : "off", mix_str, duration);
+   if (rate > 0) printf(", target %.1f req/s", rate);
+   if (num_cards > 0) printf(", %d cards", num_cards);
+   if (daemon_path)
+   {
+      if (!strcmp(sim_profile, "fixed"))
+         printf(", simulated latency %u+-%u us", sim_latency_us, sim_jitter_us);
+      else
+         printf(", simulated profile %s", sim_profile);
+      for (i=0; i<num_sim_opts; i++) printf(", %s", sim_opts[i]);
+   }
+   printf("\n");
+   printf("  %-8s %9s %7s %10s %9s %9s %9s %9s %9s\n",
+          "op", "requests", "errors", "req/s", "min(us)", "p50(us)", "p99(us)", "p999(us)", "max(us)");
+
+   for (j=0; j<NUM_OPS; j++)
+   {
+      samples_t merged = { NULL, 0, 0 };
+      uint64_t errors = 0;
+
+      if (mix[j] == 0) continue;
+      for (i=0; i<num_conns; i++)
+      {
+         size_t k;
+         for (k=0; k<workers[i].lat[j].n; k++)
+         {
+            samples_add(&merged, workers[i].lat[j].v[k]);
+            samples_add(&total, workers[i].lat[j].v[k]);
+         }
+         errors += workers[i].errors[j];
+      }
+      total_err += errors;
+      print_row(op_names[j], &merged, errors, secs);
+      free(merged.v);
+   }
+   print_row("total", &total, total_err, secs);
+
+   for (i=0; i<num_conns; i++) connects += workers[i].connects;
+   printf("  connections opened: %llu\n", (unsigned long long)connects);
+
+   exit(total.n == 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
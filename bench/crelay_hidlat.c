@@ -0,0 +1,273 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Sainsmart 16-channel driver latency
+ *
+ * Description:
+ *   This program measures the per-operation latency of the Sainsmart
+ *   16-channel relay card, or of a card emulated by crelay-uhid. To show
+ *   the effect of the driver changes in one run, the raw protocol is timed
+ *   both ways:
+ *
+ *    - read-sleep  read command, fixed 1 ms sleep, then hid_read()
+ *                  (the former driver)
+ *    - read-event  read command, then hid_read_timeout(), which returns
+ *                  as soon as the interrupt IN report arrives
+ *    - rmw-sleep   read-sleep followed by a write, the former cost of
+ *                  setting one relay
+ *
+ *   followed by the driver operations through the libcrelay API:
+ *
+ *    - get         crelay_get_relay_mask()
+ *    - set         crelay_set_relay(), using the shadow mask
+ *    - set-mask    crelay_set_relay_mask() of 4 relays
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Build instructions:
+ *   make crelay-hidlat
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <hidapi/hidapi.h>
+
+#include "relay_drv.h"
+
+#define MSG_LEN       16
+#define CMD_READ      0xD2
+#define CMD_WRITE     0xC3
+#define CMD_SIGNATURE "HIDC"
+#define READ_TIMEOUT  1000   /* ms */
+
+typedef enum
+{
+   OP_READ_SLEEP=0,
+   OP_READ_EVENT,
+   OP_RMW_SLEEP,
+   OP_GET,
+   OP_SET,
+   OP_SET_MASK,
+   NUM_OPS
+} op_t;
+
+static const char *op_names[NUM_OPS] = { "read-sleep", "read-event", "rmw-sleep", "get", "set", "set-mask" };
+
+static char     portname[MAX_COM_PORT_NAME_LEN];
+static char    *serial = NULL;
+static uint64_t *samples;
+
+
+static uint64_t now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+static int cmp_u64(const void *a, const void *b)
+{
+   uint64_t x = *(const uint64_t*)a;
+   uint64_t y = *(const uint64_t*)b;
+   return (x > y) - (x < y);
+}
+
+
+/* Value at percentile p (0..1) of n sorted samples, in us */
+static double percentile_us(unsigned long n, double p)
+{
+   unsigned long i;
+
+   if (n == 0) return 0;
+   i = (unsigned long)(p * n + 0.999999);
+   if (i > 0) i--;
+   if (i >= n) i = n-1;
+   return samples[i] / 1000.0;
+}
+
+
+/* Send a command of the Sainsmart protocol, see relay_drv_sainsmart16.c */
+static int send_cmd(hid_device *handle, uint8_t cmd, uint16_t bitmap)
+{
+   uint8_t msg[MSG_LEN];
+   uint16_t sum = 0;
+   int i;
+
+   memset(msg, (cmd == CMD_READ) ? 0x11 : 0x00, sizeof(msg));
+   msg[0] = cmd;
+   msg[1] = MSG_LEN-2;
+   msg[2] = bitmap & 0xff;
+   msg[3] = bitmap >> 8;
+   memcpy(msg+10, CMD_SIGNATURE, 4);
+   for (i=0; i<MSG_LEN-2; i++) sum += msg[i];
+   msg[14] = sum & 0xff;
+   msg[15] = sum >> 8;
+   return hid_write(handle, msg, sizeof(msg));
+}
+
+
+/* Raw read command, with the former fixed wait or waiting for the report */
+static int raw_read(hid_device *handle, int sleep_first, uint16_t *bitmap)
+{
+   uint8_t msg[MSG_LEN];
+
+   if (send_cmd(handle, CMD_READ, 0x1111) < 0)
+      return -1;
+   if (sleep_first)
+   {
+      usleep(1000);
+      if (hid_read(handle, msg, sizeof(msg)) < 4)
+         return -1;
+   }
+   else if (hid_read_timeout(handle, msg, sizeof(msg), READ_TIMEOUT) < 4)
+   {
+      return -1;
+   }
+   *bitmap = msg[2] | (msg[3] << 8);
+   return 0;
+}
+
+
+/* Execute one operation, returns its duration in ns or 0 on error */
+static uint64_t run_op(op_t op, hid_device *handle, unsigned long i)
+{
+   uint16_t states;
+   uint64_t t0;
+   int rc = 0;
+
+   t0 = now_ns();
+   switch (op)
+   {
+      case OP_READ_SLEEP:
+         rc = raw_read(handle, 1, &states);
+         break;
+      case OP_READ_EVENT:
+         rc = raw_read(handle, 0, &states);
+         break;
+      case OP_RMW_SLEEP:
+         /* Relay bits are scrambled in the read answer, the value written
+          * does not matter for the timing */
+         rc = raw_read(handle, 1, &states);
+         if (rc == 0 && send_cmd(handle, CMD_WRITE, (i & 1) ? 0x0001 : 0x0000) < 0) rc = -1;
+         break;
+      case OP_GET:
+         rc = crelay_get_relay_mask(portname, &states, serial);
+         break;
+      case OP_SET:
+         rc = crelay_set_relay(portname, FIRST_RELAY, (i & 1) ? ON : OFF, serial);
+         break;
+      case OP_SET_MASK:
+         rc = crelay_set_relay_mask(portname, 0x000f, (i & 1) ? 0x000f : 0x0000, serial);
+         break;
+      default:
+         break;
+   }
+   return (rc < 0) ? 0 : now_ns()-t0;
+}
+
+
+static void print_usage(void)
+{
+   printf("crelay-hidlat: per-operation latency of the Sainsmart 16-channel driver\n\n");
+   printf("Usage:\n");
+   printf("   crelay-hidlat [-s <serial>] [-n <ops>]\n\n");
+   printf("   -s  card serial number (hidraw path), default first card found\n");
+   printf("   -n  number of operations of each type (default 1000)\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+   hid_device *handle;
+   unsigned long i, n, ops = 1000, errors;
+   uint64_t t, sum;
+   uint8_t num_relays = FIRST_RELAY;
+   int c, op;
+
+   while ((c = getopt(argc, argv, "s:n:h")) != -1)
+   {
+      switch (c)
+      {
+         case 's': serial = optarg; break;
+         case 'n': ops = strtoul(optarg, NULL, 10); break;
+         default:
+            print_usage();
+            exit(EXIT_FAILURE);
+      }
+   }
+   if (ops == 0 || (samples = malloc(ops*sizeof(uint64_t))) == NULL)
+   {
+      print_usage();
+      exit(EXIT_FAILURE);
+   }
+
+   if (crelay_detect_relay_card(portname, &num_relays, serial, NULL) < 0 ||
+       crelay_get_relay_card_type() != SAINSMART16_USB_RELAY_TYPE)
+   {
+      fprintf(stderr, "ERROR: no Sainsmart 16-channel card found\n");
+      exit(EXIT_FAILURE);
+   }
+   if ((handle = hid_open_path(portname)) == NULL)
+   {
+      fprintf(stderr, "ERROR: cannot open %s\n", portname);
+      exit(EXIT_FAILURE);
+   }
+   printf("card %s, %lu operations each\n\n", portname, ops);
+   printf("  %-10s %8s %7s %9s %9s %9s %9s %9s\n", "op", "count", "errors", "mean_us", "min_us", "p50_us", "p99_us", "max_us");
+
+   for (op=0; op<NUM_OPS; op++)
+   {
+      /* The driver operations open the card themselves */
+      if (op == OP_GET)
+      {
+         hid_close(handle);
+         handle = NULL;
+      }
+
+      for (i=0, n=0, errors=0, sum=0; i<ops; i++)
+      {
+         if ((t = run_op(op, handle, i)) == 0)
+         {
+            errors++;
+            continue;
+         }
+         samples[n++] = t;
+         sum += t;
+      }
+      qsort(samples, n, sizeof(uint64_t), cmp_u64);
+      printf("  %-10s %8lu %7lu %9.1f %9.1f %9.1f %9.1f %9.1f\n", op_names[op], n, errors,
+             n ? sum/1e3/n : 0, percentile_us(n, 0), percentile_us(n, 0.5),
+             percentile_us(n, 0.99), percentile_us(n, 1));
+   }
+
+   crelay_set_relay_mask(portname, 0xffff, 0x0000, serial);
+   free(samples);
+   return 0;
+}
@@ -0,0 +1,397 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Realtime mode latency test
+ *
+ * Description:
+ *   This program measures the timing of relay pulse edges with and
+ *   without the realtime mode of the daemon. A thread switches a relay on
+ *   and off at planned times, like the sequence engine and the PWM do,
+ *   and records how late each edge was written to the card. The test runs
+ *   twice, first with normal scheduling and then with the realtime mode
+ *   (SCHED_FIFO, CPU affinity, locked and preallocated memory, see
+ *   realtime.h), while load threads keep all CPUs busy and allocate
+ *   memory. The results are printed as histograms side by side.
+ *
+ *   The relay is switched through libcrelay on the first card found,
+ *   which is a simulated card unless the program is built with other
+ *   drivers. The realtime mode needs root or CAP_SYS_NICE and
+ *   CAP_IPC_LOCK.
+ *
+ *   With -u the edges are not written by this program: relay 1 of the
+ *   default card of a running daemon is pulsed through its unix socket
+ *   under the same load, and the program records how late the daemon
+ *   reports the end of each pulse. The daemon ends pulses from its main
+ *   loop, which is not a realtime thread, so this shows the timing the
+ *   realtime mode does not cover.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Build instructions:
+ *   make crelay-rtlat
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "relay_drv.h"
+#include "realtime.h"
+#include "unix_api.h"
+
+#define NUM_BUCKETS  12
+#define MAX_LOAD     256
+#define LOAD_ALLOC   (1024*1024)
+
+typedef struct
+{
+   const char *name;
+   int      realtime;
+   int      rt_ok;             /* SCHED_FIFO and affinity were set */
+   unsigned long n;
+   uint64_t *late;             /* ns, per edge */
+   double   mean, sd, p99, p999, max;
+   unsigned long hist[NUM_BUCKETS];
+}
+run_t;
+
+/* Upper bucket limits in us, the last bucket is open */
+static const double bucket_us[NUM_BUCKETS-1] = { 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000 };
+
+static char     portname[MAX_COM_PORT_NAME_LEN];
+static unsigned long edges = 2000;
+static double   period_ms = 10;
+static const char *socket_path = NULL;  /* pulse through a running daemon */
+static volatile int load_stop = 0;
+
+
+static uint64_t now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+static int cmp_u64(const void *a, const void *b)
+{
+   uint64_t x = *(const uint64_t*)a;
+   uint64_t y = *(const uint64_t*)b;
+   return (x > y) - (x < y);
+}
+
+
+/* Keep one CPU busy and the allocator working */
+static void* load_thread(void *arg)
+{
+   volatile uint64_t x = 0;
+   char *p;
+   int i;
+
+   while (!load_stop)
+   {
+      if ((p = malloc(LOAD_ALLOC)) != NULL)
+      {
+         memset(p, (int)x, LOAD_ALLOC);
+         x += p[LOAD_ALLOC/2];
+         free(p);
+      }
+      for (i=0; i<100000; i++) x += i;
+   }
+   return NULL;
+}
+
+
+/* Switch the relay at the planned edge times, half a period apart */
+static void* edge_thread(void *arg)
+{
+   run_t *run = arg;
+   struct timespec ts;
+   uint64_t start, planned;
+   unsigned long i;
+
+   run->rt_ok = (realtime_thread("crelay-rtlat", 0) == 0);
+
+   start = now_ns() + 100000000ULL;
+   for (i=0; i<edges; i++)
+   {
+      planned = start + (uint64_t)(i * period_ms * 500000.0);
+      ts.tv_sec = planned / 1000000000ULL;
+      ts.tv_nsec = planned % 1000000000ULL;
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+      crelay_set_relay(portname, FIRST_RELAY, (i & 1) ? OFF : ON, NULL);
+      run->late[run->n++] = now_ns() - planned;
+   }
+   return NULL;
+}
+
+
+/* Pulse duration with -u, the daemon times pulses in ms */
+static uint32_t pulse_ms(void)
+{
+   return (period_ms/2 < 1) ? 1 : (uint32_t)(period_ms/2 + 0.5);
+}
+
+
+static int daemon_request(int fd, unix_api_request_t *req)
+{
+   unix_api_response_t msg;
+
+   req->version = UNIX_API_VERSION;
+   if (send(fd, req, sizeof(*req), 0) != sizeof(*req))
+      return -errno;
+   do
+   {
+      if (recv(fd, &msg, sizeof(msg), 0) != sizeof(msg))
+         return -EIO;
+   }
+   while (msg.type != UNIX_API_RESPONSE || msg.seq != req->seq);
+   return msg.status;
+}
+
+
+/* Pulse relay 1 of the default card through the daemon and record how
+ * late the end of each pulse is reported. It is measured from the
+ * response to the pulse request; the daemon starts the pulse timer
+ * before it responds, so the lateness is rather underestimated. */
+static void* daemon_thread(void *arg)
+{
+   run_t *run = arg;
+   struct sockaddr_un sun;
+   unix_api_request_t req;
+   unix_api_response_t msg;
+   uint32_t duration_ms = pulse_ms();
+   uint64_t started, planned, now;
+   unsigned long i;
+   int fd, rc;
+
+   memset(&sun, 0, sizeof(sun));
+   sun.sun_family = AF_UNIX;
+   snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", socket_path);
+   if ((fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0 ||
+       connect(fd, (struct sockaddr*)&sun, sizeof(sun)) < 0)
+   {
+      perror(socket_path);
+      return NULL;
+   }
+
+   memset(&req, 0, sizeof(req));
+   req.cmd = UNIX_API_SUBSCRIBE;
+   if ((rc = daemon_request(fd, &req)) < 0)
+      goto fail;
+   req.cmd = UNIX_API_SET_MASK;
+   req.seq++;
+   req.mask = 1;
+   req.states = 0;
+   if ((rc = daemon_request(fd, &req)) < 0)
+      goto fail;
+
+   for (i=0; i<edges; i++)
+   {
+      req.version = UNIX_API_VERSION;
+      req.cmd = UNIX_API_PULSE;
+      req.seq++;
+      req.duration_ms = duration_ms;
+      if (send(fd, &req, sizeof(req), 0) != sizeof(req))
+         break;
+
+      /* The response, then the event of the end (relay off again) */
+      started = 0;
+      for (;;)
+      {
+         if (recv(fd, &msg, sizeof(msg), 0) != sizeof(msg))
+            goto out;
+         now = now_ns();
+         if (msg.type == UNIX_API_RESPONSE && msg.seq == req.seq)
+         {
+            if ((rc = msg.status) < 0)
+               goto fail;
+            started = now;
+         }
+         else if (msg.type == UNIX_API_EVENT && started && !(msg.states & 1))
+         {
+            planned = started + duration_ms*1000000ULL;
+            run->late[run->n++] = (now > planned) ? now - planned : 0;
+            break;
+         }
+      }
+   }
+   goto out;
+
+fail:
+   fprintf(stderr, "ERROR: daemon request failed: %s\n", strerror(-rc));
+out:
+   close(fd);
+   return NULL;
+}
+
+
+static void evaluate(run_t *run)
+{
+   double sum = 0, sq = 0, us;
+   unsigned long i;
+   int b;
+
+   if (run->n == 0)
+      return;
+   qsort(run->late, run->n, sizeof(uint64_t), cmp_u64);
+   for (i=0; i<run->n; i++)
+   {
+      us = run->late[i] / 1e3;
+      sum += us;
+      sq += us*us;
+      for (b=0; b<NUM_BUCKETS-1 && us >= bucket_us[b]; b++);
+      run->hist[b]++;
+   }
+   run->mean = sum / run->n;
+   run->sd = sqrt(sq / run->n - run->mean * run->mean);
+   run->p99 = run->late[(unsigned long)(0.99 * (run->n-1))] / 1e3;
+   run->p999 = run->late[(unsigned long)(0.999 * (run->n-1))] / 1e3;
+   run->max = run->late[run->n-1] / 1e3;
+}
+
+
+static void print_usage(void)
+{
+   printf("crelay-rtlat: pulse edge latency with and without the realtime mode\n\n");
+   printf("Usage:\n");
+   printf("   crelay-rtlat [-n <edges>] [-t <period_ms>] [-l <threads>] [-p <prio>] [-c <cpus>]\n");
+   printf("   crelay-rtlat -u <socket> [-n <pulses>] [-t <period_ms>] [-l <threads>]\n\n");
+   printf("   -n  number of edges per run (default 2000)\n");
+   printf("   -t  pulse period in ms, edges every half period (default 10)\n");
+   printf("   -l  number of load threads (default number of CPUs)\n");
+   printf("   -p  SCHED_FIFO priority in realtime mode (default %d)\n", REALTIME_PRIORITY);
+   printf("   -c  CPU list of the edge thread in realtime mode (default all)\n");
+   printf("   -u  measure the end of pulses of period_ms/2 of a running daemon\n");
+   printf("       through its unix socket, on relay 1 of its default card\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+   run_t runs[2] = { { .name = "normal", .realtime = 0 }, { .name = "realtime", .realtime = 1 } };
+   pthread_t load[MAX_LOAD], thread;
+   uint8_t num_relays = FIRST_RELAY;
+   char *cpus = NULL;
+   long nload = sysconf(_SC_NPROCESSORS_ONLN);
+   int priority = 0, nruns = 2, c, r, i, b;
+
+   while ((c = getopt(argc, argv, "n:t:l:p:c:u:h")) != -1)
+   {
+      switch (c)
+      {
+         case 'n': edges = strtoul(optarg, NULL, 10); break;
+         case 't': period_ms = atof(optarg); break;
+         case 'l': nload = atoi(optarg); break;
+         case 'p': priority = atoi(optarg); break;
+         case 'c': cpus = optarg; break;
+         case 'u': socket_path = optarg; break;
+         default:
+            print_usage();
+            exit(EXIT_FAILURE);
+      }
+   }
+   if (edges == 0 || period_ms <= 0 || nload < 0 || nload > MAX_LOAD)
+   {
+      print_usage();
+      exit(EXIT_FAILURE);
+   }
+   if (socket_path)
+   {
+      /* One run, the scheduling is the one of the daemon */
+      runs[0].name = "daemon";
+      nruns = 1;
+      printf("daemon %s, %lu pulses of %u ms, %ld load threads\n\n", socket_path, edges, pulse_ms(), nload);
+   }
+   else
+   {
+      if (crelay_detect_relay_card(portname, &num_relays, NULL, NULL) < 0)
+      {
+         fprintf(stderr, "ERROR: no relay card found\n");
+         exit(EXIT_FAILURE);
+      }
+      printf("card %s, %lu edges every %.3f ms, %ld load threads\n\n", portname, edges, period_ms/2, nload);
+   }
+
+   for (r=0; r<nruns; r++)
+   {
+      /* The realtime mode can not be switched off again */
+      if (runs[r].realtime && realtime_init(priority, cpus, 1, 0) < 0)
+         fprintf(stderr, "WARNING: realtime mode only partly enabled\n");
+
+      if ((runs[r].late = malloc(edges*sizeof(uint64_t))) == NULL)
+         exit(EXIT_FAILURE);
+      load_stop = 0;
+      for (i=0; i<nload; i++)
+         pthread_create(&load[i], NULL, load_thread, NULL);
+      pthread_create(&thread, NULL, socket_path ? daemon_thread : edge_thread, &runs[r]);
+      pthread_join(thread, NULL);
+      load_stop = 1;
+      for (i=0; i<nload; i++)
+         pthread_join(load[i], NULL);
+      if (runs[r].n == 0)
+         exit(EXIT_FAILURE);
+      evaluate(&runs[r]);
+      if (runs[r].realtime && !runs[r].rt_ok)
+         fprintf(stderr, "WARNING: SCHED_FIFO or CPU affinity not set, run as root\n");
+   }
+
+   printf("  %-10s %9s %9s %9s %9s %9s\n", "mode", "mean_us", "sd_us", "p99_us", "p99.9_us", "max_us");
+   for (r=0; r<nruns; r++)
+      printf("  %-10s %9.1f %9.1f %9.1f %9.1f %9.1f\n", runs[r].name, runs[r].mean, runs[r].sd,
+             runs[r].p99, runs[r].p999, runs[r].max);
+
+   printf("\n  %-14s", "late_us");
+   for (r=0; r<nruns; r++)
+      printf(" %9s", runs[r].name);
+   printf("\n");
+   for (b=0; b<NUM_BUCKETS; b++)
+   {
+      char label[16];
+
+      if (b < NUM_BUCKETS-1)
+         snprintf(label, sizeof(label), "< %.0f", bucket_us[b]);
+      else
+         snprintf(label, sizeof(label), ">= %.0f", bucket_us[b-1]);
+      printf("  %-14s", label);
+      for (r=0; r<nruns; r++)
+         printf(" %9lu", runs[r].hist[b]);
+      printf("\n");
+   }
+
+   if (!socket_path)
+      crelay_set_relay(portname, FIRST_RELAY, OFF, NULL);
+   free(runs[0].late);
+   free(runs[1].late);
+   return 0;
+}
@@ -0,0 +1,151 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Shared memory state reader
+ *
+ * Description:
+ *   This program reads the relay states which the crelay daemon publishes
+ *   in its shared memory segment, using the libcrelay reader API
+ *   (crelay_state_open/read/close). It prints the states of all cards, or
+ *   of one card selected by serial number, and with -n measures the time
+ *   needed for a consistent read of the card state.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Build instructions:
+ *   make crelay-shm
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "state_shm.h"
+
+
+static uint64_t now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+static void print_state(const crelay_card_state_t *state)
+{
+   time_t t = state->timestamp_ns / 1000000000ULL;
+   char tbuf[32];
+   int i;
+
+   strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&t));
+   printf("%-20s ", state->serial[0] ? state->serial : "-");
+   for (i=0; i<state->num_relays; i++)
+      putchar((state->states & (1<<i)) ? '1' : '0');
+   printf("  version %llu  changed %s.%03llu\n", (unsigned long long)state->version,
+          tbuf, (unsigned long long)(state->timestamp_ns / 1000000) % 1000);
+}
+
+
+static void print_usage(void)
+{
+   printf("crelay-shm: read the relay states published by the crelay daemon\n\n");
+   printf("Usage:\n");
+   printf("   crelay-shm [-m <name>] [-s <serial>] [-n <reads>]\n\n");
+   printf("   -m  shared memory name (default %s)\n", STATE_SHM_NAME);
+   printf("   -s  read only the card with this serial number\n");
+   printf("   -n  measure the time of <reads> consecutive reads\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+   const state_shm_t *shm;
+   crelay_card_state_t state;
+   const char *name = NULL;
+   const char *serial = NULL;
+   unsigned long i, reads = 0;
+   uint64_t t0, t1;
+   int c;
+
+   while ((c = getopt(argc, argv, "m:s:n:h")) != -1)
+   {
+      switch (c)
+      {
+         case 'm': name = optarg; break;
+         case 's': serial = optarg; break;
+         case 'n': reads = strtoul(optarg, NULL, 10); break;
+         default:
+            print_usage();
+            exit(EXIT_FAILURE);
+      }
+   }
+
+   if ((shm = crelay_state_open(name)) == NULL)
+   {
+      fprintf(stderr, "ERROR: cannot open shared memory %s\n", name ? name : STATE_SHM_NAME);
+      exit(EXIT_FAILURE);
+   }
+
+   if (reads > 0)
+   {
+      t0 = now_ns();
+      for (i=0; i<reads; i++)
+      {
+         if (crelay_state_read(shm, serial, &state) < 0)
+         {
+            fprintf(stderr, "ERROR: card not found, daemon not running or entry locked\n");
+            exit(EXIT_FAILURE);
+         }
+      }
+      t1 = now_ns();
+      printf("%lu reads, %.1f ns per read\n", reads, (double)(t1-t0)/reads);
+   }
+   else if (serial != NULL)
+   {
+      if (crelay_state_read(shm, serial, &state) < 0)
+      {
+         fprintf(stderr, "ERROR: card not found, daemon not running or entry locked\n");
+         exit(EXIT_FAILURE);
+      }
+      print_state(&state);
+   }
+   else
+   {
+      printf("daemon pid %u\n", shm->pid);
+      for (i=0; i<shm->num_cards && i<STATE_SHM_MAX_CARDS; i++)
+      {
+         if (shm->cards[i].serial[0] && crelay_state_read(shm, shm->cards[i].serial, &state) == 0)
+            print_state(&state);
+         else if (!shm->cards[i].serial[0] && crelay_state_read(shm, NULL, &state) == 0)
+            print_state(&state);
+      }
+   }
+
+   crelay_state_close(shm);
+   return 0;
+}
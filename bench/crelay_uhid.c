@@ -0,0 +1,574 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Emulated HID relay cards
+ *
+ * Description:
+ *   This program creates virtual HID relay cards through the kernel uhid
+ *   interface (/dev/uhid), so that the real HID API and Sainsmart 16-channel
+ *   drivers can be benchmarked end-to-end without physical boards:
+ *
+ *    - HID API compatible cards (16c0:05df, "USBRelay<n>"), answering the
+ *      feature report status request and the relay on/off output reports
+ *    - Sainsmart 16-channel cards (0416:5020), answering the "HIDC" read
+ *      and write commands including checksum verification
+ *
+ *   Any number of cards of both types can be created. Each card is served
+ *   by its own thread and can add a configurable delay before answering,
+ *   to emulate the USB transfer time.
+ *
+ * Note:
+ *   The uhid devices are plain HID devices and not USB devices, so they
+ *   are only visible through the hidraw backend of hidapi. Build crelay
+ *   against libhidapi-hidraw to use them (see "make hid" in this folder).
+ *   Access to /dev/uhid requires root privileges.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Build instructions:
+ *   make crelay-uhid
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <linux/uhid.h>
+#include <linux/input.h>
+
+#define UHID_DEV "/dev/uhid"
+#define MAX_CARDS 128
+
+/* HID API compatible relay card */
+#define HIDAPI_VENDOR_ID    0x16c0
+#define HIDAPI_DEVICE_ID    0x05df
+#define HIDAPI_PRODUCT_BASE "USBRelay"
+#define HIDAPI_REPORT_LEN   8
+#define HIDAPI_STATUS_OFS   7
+#define CMD_ON      0xff
+#define CMD_ALL_ON  0xfe
+#define CMD_OFF     0xfd
+#define CMD_ALL_OFF 0xfc
+
+/* Sainsmart 16-channel relay card */
+#define SAIN16_VENDOR_ID    0x0416
+#define SAIN16_DEVICE_ID    0x5020
+#define SAIN16_PRODUCT      "Sainsmart 16-channel relay card"
+#define SAIN16_MSG_LEN      16
+#define SAIN16_CMD_READ     0xD2
+#define SAIN16_CMD_WRITE    0xC3
+#define SAIN16_SIGNATURE    "HIDC"
+
+typedef enum
+{
+   CARD_HIDAPI=0,
+   CARD_SAIN16
+} card_type_t;
+
+typedef struct
+{
+   card_type_t type;
+   int         fd;
+   pthread_t   thread;
+   char        id[16];       /* HID API: 5 character card id */
+   uint8_t     num_relays;
+   uint16_t    mask;         /* relay states, bit 0 = relay 1 */
+   uint64_t    transfers;
+   uint64_t    bad_msgs;
+} card_t;
+
+/* Report descriptor of the HID API card: 8 byte feature and output report */
+static const uint8_t hidapi_rdesc[] =
+{
+   0x06, 0x00, 0xff,  /* USAGE_PAGE (Vendor Defined Page 1) */
+   0x09, 0x01,        /* USAGE (Vendor Usage 1) */
+   0xa1, 0x01,        /* COLLECTION (Application) */
+   0x15, 0x00,        /*   LOGICAL_MINIMUM (0) */
+   0x26, 0xff, 0x00,  /*   LOGICAL_MAXIMUM (255) */
+   0x75, 0x08,        /*   REPORT_SIZE (8) */
+   0x95, 0x08,        /*   REPORT_COUNT (8) */
+   0x09, 0x00,        /*   USAGE (Undefined) */
+   0xb2, 0x02, 0x01,  /*   FEATURE (Data,Var,Abs,Buf) */
+   0x09, 0x00,        /*   USAGE (Undefined) */
+   0x91, 0x02,        /*   OUTPUT (Data,Var,Abs) */
+   0xc0               /* END_COLLECTION */
+};
+
+/* Report descriptor of the Sainsmart card: 16 byte input and output report */
+static const uint8_t sain16_rdesc[] =
+{
+   0x06, 0x00, 0xff,  /* USAGE_PAGE (Vendor Defined Page 1) */
+   0x09, 0x01,        /* USAGE (Vendor Usage 1) */
+   0xa1, 0x01,        /* COLLECTION (Application) */
+   0x15, 0x00,        /*   LOGICAL_MINIMUM (0) */
+   0x26, 0xff, 0x00,  /*   LOGICAL_MAXIMUM (255) */
+   0x75, 0x08,        /*   REPORT_SIZE (8) */
+   0x95, 0x10,        /*   REPORT_COUNT (16) */
+   0x09, 0x00,        /*   USAGE (Undefined) */
+   0x81, 0x02,        /*   INPUT (Data,Var,Abs) */
+   0x09, 0x00,        /*   USAGE (Undefined) */
+   0x91, 0x02,        /*   OUTPUT (Data,Var,Abs) */
+   0xc0               /* END_COLLECTION */
+};
+
+/* Association between relay number (array index) and bit position
+ * in the read response of the Sainsmart card */
+static const uint8_t relay_bit_pos[] = {7 , 8 , 6 , 9 , 5 , 10, 4 , 11, 3 , 12, 2 , 13, 1 , 14, 0 , 15};
+
+static card_t  cards[MAX_CARDS];
+static int     num_cards = 0;
+static uint32_t delay_us = 0;
+static int     verbose = 0;
+static volatile sig_atomic_t running = 1;
+
+
+static void delay_transfer(void)
+{
+   struct timespec ts;
+
+   if (delay_us == 0) return;
+   ts.tv_sec  = delay_us / 1000000;
+   ts.tv_nsec = (delay_us % 1000000) * 1000;
+   while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) != 0 && running);
+}
+
+
+static int uhid_write(int fd, const struct uhid_event *ev)
+{
+   ssize_t ret = write(fd, ev, sizeof(*ev));
+
+   if (ret < 0)
+   {
+      fprintf(stderr, "write to %s failed: %s\n", UHID_DEV, strerror(errno));
+      return -1;
+   }
+   if (ret != sizeof(*ev))
+   {
+      fprintf(stderr, "short write to %s\n", UHID_DEV);
+      return -1;
+   }
+   return 0;
+}
+
+
+/**********************************************************
+ * Function card_create()
+ *
+ * Description: Create the virtual HID device of a card
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+static int card_create(card_t *card, int index)
+{
+   struct uhid_event ev;
+
+   card->fd = open(UHID_DEV, O_RDWR | O_CLOEXEC);
+   if (card->fd < 0)
+   {
+      fprintf(stderr, "cannot open %s: %s\n", UHID_DEV, strerror(errno));
+      return -1;
+   }
+
+   memset(&ev, 0, sizeof(ev));
+   ev.type = UHID_CREATE2;
+   ev.u.create2.bus = BUS_USB;
+   snprintf((char*)ev.u.create2.phys, sizeof(ev.u.create2.phys), "crelay-uhid/%d", index);
+
+   if (card->type == CARD_HIDAPI)
+   {
+      snprintf((char*)ev.u.create2.name, sizeof(ev.u.create2.name), "%s%d",
+               HIDAPI_PRODUCT_BASE, card->num_relays);
+      snprintf((char*)ev.u.create2.uniq, sizeof(ev.u.create2.uniq), "%s", card->id);
+      memcpy(ev.u.create2.rd_data, hidapi_rdesc, sizeof(hidapi_rdesc));
+      ev.u.create2.rd_size = sizeof(hidapi_rdesc);
+      ev.u.create2.vendor  = HIDAPI_VENDOR_ID;
+      ev.u.create2.product = HIDAPI_DEVICE_ID;
+   }
+   else
+   {
+      snprintf((char*)ev.u.create2.name, sizeof(ev.u.create2.name), "%s", SAIN16_PRODUCT);
+      snprintf((char*)ev.u.create2.uniq, sizeof(ev.u.create2.uniq), "SAIN16-%03d", index);
+      memcpy(ev.u.create2.rd_data, sain16_rdesc, sizeof(sain16_rdesc));
+      ev.u.create2.rd_size = sizeof(sain16_rdesc);
+      ev.u.create2.vendor  = SAIN16_VENDOR_ID;
+      ev.u.create2.product = SAIN16_DEVICE_ID;
+   }
+
+   return uhid_write(card->fd, &ev);
+}
+
+
+static void card_destroy(card_t *card)
+{
+   struct uhid_event ev;
+
+   if (card->fd < 0) return;
+   memset(&ev, 0, sizeof(ev));
+   ev.type = UHID_DESTROY;
+   uhid_write(card->fd, &ev);
+   close(card->fd);
+   card->fd = -1;
+}
+
+
+/**********************************************************
+ * Function hidapi_get_report()
+ *
+ * Description: Answer the status request of the HID API
+ *              card. The feature report contains the card
+ *              id (5 characters, 0 terminated) and the
+ *              relay status byte.
+ *********************************************************/
+static void hidapi_get_report(card_t *card, const struct uhid_get_report_req *req)
+{
+   struct uhid_event ev;
+
+   memset(&ev, 0, sizeof(ev));
+   ev.type = UHID_GET_REPORT_REPLY;
+   ev.u.get_report_reply.id = req->id;
+
+   if (req->rtype != UHID_FEATURE_REPORT)
+   {
+      ev.u.get_report_reply.err = EIO;
+   }
+   else
+   {
+      /* Report number followed by the 8 byte report */
+      delay_transfer();
+      ev.u.get_report_reply.size = HIDAPI_REPORT_LEN+1;
+      memcpy(ev.u.get_report_reply.data, card->id, 5);
+      ev.u.get_report_reply.data[5] = 0;
+      ev.u.get_report_reply.data[HIDAPI_STATUS_OFS] = card->mask & 0xff;
+      card->transfers++;
+   }
+
+   uhid_write(card->fd, &ev);
+}
+
+
+/**********************************************************
+ * Function hidapi_output()
+ *
+ * Description: Handle the relay on/off command of the
+ *              HID API card:  [0] S R 0 0 0 0 0 0
+ *********************************************************/
+static void hidapi_output(card_t *card, const uint8_t *data, uint16_t size)
+{
+   uint8_t cmd, relay;
+   uint16_t all = (1 << card->num_relays) - 1;
+
+   /* Skip the report number if it was passed along */
+   if (size > HIDAPI_REPORT_LEN)
+   {
+      data++;
+      size--;
+   }
+   if (size < 2)
+   {
+      card->bad_msgs++;
+      return;
+   }
+
+   delay_transfer();
+   cmd   = data[0];
+   relay = data[1];
+   switch (cmd)
+   {
+      case CMD_ON:
+         if (relay >= 1 && relay <= card->num_relays) card->mask |= 1 << (relay-1);
+         break;
+      case CMD_OFF:
+         if (relay >= 1 && relay <= card->num_relays) card->mask &= ~(1 << (relay-1));
+         break;
+      case CMD_ALL_ON:
+         card->mask = all;
+         break;
+      case CMD_ALL_OFF:
+         card->mask = 0;
+         break;
+      default:
+         card->bad_msgs++;
+         return;
+   }
+   card->transfers++;
+   if (verbose) printf("%s: cmd 0x%02x relay %d -> mask 0x%02x\n", card->id, cmd, relay, card->mask);
+}
+
+
+static uint16_t sain16_checksum(const uint8_t *msg)
+{
+   uint16_t sum = 0;
+   int i;
+
+   for (i=0; i<SAIN16_MSG_LEN-2; i++) sum += msg[i];
+   return sum;
+}
+
+
+/**********************************************************
+ * Function sain16_output()
+ *
+ * Description: Handle the read and write commands of the
+ *              Sainsmart card. Messages with wrong length,
+ *              signature or checksum are ignored, like the
+ *              real card does.
+ *********************************************************/
+static void sain16_output(card_t *card, const uint8_t *msg, uint16_t size)
+{
+   struct uhid_event ev;
+   uint16_t chksum, bitmap;
+   int i;
+
+   if (size != SAIN16_MSG_LEN ||
+       memcmp(msg+10, SAIN16_SIGNATURE, 4) != 0)
+   {
+      card->bad_msgs++;
+      return;
+   }
+   chksum = msg[14] | (msg[15] << 8);
+   if (chksum != sain16_checksum(msg))
+   {
+      card->bad_msgs++;
+      return;
+   }
+
+   delay_transfer();
+   card->transfers++;
+
+   if (msg[0] == SAIN16_CMD_WRITE)
+   {
+      card->mask = msg[2] | (msg[3] << 8);
+      if (verbose) printf("SAIN16 %d: write mask 0x%04x\n", (int)(card-cards), card->mask);
+   }
+   else if (msg[0] == SAIN16_CMD_READ)
+   {
+      /* Reply with the scrambled relay bitmap in bytes 2 and 3 */
+      bitmap = 0;
+      for (i=0; i<16; i++)
+      {
+         if (card->mask & (1 << i)) bitmap |= 1 << relay_bit_pos[i];
+      }
+      memset(&ev, 0, sizeof(ev));
+      ev.type = UHID_INPUT2;
+      ev.u.input2.size = SAIN16_MSG_LEN;
+      ev.u.input2.data[0] = SAIN16_CMD_READ;
+      ev.u.input2.data[1] = SAIN16_MSG_LEN-2;
+      ev.u.input2.data[2] = bitmap & 0xff;
+      ev.u.input2.data[3] = bitmap >> 8;
+      uhid_write(card->fd, &ev);
+   }
+   else
+   {
+      card->bad_msgs++;
+   }
+}
+
+
+static void* card_thread(void *arg)
+{
+   card_t *card = arg;
+   struct uhid_event ev;
+   ssize_t ret;
+
+   while (running)
+   {
+      ret = read(card->fd, &ev, sizeof(ev));
+      if (ret < 0)
+      {
+         if (errno == EINTR) continue;
+         fprintf(stderr, "read from %s failed: %s\n", UHID_DEV, strerror(errno));
+         break;
+      }
+
+      switch (ev.type)
+      {
+         case UHID_OUTPUT:
+            if (card->type == CARD_HIDAPI)
+               hidapi_output(card, ev.u.output.data, ev.u.output.size);
+            else
+               sain16_output(card, ev.u.output.data, ev.u.output.size);
+            break;
+
+         case UHID_GET_REPORT:
+            if (card->type == CARD_HIDAPI)
+            {
+               hidapi_get_report(card, &ev.u.get_report);
+            }
+            else
+            {
+               memset(&ev.u.get_report_reply, 0, sizeof(ev.u.get_report_reply));
+               ev.type = UHID_GET_REPORT_REPLY;
+               ev.u.get_report_reply.err = EIO;
+               uhid_write(card->fd, &ev);
+            }
+            break;
+
+         case UHID_SET_REPORT:
+            /* Output reports may also arrive as SET_REPORT requests */
+            if (card->type == CARD_HIDAPI)
+               hidapi_output(card, ev.u.set_report.data, ev.u.set_report.size);
+            else
+               sain16_output(card, ev.u.set_report.data, ev.u.set_report.size);
+            {
+               uint32_t id = ev.u.set_report.id;
+               memset(&ev, 0, sizeof(ev));
+               ev.type = UHID_SET_REPORT_REPLY;
+               ev.u.set_report_reply.id = id;
+               uhid_write(card->fd, &ev);
+            }
+            break;
+
+         default:
+            /* UHID_START, UHID_STOP, UHID_OPEN, UHID_CLOSE */
+            break;
+      }
+   }
+
+   return NULL;
+}
+
+
+static void stop_handler(int signum)
+{
+   running = 0;
+}
+
+
+static void print_usage(void)
+{
+   printf("crelay-uhid: emulated HID relay cards via %s\n\n", UHID_DEV);
+   printf("Usage:\n");
+   printf("    crelay-uhid [-u <cards>] [-r <relays>] [-s <cards>] [-l <us>] [-v]\n\n");
+   printf("       -u <cards>   number of HID API compatible cards (%04x:%04x) to create\n",
+          HIDAPI_VENDOR_ID, HIDAPI_DEVICE_ID);
+   printf("       -r <relays>  number of relays of the HID API cards (1 to 8, default 8)\n");
+   printf("       -s <cards>   number of Sainsmart 16-channel cards (%04x:%04x) to create\n",
+          SAIN16_VENDOR_ID, SAIN16_DEVICE_ID);
+   printf("       -l <us>      delay before answering each transfer (default 0)\n");
+   printf("       -v           log every relay command\n\n");
+   printf("       The cards exist until the program is terminated (Ctrl-C).\n");
+   printf("       The HID API card ids are EMU00, EMU01, ...\n\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+   int num_hidapi = 0, num_sain16 = 0, num_relays = 8;
+   int c, i, ret = EXIT_SUCCESS;
+   struct sigaction sa;
+
+   while ((c = getopt(argc, argv, "u:r:s:l:vh")) != -1)
+   {
+      switch (c)
+      {
+         case 'u': num_hidapi = atoi(optarg); break;
+         case 'r': num_relays = atoi(optarg); break;
+         case 's': num_sain16 = atoi(optarg); break;
+         case 'l': delay_us = atoi(optarg); break;
+         case 'v': verbose = 1; break;
+         default:
+            print_usage();
+            exit(EXIT_FAILURE);
+      }
+   }
+
+   if (num_hidapi+num_sain16 < 1 || num_hidapi+num_sain16 > MAX_CARDS ||
+       num_hidapi > 100 || num_relays < 1 || num_relays > 8)
+   {
+      print_usage();
+      exit(EXIT_FAILURE);
+   }
+
+   /* Stop on Ctrl-C without restarting the blocking reads */
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = stop_handler;
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+
+   for (i=0; i<num_hidapi+num_sain16; i++)
+   {
+      card_t *card = &cards[num_cards];
+
+      memset(card, 0, sizeof(*card));
+      card->fd = -1;
+      if (i < num_hidapi)
+      {
+         card->type = CARD_HIDAPI;
+         card->num_relays = num_relays;
+         snprintf(card->id, sizeof(card->id), "EMU%02d", i);
+      }
+      else
+      {
+         card->type = CARD_SAIN16;
+         card->num_relays = 16;
+      }
+
+      if (card_create(card, i) < 0)
+      {
+         ret = EXIT_FAILURE;
+         goto done;
+      }
+      num_cards++;
+   }
+
+   for (i=0; i<num_cards; i++)
+   {
+      pthread_create(&cards[i].thread, NULL, card_thread, &cards[i]);
+   }
+
+   printf("Created %d HID API card(s) and %d Sainsmart 16-channel card(s), press Ctrl-C to stop\n",
+          num_hidapi, num_sain16);
+
+   while (running) pause();
+
+   /* Wake up the card threads blocked in read() */
+   for (i=0; i<num_cards; i++)
+   {
+      pthread_kill(cards[i].thread, SIGINT);
+      pthread_join(cards[i].thread, NULL);
+   }
+
+   for (i=0; i<num_cards; i++)
+   {
+      printf("  %-10s %-8s transfers %8llu  bad messages %llu\n",
+             cards[i].type == CARD_HIDAPI ? cards[i].id : "SAIN16",
+             cards[i].type == CARD_HIDAPI ? "hidapi" : "sain16",
+             (unsigned long long)cards[i].transfers,
+             (unsigned long long)cards[i].bad_msgs);
+   }
+
+ done:
+   for (i=0; i<num_cards; i++)
+   {
+      card_destroy(&cards[i]);
+   }
+   exit(ret);
+}
@@ -0,0 +1,202 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Lease timer benchmark
+ *
+ * Description:
+ *   This program measures the cost of the timer operations behind the
+ *   relay leases (see lease.h) for a growing number of running timers:
+ *
+ *    - add     start a timer
+ *    - renew   move a running timer to a new expiry time (lease renewal)
+ *    - expire  advance the wheel tick by tick until all timers expired,
+ *              per expired timer
+ *    - timeout time until the next timer, as computed on every iteration
+ *              of the main loop
+ *
+ *   For comparison the last column gives the cost of finding the next
+ *   deadline by scanning an array of all timers, as done for the pulses.
+ *   The time is simulated, the program does not sleep.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Build instructions:
+ *   make crelay-wheel
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "timer_wheel.h"
+
+#define START_MS   1000000
+#define MIN_MS     1000      /* expiry times from start */
+#define MAX_MS     30000
+
+static timer_wheel_t wheel;
+static timer_wheel_entry_t *timers;
+static uint64_t *deadlines;
+static unsigned long *renew_idx;     /* renewals, drawn in advance */
+static uint64_t *renew_ms;
+
+
+static uint64_t now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+/* Random expiry time between MIN_MS and MAX_MS after now_ms */
+static uint64_t random_expiry(uint64_t now_ms)
+{
+   return now_ms + MIN_MS + rand() % (MAX_MS-MIN_MS);
+}
+
+
+/* Time until the next deadline by scanning all timers, in ms */
+static int scan_timeout(unsigned long n, uint64_t now_ms)
+{
+   int64_t timeout = -1;
+   unsigned long i;
+
+   for (i=0; i<n; i++)
+   {
+      if (deadlines[i] <= now_ms) return 0;
+      if (timeout < 0 || deadlines[i] - now_ms < (uint64_t)timeout)
+         timeout = deadlines[i] - now_ms;
+   }
+   return (int)timeout;
+}
+
+
+static void run(unsigned long n, unsigned long ops)
+{
+   timer_wheel_entry_t *expired;
+   uint64_t t0, t_add, t_renew, t_expire, t_timeout, t_scan, now;
+   unsigned long i, num_expired = 0;
+   volatile int sink = 0;
+
+   memset(timers, 0, n*sizeof(timer_wheel_entry_t));
+   timer_wheel_init(&wheel, START_MS);
+   srand(1);
+
+   t0 = now_ns();
+   for (i=0; i<n; i++)
+      timer_wheel_add(&wheel, &timers[i], random_expiry(START_MS));
+   t_add = now_ns()-t0;
+
+   for (i=0; i<ops; i++)
+   {
+      renew_idx[i] = rand() % n;
+      renew_ms[i] = random_expiry(START_MS);
+   }
+   t0 = now_ns();
+   for (i=0; i<ops; i++)
+      timer_wheel_add(&wheel, &timers[renew_idx[i]], renew_ms[i]);
+   t_renew = now_ns()-t0;
+
+   t0 = now_ns();
+   for (i=0; i<ops; i++)
+      sink += timer_wheel_timeout(&wheel, START_MS);
+   t_timeout = now_ns()-t0;
+
+   for (i=0; i<n; i++)
+      deadlines[i] = random_expiry(START_MS);
+   t0 = now_ns();
+   for (i=0; i<1000; i++)
+      sink += scan_timeout(n, START_MS);
+   t_scan = now_ns()-t0;
+
+   /* Advance by one tick at a time, as the main loop does when the
+    * timers are due */
+   t0 = now_ns();
+   for (now = START_MS; wheel.count > 0; now += TIMER_WHEEL_TICK_MS)
+   {
+      for (expired = timer_wheel_expire(&wheel, now); expired != NULL; expired = expired->next)
+         num_expired++;
+   }
+   t_expire = now_ns()-t0;
+
+   printf("  %8lu %9.1f %9.1f %10.1f %10.1f %12.1f\n", n,
+          (double)t_add/n, (double)t_renew/ops, (double)t_expire/num_expired,
+          (double)t_timeout/ops, (double)t_scan/1000);
+   (void)sink;
+}
+
+
+static void print_usage(void)
+{
+   printf("crelay-wheel: cost of the lease timer operations\n\n");
+   printf("Usage:\n");
+   printf("   crelay-wheel [-n <timers>] [-o <ops>]\n\n");
+   printf("   -n  largest number of running timers (default 1000000)\n");
+   printf("   -o  number of renew and timeout operations (default 1000000)\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+   unsigned long n, max = 1000000, ops = 1000000;
+   int c;
+
+   while ((c = getopt(argc, argv, "n:o:h")) != -1)
+   {
+      switch (c)
+      {
+         case 'n': max = strtoul(optarg, NULL, 10); break;
+         case 'o': ops = strtoul(optarg, NULL, 10); break;
+         default:
+            print_usage();
+            exit(EXIT_FAILURE);
+      }
+   }
+   if (max == 0 || ops == 0 ||
+       (timers = malloc(max*sizeof(timer_wheel_entry_t))) == NULL ||
+       (deadlines = malloc(max*sizeof(uint64_t))) == NULL ||
+       (renew_idx = malloc(ops*sizeof(unsigned long))) == NULL ||
+       (renew_ms = malloc(ops*sizeof(uint64_t))) == NULL)
+   {
+      print_usage();
+      exit(EXIT_FAILURE);
+   }
+
+   printf("timer wheel: %d slots of %d ms, expiry %d..%d ms, %lu operations\n\n",
+          TIMER_WHEEL_SLOTS, TIMER_WHEEL_TICK_MS, MIN_MS, MAX_MS, ops);
+   printf("  %8s %9s %9s %10s %10s %12s\n", "timers", "add_ns", "renew_ns", "expire_ns", "timeout_ns", "scan_ns");
+   for (n=100; n<=max; n*=10)
+      run(n, ops);
+
+   free(timers);
+   free(deadlines);
+   free(renew_idx);
+   free(renew_ms);
+   return 0;
+}
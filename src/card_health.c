@@ -0,0 +1,501 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Card health and circuit breaker
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the per card circuit breaker, see card_health.h.
+ *
+ *   The hotplug events are received from the kernel on a netlink socket
+ *   (NETLINK_KOBJECT_UEVENT). When a USB device is added, the open cards
+ *   are probed after a short delay, which leaves the kernel the time to
+ *   create the device nodes.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "relay_drv.h"
+#include "card_health.h"
+#include "data_types.h"
+
+extern config_t config;
+
+#define HOTPLUG_SETTLE_MS 500   /* delay of the probe after a hotplug event */
+
+typedef struct
+{
+   uint8_t      used;
+   char         key[MAX_SERIAL_LEN];
+   card_state_t state;
+   uint8_t      probing;      /* probe in progress (half-open) */
+   pthread_t    prober;       /* thread doing the probe */
+   uint64_t     probe_ns;
+   uint32_t     failures;
+   uint32_t     trips;
+   int          last_error;
+   uint32_t     backoff_ms;
+   uint64_t     retry_ns;     /* CLOCK_MONOTONIC time of the next probe */
+   uint64_t     used_ns;
+}
+entry_t;
+
+static entry_t  g_cards[CARD_HEALTH_MAX_CARDS];
+static uint32_t g_threshold = CARD_HEALTH_FAILURE_THRESHOLD;
+static uint32_t g_backoff_min_ms = CARD_HEALTH_BACKOFF_MIN_MS;
+static uint32_t g_backoff_max_ms = CARD_HEALTH_BACKOFF_MAX_MS;
+static int      g_fd = -1;
+
+static pthread_once_t  g_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *state_names[] = {"healthy", "degraded", "open", "half-open"};
+
+
+static uint64_t monotonic_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+/**********************************************************
+ * Internal function health_init()
+ *
+ * Description: Set up the parameters from the configuration
+ *              (done once)
+ *
+ * Return: none
+ *********************************************************/
+static void health_init(void)
+{
+   if (config.io_failure_threshold > 0) g_threshold = config.io_failure_threshold;
+   if (config.io_backoff_min_ms > 0) g_backoff_min_ms = config.io_backoff_min_ms;
+   if (config.io_backoff_max_ms > 0) g_backoff_max_ms = config.io_backoff_max_ms;
+   if (g_backoff_max_ms < g_backoff_min_ms) g_backoff_max_ms = g_backoff_min_ms;
+}
+
+
+/**********************************************************
+ * Internal function find_card()
+ *
+ * Description: Find the entry of a card, optionally create
+ *              it, replacing the least recently used healthy
+ *              entry if the table is full
+ *
+ * Return: entry, NULL if not found
+ *********************************************************/
+static entry_t* find_card(const char *serial, int create, uint64_t now)
+{
+   const char *key = serial ? serial : "";
+   entry_t *entry = NULL;
+   int i;
+
+   for (i=0; i<CARD_HEALTH_MAX_CARDS; i++)
+   {
+      if (g_cards[i].used && !strcmp(g_cards[i].key, key))
+         return &g_cards[i];
+      if (!create)
+         continue;
+      if (!g_cards[i].used)
+      {
+         if (entry == NULL || entry->used) entry = &g_cards[i];
+      }
+      else if (g_cards[i].state == CARD_HEALTHY &&
+               (entry == NULL || (entry->used && g_cards[i].used_ns < entry->used_ns)))
+      {
+         entry = &g_cards[i];
+      }
+   }
+   if (entry == NULL)
+      return NULL;
+
+   memset(entry, 0, sizeof(entry_t));
+   entry->used = 1;
+   snprintf(entry->key, sizeof(entry->key), "%s", key);
+   entry->used_ns = now;
+   return entry;
+}
+
+
+/**********************************************************
+ * Internal function open_circuit()
+ *
+ * Description: Open the circuit of a card
+ *
+ * Return: none
+ *********************************************************/
+static void open_circuit(entry_t *entry, uint64_t now)
+{
+   if (entry->state == CARD_HALF_OPEN)
+   {
+      entry->backoff_ms = (entry->backoff_ms*2 < g_backoff_max_ms) ? entry->backoff_ms*2 : g_backoff_max_ms;
+   }
+   else
+   {
+      entry->backoff_ms = g_backoff_min_ms;
+      entry->trips++;
+      syslog(LOG_DAEMON | LOG_WARNING, "Card %s failed %u times (error %d), circuit open\n",
+             entry->key[0] ? entry->key : "(default)", entry->failures, entry->last_error);
+   }
+   entry->state = CARD_OPEN;
+   entry->retry_ns = now + (uint64_t)entry->backoff_ms*1000000ULL;
+}
+
+
+/**********************************************************
+ * Function card_health_check()
+ *
+ * Description: Check if an operation on a card may be
+ *              started
+ *
+ * Parameters: serial (in) - serial number, NULL for the
+ *                           default card
+ *
+ * Return:  0 - operation allowed
+ *         -ENOLINK if the circuit of the card is open
+ *********************************************************/
+int card_health_check(const char *serial)
+{
+   entry_t *entry;
+   uint64_t now = monotonic_ns();
+   int rc = 0;
+
+   pthread_once(&g_once, health_init);
+   pthread_mutex_lock(&g_lock);
+   if ((entry = find_card(serial, 0, now)) != NULL)
+   {
+      entry->used_ns = now;
+      if (entry->state == CARD_OPEN && now >= entry->retry_ns)
+         entry->state = CARD_HALF_OPEN;
+
+      /* Only one thread probes the card, a probe which was given up
+       * without result is taken over after backoff_min_ms */
+      if (entry->state == CARD_HALF_OPEN &&
+          (!entry->probing || pthread_equal(entry->prober, pthread_self()) ||
+           now - entry->probe_ns > (uint64_t)g_backoff_min_ms*1000000ULL))
+      {
+         entry->probing = 1;
+         entry->prober = pthread_self();
+         entry->probe_ns = now;
+      }
+      else if (entry->state != CARD_HEALTHY && entry->state != CARD_DEGRADED)
+      {
+         rc = -ENOLINK;
+      }
+   }
+   pthread_mutex_unlock(&g_lock);
+   return rc;
+}
+
+
+/**********************************************************
+ * Function card_health_report()
+ *
+ * Description: Report the result of an operation on a card.
+ *              Only reads and writes report a success, a
+ *              card which is found but does not answer must
+ *              not look healthy.
+ *
+ * Parameters: serial (in) - serial number, NULL for the
+ *                           default card
+ *             rc (in)     - result of the operation
+ *
+ * Return: none
+ *********************************************************/
+void card_health_report(const char *serial, int rc)
+{
+   entry_t *entry;
+   uint64_t now = monotonic_ns();
+
+   /* A card busy playing a waveform is not at fault */
+   if (rc == -EBUSY)
+      return;
+
+   pthread_once(&g_once, health_init);
+   pthread_mutex_lock(&g_lock);
+   if ((entry = find_card(serial, rc < 0, now)) == NULL)
+   {
+      pthread_mutex_unlock(&g_lock);
+      return;
+   }
+
+   entry->probing = 0;
+   if (rc == 0)
+   {
+      if (entry->state == CARD_OPEN || entry->state == CARD_HALF_OPEN)
+         syslog(LOG_DAEMON | LOG_NOTICE, "Card %s is back, circuit closed\n", entry->key[0] ? entry->key : "(default)");
+      entry->state = CARD_HEALTHY;
+      entry->failures = 0;
+      entry->backoff_ms = 0;
+   }
+   else
+   {
+      entry->failures++;
+      entry->last_error = rc;
+      if (entry->state == CARD_HALF_OPEN || entry->failures >= g_threshold)
+         open_circuit(entry, now);
+      else if (entry->state != CARD_OPEN)
+         entry->state = CARD_DEGRADED;
+   }
+   pthread_mutex_unlock(&g_lock);
+}
+
+
+/**********************************************************
+ * Function card_health_list()
+ *
+ * Description: Get the health of the cards which have been
+ *              used
+ *
+ * Parameters: cards (out) - card health
+ *             max (in)    - max. number of entries
+ *
+ * Return: number of entries
+ *********************************************************/
+int card_health_list(card_health_t *cards, int max)
+{
+   uint64_t now = monotonic_ns();
+   int i, n = 0;
+
+   pthread_mutex_lock(&g_lock);
+   for (i=0; i<CARD_HEALTH_MAX_CARDS && n < max; i++)
+   {
+      if (!g_cards[i].used) continue;
+      strcpy(cards[n].serial, g_cards[i].key);
+      cards[n].state = g_cards[i].state;
+      cards[n].failures = g_cards[i].failures;
+      cards[n].trips = g_cards[i].trips;
+      cards[n].last_error = g_cards[i].last_error;
+      cards[n].retry_ms = (g_cards[i].state == CARD_OPEN && g_cards[i].retry_ns > now) ?
+                          (g_cards[i].retry_ns-now)/1000000 : 0;
+      n++;
+   }
+   pthread_mutex_unlock(&g_lock);
+   return n;
+}
+
+
+/**********************************************************
+ * Function card_health_state_name()
+ *
+ * Description: Get the name of a card state
+ *
+ * Parameters: state (in) - card state
+ *
+ * Return: state name
+ *********************************************************/
+const char* card_health_state_name(card_state_t state)
+{
+   return (state <= CARD_HALF_OPEN) ? state_names[state] : "unknown";
+}
+
+
+/**********************************************************
+ * Function card_health_init()
+ *
+ * Description: Open the socket for the hotplug events
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - fail, cards are probed only on timeout
+ *********************************************************/
+int card_health_init(void)
+{
+   struct sockaddr_nl addr;
+
+   pthread_once(&g_once, health_init);
+
+   g_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+   if (g_fd < 0)
+   {
+      syslog(LOG_DAEMON | LOG_WARNING, "No hotplug events: %s\n", strerror(errno));
+      return -1;
+   }
+   memset(&addr, 0, sizeof(addr));
+   addr.nl_family = AF_NETLINK;
+   addr.nl_groups = 1;   /* kernel events */
+   if (bind(g_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+   {
+      syslog(LOG_DAEMON | LOG_WARNING, "No hotplug events: %s\n", strerror(errno));
+      close(g_fd);
+      g_fd = -1;
+      return -1;
+   }
+   return 0;
+}
+
+
+/**********************************************************
+ * Function card_health_close()
+ *
+ * Description: Close the socket for the hotplug events
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void card_health_close(void)
+{
+   if (g_fd >= 0)
+   {
+      close(g_fd);
+      g_fd = -1;
+   }
+}
+
+
+/**********************************************************
+ * Function card_health_pollfd()
+ *
+ * Description: Get the file descriptor to be polled for
+ *              POLLIN by the main loop, it is readable
+ *              when there are hotplug events
+ *
+ * Parameters: none
+ *
+ * Return: file descriptor, -1 if not available
+ *********************************************************/
+int card_health_pollfd(void)
+{
+   return g_fd;
+}
+
+
+/**********************************************************
+ * Function card_health_process()
+ *
+ * Description: Read the hotplug events, a new USB device
+ *              triggers the probe of all open cards
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void card_health_process(void)
+{
+   char buf[4096];
+   uint64_t retry_ns;
+   ssize_t len;
+   int added = 0, i;
+
+   /* The header of an event is "<action>@<devpath>" */
+   while ((len = recv(g_fd, buf, sizeof(buf)-1, 0)) > 0)
+   {
+      buf[len] = 0;
+      if (!strncmp(buf, "add@", 4) && (strstr(buf, "/usb") != NULL || strstr(buf, "/hidraw") != NULL))
+         added = 1;
+   }
+   if (!added)
+      return;
+
+   retry_ns = monotonic_ns() + HOTPLUG_SETTLE_MS*1000000ULL;
+   pthread_mutex_lock(&g_lock);
+   for (i=0; i<CARD_HEALTH_MAX_CARDS; i++)
+   {
+      if (g_cards[i].used && g_cards[i].state == CARD_OPEN && g_cards[i].retry_ns > retry_ns)
+         g_cards[i].retry_ns = retry_ns;
+   }
+   pthread_mutex_unlock(&g_lock);
+}
+
+
+/**********************************************************
+ * Function card_health_timeout()
+ *
+ * Description: Get the time until the next probe of an
+ *              open card
+ *
+ * Parameters: none
+ *
+ * Return: time in ms, -1 if no card is to be probed
+ *********************************************************/
+int card_health_timeout(void)
+{
+   uint64_t now = monotonic_ns(), next = UINT64_MAX;
+   int i;
+
+   pthread_mutex_lock(&g_lock);
+   for (i=0; i<CARD_HEALTH_MAX_CARDS; i++)
+   {
+      if (g_cards[i].used && g_cards[i].state == CARD_OPEN && g_cards[i].retry_ns < next)
+         next = g_cards[i].retry_ns;
+   }
+   pthread_mutex_unlock(&g_lock);
+
+   if (next == UINT64_MAX) return -1;
+   return (next <= now) ? 0 : (next-now+999999)/1000000;
+}
+
+
+/**********************************************************
+ * Function card_health_probe()
+ *
+ * Description: Probe the open cards whose backoff time has
+ *              passed by detecting them and reading their
+ *              relay states
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void card_health_probe(void)
+{
+   char serial[MAX_SERIAL_LEN], portname[MAX_COM_PORT_NAME_LEN];
+   uint8_t num_relays;
+   uint16_t states;
+   uint64_t now = monotonic_ns();
+   int i, due;
+
+   for (i=0; i<CARD_HEALTH_MAX_CARDS; i++)
+   {
+      pthread_mutex_lock(&g_lock);
+      due = (g_cards[i].used && g_cards[i].state == CARD_OPEN && g_cards[i].retry_ns <= now);
+      strcpy(serial, g_cards[i].key);
+      pthread_mutex_unlock(&g_lock);
+      if (!due)
+         continue;
+
+      /* The card operations pass the circuit check as probe and report
+       * their result */
+      num_relays = FIRST_RELAY;
+      if (crelay_detect_relay_card(portname, &num_relays, serial[0] ? serial : NULL, NULL) == 0)
+         crelay_get_relay_mask(portname, &states, serial[0] ? serial : NULL);
+   }
+}
@@ -0,0 +1,208 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Card health and circuit breaker
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the per card circuit breaker.
+ *   The result of every card operation is reported, and the card moves
+ *   through the following states:
+ *
+ *     healthy    last operation succeeded
+ *     degraded   less than failure_threshold consecutive failures
+ *     open       too many failures, operations fail immediately with
+ *                -ENOLINK until the backoff time has passed
+ *     half-open  one thread may probe the card, a successful read or
+ *                write closes the circuit, a failure opens it again with
+ *                twice the backoff time (up to backoff_max_ms)
+ *
+ *   The daemon probes open cards itself when their backoff time has
+ *   passed, and immediately when the kernel reports a new USB device.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef card_health_h
+#define card_health_h
+
+#include <stdint.h>
+
+#include "relay_drv.h"
+
+#define CARD_HEALTH_MAX_CARDS         32
+#define CARD_HEALTH_FAILURE_THRESHOLD 3
+#define CARD_HEALTH_BACKOFF_MIN_MS    1000
+#define CARD_HEALTH_BACKOFF_MAX_MS    60000
+
+typedef enum
+{
+   CARD_HEALTHY=0,
+   CARD_DEGRADED,
+   CARD_OPEN,
+   CARD_HALF_OPEN
+} card_state_t;
+
+/* Card health, as returned by card_health_list() */
+typedef struct
+{
+   char         serial[MAX_SERIAL_LEN];   /* empty for the default card */
+   card_state_t state;
+   uint32_t     failures;                 /* consecutive failures */
+   uint32_t     trips;                    /* number of times the circuit was opened */
+   int          last_error;
+   uint32_t     retry_ms;                 /* time until the next probe, open circuit only */
+}
+card_health_t;
+
+
+/**********************************************************
+ * Function card_health_init()
+ *
+ * Description: Open the socket for the hotplug events
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - fail, cards are probed only on timeout
+ *********************************************************/
+int card_health_init(void);
+
+/**********************************************************
+ * Function card_health_close()
+ *
+ * Description: Close the socket for the hotplug events
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void card_health_close(void);
+
+/**********************************************************
+ * Function card_health_check()
+ *
+ * Description: Check if an operation on a card may be
+ *              started
+ *
+ * Parameters: serial (in) - serial number, NULL for the
+ *                           default card
+ *
+ * Return:  0 - operation allowed
+ *         -ENOLINK if the circuit of the card is open
+ *********************************************************/
+int card_health_check(const char *serial);
+
+/**********************************************************
+ * Function card_health_report()
+ *
+ * Description: Report the result of an operation on a card.
+ *              Only reads and writes report a success, a
+ *              card which is found but does not answer must
+ *              not look healthy. -EBUSY (card playing a
+ *              waveform) is ignored.
+ *
+ * Parameters: serial (in) - serial number, NULL for the
+ *                           default card
+ *             rc (in)     - result of the operation
+ *
+ * Return: none
+ *********************************************************/
+void card_health_report(const char *serial, int rc);
+
+/**********************************************************
+ * Function card_health_list()
+ *
+ * Description: Get the health of the cards which have been
+ *              used
+ *
+ * Parameters: cards (out) - card health
+ *             max (in)    - max. number of entries
+ *
+ * Return: number of entries
+ *********************************************************/
+int card_health_list(card_health_t *cards, int max);
+
+/**********************************************************
+ * Function card_health_state_name()
+ *
+ * Description: Get the name of a card state
+ *
+ * Parameters: state (in) - card state
+ *
+ * Return: state name
+ *********************************************************/
+const char* card_health_state_name(card_state_t state);
+
+/**********************************************************
+ * Function card_health_pollfd()
+ *
+ * Description: Get the file descriptor to be polled for
+ *              POLLIN by the main loop, it is readable
+ *              when there are hotplug events
+ *
+ * Parameters: none
+ *
+ * Return: file descriptor, -1 if not available
+ *********************************************************/
+int card_health_pollfd(void);
+
+/**********************************************************
+ * Function card_health_process()
+ *
+ * Description: Read the hotplug events, a new USB device
+ *              triggers the probe of all open cards
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void card_health_process(void);
+
+/**********************************************************
+ * Function card_health_timeout()
+ *
+ * Description: Get the time until the next probe of an
+ *              open card
+ *
+ * Parameters: none
+ *
+ * Return: time in ms, -1 if no card is to be probed
+ *********************************************************/
+int card_health_timeout(void);
+
+/**********************************************************
+ * Function card_health_probe()
+ *
+ * Description: Probe the open cards whose backoff time has
+ *              passed by detecting them and reading their
+ *              relay states
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void card_health_probe(void);
+
+#endif
@@ -0,0 +1,477 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Batch mode of the command line interface
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the batch mode (crelay -b <file>|-), which
+ *   executes a stream of commands within one program run. The card is
+ *   detected only once per "card" command (or once at all, if a daemon
+ *   is running and all commands are sent through one connection to its
+ *   unix socket), and consecutive set commands are collapsed into a
+ *   single mask write.
+ *
+ *   For every command a result line is printed:
+ *
+ *     ok <line> <command> [<result>]
+ *     error <line> <message>
+ *
+ *   e.g. "ok 3 get all 10100000" (relay 1 first) or "ok 4 get 2 off".
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "relay_drv.h"
+#include "unix_api.h"
+#include "interlock.h"
+#include "cli_batch.h"
+
+#define MAX_LINE_LEN  256
+#define MAX_PENDING   64   /* set commands collapsed into one write */
+
+/* Card used by the commands */
+typedef struct
+{
+   int      fd;          /* daemon connection, -1 for direct access */
+   uint16_t seq;
+   uint8_t  selected;    /* card detected */
+   char     serial[MAX_SERIAL_LEN];  /* empty for first card */
+   char     com_port[MAX_COM_PORT_NAME_LEN];
+   uint8_t  num_relays;
+} session_t;
+
+/* Set commands which are not written yet */
+typedef struct
+{
+   uint16_t mask;
+   uint16_t states;
+   int      num;
+   int      lineno[MAX_PENDING];
+   char     text[MAX_PENDING][32];
+} pending_t;
+
+
+static char* serial_arg(session_t *s)
+{
+   return s->serial[0] ? s->serial : NULL;
+}
+
+
+/**********************************************************
+ * Internal function daemon_request()
+ *
+ * Description: Execute a request through the daemon
+ *
+ * Return: 0 on success, negative errno value otherwise
+ *********************************************************/
+static int daemon_request(session_t *s, uint8_t cmd, uint16_t mask, uint16_t states, uint16_t *result)
+{
+   unix_api_request_t req;
+   unix_api_response_t resp;
+
+   memset(&req, 0, sizeof(req));
+   req.cmd = cmd;
+   req.seq = ++s->seq;
+   req.mask = mask;
+   req.states = states;
+   strcpy(req.serial, s->serial);
+
+   if (unix_api_request(s->fd, &req, &resp) < 0)
+      return -EPIPE;
+
+   if (resp.status == 0)
+   {
+      s->num_relays = resp.num_relays;
+      if (result != NULL) *result = resp.states;
+   }
+   return resp.status;
+}
+
+
+static int session_select(session_t *s)
+{
+   int rc;
+
+   s->selected = 0;
+   if (s->fd >= 0)
+   {
+      if (daemon_request(s, UNIX_API_GET_MASK, 0, 0, NULL) < 0)
+         return -ENODEV;
+   }
+   else
+   {
+      s->num_relays = FIRST_RELAY;
+      rc = crelay_detect_relay_card(s->com_port, &s->num_relays, serial_arg(s), NULL);
+      if (rc < 0)
+         return (rc == -ETIMEDOUT) ? rc : -ENODEV;
+   }
+   s->selected = 1;
+   return 0;
+}
+
+
+/* Keep the driver errors which tell the user more than an
+ * access failure, like the daemon does for its clients. Some
+ * drivers fail with -1, which is only an interlock rejection
+ * if rules are configured. */
+static int card_error(int rc)
+{
+   if (rc == -EPERM)
+      return interlock_active() ? rc : -EIO;
+   return (rc == -ETIMEDOUT || rc == -ENOLINK || rc == -EBUSY) ? rc : -EIO;
+}
+
+
+static int session_get(session_t *s, uint16_t *states)
+{
+   int rc;
+
+   if (!s->selected && (rc = session_select(s)) < 0)
+      return rc;
+
+   if (s->fd >= 0)
+      return daemon_request(s, UNIX_API_GET_MASK, 0, 0, states);
+
+   if ((rc = crelay_get_relay_mask(s->com_port, states, serial_arg(s))) < 0)
+      return card_error(rc);
+   return 0;
+}
+
+
+static int session_set(session_t *s, uint16_t mask, uint16_t states)
+{
+   int rc;
+
+   if (!s->selected && (rc = session_select(s)) < 0)
+      return rc;
+
+   if (s->fd >= 0)
+      return daemon_request(s, UNIX_API_SET_MASK, mask, states, NULL);
+
+   if ((rc = crelay_set_relay_mask(s->com_port, mask, states, serial_arg(s))) < 0)
+      return card_error(rc);
+   return 0;
+}
+
+
+static const char* error_msg(int rc)
+{
+   switch (rc)
+   {
+      case -ENODEV: return "no compatible device detected";
+      case -ETIMEDOUT: return "relay card did not answer in time";
+      case -EINVAL: return "relay number out of range";
+      case -EPIPE:  return "connection to daemon lost";
+      case -EPERM:  return "breaks an interlock rule";
+      case -ENOLINK: return "relay card circuit open after repeated failures";
+      case -EBUSY:  return "relay card is playing a waveform";
+      case -EIO:    return "relay card access failed";
+      default:      return strerror(-rc);
+   }
+}
+
+
+/**********************************************************
+ * Internal function flush_pending()
+ *
+ * Description: Write the collapsed set commands and print
+ *              their results
+ *
+ * Return: 0 on success, -1 on failure
+ *********************************************************/
+static int flush_pending(session_t *s, pending_t *p, FILE *out)
+{
+   int i, rc;
+
+   if (p->num == 0)
+      return 0;
+
+   rc = session_set(s, p->mask, p->states);
+   for (i=0; i<p->num; i++)
+   {
+      if (rc == 0)
+         fprintf(out, "ok %d %s\n", p->lineno[i], p->text[i]);
+      else
+         fprintf(out, "error %d %s\n", p->lineno[i], error_msg(rc));
+   }
+   fflush(out);
+
+   p->mask = 0;
+   p->states = 0;
+   p->num = 0;
+   return rc < 0 ? -1 : 0;
+}
+
+
+/**********************************************************
+ * Internal function parse_duration()
+ *
+ * Description: Parse a duration with optional unit us, ms
+ *              or s (default ms)
+ *
+ * Return: 0 on success, -1 on invalid duration
+ *********************************************************/
+static int parse_duration(const char *str, uint64_t *us)
+{
+   char *end;
+   double val;
+
+   if (str == NULL)
+      return -1;
+   val = strtod(str, &end);
+   if (end == str || val < 0)
+      return -1;
+
+   if (*end == 0 || !strcmp(end, "ms"))
+      *us = val*1000;
+   else if (!strcmp(end, "us"))
+      *us = val;
+   else if (!strcmp(end, "s"))
+      *us = val*1000000;
+   else
+      return -1;
+   return 0;
+}
+
+
+static void sleep_us(uint64_t us)
+{
+   struct timespec ts;
+
+   ts.tv_sec  = us / 1000000;
+   ts.tv_nsec = (us % 1000000) * 1000;
+   while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+
+/**********************************************************
+ * Internal function parse_relays()
+ *
+ * Description: Parse a relay number or "all" into a mask.
+ *              Selects the card, as the number of relays
+ *              must be known.
+ *
+ * Return: 0 on success, negative errno value otherwise
+ *********************************************************/
+static int parse_relays(session_t *s, const char *str, uint16_t *mask)
+{
+   int relay, rc;
+   char *end;
+
+   if (str == NULL)
+      return -EINVAL;
+   if (!s->selected && (rc = session_select(s)) < 0)
+      return rc;
+
+   if (!strcasecmp(str, "all"))
+   {
+      *mask = (1<<s->num_relays)-1;
+      return 0;
+   }
+
+   relay = strtol(str, &end, 10);
+   if (*end != 0 || relay < FIRST_RELAY || relay > s->num_relays)
+      return -EINVAL;
+   *mask = 1<<(relay-FIRST_RELAY);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function cli_batch()
+ *
+ * Description: Execute a stream of relay commands, one per
+ *              line, and print one result line for each
+ *
+ * Parameters: in (in)           - command stream
+ *             out (in)          - result stream
+ *             serial (in)       - initial card [optional]
+ *             socket_path (in)  - unix socket of the daemon,
+ *                                 NULL for direct access
+ *
+ * Return:  0 - all commands successful
+ *         -1 - at least one command failed
+ *********************************************************/
+int cli_batch(FILE *in, FILE *out, char *serial, const char *socket_path)
+{
+   session_t session;
+   pending_t pending;
+   char line[MAX_LINE_LEN];
+   char *cmd, *arg1, *arg2, *save, *p;
+   const char *msg;
+   uint16_t mask, states;
+   uint64_t us;
+   int lineno = 0;
+   int failed = 0;
+   int rc, i;
+
+   memset(&session, 0, sizeof(session));
+   memset(&pending, 0, sizeof(pending));
+   session.fd = -1;
+   if (socket_path != NULL)
+   {
+      rc = unix_api_connect(socket_path);
+      if (rc >= 0)
+      {
+         session.fd = rc;
+      }
+      else if (rc != -ENOENT && rc != -ECONNREFUSED)
+      {
+         /* A daemon which is running but not usable must not be bypassed */
+         fprintf(stderr, "ERROR: Cannot connect to daemon at %s: %s\n", socket_path, strerror(-rc));
+         return -1;
+      }
+   }
+   if (serial != NULL)
+      snprintf(session.serial, sizeof(session.serial), "%s", serial);
+
+   while (fgets(line, sizeof(line), in))
+   {
+      lineno++;
+
+      /* Strip comments and skip empty lines */
+      if ((p = strchr(line, '#')) != NULL) *p = 0;
+      if ((cmd = strtok_r(line, " \t\r\n", &save)) == NULL)
+         continue;
+      arg1 = strtok_r(NULL, " \t\r\n", &save);
+      arg2 = strtok_r(NULL, " \t\r\n", &save);
+      msg = NULL;
+      rc = 0;
+
+      if (!strcasecmp(cmd, "set"))
+      {
+         if (arg2 == NULL || (strcasecmp(arg2, "on") && strcasecmp(arg2, "off")))
+         {
+            msg = "invalid state";
+         }
+         else if ((rc = parse_relays(&session, arg1, &mask)) == 0)
+         {
+            /* Collect the set commands, they are written together */
+            if (pending.num == MAX_PENDING && flush_pending(&session, &pending, out) < 0)
+               failed = 1;
+            states = strcasecmp(arg2, "on") ? 0 : mask;
+            pending.mask |= mask;
+            pending.states = (pending.states & ~mask) | states;
+            pending.lineno[pending.num] = lineno;
+            snprintf(pending.text[pending.num], sizeof(pending.text[0]), "set %s %s", arg1, states ? "on" : "off");
+            pending.num++;
+            continue;
+         }
+      }
+
+      /* All other commands see the result of the previous sets */
+      if (flush_pending(&session, &pending, out) < 0)
+         failed = 1;
+
+      if (!strcasecmp(cmd, "set"))
+      {
+         /* Only invalid set commands get here */
+      }
+      else if (!strcasecmp(cmd, "card"))
+      {
+         snprintf(session.serial, sizeof(session.serial), "%s", arg1 ? arg1 : "");
+         if ((rc = session_select(&session)) == 0)
+            fprintf(out, "ok %d card %s %d\n", lineno, arg1 ? arg1 : "-", session.num_relays);
+      }
+      else if (!strcasecmp(cmd, "get"))
+      {
+         if ((rc = parse_relays(&session, arg1, &mask)) == 0 &&
+             (rc = session_get(&session, &states)) == 0)
+         {
+            if (!strcasecmp(arg1, "all"))
+            {
+               fprintf(out, "ok %d get all ", lineno);
+               for (i=0; i<session.num_relays; i++)
+                  fputc((states & (1<<i)) ? '1' : '0', out);
+               fputc('\n', out);
+            }
+            else
+            {
+               fprintf(out, "ok %d get %s %s\n", lineno, arg1, (states & mask) ? "on" : "off");
+            }
+         }
+      }
+      else if (!strcasecmp(cmd, "pulse"))
+      {
+         if (parse_duration(arg2, &us) < 0)
+         {
+            msg = "invalid duration";
+         }
+         else if ((rc = parse_relays(&session, arg1, &mask)) == 0 &&
+                  (rc = session_get(&session, &states)) == 0 &&
+                  (rc = session_set(&session, mask, ~states)) == 0)
+         {
+            sleep_us(us);
+            if ((rc = session_set(&session, mask, states)) == 0)
+               fprintf(out, "ok %d pulse %s %s\n", lineno, arg1, arg2);
+         }
+      }
+      else if (!strcasecmp(cmd, "wait"))
+      {
+         if (parse_duration(arg1, &us) < 0)
+         {
+            msg = "invalid duration";
+         }
+         else
+         {
+            sleep_us(us);
+            fprintf(out, "ok %d wait %s\n", lineno, arg1);
+         }
+      }
+      else
+      {
+         msg = "unknown command";
+      }
+
+      if (msg != NULL)
+      {
+         fprintf(out, "error %d %s\n", lineno, msg);
+         failed = 1;
+      }
+      else if (rc != 0)
+      {
+         fprintf(out, "error %d %s\n", lineno, error_msg(rc));
+         failed = 1;
+      }
+      fflush(out);
+   }
+
+   if (flush_pending(&session, &pending, out) < 0)
+      failed = 1;
+
+   if (session.fd >= 0)
+      close(session.fd);
+
+   return failed ? -1 : 0;
+}
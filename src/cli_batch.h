@@ -0,0 +1,66 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Batch mode of the command line interface
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the batch mode functions.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef cli_batch_h
+#define cli_batch_h
+
+#include <stdio.h>
+
+/**********************************************************
+ * Function cli_batch()
+ *
+ * Description: Execute a stream of relay commands, one per
+ *              line, and print one result line for each:
+ *
+ *                card [<serial>]          select card
+ *                set <n>|all on|off       set relay state
+ *                get <n>|all              read relay state
+ *                pulse <n> <duration>     toggle relay for duration
+ *                wait <duration>          pause
+ *
+ *              Durations are given in us, ms (default) or s,
+ *              e.g. 250ms. Consecutive set commands for the
+ *              same card are collapsed into one mask write.
+ *
+ * Parameters: in (in)           - command stream
+ *             out (in)          - result stream
+ *             serial (in)       - initial card [optional]
+ *             socket_path (in)  - unix socket of the daemon,
+ *                                 NULL for direct access
+ *
+ * Return:  0 - all commands successful
+ *         -1 - at least one command failed
+ *********************************************************/
+int cli_batch(FILE *in, FILE *out, char *serial, const char *socket_path);
+
+#endif
@@ -52,10 +52,32 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <poll.h>
 
 #include "data_types.h"
 #include "config.h"
 #include "relay_drv.h"
+#include "unix_api.h"
+#include "state_shm.h"
+#include "state_journal.h"
+#include "history.h"
+#include "relay_stats.h"
+#include "scheduler.h"
+#include "sequence.h"
+#include "waveform.h"
+#include "gpio_pwm.h"
+#include "gpio_input.h"
+#include "realtime.h"
+#include "emergency.h"
+#include "lease.h"
+#include "scene.h"
+#include "interlock.h"
+#include "power_seq.h"
+#include "card_health.h"
+#include "http_api.h"
+#include "cli_batch.h"
+#include "trace.h"
+#include "crelay.h"
 
 #define VERSION "0.14.1"
 #define DATE "2021"
@@ -66,17 +88,33 @@
 #define RFC1123FMT "%a, %d %b %Y %H:%M:%S GMT"
 #define API_URL "gpio"
 #define DEFAULT_SERVER_PORT 8000
+#define HTTP_MAX_REQUEST_LEN 1024
 
 /* HTML tag definitions */
 #define RELAY_TAG "pin"
 #define STATE_TAG "status"
 #define SERIAL_TAG "serial"
+#define LEASE_TAG "lease_ms"
 
 #define CONFIG_FILE "/etc/crelay.conf"
 
+/* Phases of a HTTP request, reported in the Server-Timing header */
+typedef enum
+{
+   PHASE_PARSE=0,
+   PHASE_DETECT,
+   PHASE_SWITCH,
+   PHASE_READ,
+   NUM_PHASES
+} http_phase_t;
+
+static const char* phase_names[NUM_PHASES] = {"parse", "detect", "switch", "read"};
+
 /* Global variables */
 config_t config;
 
+static const char* config_file = CONFIG_FILE;
+
 static char rlabels[MAX_NUM_RELAYS][32] = {"My appliance 1", "My appliance 2", "My appliance 3", "My appliance 4",
                                            "My appliance 5", "My appliance 6", "My appliance 7", "My appliance 8"};                                       
 
@@ -138,6 +176,132 @@ static int config_cb(void* user, const char* section, const char* name, const ch
    {
       pconfig->pulse_duration = atoi(value);
    }
+   else if (MATCH("HTTP server", "server_timing")) 
+   {
+      pconfig->server_timing = atoi(value);
+   }
+   else if (MATCH("Unix socket", "enabled")) 
+   {
+      pconfig->unix_disabled = !atoi(value);
+   }
+   else if (MATCH("Unix socket", "socket_path")) 
+   {
+      pconfig->unix_socket_path = strdup(value);
+   }
+   else if (MATCH("Unix socket", "allow_users")) 
+   {
+      pconfig->unix_allow_users = strdup(value);
+   }
+   else if (MATCH("Unix socket", "allow_groups")) 
+   {
+      pconfig->unix_allow_groups = strdup(value);
+   }
+   else if (MATCH("Shared memory", "enabled")) 
+   {
+      pconfig->shm_disabled = !atoi(value);
+   }
+   else if (MATCH("Shared memory", "name")) 
+   {
+      pconfig->shm_name = strdup(value);
+   }
+   else if (MATCH("State journal", "enabled")) 
+   {
+      pconfig->journal_disabled = !atoi(value);
+   }
+   else if (MATCH("State journal", "path")) 
+   {
+      pconfig->journal_path = strdup(value);
+   }
+   else if (MATCH("History", "enabled")) 
+   {
+      pconfig->history_disabled = !atoi(value);
+   }
+   else if (MATCH("History", "dir")) 
+   {
+      pconfig->history_dir = strdup(value);
+   }
+   else if (MATCH("History", "max_segments")) 
+   {
+      pconfig->history_max_segments = atoi(value);
+   }
+   else if (MATCH("Statistics", "enabled")) 
+   {
+      pconfig->stats_disabled = !atoi(value);
+   }
+   else if (MATCH("Statistics", "path")) 
+   {
+      pconfig->stats_path = strdup(value);
+   }
+   else if (MATCH("Scheduler", "latitude")) 
+   {
+      pconfig->sched_latitude = strdup(value);
+   }
+   else if (MATCH("Scheduler", "longitude")) 
+   {
+      pconfig->sched_longitude = strdup(value);
+   }
+   else if (MATCH("Scheduler", "entry")) 
+   {
+      if (pconfig->sched_num_entries < MAX_CONFIG_SCHEDULES)
+         pconfig->sched_entries[pconfig->sched_num_entries++] = strdup(value);
+   }
+   else if (MATCH("Card I/O", "timeout_ms")) 
+   {
+      pconfig->io_timeout_ms = atoi(value);
+   }
+   else if (MATCH("Card I/O", "failure_threshold")) 
+   {
+      pconfig->io_failure_threshold = atoi(value);
+   }
+   else if (MATCH("Card I/O", "backoff_min_ms")) 
+   {
+      pconfig->io_backoff_min_ms = atoi(value);
+   }
+   else if (MATCH("Card I/O", "backoff_max_ms")) 
+   {
+      pconfig->io_backoff_max_ms = atoi(value);
+   }
+   else if (MATCH("Realtime", "enabled")) 
+   {
+      pconfig->rt_enabled = atoi(value);
+   }
+   else if (MATCH("Realtime", "priority")) 
+   {
+      pconfig->rt_priority = atoi(value);
+   }
+   else if (MATCH("Realtime", "cpus")) 
+   {
+      pconfig->rt_cpus = strdup(value);
+   }
+   else if (MATCH("Realtime", "lock_memory")) 
+   {
+      pconfig->rt_unlocked = !atoi(value);
+   }
+   else if (MATCH("Realtime", "prealloc_kb")) 
+   {
+      pconfig->rt_prealloc_kb = atoi(value);
+   }
+   else if (MATCH("Power-on", "max_on")) 
+   {
+      pconfig->poweron_max_on = atoi(value);
+   }
+   else if (MATCH("Power-on", "gap_ms")) 
+   {
+      pconfig->poweron_gap_ms = atoi(value);
+   }
+   else if (MATCH("Power-on", "group")) 
+   {
+      if (pconfig->poweron_num_groups < MAX_CONFIG_POWERON_GROUPS)
+         pconfig->poweron_groups[pconfig->poweron_num_groups++] = strdup(value);
+   }
+   else if (strcmp(section, "Scenes") == 0) 
+   {
+      if (pconfig->num_scenes < MAX_CONFIG_SCENES)
+      {
+         pconfig->scene_names[pconfig->num_scenes] = strdup(name);
+         pconfig->scene_defs[pconfig->num_scenes++] = strdup(value);
+      }
+   }
    else if (MATCH("GPIO drv", "num_relays")) 
    {
       pconfig->gpio_num_relays = atoi(value);
@@ -178,10 +342,88 @@ static int config_cb(void* user, const char* section, const char* name, const ch
    {
       pconfig->relay8_gpio_pin = atoi(value);
    } 
+   else if (MATCH("GPIO drv", "pwm_priority")) 
+   {
+      pconfig->gpio_pwm_priority = atoi(value);
+   } 
+   else if (MATCH("GPIO inputs", "chip")) 
+   {
+      pconfig->input_chip = strdup(value);
+   } 
+   else if (MATCH("GPIO inputs", "debounce_ms")) 
+   {
+      pconfig->input_debounce_ms = atoi(value);
+   } 
+   else if (MATCH("GPIO inputs", "input")) 
+   {
+      if (pconfig->num_inputs < MAX_CONFIG_INPUTS)
+         pconfig->inputs[pconfig->num_inputs++] = strdup(value);
+   } 
+   else if (MATCH("Leases", "max_leases")) 
+   {
+      pconfig->max_leases = atoi(value);
+   } 
+   else if (MATCH("Interlocks", "rule")) 
+   {
+      if (pconfig->num_interlocks < MAX_CONFIG_INTERLOCKS)
+         pconfig->interlocks[pconfig->num_interlocks++] = strdup(value);
+   } 
    else if (MATCH("Sainsmart drv", "num_relays")) 
    {
       pconfig->sainsmart_num_relays = atoi(value);
    } 
+   else if (MATCH("Sainsmart drv", "wave_clock_div")) 
+   {
+      pconfig->sainsmart_wave_clock_div = atoi(value);
+   } 
+   else if (MATCH("Simulated drv", "num_relays")) 
+   {
+      pconfig->sim_num_relays = atoi(value);
+   } 
+   else if (MATCH("Simulated drv", "num_cards")) 
+   {
+      pconfig->sim_num_cards = atoi(value);
+   } 
+   else if (MATCH("Simulated drv", "num_buses")) 
+   {
+      pconfig->sim_num_buses = atoi(value);
+   } 
+   else if (MATCH("Simulated drv", "profile")) 
+   {
+      pconfig->sim_profile = strdup(value);
+   } 
+   else if (MATCH("Simulated drv", "latency_us")) 
+   {
+      pconfig->sim_latency_us = atoi(value);
+   } 
+   else if (MATCH("Simulated drv", "jitter_us")) 
+   {
+      pconfig->sim_jitter_us = atoi(value);
+   } 
+   else if (MATCH("Simulated drv", "fault_card")) 
+   {
+      pconfig->sim_fault_card = strdup(value);
+   } 
+   else if (MATCH("Simulated drv", "timeout_rate")) 
+   {
+      pconfig->sim_timeout_rate = atof(value);
+   } 
+   else if (MATCH("Simulated drv", "timeout_ms")) 
+   {
+      pconfig->sim_timeout_ms = atoi(value);
+   } 
+   else if (MATCH("Simulated drv", "disconnect_rate")) 
+   {
+      pconfig->sim_disconnect_rate = atof(value);
+   } 
+   else if (MATCH("Simulated drv", "disconnect_ms")) 
+   {
+      pconfig->sim_disconnect_ms = atoi(value);
+   } 
+   else if (MATCH("Simulated drv", "stuck_bits")) 
+   {
+      pconfig->sim_stuck_bits = strtol(value, NULL, 0);
+   } 
    else 
    {
       syslog(LOG_DAEMON | LOG_WARNING, "unknown config parameter %s/%s\n", section, name);
@@ -203,6 +445,21 @@ static int config_cb(void* user, const char* section, const char* name, const ch
 static void exit_handler(int signum)
 {
    syslog(LOG_DAEMON | LOG_NOTICE, "Exit crelay daemon\n");
+   unix_api_close();
+   state_shm_close();
+   state_journal_close();
+   history_close();
+   relay_stats_close();
+   scheduler_close();
+   sequence_close();
+   waveform_close();
+   gpio_pwm_close();
+   gpio_input_close();
+   emergency_close();
+   lease_close();
+   scene_close();
+   card_health_close();
+   power_seq_close();
    exit(EXIT_SUCCESS);
 }
 
@@ -345,10 +602,10 @@ void style_sheet(FILE *f)
  * Parameters:
  * 
  *********************************************************/
-void web_page_header(FILE *f)
+void web_page_header(FILE *f, char *extra)
 {
    /* Send http header */
-   send_headers(f, 200, "OK", NULL, "text/html", -1, -1);   
+   send_headers(f, 200, "OK", extra, "text/html", -1, -1);   
    fprintf(f, "<!DOCTYPE html PUBLIC \"-//W3C//DTD HTML 4.01//EN\" \"http://www.w3.org/TR/html4/strict.dtd\">\r\n");
    fprintf(f, "<html><head><title>Relay Card Control</title>\r\n");
    style_sheet(f);
@@ -399,7 +656,7 @@ void web_page_error(FILE *f)
    fprintf(f, "<span style=\"font-size: 14px; color: grey;  font-weight: normal;\">This can be due to the following reasons:\r\n");
    fprintf(f, "<div>- No supported relay card is connected via USB cable</div>\r\n");
    fprintf(f, "<div>- The relay card is connected but it is broken</div>\r\n");
-   fprintf(f, "<div>- There is no GPIO sysfs support available or GPIO pins not defined in %s\r\n", CONFIG_FILE);
+   fprintf(f, "<div>- There is no GPIO sysfs support available or GPIO pins not defined in %s\r\n", config_file);
    fprintf(f, "<div>- You are running on a multiuser OS and don't have root permissions\r\n");
    fprintf(f, "</span></td></tbody></table><br>\r\n");
 }   
@@ -415,7 +672,7 @@ void web_page_error(FILE *f)
  *********************************************************/
 int read_httppost_data(FILE* f, char* data, size_t datalen)
 {
-   char buf[256];
+   char buf[HTTP_MAX_REQUEST_LEN];
    int data_len=0;
    
    /* POST request: data is provided after the page header.
@@ -470,13 +727,62 @@ int read_httpget_data(char* buf, char* data, size_t datalen)
    *data = 0;
    if ((datastr=strchr(buf, '?')) != NULL)
    {
-       strncpy(data, datastr+1, datalen);
+       strncpy(data, datastr+1, datalen-1);
+       data[datalen-1] = 0;
    }
    
    return strlen(data);
 }
 
 
+/**********************************************************
+ * Function phase_end()
+ * 
+ * Description: Add the time elapsed since the end of the
+ *              previous phase to the given request phase
+ * 
+ * Parameters: ts (in/out)     - end time of previous phase
+ *             phase_ms (out)  - phase durations in ms
+ *             phase (in)      - phase which just ended
+ * 
+ *********************************************************/
+static void phase_end(struct timespec *ts, double *phase_ms, http_phase_t phase)
+{
+   struct timespec now;
+   
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   phase_ms[phase] += (now.tv_sec - ts->tv_sec)*1e3 + (now.tv_nsec - ts->tv_nsec)/1e6;
+   *ts = now;
+}
+
+
+/**********************************************************
+ * Function server_timing()
+ * 
+ * Description: Format the Server-Timing header line with
+ *              the durations of the request phases
+ * 
+ * Parameters: buf (out)       - header line buffer
+ *             len (in)        - size of buffer
+ *             phase_ms (in)   - phase durations in ms
+ * 
+ * Return: header line, NULL if disabled in config
+ *********************************************************/
+static char* server_timing(char *buf, size_t len, const double *phase_ms)
+{
+   int i, n;
+   
+   if (!config.server_timing) return NULL;
+   
+   n = snprintf(buf, len, "Server-Timing: ");
+   for (i=0; i<NUM_PHASES && n<len; i++)
+   {
+      n += snprintf(buf+n, len-n, "%s%s;dur=%.3f", i ? ", " : "", phase_names[i], phase_ms[i]);
+   }
+   return buf;
+}
+
+
 /**********************************************************
  * Function process_http_request()
  * 
@@ -488,10 +794,10 @@ int read_httpget_data(char* buf, char* data, size_t datalen)
 int process_http_request(int sock)
 {
    FILE *fin, *fout;
-   char buf[256];
+   char buf[HTTP_MAX_REQUEST_LEN];
    char *method;
    char *url;
-   char formdata[64];
+   char formdata[HTTP_MAX_REQUEST_LEN];
    char *datastr;
    int  relay=0;
    int  i;
@@ -502,6 +808,20 @@ int process_http_request(int sock)
    uint8_t last_relay=FIRST_RELAY;
    relay_state_t rstate[MAX_NUM_RELAYS]={0};
    relay_state_t nstate=INVALID;
+   uint32_t lease_ms=0;
+   struct timespec ts;
+   double phase_ms[NUM_PHASES]={0};
+   char timing[128];
+   int detected;
+   struct sockaddr_in peer;
+   socklen_t peerlen = sizeof(peer);
+   uint32_t client_ip = 0;
+   
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   CRELAY_TRACE1(http__request__start, sock);
+   
+   if (getpeername(sock, (struct sockaddr*)&peer, &peerlen) == 0 && peer.sin_family == AF_INET)
+      client_ip = peer.sin_addr.s_addr;
    
    formdata[0]=0;  
 
@@ -561,6 +881,21 @@ int process_http_request(int sock)
      fprintf(fout, "ERROR: Invalid Input. \r\n");
      goto done;
    }
+   
+   /* JSON API request */
+   if (!strncmp(url, HTTP_API_URL, strlen(HTTP_API_URL)))
+   {
+      http_api_process(fout, method, url, strcasecmp(method, "POST") ? NULL : formdata, client_ip);
+      goto done;
+   }
+   
+   /* Prometheus metrics */
+   if (!strncmp(url, HTTP_METRICS_URL, strlen(HTTP_METRICS_URL)) &&
+       (url[strlen(HTTP_METRICS_URL)] == 0 || url[strlen(HTTP_METRICS_URL)] == '?'))
+   {
+      http_api_metrics(fout);
+      goto done;
+   }
 
    /* Get values from form data */
    if (formdatalen > 0) 
@@ -578,6 +913,10 @@ int process_http_request(int sock)
          nstate = atoi(datastr+strlen(STATE_TAG)+1);
          //printf("%sstate=%d", found ? ", " : "", nstate);
       }
+      datastr = strstr(formdata, LEASE_TAG);
+      if (datastr) {
+         lease_ms = atoi(datastr+strlen(LEASE_TAG)+1);
+      }
       datastr = strstr(formdata, SERIAL_TAG);
       if (datastr) {
          serial = datastr+strlen(SERIAL_TAG)+1;
@@ -588,20 +927,53 @@ int process_http_request(int sock)
       }
       //printf("\n\n");
    }
+   phase_end(&ts, phase_ms, PHASE_PARSE);
+   CRELAY_TRACE2(http__request__parsed, relay, nstate);
+   
+   /* Renewal of a lease, the card is not accessed */
+   if (lease_ms > 0 && (nstate == ON || nstate == OFF) &&
+       relay >= FIRST_RELAY && relay < FIRST_RELAY+MAX_NUM_RELAYS &&
+       lease_renew(serial ? serial : "", 1<<(relay-FIRST_RELAY), (nstate == ON) ? 1<<(relay-FIRST_RELAY) : 0,
+                   lease_ms, &last_relay) == 0)
+   {
+      phase_end(&ts, phase_ms, PHASE_SWITCH);
+      send_headers(fout, 200, "OK", server_timing(timing, sizeof(timing), phase_ms), "text/plain", -1, -1);
+      fprintf(fout, "Relay %d:%d<br>", relay, nstate);
+      goto done;
+   }
    
    /* Check if a relay card is present */
-   if (crelay_detect_relay_card(com_port, &last_relay, serial, NULL) == -1)
+   detected = crelay_detect_relay_card(com_port, &last_relay, serial, NULL);
+   phase_end(&ts, phase_ms, PHASE_DETECT);
+   CRELAY_TRACE1(http__detect__done, detected);
+   if (detected == -ETIMEDOUT && strstr(url, API_URL))
+   {
+      /* HTTP API request, a card did not answer in time */
+      send_headers(fout, 504, "Relay card timeout", 
+                   server_timing(timing, sizeof(timing), phase_ms), "text/plain", -1, -1);
+      fprintf(fout, "ERROR: Relay card did not answer in time");
+   }
+   else if (detected == -ENOLINK && strstr(url, API_URL))
+   {
+      /* HTTP API request, the card failed too often and is not accessed
+       * until its next probe */
+      send_headers(fout, 503, "Relay card unavailable", 
+                   server_timing(timing, sizeof(timing), phase_ms), "text/plain", -1, -1);
+      fprintf(fout, "ERROR: Relay card unavailable, retrying later");
+   }
+   else if (detected < 0)
    {
       if (strstr(url, API_URL))
       {
          /* HTTP API request, send response */
-         send_headers(fout, 503, "No compatible device detected", NULL, "text/plain", -1, -1);
+         send_headers(fout, 503, "No compatible device detected", 
+                      server_timing(timing, sizeof(timing), phase_ms), "text/plain", -1, -1);
          fprintf(fout, "ERROR: No compatible device detected");
       }
       else
       {  
          /* Web page request */
-         web_page_header(fout);
+         web_page_header(fout, server_timing(timing, sizeof(timing), phase_ms));
          web_page_error(fout);
          web_page_footer(fout);
       }     
@@ -616,49 +988,102 @@ int process_http_request(int sock)
             /* Perform the requested action here */
             if (nstate==PULSE)
             {
-               /* Generate pulse on relay switch */
-               rc = crelay_get_relay(com_port, relay, &rstate[relay-1], serial);
-               if (rc==0 && rstate[relay-1] == ON)
-               {
-                  rc = crelay_set_relay(com_port, relay, OFF, serial);
-                  if (rc == 0)
-                  {
-                     sleep(config.pulse_duration);
-                     rc = crelay_set_relay(com_port, relay, ON, serial);
-                  }
-               }
-               else if (rc==0 && rstate[relay-1] == OFF)
-               {
-                  rc = crelay_set_relay(com_port, relay, ON, serial);
-                  if (rc == 0)
-                  {
-                     sleep(config.pulse_duration);
-                     rc = crelay_set_relay(com_port, relay, OFF, serial);
-                  }
-               }
+               /* Toggle the relay, it is switched back by the pulse timers
+                * of the main loop, which an emergency off cancels */
+               uint16_t states;
+               
+               if (relay < FIRST_RELAY || relay > last_relay)
+                  rc = -EINVAL;
+               else
+                  rc = unix_api_start_pulse(com_port, serial ? serial : "", 1<<(relay-FIRST_RELAY),
+                                            config.pulse_duration*1000, HISTORY_SRC_HTTP, client_ip, &states);
+            }
+            else if (lease_ms > 0)
+            {
+               /* Switch relay on/off until the lease expires, the state is
+                * not journaled */
+               uint16_t states;
+               
+               if (relay < FIRST_RELAY || relay > last_relay)
+                  rc = -1;
+               else
+                  rc = lease_set(com_port, serial ? serial : "", last_relay, 1<<(relay-FIRST_RELAY),
+                                 (nstate==ON) ? 1<<(relay-FIRST_RELAY) : 0, lease_ms,
+                                 HISTORY_SRC_HTTP, client_ip, &states);
             }
             else
             {
                /* Switch relay on/off */
                rc = crelay_set_relay(com_port, relay, nstate, serial);
+               if (rc == 0)
+               {
+                  state_journal_record(serial, 1<<(relay-FIRST_RELAY), (nstate==ON) ? 1<<(relay-FIRST_RELAY) : 0);
+                  lease_release(serial ? serial : "", 1<<(relay-FIRST_RELAY));
+               }
             }
+            phase_end(&ts, phase_ms, PHASE_SWITCH);
+            CRELAY_TRACE1(http__switch__done, rc);
          }
       }
       
       /* Read current state for all relays */
       if (rc == 0)
       {
-         for (i=FIRST_RELAY; i<=last_relay; i++)
+         for (i=FIRST_RELAY; i<=last_relay && rc == 0; i++)
          {
             rc = crelay_get_relay(com_port, i, &rstate[i-1], serial);
          }
+         phase_end(&ts, phase_ms, PHASE_READ);
+         CRELAY_TRACE1(http__read__done, rc);
+      }
+      
+      /* Inform local clients about the state change */
+      if (rc == 0)
+      {
+         uint16_t states=0;
+         for (i=FIRST_RELAY; i<=last_relay; i++)
+         {
+            if (rstate[i-1] == ON) states |= 1<<(i-FIRST_RELAY);
+         }
+         publish_states(serial, last_relay, 0, states,
+                        (relay != 0 && nstate != INVALID) ? HISTORY_SRC_HTTP : HISTORY_SRC_EXTERNAL, client_ip);
       }
       
       /* Send response to client */
-      if (strstr(url, API_URL))
+      if (rc == -ETIMEDOUT && strstr(url, API_URL))
+      {
+         /* HTTP API request, the card did not answer in time */
+         send_headers(fout, 504, "Relay card timeout", server_timing(timing, sizeof(timing), phase_ms), "text/plain", -1, -1);
+         fprintf(fout, "ERROR: Relay card did not answer in time");
+      }
+      else if (rc == -EBUSY && strstr(url, API_URL))
+      {
+         /* HTTP API request, the card plays a waveform or the relay is in PWM mode */
+         send_headers(fout, 409, "Relay card busy", server_timing(timing, sizeof(timing), phase_ms), "text/plain", -1, -1);
+         fprintf(fout, "ERROR: Relay card is playing a waveform or relay is in PWM mode");
+      }
+      else if (rc == -EPERM && strstr(url, API_URL))
+      {
+         /* HTTP API request, the relay would break an interlock rule */
+         send_headers(fout, 409, "Interlock violated", server_timing(timing, sizeof(timing), phase_ms), "text/plain", -1, -1);
+         fprintf(fout, "ERROR: Interlock rule \"%s\" violated", interlock_violation());
+      }
+      else if (rc == -EINVAL && lease_ms > 0 && strstr(url, API_URL))
+      {
+         /* HTTP API request, lease duration out of range */
+         send_headers(fout, 400, "Bad Request", server_timing(timing, sizeof(timing), phase_ms), "text/plain", -1, -1);
+         fprintf(fout, "ERROR: Invalid lease duration");
+      }
+      else if (rc == -ENOSPC && lease_ms > 0 && strstr(url, API_URL))
+      {
+         /* HTTP API request, all leases in use */
+         send_headers(fout, 503, "Too many leases", server_timing(timing, sizeof(timing), phase_ms), "text/plain", -1, -1);
+         fprintf(fout, "ERROR: Too many leased relays");
+      }
+      else if (strstr(url, API_URL))
       {
          /* HTTP API request, send response */
-         send_headers(fout, 200, "OK", NULL, "text/plain", -1, -1);
+         send_headers(fout, 200, "OK", server_timing(timing, sizeof(timing), phase_ms), "text/plain", -1, -1);
          for (i=FIRST_RELAY; i<=last_relay; i++)
          {
             fprintf(fout, "Relay %d:%d<br>", i, rstate[i-1]);
@@ -670,7 +1095,7 @@ int process_http_request(int sock)
          char cname[MAX_RELAY_CARD_NAME_LEN];
          crelay_get_relay_card_name(crelay_get_relay_card_type(), cname);
          
-         web_page_header(fout);
+         web_page_header(fout, server_timing(timing, sizeof(timing), phase_ms));
          
          /* Display relay status and controls on web page */
          fprintf(fout, "<table style=\"text-align: left; width: 460px; background-color: white; font-family: Helvetica,Arial,sans-serif; font-weight: bold; font-size: 20px;\" border=\"0\" cellpadding=\"2\" cellspacing=\"3\"><tbody>\r\n");
@@ -696,7 +1121,236 @@ int process_http_request(int sock)
  done:
    fclose(fout);
    fclose(fin);
+   CRELAY_TRACE(http__request__done);
+
+   return 0;
+}
+
+
+/**********************************************************
+ * Function publish_states()
+ * 
+ * Description: Publish the relay states of a card after a
+ *              write or a read (see crelay.h)
+ * 
+ * Parameters: serial (in)     - card serial number, NULL or
+ *                               empty for the default card
+ *             num_relays (in) - number of relays on the card
+ *             mask (in)       - relays to record in the state
+ *                               journal, 0 for none
+ *             states (in)     - relay states of the card
+ *             source (in)     - origin of the change
+ *             id (in)         - source specific id
+ * 
+ * Returns: none
+ *********************************************************/
+void publish_states(const char *serial, uint8_t num_relays, uint16_t mask, uint16_t states,
+                    history_source_t source, uint32_t id)
+{
+   state_journal_record(serial, mask, states);
+   history_record(serial, num_relays, states, source, id);
+   relay_stats_update(serial, num_relays, states);
+   state_shm_update(serial, num_relays, states);
+   if (source != HISTORY_SRC_EXTERNAL)
+      unix_api_notify(serial, num_relays, states);
+}
+
+
+/**********************************************************
+ * Function set_default_card()
+ * 
+ * Description: Tell the modules which key their data by
+ *              serial number which card is used by requests
+ *              without serial number: the first detected
+ *              card. Must be done before the state journal
+ *              is opened, so its records for the default
+ *              card are merged with the ones carrying its
+ *              serial number.
+ * 
+ * Parameters: none
+ * 
+ * Returns: none
+ *********************************************************/
+static void set_default_card(void)
+{
+   relay_info_t *relay_info, *next;
+   char com_port[MAX_COM_PORT_NAME_LEN];
+   uint8_t num_relays;
+   int first = 1;
+   
+   if (crelay_detect_all_relay_cards(&relay_info) == 0)
+   {
+      while (relay_info->next != NULL)
+      {
+         num_relays = FIRST_RELAY;
+         if (first && crelay_detect_relay_card(com_port, &num_relays, relay_info->serial, NULL) == 0)
+         {
+            history_set_default(relay_info->serial);
+            relay_stats_set_default(relay_info->serial);
+            interlock_set_default(relay_info->serial);
+            power_seq_set_default(relay_info->serial);
+            lease_set_default(relay_info->serial);
+            state_journal_set_default(relay_info->serial);
+            first = 0;
+         }
+         next = relay_info->next;
+         free(relay_info);
+         relay_info = next;
+      }
+   }
+   free(relay_info);
+}
+
+
+/**********************************************************
+ * Function publish_all_cards()
+ * 
+ * Description: Publish the current relay states of all
+ *              detected cards in the shared memory segment
+ *              and pass them to the history and statistics.
+ *              The first card is the one used by requests
+ *              without serial number, see set_default_card().
+ * 
+ * Parameters: none
+ * 
+ * Returns: none
+ *********************************************************/
+static void publish_all_cards(void)
+{
+   relay_info_t *relay_info, *next;
+   char com_port[MAX_COM_PORT_NAME_LEN];
+   uint8_t num_relays;
+   uint16_t states;
+   int first = 1;
+   
+   if (crelay_detect_all_relay_cards(&relay_info) == 0)
+   {
+      while (relay_info->next != NULL)
+      {
+         num_relays = FIRST_RELAY;
+         if (crelay_detect_relay_card(com_port, &num_relays, relay_info->serial, NULL) == 0 &&
+             crelay_get_relay_mask(com_port, &states, relay_info->serial) == 0)
+         {
+            publish_states(relay_info->serial, num_relays, 0, states, HISTORY_SRC_EXTERNAL, 0);
+            if (first)
+               state_shm_set_default(relay_info->serial);
+            first = 0;
+         }
+         next = relay_info->next;
+         free(relay_info);
+         relay_info = next;
+      }
+   }
+   free(relay_info);
+   
+   /* Cards without serial number (GPIO) */
+   if (first)
+   {
+      num_relays = FIRST_RELAY;
+      if (crelay_detect_relay_card(com_port, &num_relays, NULL, NULL) == 0 &&
+          crelay_get_relay_mask(com_port, &states, NULL) == 0)
+      {
+         publish_states(NULL, num_relays, 0, states, HISTORY_SRC_EXTERNAL, 0);
+      }
+   }
+}
+
+
+/**********************************************************
+ * Function cli_socket_path()
+ * 
+ * Description: Get the unix socket path of the daemon from
+ *              its config file
+ * 
+ * Parameters: none
+ * 
+ * Returns: socket path, NULL if the socket is disabled
+ *********************************************************/
+static const char* cli_socket_path(void)
+{
+   memset((void*)&config, 0, sizeof(config_t));
+   if (conf_parse(config_file, config_cb, &config) >= 0)
+   {
+      if (config.unix_disabled) return NULL;
+      if (config.unix_socket_path != NULL) return config.unix_socket_path;
+   }
+   return UNIX_API_SOCKET_PATH;
+}
 
+
+/**********************************************************
+ * Function cli_daemon_command()
+ * 
+ * Description: Execute a command line request through the
+ *              unix socket of a running daemon. The daemon
+ *              already owns the relay card, so it does not
+ *              need to be detected and opened again.
+ * 
+ * Parameters: relay (in)   - relay number
+ *             nstate (in)  - new relay state, INVALID to
+ *                            read the current state
+ *             serial (in)  - serial number [optional]
+ * 
+ * Returns:  0 - success
+ *           1 - no daemon running, use direct access
+ *          -1 - fail
+ *********************************************************/
+static int cli_daemon_command(uint8_t relay, relay_state_t nstate, char* serial)
+{
+   unix_api_request_t req;
+   unix_api_response_t resp;
+   const char *path;
+   int fd, rc;
+   
+   if ((path = cli_socket_path()) == NULL)
+   {
+      return 1;
+   }
+   if ((fd = unix_api_connect(path)) < 0)
+   {
+      /* Only access the card directly if no daemon owns it */
+      if (fd == -ENOENT || fd == -ECONNREFUSED)
+         return 1;
+      fprintf(stderr, "ERROR: Cannot connect to daemon at %s: %s\n", path, strerror(-fd));
+      return -1;
+   }
+   
+   memset(&req, 0, sizeof(req));
+   req.cmd = (nstate == INVALID) ? UNIX_API_GET_MASK : UNIX_API_SET_MASK;
+   req.seq = 1;
+   if (relay >= FIRST_RELAY && relay < FIRST_RELAY+MAX_NUM_RELAYS)
+      req.mask = 1<<(relay-FIRST_RELAY);
+   req.states = (nstate == ON) ? req.mask : 0;
+   if (serial != NULL) snprintf(req.serial, sizeof(req.serial), "%s", serial);
+   
+   /* A daemon refusing our credentials closes the connection */
+   rc = unix_api_request(fd, &req, &resp);
+   close(fd);
+   if (rc < 0)
+   {
+      fprintf(stderr, "ERROR: No response from daemon at %s\n", path);
+      return -1;
+   }
+   
+   if (resp.status == -ENODEV)
+   {
+      printf("No compatible device detected.\n");
+      return -1;
+   }
+   if (resp.status == -EINVAL || req.mask == 0 || relay > resp.num_relays)
+   {
+      fprintf(stderr, "ERROR: Relay number out of range\n");
+      return -1;
+   }
+   if (resp.status != 0)
+   {
+      fprintf(stderr, "ERROR: %s\n", strerror(-resp.status));
+      return -1;
+   }
+   
+   if (nstate == INVALID)
+      printf("Relay %d is %s\n", relay, (resp.states & req.mask) ? "on" : "off");
+   
    return 0;
 }
 
@@ -732,11 +1386,25 @@ void print_usage()
    printf("       If only the relay number is provided then the current state is returned,\n");
    printf("       otherwise the relays state is set to the new value provided as second parameter.\n");
    printf("       The USB communication port is auto detected. The first compatible device\n");
-   printf("       found will be used, unless -s switch and a serial number is passed.\n\n");
+   printf("       found will be used, unless -s switch and a serial number is passed.\n");
+   printf("       If the crelay daemon is running, the command is passed to the daemon via\n");
+   printf("       its unix socket instead of accessing the relay card directly.\n\n");
+   printf("    crelay [-s <serial number>] -b <file>|-\n\n");
+   printf("       -b execute the commands in file (or stdin), one per line:\n");
+   printf("            card [<serial number>]\n");
+   printf("            set <relay number>|all on|off\n");
+   printf("            get <relay number>|all\n");
+   printf("            pulse <relay number> <duration>\n");
+   printf("            wait <duration>\n");
+   printf("          Durations are given in us, ms (default) or s, e.g. 250ms.\n");
+   printf("          Consecutive set commands are written to the card at once.\n");
+   printf("          One result line \"ok <line> ...\" or \"error <line> ...\" is\n");
+   printf("          printed per command.\n\n");
    printf("Daemon mode:\n");
-   printf("    crelay -d|-D [<relay1_label> [<relay2_label> [<relay3_label> [<relay4_label>]]]] \n\n");
+   printf("    crelay -d|-D [-c <config file>] [<relay1_label> [<relay2_label> [<relay3_label> [<relay4_label>]]]] \n\n");
    printf("       -d use daemon mode, run in foreground\n");
-   printf("       -D use daemon mode, run in background\n\n");
+   printf("       -D use daemon mode, run in background\n");
+   printf("       -c use the given config file instead of %s\n\n", CONFIG_FILE);
    printf("       In daemon mode the built-in web server will be started and the relays\n");
    printf("       can be completely controlled via a Web browser GUI or HTTP API.\n");
    printf("       The config file %s will be used, if present.\n", CONFIG_FILE);
@@ -784,6 +1452,7 @@ int main(int argc, char *argv[])
       struct in_addr iface;
       int port=DEFAULT_SERVER_PORT;
       int sock;
+      int optval=1;
       int i;
       
       iface.s_addr = INADDR_ANY;
@@ -796,11 +1465,18 @@ int main(int argc, char *argv[])
       signal(SIGINT, exit_handler);   /* Ctrl-C */
       signal(SIGTERM, exit_handler);  /* "regular" kill */
    
+      /* Get alternative config file from command line */
+      if (argc > 3 && !strcmp(argv[argn+1], "-c"))
+      {
+         config_file = argv[argn+2];
+         argn += 2;
+      }
+      
       /* Load configuration from .conf file */
       memset((void*)&config, 0, sizeof(config_t));
-      if (conf_parse(CONFIG_FILE, config_cb, &config) >= 0) 
+      if (conf_parse(config_file, config_cb, &config) >= 0) 
       {
-         syslog(LOG_DAEMON | LOG_NOTICE, "Config parameters read from %s:\n", CONFIG_FILE);
+         syslog(LOG_DAEMON | LOG_NOTICE, "Config parameters read from %s:\n", config_file);
          syslog(LOG_DAEMON | LOG_NOTICE, "***************************\n");
          if (config.server_iface != NULL) syslog(LOG_DAEMON | LOG_NOTICE, "server_iface: %s\n", config.server_iface);
          if (config.server_port != 0)     syslog(LOG_DAEMON | LOG_NOTICE, "server_port: %u\n", config.server_port);
@@ -813,6 +1489,36 @@ int main(int argc, char *argv[])
          if (config.relay7_label != NULL) syslog(LOG_DAEMON | LOG_NOTICE, "relay7_label: %s\n", config.relay7_label);
          if (config.relay8_label != NULL) syslog(LOG_DAEMON | LOG_NOTICE, "relay8_label: %s\n", config.relay8_label);
          if (config.pulse_duration != 0)  syslog(LOG_DAEMON | LOG_NOTICE, "pulse_duration: %u\n", config.pulse_duration);
+         if (config.server_timing != 0)   syslog(LOG_DAEMON | LOG_NOTICE, "server_timing: %u\n", config.server_timing);
+         if (config.unix_disabled != 0)   syslog(LOG_DAEMON | LOG_NOTICE, "unix socket: disabled\n");
+         if (config.unix_socket_path != NULL) syslog(LOG_DAEMON | LOG_NOTICE, "unix_socket_path: %s\n", config.unix_socket_path);
+         if (config.unix_allow_users != NULL) syslog(LOG_DAEMON | LOG_NOTICE, "unix_allow_users: %s\n", config.unix_allow_users);
+         if (config.unix_allow_groups != NULL) syslog(LOG_DAEMON | LOG_NOTICE, "unix_allow_groups: %s\n", config.unix_allow_groups);
+         if (config.shm_disabled != 0)    syslog(LOG_DAEMON | LOG_NOTICE, "shared memory: disabled\n");
+         if (config.shm_name != NULL)     syslog(LOG_DAEMON | LOG_NOTICE, "shm_name: %s\n", config.shm_name);
+         if (config.journal_disabled != 0) syslog(LOG_DAEMON | LOG_NOTICE, "state journal: disabled\n");
+         if (config.journal_path != NULL) syslog(LOG_DAEMON | LOG_NOTICE, "journal_path: %s\n", config.journal_path);
+         if (config.history_disabled != 0) syslog(LOG_DAEMON | LOG_NOTICE, "history: disabled\n");
+         if (config.history_dir != NULL)  syslog(LOG_DAEMON | LOG_NOTICE, "history_dir: %s\n", config.history_dir);
+         if (config.history_max_segments != 0) syslog(LOG_DAEMON | LOG_NOTICE, "history_max_segments: %u\n", config.history_max_segments);
+         if (config.stats_disabled != 0)  syslog(LOG_DAEMON | LOG_NOTICE, "statistics: disabled\n");
+         if (config.stats_path != NULL)   syslog(LOG_DAEMON | LOG_NOTICE, "stats_path: %s\n", config.stats_path);
+         if (config.sched_latitude != NULL) syslog(LOG_DAEMON | LOG_NOTICE, "latitude: %s\n", config.sched_latitude);
+         if (config.sched_longitude != NULL) syslog(LOG_DAEMON | LOG_NOTICE, "longitude: %s\n", config.sched_longitude);
+         for (i=0; i<config.sched_num_entries; i++) syslog(LOG_DAEMON | LOG_NOTICE, "schedule: %s\n", config.sched_entries[i]);
+         if (config.io_timeout_ms != 0) syslog(LOG_DAEMON | LOG_NOTICE, "io_timeout_ms: %u\n", config.io_timeout_ms);
+         if (config.io_failure_threshold != 0) syslog(LOG_DAEMON | LOG_NOTICE, "failure_threshold: %u\n", config.io_failure_threshold);
+         if (config.io_backoff_min_ms != 0) syslog(LOG_DAEMON | LOG_NOTICE, "backoff_min_ms: %u\n", config.io_backoff_min_ms);
+         if (config.io_backoff_max_ms != 0) syslog(LOG_DAEMON | LOG_NOTICE, "backoff_max_ms: %u\n", config.io_backoff_max_ms);
+         if (config.rt_enabled != 0) syslog(LOG_DAEMON | LOG_NOTICE, "realtime: enabled\n");
+         if (config.rt_priority != 0) syslog(LOG_DAEMON | LOG_NOTICE, "rt_priority: %u\n", config.rt_priority);
+         if (config.rt_cpus != NULL) syslog(LOG_DAEMON | LOG_NOTICE, "rt_cpus: %s\n", config.rt_cpus);
+         if (config.rt_unlocked != 0) syslog(LOG_DAEMON | LOG_NOTICE, "rt_lock_memory: disabled\n");
+         if (config.rt_prealloc_kb != 0) syslog(LOG_DAEMON | LOG_NOTICE, "rt_prealloc_kb: %u\n", config.rt_prealloc_kb);
+         if (config.poweron_max_on != 0) syslog(LOG_DAEMON | LOG_NOTICE, "poweron_max_on: %u\n", config.poweron_max_on);
+         if (config.poweron_gap_ms != 0) syslog(LOG_DAEMON | LOG_NOTICE, "poweron_gap_ms: %u\n", config.poweron_gap_ms);
+         for (i=0; i<config.poweron_num_groups; i++) syslog(LOG_DAEMON | LOG_NOTICE, "poweron_group: %s\n", config.poweron_groups[i]);
+         for (i=0; i<config.num_scenes; i++) syslog(LOG_DAEMON | LOG_NOTICE, "scene %s: %s\n", config.scene_names[i], config.scene_defs[i]);
          if (config.gpio_num_relays != 0) syslog(LOG_DAEMON | LOG_NOTICE, "gpio_num_relays: %u\n", config.gpio_num_relays);
          if (config.gpio_active_value >= 0) syslog(LOG_DAEMON | LOG_NOTICE, "gpio_active_value: %u\n", config.gpio_active_value);
          if (config.relay1_gpio_pin != 0) syslog(LOG_DAEMON | LOG_NOTICE, "relay1_gpio_pin: %u\n", config.relay1_gpio_pin);
@@ -823,7 +1529,24 @@ int main(int argc, char *argv[])
          if (config.relay6_gpio_pin != 0) syslog(LOG_DAEMON | LOG_NOTICE, "relay6_gpio_pin: %u\n", config.relay6_gpio_pin);
          if (config.relay7_gpio_pin != 0) syslog(LOG_DAEMON | LOG_NOTICE, "relay7_gpio_pin: %u\n", config.relay7_gpio_pin);
          if (config.relay8_gpio_pin != 0) syslog(LOG_DAEMON | LOG_NOTICE, "relay8_gpio_pin: %u\n", config.relay8_gpio_pin);
+         if (config.gpio_pwm_priority != 0) syslog(LOG_DAEMON | LOG_NOTICE, "gpio_pwm_priority: %u\n", config.gpio_pwm_priority);
+         if (config.input_chip != NULL) syslog(LOG_DAEMON | LOG_NOTICE, "input_chip: %s\n", config.input_chip);
+         if (config.input_debounce_ms != 0) syslog(LOG_DAEMON | LOG_NOTICE, "input_debounce_ms: %u\n", config.input_debounce_ms);
+         for (i=0; i<config.num_inputs; i++) syslog(LOG_DAEMON | LOG_NOTICE, "input: %s\n", config.inputs[i]);
+         if (config.max_leases != 0) syslog(LOG_DAEMON | LOG_NOTICE, "max_leases: %u\n", config.max_leases);
+         for (i=0; i<config.num_interlocks; i++) syslog(LOG_DAEMON | LOG_NOTICE, "interlock: %s\n", config.interlocks[i]);
          if (config.sainsmart_num_relays != 0) syslog(LOG_DAEMON | LOG_NOTICE, "sainsmart_num_relays: %u\n", config.sainsmart_num_relays);
+         if (config.sainsmart_wave_clock_div != 0) syslog(LOG_DAEMON | LOG_NOTICE, "sainsmart_wave_clock_div: %u\n", config.sainsmart_wave_clock_div);
+         if (config.sim_num_relays != 0) syslog(LOG_DAEMON | LOG_NOTICE, "sim_num_relays: %u\n", config.sim_num_relays);
+         if (config.sim_num_cards != 0)  syslog(LOG_DAEMON | LOG_NOTICE, "sim_num_cards: %u\n", config.sim_num_cards);
+         if (config.sim_num_buses != 0)  syslog(LOG_DAEMON | LOG_NOTICE, "sim_num_buses: %u\n", config.sim_num_buses);
+         if (config.sim_profile != NULL) syslog(LOG_DAEMON | LOG_NOTICE, "sim_profile: %s\n", config.sim_profile);
+         if (config.sim_latency_us != 0) syslog(LOG_DAEMON | LOG_NOTICE, "sim_latency_us: %u\n", config.sim_latency_us);
+         if (config.sim_jitter_us != 0)  syslog(LOG_DAEMON | LOG_NOTICE, "sim_jitter_us: %u\n", config.sim_jitter_us);
+         if (config.sim_fault_card != NULL) syslog(LOG_DAEMON | LOG_NOTICE, "sim_fault_card: %s\n", config.sim_fault_card);
+         if (config.sim_timeout_rate > 0) syslog(LOG_DAEMON | LOG_NOTICE, "sim_timeout_rate: %.3f%% (%u ms)\n", config.sim_timeout_rate, config.sim_timeout_ms);
+         if (config.sim_disconnect_rate > 0) syslog(LOG_DAEMON | LOG_NOTICE, "sim_disconnect_rate: %.3f%% (%u ms)\n", config.sim_disconnect_rate, config.sim_disconnect_ms);
+         if (config.sim_stuck_bits != 0) syslog(LOG_DAEMON | LOG_NOTICE, "sim_stuck_bits: 0x%04X\n", config.sim_stuck_bits);
          syslog(LOG_DAEMON | LOG_NOTICE, "***************************\n");
          
          /* Get relay labels from config file */
@@ -850,11 +1573,17 @@ int main(int argc, char *argv[])
          {
             port = config.server_port;
          }
+         
+         /* Get deadline of the card operations from config file */
+         if (config.io_timeout_ms > 0)
+         {
+            crelay_set_io_timeout(config.io_timeout_ms);
+         }
 
       }
       else
       {
-         syslog(LOG_DAEMON | LOG_NOTICE, "Can't load %s, using default parameters\n", CONFIG_FILE);
+         syslog(LOG_DAEMON | LOG_NOTICE, "Can't load %s, using default parameters\n", config_file);
       }
 
       /* Ensure pulse duration is valid **/
@@ -864,13 +1593,14 @@ int main(int argc, char *argv[])
       }
       
       /* Parse command line for relay labels (overrides config file)*/
-      for (i=0; i<argc-2 && i<MAX_NUM_RELAYS; i++)
+      for (i=0; i<argc-argn-1 && i<MAX_NUM_RELAYS; i++)
       {
-         strcpy(rlabels[i], argv[i+2]);
+         strcpy(rlabels[i], argv[i+argn+1]);
       }         
       
       /* Start build-in web server */
       sock = socket(AF_INET, SOCK_STREAM, 0);
+      setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
       sin.sin_family = AF_INET;
       sin.sin_addr.s_addr = iface.s_addr;
       sin.sin_port = htons(port);
@@ -897,23 +1627,213 @@ int main(int argc, char *argv[])
          }
          syslog(LOG_DAEMON | LOG_NOTICE, "Program is now running as system daemon");
       }
+      
+      /* Lock the memory before any thread is started, the timing threads
+       * switch to SCHED_FIFO themselves */
+      if (config.rt_enabled)
+         realtime_init(config.rt_priority, config.rt_cpus, !config.rt_unlocked, config.rt_prealloc_kb);
 
       /* Init GPIO pins in case they have been configured */
       crelay_detect_relay_card(com_port, &num_relays, NULL, NULL);
       
+      /* Before anything keyed by serial number is opened or
+       * written, in particular before the journal restore */
+      set_default_card();
+      
+      /* Open the relay state change history */
+      if (!config.history_disabled)
+      {
+         history_open(config.history_dir ? config.history_dir : HISTORY_DIR, config.history_max_segments);
+      }
+      
+      /* Open the relay usage statistics */
+      if (!config.stats_disabled)
+      {
+         relay_stats_open(config.stats_path ? config.stats_path : RELAY_STATS_PATH);
+      }
+      
+      /* Switch on the relays held back by the power-on limits from the
+       * main loop, without blocking the requests */
+      power_seq_init();
+      
+      /* Restore the last commanded relay states */
+      if (!config.journal_disabled &&
+          state_journal_open(config.journal_path ? config.journal_path : STATE_JOURNAL_PATH) == 0)
+      {
+         state_journal_restore();
+      }
+      
+      /* Start unix domain socket API for local clients */
+      if (!config.unix_disabled)
+      {
+         unix_api_init(config.unix_socket_path ? config.unix_socket_path : UNIX_API_SOCKET_PATH,
+                       config.unix_allow_users, config.unix_allow_groups);
+      }
+      
+      /* Publish relay states in shared memory for local readers */
+      if (!config.shm_disabled)
+      {
+         state_shm_init(config.shm_name ? config.shm_name : STATE_SHM_NAME);
+      }
+      publish_all_cards();
+      
+      /* Start the scheduler with the schedules from the config file */
+      if (scheduler_init(config.sched_latitude, config.sched_longitude) == 0)
+      {
+         char err[64];
+         
+         for (i=0; i<config.sched_num_entries; i++)
+         {
+            if (scheduler_add(config.sched_entries[i], 1, err, sizeof(err)) < 0)
+               syslog(LOG_DAEMON | LOG_ERR, "Invalid schedule \"%s\": %s\n", config.sched_entries[i], err);
+         }
+      }
+      
+      /* Prepare the engine for relay sequences */
+      sequence_init();
+      
+      /* Prepare the player for relay waveforms */
+      waveform_init();
+      
+      /* Listen for hotplug events to reconnect failed cards */
+      card_health_init();
+      
+      /* Start the scene workers and define the scenes from the config file */
+      if (scene_init() == 0)
+      {
+         char err[64];
+         
+         for (i=0; i<config.num_scenes; i++)
+         {
+            if (scene_define(config.scene_names[i], config.scene_defs[i], 1, err, sizeof(err)) < 0)
+               syslog(LOG_DAEMON | LOG_ERR, "Invalid scene \"%s\": %s\n", config.scene_names[i], err);
+         }
+      }
+      
+      /* Leased relay sets, switched back unless renewed */
+      lease_init(config.max_leases);
+      
+      /* Switch all relays off on SIGUSR1 */
+      emergency_init();
+      
+      /* Request the GPIO input lines of the input rules */
+      if (config.num_inputs > 0)
+      {
+         char err[64];
+         int valid = 0;
+         
+         for (i=0; i<config.num_inputs; i++)
+         {
+            if (gpio_input_add(config.inputs[i], err, sizeof(err)) < 0)
+               syslog(LOG_DAEMON | LOG_ERR, "Invalid input \"%s\": %s\n", config.inputs[i], err);
+            else
+               valid++;
+         }
+         if (valid > 0)
+            gpio_input_init(config.input_chip, config.input_debounce_ms);
+      }
+      
       while (1)
       {
-         int s;
+         struct pollfd fds[7+GPIO_INPUT_MAX_LINES+UNIX_API_MAX_FDS];
+         int nfds, nin, s, timeout, probe;
          
-         /* Wait for request from web client */
-         s = accept(sock, NULL, NULL);
-         if (s < 0) break;
+         /* Wait for request from web client or local clients, for the next
+          * schedule, for steps executed by the sequence thread, for hotplug
+          * events, for the next probe of a failed card, for the end of
+          * a waveform, for an emergency off signal, for deferred turn-ons,
+          * for edges on the GPIO inputs or for the expiry of leases */
+         fds[0].fd = sock;
+         fds[0].events = POLLIN;
+         fds[1].fd = scheduler_pollfd();
+         fds[1].events = POLLIN;
+         fds[2].fd = sequence_pollfd();
+         fds[2].events = POLLIN;
+         fds[3].fd = card_health_pollfd();
+         fds[3].events = POLLIN;
+         fds[4].fd = waveform_pollfd();
+         fds[4].events = POLLIN;
+         fds[5].fd = emergency_pollfd();
+         fds[5].events = POLLIN;
+         fds[6].fd = power_seq_pollfd();
+         fds[6].events = POLLIN;
+         nin = gpio_input_pollfds(&fds[7], GPIO_INPUT_MAX_LINES);
+         nfds = 7 + nin + unix_api_pollfds(&fds[7+nin], UNIX_API_MAX_FDS);
+         timeout = unix_api_timeout();
+         probe = card_health_timeout();
+         if (probe >= 0 && (timeout < 0 || probe < timeout)) timeout = probe;
+         probe = gpio_input_timeout();
+         if (probe >= 0 && (timeout < 0 || probe < timeout)) timeout = probe;
+         probe = lease_timeout();
+         if (probe >= 0 && (timeout < 0 || probe < timeout)) timeout = probe;
+         if (poll(fds, nfds, timeout) < 0)
+         {
+            if (errno == EINTR) continue;
+            break;
+         }
          
-         /* Process request */
-         process_http_request(s);
-         close(s);
+         /* Emergency off before anything else */
+         if (fds[5].revents & POLLIN)
+            emergency_process();
+         
+         /* React to the GPIO inputs first, their latency is measured
+          * from the edge */
+         gpio_input_process(&fds[7], nin);
+         
+         /* End pulses started via the unix socket or by the inputs,
+          * switch back the relays of expired leases */
+         unix_api_timers();
+         gpio_input_timers();
+         lease_timers();
+         
+         /* Switch on the relays held back by the power-on limits */
+         if (fds[6].revents & POLLIN)
+            power_seq_process();
+         
+         /* Execute the schedules which are due */
+         if (fds[1].revents & POLLIN)
+            scheduler_process();
+         
+         /* Record the steps of a running sequence */
+         if (fds[2].revents & POLLIN)
+            sequence_process();
+         
+         /* Try to reconnect the failed cards */
+         if (fds[3].revents & POLLIN)
+            card_health_process();
+         card_health_probe();
+         
+         /* Record the end of a waveform */
+         if (fds[4].revents & POLLIN)
+            waveform_process();
+         
+         /* Process requests */
+         unix_api_process(&fds[7+nin], nfds-7-nin);
+         if (fds[0].revents & POLLIN)
+         {
+            s = accept(sock, NULL, NULL);
+            if (s < 0) continue;
+            
+            process_http_request(s);
+            close(s);
+         }
       }
       
+      unix_api_close();
+      state_shm_close();
+      state_journal_close();
+      history_close();
+      relay_stats_close();
+      scheduler_close();
+      sequence_close();
+      waveform_close();
+      gpio_pwm_close();
+      gpio_input_close();
+      emergency_close();
+      lease_close();
+      scene_close();
+      card_health_close();
+      power_seq_close();
       close(sock);
    }
    else
@@ -923,7 +1843,7 @@ int main(int argc, char *argv[])
       if (!strcmp(argv[argn],"-i"))
       {
          /* Detect all cards connected to the system */
-         if (crelay_detect_all_relay_cards(&relay_info) == -1)
+         if (crelay_detect_all_relay_cards(&relay_info) < 0)
          {
             printf("No compatible device detected.\n");
             return -1;
@@ -954,10 +1874,64 @@ int main(int argc, char *argv[])
             exit(EXIT_FAILURE);            
          }
       }
+      
+      if (argn >= argc)
+      {
+         print_usage();
+         exit(EXIT_FAILURE);
+      }
+      
+      if (!strcmp(argv[argn], "-b"))
+      {
+         FILE *fin = stdin;
+         
+         if (argc != argn+2)
+         {
+            print_usage();
+            exit(EXIT_FAILURE);
+         }
+         if (strcmp(argv[argn+1], "-") && (fin = fopen(argv[argn+1], "r")) == NULL)
+         {
+            fprintf(stderr, "ERROR: cannot open %s: %s\n", argv[argn+1], strerror(errno));
+            exit(EXIT_FAILURE);
+         }
+         
+         err = cli_batch(fin, stdout, serial, cli_socket_path());
+         if (fin != stdin) fclose(fin);
+         exit(err ? EXIT_FAILURE : EXIT_SUCCESS);
+      }
+      
+      /* Send the command to the daemon if it is running */
+      if (argc >= 2 && argc <= 5)
+      {
+         relay_state_t nstate = INVALID;
+         
+         if (argc == 3 || argc == 5)
+         {
+            if (!strcmp(argv[argn+1],"on") || !strcmp(argv[argn+1],"ON"))
+               nstate = ON;
+            else if (!strcmp(argv[argn+1],"off") || !strcmp(argv[argn+1],"OFF"))
+               nstate = OFF;
+            else 
+            {
+               print_usage();
+               exit(EXIT_FAILURE);
+            }
+         }
+         
+         err = cli_daemon_command(atoi(argv[argn]), nstate, serial);
+         if (err == 0)
+            exit(EXIT_SUCCESS);
+         else if (err < 0)
+            exit(EXIT_FAILURE);
+      }
 
-      if (crelay_detect_relay_card(com_port, &num_relays, serial, NULL) == -1)
+      if ((err = crelay_detect_relay_card(com_port, &num_relays, serial, NULL)) < 0)
       {
-         printf("No compatible device detected.\n");
+         if (err == -ETIMEDOUT)
+            printf("Relay card did not answer in time.\n");
+         else
+            printf("No compatible device detected.\n");
          
          if(geteuid() != 0)
          {
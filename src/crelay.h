@@ -0,0 +1,68 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Main module
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the main module functions
+ *   which are used by the other modules of the daemon.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef crelay_h
+#define crelay_h
+
+#include <stdint.h>
+
+#include "history.h"
+
+
+/**********************************************************
+ * Function publish_states()
+ *
+ * Description: Publish the relay states of a card after a
+ *              write or a read: record the written relays
+ *              in the state journal, the changes in the
+ *              history and statistics, update the shared
+ *              memory segment and notify the subscribed
+ *              unix socket clients. Reads (source
+ *              HISTORY_SRC_EXTERNAL) are not notified.
+ *
+ * Parameters: serial (in)     - card serial number, NULL or
+ *                               empty for the default card
+ *             num_relays (in) - number of relays on the card
+ *             mask (in)       - relays to record in the state
+ *                               journal, 0 for none
+ *             states (in)     - relay states of the card
+ *             source (in)     - origin of the change
+ *             id (in)         - source specific id
+ *
+ * Return: none
+ *********************************************************/
+void publish_states(const char *serial, uint8_t num_relays, uint16_t mask, uint16_t states,
+                    history_source_t source, uint32_t id);
+
+#endif
@@ -37,6 +37,12 @@
 #ifndef data_types_h
 #define data_types_h
 
+#define MAX_CONFIG_SCHEDULES 32
+#define MAX_CONFIG_SCENES    32
+#define MAX_CONFIG_POWERON_GROUPS 16
+#define MAX_CONFIG_INPUTS    16
+#define MAX_CONFIG_INTERLOCKS 32
+
 /* Config data struct */
 typedef struct
 {
@@ -52,6 +58,53 @@ typedef struct
     const char* relay7_label;
     const char* relay8_label;
     uint8_t pulse_duration;
+    uint8_t server_timing;
+    
+    /* [Unix socket] */
+    uint8_t unix_disabled;
+    const char* unix_socket_path;
+    const char* unix_allow_users;
+    const char* unix_allow_groups;
+    
+    /* [Shared memory] */
+    uint8_t shm_disabled;
+    const char* shm_name;
+    
+    /* [State journal] */
+    uint8_t journal_disabled;
+    const char* journal_path;
+    
+    /* [History] */
+    uint8_t history_disabled;
+    const char* history_dir;
+    uint16_t history_max_segments;
+    
+    /* [Statistics] */
+    uint8_t stats_disabled;
+    const char* stats_path;
+    
+    /* [Scheduler] */
+    const char* sched_latitude;
+    const char* sched_longitude;
+    const char* sched_entries[MAX_CONFIG_SCHEDULES];
+    uint8_t sched_num_entries;
+    
+    /* [Scenes] */
+    const char* scene_names[MAX_CONFIG_SCENES];
+    const char* scene_defs[MAX_CONFIG_SCENES];
+    uint8_t num_scenes;
+    
+    /* [Card I/O] */
+    uint32_t io_timeout_ms;
+    uint32_t io_failure_threshold;
+    uint32_t io_backoff_min_ms;
+    uint32_t io_backoff_max_ms;
+    
+    /* [Power-on] */
+    uint8_t poweron_max_on;
+    uint32_t poweron_gap_ms;
+    const char* poweron_groups[MAX_CONFIG_POWERON_GROUPS];
+    uint8_t poweron_num_groups;
     
     /* [GPIO drv] */
     uint8_t gpio_num_relays;
@@ -64,9 +117,45 @@ typedef struct
     uint16_t relay6_gpio_pin;
     uint16_t relay7_gpio_pin;
     uint16_t relay8_gpio_pin;
+    uint8_t gpio_pwm_priority;
+    
+    /* [Realtime] */
+    uint8_t rt_enabled;
+    uint8_t rt_priority;
+    const char* rt_cpus;
+    uint8_t rt_unlocked;
+    uint32_t rt_prealloc_kb;
+    
+    /* [GPIO inputs] */
+    const char* input_chip;
+    uint32_t input_debounce_ms;
+    const char* inputs[MAX_CONFIG_INPUTS];
+    uint8_t num_inputs;
+    
+    /* [Leases] */
+    uint32_t max_leases;
+    
+    /* [Interlocks] */
+    const char* interlocks[MAX_CONFIG_INTERLOCKS];
+    uint8_t num_interlocks;
     
     /* [Sainsmart drv] */
     uint8_t sainsmart_num_relays;
+    uint8_t sainsmart_wave_clock_div;
+    
+    /* [Simulated drv] */
+    uint8_t sim_num_relays;
+    uint8_t sim_num_cards;
+    uint8_t sim_num_buses;
+    const char* sim_profile;
+    uint32_t sim_latency_us;
+    uint32_t sim_jitter_us;
+    const char* sim_fault_card;
+    float sim_timeout_rate;
+    uint32_t sim_timeout_ms;
+    float sim_disconnect_rate;
+    uint32_t sim_disconnect_ms;
+    uint16_t sim_stuck_bits;
     
 } config_t;
 
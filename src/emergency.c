@@ -0,0 +1,403 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Emergency off
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the emergency off, see emergency.h.
+ *
+ *   The cards are listed with one detection pass over all drivers and
+ *   switched off by the scene workers, up to SCENE_MAX_CARDS cards at
+ *   a time. The states are not read back, each card reports its result
+ *   and the time from the trigger until its write was done.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <syslog.h>
+
+#include "relay_drv.h"
+#include "relay_drv_gpio.h"
+#include "emergency.h"
+#include "scene.h"
+#include "sequence.h"
+#include "waveform.h"
+#include "gpio_pwm.h"
+#include "gpio_input.h"
+#include "scheduler.h"
+#include "unix_api.h"
+#include "lease.h"
+#include "power_seq.h"
+#include "history.h"
+#include "crelay.h"
+
+static int              g_pipe[2] = {-1, -1};
+static emergency_info_t g_info;
+static uint32_t         g_next_id = 1;
+
+
+static uint64_t monotonic_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+static void signal_handler(int signum)
+{
+   int saved = errno;
+
+   if (write(g_pipe[1], "!", 1) < 0) {}
+   errno = saved;
+}
+
+
+/**********************************************************
+ * Internal function record()
+ *
+ * Description: Record the relays of a card as switched off
+ *
+ * Return: none
+ *********************************************************/
+static void record(const char *serial, uint8_t num_relays, uint16_t mask)
+{
+   publish_states(serial, num_relays, mask, 0, HISTORY_SRC_EMERGENCY, g_info.id);
+}
+
+
+/**********************************************************
+ * Internal function stop_all()
+ *
+ * Description: Stop sequences, waveforms, PWM, pulses,
+ *              leases and deferred turn-ons and hold the
+ *              scheduler
+ *
+ * Return: none
+ *********************************************************/
+static void stop_all(void)
+{
+   gpio_pwm_info_t pwm[GENERIC_GPIO_NUM_RELAYS];
+   int i, num;
+
+   scheduler_hold(1);
+   g_info.held = 1;
+   g_info.pulses = unix_api_cancel_pulses() + gpio_input_cancel_pulses();
+   g_info.leases = lease_cancel_all();
+   power_seq_cancel(NULL, NULL, 0xffff);
+   g_info.sequence = (sequence_stop() == 0);
+   g_info.waveform = (waveform_stop() == 0);
+
+   num = gpio_pwm_list(pwm, GENERIC_GPIO_NUM_RELAYS);
+   for (i=0; i<num; i++)
+   {
+      if (gpio_pwm_stop(pwm[i].relay) == 0)
+         g_info.pwm++;
+   }
+}
+
+
+/**********************************************************
+ * Internal function gpio_off()
+ *
+ * Description: Switch the GPIO relays off, if configured
+ *
+ * Return: none
+ *********************************************************/
+static void gpio_off(uint64_t t0, int record_states)
+{
+   char portname[MAX_COM_PORT_NAME_LEN];
+   emergency_card_t *card;
+   uint8_t num_relays = FIRST_RELAY;
+   uint16_t mask;
+   uint64_t start;
+
+   if (g_info.num_cards == EMERGENCY_MAX_CARDS ||
+       detect_relay_card_generic_gpio(portname, &num_relays, NULL, NULL) < 0)
+      return;
+
+   card = &g_info.cards[g_info.num_cards++];
+   mask = (1 << num_relays) - 1;
+   strcpy(card->serial, EMERGENCY_GPIO_NAME);
+   start = monotonic_ns();
+   card->rc = crelay_set_relay_mask_type(GENERIC_GPIO_RELAY_TYPE, num_relays, portname, mask, 0, NULL);
+   card->done_ms = (monotonic_ns() - t0)/1e6;
+   card->write_ms = (monotonic_ns() - start)/1e6;
+
+   /* The GPIO relays are recorded as the default card, which they are
+    * only if no other card is connected */
+   if (card->rc == 0 && record_states)
+      record("", num_relays, mask);
+}
+
+
+/**********************************************************
+ * Function emergency_init()
+ *
+ * Description: Install the SIGUSR1 handler
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int emergency_init(void)
+{
+   struct sigaction sa;
+
+   if (pipe2(g_pipe, O_NONBLOCK|O_CLOEXEC) < 0)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to init emergency off: %s\n", strerror(errno));
+      return -1;
+   }
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = signal_handler;
+   sa.sa_flags = SA_RESTART;
+   sigemptyset(&sa.sa_mask);
+   sigaction(SIGUSR1, &sa, NULL);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function emergency_close()
+ *
+ * Description: Remove the SIGUSR1 handler
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void emergency_close(void)
+{
+   signal(SIGUSR1, SIG_IGN);
+   if (g_pipe[0] >= 0)
+   {
+      close(g_pipe[0]);
+      close(g_pipe[1]);
+   }
+   g_pipe[0] = g_pipe[1] = -1;
+}
+
+
+/**********************************************************
+ * Function emergency_pollfd()
+ *
+ * Description: Get the file descriptor to be polled for
+ *              POLLIN by the main loop, it is readable
+ *              when SIGUSR1 was received
+ *
+ * Parameters: none
+ *
+ * Return: file descriptor, -1 if not initialized
+ *********************************************************/
+int emergency_pollfd(void)
+{
+   return g_pipe[0];
+}
+
+
+/**********************************************************
+ * Function emergency_process()
+ *
+ * Description: Execute the emergency off requested by
+ *              SIGUSR1
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void emergency_process(void)
+{
+   char buf[16];
+   int n = 0;
+
+   /* Several signals in a row trigger one emergency off */
+   while (read(g_pipe[0], buf, sizeof(buf)) > 0)
+      n++;
+   if (n > 0)
+      emergency_off("signal");
+}
+
+
+/**********************************************************
+ * Function emergency_off()
+ *
+ * Description: Stop everything which switches relays and
+ *              switch all relays of all cards off
+ *
+ * Parameters: by (in) - trigger, for the report and log
+ *
+ * Return:  0 - success
+ *         -ENODEV if no card was found,
+ *         -EIO if a card could not be switched off
+ *********************************************************/
+int emergency_off(const char *by)
+{
+   scene_write_t writes[SCENE_MAX_CARDS];
+   relay_info_t *relay_info, *next;
+   emergency_card_t *card;
+   struct timespec ts;
+   uint64_t t0;
+   int i, num, rc = 0;
+
+   t0 = monotonic_ns();
+   clock_gettime(CLOCK_REALTIME, &ts);
+   memset(&g_info, 0, sizeof(g_info));
+   g_info.id = g_next_id++;
+   g_info.time_ns = (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+   snprintf(g_info.by, sizeof(g_info.by), "%s", by);
+
+   stop_all();
+   g_info.stop_ms = (monotonic_ns() - t0)/1e6;
+
+   /* List the cards, the list ends with an empty element. The cards are
+    * written with the port found by this enumeration, without detecting
+    * them again and without the card health check, so a card whose
+    * circuit is open is switched off too. */
+   crelay_detect_all_relay_cards(&relay_info);
+   for (;;)
+   {
+      for (num=0; relay_info->next != NULL && num < SCENE_MAX_CARDS &&
+                  g_info.num_cards+num < EMERGENCY_MAX_CARDS; num++)
+      {
+         memset(&writes[num], 0, sizeof(scene_write_t));
+         snprintf(writes[num].serial, sizeof(writes[num].serial), "%s", relay_info->serial);
+         writes[num].type = relay_info->relay_type;
+         snprintf(writes[num].portname, sizeof(writes[num].portname), "%s", relay_info->portname);
+         writes[num].num_relays = relay_info->num_relays;
+         writes[num].mask = 0xffff;
+         next = relay_info->next;
+         free(relay_info);
+         relay_info = next;
+      }
+      if (num == 0)
+         break;
+
+      /* Masks are limited to the relays of each card */
+      scene_dispatch_urgent(writes, num);
+      for (i=0; i<num; i++)
+      {
+         card = &g_info.cards[g_info.num_cards++];
+         strcpy(card->serial, writes[i].serial);
+         card->rc = writes[i].rc;
+         if (writes[i].start_ns != 0)
+         {
+            card->done_ms = (writes[i].end_ns - t0)/1e6;
+            card->write_ms = (writes[i].end_ns - writes[i].start_ns)/1e6;
+         }
+      }
+      for (i=0; i<num; i++)
+      {
+         if (writes[i].rc == 0)
+            record(writes[i].serial, writes[i].num_relays, writes[i].mask);
+      }
+   }
+   while (relay_info != NULL)
+   {
+      next = relay_info->next;
+      free(relay_info);
+      relay_info = next;
+   }
+
+   gpio_off(t0, g_info.num_cards == 0);
+   g_info.total_ms = (monotonic_ns() - t0)/1e6;
+
+   if (g_info.num_cards == 0)
+      rc = -ENODEV;
+   for (i=0; i<g_info.num_cards; i++)
+   {
+      if (g_info.cards[i].rc < 0)
+      {
+         syslog(LOG_DAEMON | LOG_ERR, "Emergency off: card %s failed (%d)\n", g_info.cards[i].serial, g_info.cards[i].rc);
+         rc = -EIO;
+      }
+   }
+   syslog(LOG_DAEMON | LOG_WARNING, "Emergency off %u by %s: %d cards in %.1f ms (stopping %.1f ms)\n",
+          g_info.id, g_info.by, g_info.num_cards, g_info.total_ms, g_info.stop_ms);
+   return rc;
+}
+
+
+/**********************************************************
+ * Function emergency_release()
+ *
+ * Description: Release the hold of the scheduler and the
+ *              GPIO input rules
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - not held
+ *********************************************************/
+int emergency_release(void)
+{
+   if (!g_info.held)
+      return -1;
+   g_info.held = 0;
+   scheduler_hold(0);
+   syslog(LOG_DAEMON | LOG_NOTICE, "Emergency off %u released\n", g_info.id);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function emergency_held()
+ *
+ * Description: Check if an emergency off is held
+ *
+ * Parameters: none
+ *
+ * Return: 1 if held, 0 otherwise
+ *********************************************************/
+int emergency_held(void)
+{
+   return g_info.held;
+}
+
+
+/**********************************************************
+ * Function emergency_get()
+ *
+ * Description: Get the report of the last emergency off
+ *
+ * Parameters: info (out) - report
+ *
+ * Return: none
+ *********************************************************/
+void emergency_get(emergency_info_t *info)
+{
+   *info = g_info;
+}
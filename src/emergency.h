@@ -0,0 +1,187 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Emergency off
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the emergency off, which
+ *   switches all relays of all cards off as fast as possible.
+ *
+ *   It is triggered by POST /api/v1/emergency-off, by the unix socket
+ *   command UNIX_API_EMERGENCY_OFF or by the signal SIGUSR1, and is
+ *   executed before any other pending request of the main loop. First
+ *   everything which could switch relays on again is stopped: running
+ *   sequences and waveforms are cancelled (waiting for their threads to
+ *   end), the PWM of the GPIO relays is stopped, running pulses and
+ *   leases are dropped without switching the relays back, and the
+ *   scheduler and the GPIO input rules are held. Then all cards are
+ *   switched off with one mask write per card, all cards in parallel
+ *   (the HID API cards use their "all off" command for this). The GPIO
+ *   relays are switched off directly.
+ *
+ *   The hold stays until it is released through the JSON API.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef emergency_h
+#define emergency_h
+
+#include <stdint.h>
+
+#include "relay_drv.h"
+
+#define EMERGENCY_MAX_CARDS  32
+#define EMERGENCY_BY_LEN     32
+#define EMERGENCY_GPIO_NAME  "gpio"   /* card name of the GPIO relays in the report */
+
+/* Result of one card */
+typedef struct
+{
+   char     serial[MAX_SERIAL_LEN];
+   int      rc;              /* result of the write */
+   double   done_ms;         /* from the trigger to the end of the write */
+   double   write_ms;        /* duration of the write */
+}
+emergency_card_t;
+
+/* Report of the last emergency off, as returned by emergency_get() */
+typedef struct
+{
+   uint32_t id;              /* emergency offs since the start, 0 if none */
+   char     by[EMERGENCY_BY_LEN];
+   uint8_t  held;            /* scheduler and inputs are held */
+   uint64_t time_ns;         /* CLOCK_REALTIME of the trigger */
+   double   stop_ms;         /* stopping sequences, waveforms, PWM and pulses */
+   double   total_ms;
+   int      sequence;        /* a sequence was cancelled */
+   int      waveform;        /* a waveform was cancelled */
+   int      pwm;             /* relays taken out of PWM mode */
+   int      pulses;          /* pulses dropped */
+   int      leases;          /* leases dropped */
+   int      num_cards;
+   emergency_card_t cards[EMERGENCY_MAX_CARDS];
+}
+emergency_info_t;
+
+
+/**********************************************************
+ * Function emergency_init()
+ *
+ * Description: Install the SIGUSR1 handler
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int emergency_init(void);
+
+/**********************************************************
+ * Function emergency_close()
+ *
+ * Description: Remove the SIGUSR1 handler
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void emergency_close(void);
+
+/**********************************************************
+ * Function emergency_pollfd()
+ *
+ * Description: Get the file descriptor to be polled for
+ *              POLLIN by the main loop, it is readable
+ *              when SIGUSR1 was received
+ *
+ * Parameters: none
+ *
+ * Return: file descriptor, -1 if not initialized
+ *********************************************************/
+int emergency_pollfd(void);
+
+/**********************************************************
+ * Function emergency_process()
+ *
+ * Description: Execute the emergency off requested by
+ *              SIGUSR1
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void emergency_process(void);
+
+/**********************************************************
+ * Function emergency_off()
+ *
+ * Description: Stop everything which switches relays and
+ *              switch all relays of all cards off
+ *
+ * Parameters: by (in) - trigger, for the report and log
+ *
+ * Return:  0 - success
+ *         -ENODEV if no card was found,
+ *         -EIO if a card could not be switched off
+ *********************************************************/
+int emergency_off(const char *by);
+
+/**********************************************************
+ * Function emergency_release()
+ *
+ * Description: Release the hold of the scheduler and the
+ *              GPIO input rules
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - not held
+ *********************************************************/
+int emergency_release(void);
+
+/**********************************************************
+ * Function emergency_held()
+ *
+ * Description: Check if an emergency off is held
+ *
+ * Parameters: none
+ *
+ * Return: 1 if held, 0 otherwise
+ *********************************************************/
+int emergency_held(void);
+
+/**********************************************************
+ * Function emergency_get()
+ *
+ * Description: Get the report of the last emergency off
+ *
+ * Parameters: info (out) - report
+ *
+ * Return: none
+ *********************************************************/
+void emergency_get(emergency_info_t *info);
+
+#endif
@@ -0,0 +1,670 @@
+/******************************************************************************
+ *
+ * Relay card control utility: GPIO input triggers
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the GPIO inputs, see gpio_input.h.
+ *
+ *   The lines are requested through the GPIO character device (uAPI v2),
+ *   one line request per input line with the edges of all its rules. The
+ *   kernel timestamps every edge in its interrupt handler with
+ *   CLOCK_MONOTONIC, so the reaction latency includes the wakeup of the
+ *   daemon and the time spent waiting in its main loop.
+ *
+ *   A pulse started again while it runs is extended instead of switching
+ *   the relays back, like a staircase timer.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <syslog.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "data_types.h"
+#include "relay_drv.h"
+#include "gpio_input.h"
+#include "scene.h"
+#include "history.h"
+#include "crelay.h"
+#include "emergency.h"
+
+#define MAX_EVENTS  16   /* events read at once */
+
+typedef enum
+{
+   ACTION_TOGGLE=0,
+   ACTION_PULSE,
+   ACTION_SCENE
+} action_t;
+
+typedef struct
+{
+   uint32_t line;
+   uint64_t edges;          /* GPIO_V2_LINE_FLAG_EDGE_* */
+   action_t action;
+   char     serial[MAX_SERIAL_LEN];
+   uint16_t mask;
+   uint32_t duration_ms;
+   char     scene[SCENE_NAME_LEN];
+   char     spec[GPIO_INPUT_SPEC_LEN];
+
+   /* Running pulse */
+   uint8_t  pulse_active;
+   uint16_t restore;
+   uint64_t deadline_ms;    /* CLOCK_MONOTONIC */
+
+   /* Reaction times */
+   uint64_t events;
+   uint64_t failures;
+   uint64_t last_ns;
+   double   latency_last;   /* us */
+   double   latency_sum;
+   double   latency_max;
+   double   dispatch_max;
+}
+input_rule_t;
+
+typedef struct
+{
+   uint32_t line;
+   uint64_t edges;
+   int      fd;
+}
+input_line_t;
+
+static input_rule_t g_rules[GPIO_INPUT_MAX];
+static int          g_num_rules = 0;
+static input_line_t g_lines[GPIO_INPUT_MAX_LINES];
+static int          g_num_lines = 0;
+
+
+static uint64_t monotonic_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+static uint64_t realtime_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+/**********************************************************
+ * Internal function parse_relays()
+ *
+ * Description: Parse a relay list "[serial:]<relay>[,...]"
+ *
+ * Return: 0 on success, -1 if the list is invalid
+ *********************************************************/
+static int parse_relays(char *str, input_rule_t *rule)
+{
+   char *colon, *tok, *save, *end;
+   long relay;
+
+   if ((colon = strrchr(str, ':')) != NULL)
+   {
+      *colon = '\0';
+      if (strlen(str) >= MAX_SERIAL_LEN) return -1;
+      strcpy(rule->serial, str);
+      str = colon+1;
+   }
+
+   for (tok = strtok_r(str, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+   {
+      relay = strtol(tok, &end, 10);
+      if (*end != '\0' || relay < FIRST_RELAY || relay > MAX_NUM_RELAYS) return -1;
+      rule->mask |= 1 << (relay-FIRST_RELAY);
+   }
+   return rule->mask ? 0 : -1;
+}
+
+
+/**********************************************************
+ * Internal function record()
+ *
+ * Description: Record new relay states of a card written
+ *              by a rule
+ *
+ * Return: none
+ *********************************************************/
+static void record(input_rule_t *rule, uint8_t num_relays, uint16_t states)
+{
+   uint32_t id = rule - g_rules + 1;
+
+   publish_states(rule->serial, num_relays, rule->mask, states, HISTORY_SRC_INPUT, id);
+}
+
+
+/**********************************************************
+ * Internal function toggle()
+ *
+ * Description: Toggle the relays of a rule
+ *
+ * Return: 0 on success, negative errno value otherwise
+ *********************************************************/
+static int toggle(input_rule_t *rule, uint16_t *previous)
+{
+   char portname[MAX_COM_PORT_NAME_LEN];
+   char *serial = rule->serial[0] ? rule->serial : NULL;
+   uint8_t num_relays = FIRST_RELAY;
+   uint16_t current, states;
+   int rc;
+
+   if ((rc = crelay_detect_relay_card(portname, &num_relays, serial, NULL)) < 0)
+      return rc;
+   if ((rule->mask >> num_relays) != 0)
+      return -EINVAL;
+   if ((rc = crelay_get_relay_mask(portname, &current, serial)) < 0)
+      return rc;
+   if ((rc = crelay_set_relay_mask(portname, rule->mask, ~current, serial)) < 0)
+      return rc;
+
+   states = (current & ~rule->mask) | (~current & rule->mask);
+   record(rule, num_relays, states);
+   if (previous != NULL)
+      *previous = current;
+   return 0;
+}
+
+
+/**********************************************************
+ * Internal function run_action()
+ *
+ * Description: Execute the action of a rule
+ *
+ * Return: 0 on success, negative errno value otherwise
+ *********************************************************/
+static int run_action(input_rule_t *rule)
+{
+   scene_write_t writes[SCENE_MAX_CARDS];
+   uint16_t current;
+   int num, rc = 0;
+
+   switch (rule->action)
+   {
+      case ACTION_TOGGLE:
+         rc = toggle(rule, NULL);
+         break;
+
+      case ACTION_PULSE:
+         if (!rule->pulse_active)
+         {
+            if ((rc = toggle(rule, &current)) < 0)
+               break;
+            rule->pulse_active = 1;
+            rule->restore = current & rule->mask;
+         }
+         rule->deadline_ms = monotonic_ns()/1000000 + rule->duration_ms;
+         break;
+
+      case ACTION_SCENE:
+         rc = scene_apply(rule->scene, writes, &num, 0);
+         break;
+   }
+   return rc;
+}
+
+
+/**********************************************************
+ * Function gpio_input_add()
+ *
+ * Description: Add an input rule, must be called before
+ *              gpio_input_init()
+ *
+ * Parameters: spec (in)   - input rule
+ *             err (out)   - error message
+ *             errlen (in) - size of err
+ *
+ * Return: rule number (>0) on success,
+ *         -EINVAL if the rule is invalid
+ *********************************************************/
+int gpio_input_add(const char *spec, char *err, size_t errlen)
+{
+   input_rule_t *rule;
+   char copy[GPIO_INPUT_SPEC_LEN];
+   char *line, *edge, *action, *target, *arg, *extra, *end, *save;
+   long value;
+
+   if (g_num_rules == GPIO_INPUT_MAX)
+   {
+      snprintf(err, errlen, "too many input rules");
+      return -EINVAL;
+   }
+   if (strlen(spec) >= sizeof(copy))
+   {
+      snprintf(err, errlen, "input rule too long");
+      return -EINVAL;
+   }
+   strcpy(copy, spec);
+
+   line   = strtok_r(copy, " \t", &save);
+   edge   = strtok_r(NULL, " \t", &save);
+   action = strtok_r(NULL, " \t", &save);
+   target = strtok_r(NULL, " \t", &save);
+   arg    = strtok_r(NULL, " \t", &save);
+   extra  = strtok_r(NULL, " \t", &save);
+   if (target == NULL)
+   {
+      snprintf(err, errlen, "expected <line> <edge> <action> <target>");
+      return -EINVAL;
+   }
+
+   rule = &g_rules[g_num_rules];
+   memset(rule, 0, sizeof(*rule));
+
+   value = strtol(line, &end, 10);
+   if (*end != '\0' || value < 0 || value > 1023)
+   {
+      snprintf(err, errlen, "invalid line '%s'", line);
+      return -EINVAL;
+   }
+   rule->line = value;
+
+   if (!strcmp(edge, "rising"))
+      rule->edges = GPIO_V2_LINE_FLAG_EDGE_RISING;
+   else if (!strcmp(edge, "falling"))
+      rule->edges = GPIO_V2_LINE_FLAG_EDGE_FALLING;
+   else if (!strcmp(edge, "both"))
+      rule->edges = GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+   else
+   {
+      snprintf(err, errlen, "invalid edge '%s', expected rising, falling or both", edge);
+      return -EINVAL;
+   }
+
+   if (!strcmp(action, "toggle") || !strcmp(action, "pulse"))
+   {
+      rule->action = strcmp(action, "toggle") ? ACTION_PULSE : ACTION_TOGGLE;
+      if (parse_relays(target, rule) < 0)
+      {
+         snprintf(err, errlen, "invalid relay list");
+         return -EINVAL;
+      }
+      if (rule->action == ACTION_PULSE)
+      {
+         if (arg == NULL || (value = strtol(arg, &end, 10)) <= 0 || *end != '\0' || value > 86400000)
+         {
+            snprintf(err, errlen, "pulse needs a duration in ms");
+            return -EINVAL;
+         }
+         rule->duration_ms = value;
+         arg = extra;
+      }
+   }
+   else if (!strcmp(action, "scene"))
+   {
+      rule->action = ACTION_SCENE;
+      if (strlen(target) >= SCENE_NAME_LEN)
+      {
+         snprintf(err, errlen, "scene name too long");
+         return -EINVAL;
+      }
+      strcpy(rule->scene, target);
+   }
+   else
+   {
+      snprintf(err, errlen, "invalid action '%s', expected toggle, pulse or scene", action);
+      return -EINVAL;
+   }
+   if (arg != NULL)
+   {
+      snprintf(err, errlen, "unexpected '%s'", arg);
+      return -EINVAL;
+   }
+
+   strcpy(rule->spec, spec);
+   return ++g_num_rules;
+}
+
+
+/**********************************************************
+ * Function gpio_input_init()
+ *
+ * Description: Request the input lines of the rules with
+ *              edge detection
+ *
+ * Parameters: chip (in)        - GPIO character device,
+ *                                NULL for the default
+ *             debounce_ms (in) - debounce period, 0 for
+ *                                none
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int gpio_input_init(const char *chip, uint32_t debounce_ms)
+{
+   struct gpio_v2_line_request req;
+   input_line_t *ln;
+   int chip_fd, i, j;
+
+   if (chip == NULL) chip = GPIO_INPUT_CHIP;
+
+   /* Merge the edges of the rules of each line */
+   for (i=0; i<g_num_rules; i++)
+   {
+      for (j=0; j<g_num_lines && g_lines[j].line != g_rules[i].line; j++);
+      if (j == g_num_lines)
+      {
+         if (g_num_lines == GPIO_INPUT_MAX_LINES)
+         {
+            syslog(LOG_DAEMON | LOG_ERR, "Too many GPIO input lines\n");
+            return -1;
+         }
+         g_lines[j].line = g_rules[i].line;
+         g_lines[j].edges = 0;
+         g_lines[j].fd = -1;
+         g_num_lines++;
+      }
+      g_lines[j].edges |= g_rules[i].edges;
+   }
+
+   if ((chip_fd = open(chip, O_RDONLY | O_CLOEXEC)) < 0)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Cannot open GPIO chip %s: %s\n", chip, strerror(errno));
+      g_num_lines = 0;
+      return -1;
+   }
+
+   for (i=0; i<g_num_lines; i++)
+   {
+      ln = &g_lines[i];
+      memset(&req, 0, sizeof(req));
+      req.offsets[0] = ln->line;
+      req.num_lines = 1;
+      snprintf(req.consumer, sizeof(req.consumer), "crelay");
+      req.config.flags = GPIO_V2_LINE_FLAG_INPUT | ln->edges;
+      if (debounce_ms > 0)
+      {
+         req.config.num_attrs = 1;
+         req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+         req.config.attrs[0].attr.debounce_period_us = debounce_ms*1000;
+         req.config.attrs[0].mask = 1;
+      }
+      if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0)
+      {
+         syslog(LOG_DAEMON | LOG_ERR, "Cannot request GPIO input line %u: %s\n", ln->line, strerror(errno));
+         close(chip_fd);
+         gpio_input_close();
+         return -1;
+      }
+      ln->fd = req.fd;
+      fcntl(ln->fd, F_SETFL, fcntl(ln->fd, F_GETFL) | O_NONBLOCK);
+      fcntl(ln->fd, F_SETFD, FD_CLOEXEC);
+   }
+   close(chip_fd);
+
+   syslog(LOG_DAEMON | LOG_NOTICE, "GPIO inputs: %d rules on %d lines of %s\n", g_num_rules, g_num_lines, chip);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function gpio_input_close()
+ *
+ * Description: Release the input lines
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void gpio_input_close(void)
+{
+   int i;
+
+   for (i=0; i<g_num_lines; i++)
+   {
+      if (g_lines[i].fd >= 0)
+         close(g_lines[i].fd);
+   }
+   g_num_lines = 0;
+}
+
+
+/**********************************************************
+ * Function gpio_input_pollfds()
+ *
+ * Description: Get the file descriptors to be polled for
+ *              POLLIN by the main loop, one per input line
+ *
+ * Parameters: fds (out) - poll descriptors
+ *             max (in)  - max. number of descriptors
+ *
+ * Return: number of descriptors
+ *********************************************************/
+int gpio_input_pollfds(struct pollfd *fds, int max)
+{
+   int i;
+
+   for (i=0; i<g_num_lines && i<max; i++)
+   {
+      fds[i].fd = g_lines[i].fd;
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+   }
+   return i;
+}
+
+
+/**********************************************************
+ * Function gpio_input_process()
+ *
+ * Description: Read the line events and execute the
+ *              actions of the matching rules
+ *
+ * Parameters: fds (in) - poll descriptors returned by
+ *                        gpio_input_pollfds()
+ *             num (in) - number of descriptors
+ *
+ * Return: none
+ *********************************************************/
+void gpio_input_process(struct pollfd *fds, int num)
+{
+   struct gpio_v2_line_event ev[MAX_EVENTS];
+   input_rule_t *rule;
+   uint64_t edge, start, done;
+   double latency;
+   ssize_t len;
+   int i, n, r, rc;
+
+   for (i=0; i<num; i++)
+   {
+      if (!(fds[i].revents & POLLIN)) continue;
+
+      while ((len = read(fds[i].fd, ev, sizeof(ev))) > 0)
+      {
+         for (n=0; n<len/(ssize_t)sizeof(ev[0]); n++)
+         {
+            edge = (ev[n].id == GPIO_V2_LINE_EVENT_RISING_EDGE) ? GPIO_V2_LINE_FLAG_EDGE_RISING : GPIO_V2_LINE_FLAG_EDGE_FALLING;
+            for (r=0; r<g_num_rules; r++)
+            {
+               rule = &g_rules[r];
+               if (rule->line != ev[n].offset || !(rule->edges & edge)) continue;
+               if (emergency_held()) continue;
+
+               start = monotonic_ns();
+               rc = run_action(rule);
+               done = monotonic_ns();
+
+               latency = (done - ev[n].timestamp_ns)/1e3;
+               rule->events++;
+               rule->last_ns = realtime_ns() - (done - ev[n].timestamp_ns);
+               rule->latency_last = latency;
+               rule->latency_sum += latency;
+               if (latency > rule->latency_max) rule->latency_max = latency;
+               if ((start - ev[n].timestamp_ns)/1e3 > rule->dispatch_max)
+                  rule->dispatch_max = (start - ev[n].timestamp_ns)/1e3;
+               if (rc < 0)
+               {
+                  rule->failures++;
+                  syslog(LOG_DAEMON | LOG_ERR, "Input rule %d (%s) failed: %s\n", r+1, rule->spec, strerror(-rc));
+               }
+            }
+         }
+      }
+   }
+}
+
+
+/**********************************************************
+ * Function gpio_input_timeout()
+ *
+ * Description: Get the time until the next running pulse
+ *              has to be ended
+ *
+ * Parameters: none
+ *
+ * Return: timeout in ms for poll(), -1 if no pulse running
+ *********************************************************/
+int gpio_input_timeout(void)
+{
+   uint64_t now = monotonic_ns()/1000000;
+   int64_t timeout = -1;
+   int i;
+
+   for (i=0; i<g_num_rules; i++)
+   {
+      if (!g_rules[i].pulse_active) continue;
+      if (g_rules[i].deadline_ms <= now) return 0;
+      if (timeout < 0 || g_rules[i].deadline_ms - now < timeout)
+         timeout = g_rules[i].deadline_ms - now;
+   }
+
+   return (int)timeout;
+}
+
+
+/**********************************************************
+ * Function gpio_input_timers()
+ *
+ * Description: End the pulses which are due
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void gpio_input_timers(void)
+{
+   char portname[MAX_COM_PORT_NAME_LEN];
+   uint8_t num_relays;
+   uint16_t states;
+   uint64_t now = monotonic_ns()/1000000;
+   input_rule_t *rule;
+   char *serial;
+   int i;
+
+   for (i=0; i<g_num_rules; i++)
+   {
+      rule = &g_rules[i];
+      if (!rule->pulse_active || rule->deadline_ms > now) continue;
+
+      rule->pulse_active = 0;
+      serial = rule->serial[0] ? rule->serial : NULL;
+      num_relays = FIRST_RELAY;
+      if (crelay_detect_relay_card(portname, &num_relays, serial, NULL) < 0 ||
+          crelay_set_relay_mask(portname, rule->mask, rule->restore, serial) < 0 ||
+          crelay_get_relay_mask(portname, &states, serial) < 0)
+      {
+         syslog(LOG_DAEMON | LOG_ERR, "Failed to end pulse of input rule %d\n", i+1);
+         continue;
+      }
+      record(rule, num_relays, states);
+   }
+}
+
+
+/**********************************************************
+ * Function gpio_input_cancel_pulses()
+ *
+ * Description: Drop the running pulses, the relays are not
+ *              switched back
+ *
+ * Parameters: none
+ *
+ * Return: number of pulses dropped
+ *********************************************************/
+int gpio_input_cancel_pulses(void)
+{
+   int i, n = 0;
+
+   for (i=0; i<g_num_rules; i++)
+   {
+      if (g_rules[i].pulse_active)
+      {
+         g_rules[i].pulse_active = 0;
+         n++;
+      }
+   }
+   return n;
+}
+
+
+/**********************************************************
+ * Function gpio_input_list()
+ *
+ * Description: Get the input rules and their reaction
+ *              times
+ *
+ * Parameters: info (out) - input rules
+ *             max (in)   - max. number of entries
+ *
+ * Return: number of entries
+ *********************************************************/
+int gpio_input_list(gpio_input_info_t *info, int max)
+{
+   input_rule_t *rule;
+   int i;
+
+   for (i=0; i<g_num_rules && i<max; i++)
+   {
+      rule = &g_rules[i];
+      info[i].id = i+1;
+      strcpy(info[i].spec, rule->spec);
+      info[i].events = rule->events;
+      info[i].failures = rule->failures;
+      info[i].last_ns = rule->last_ns;
+      info[i].latency_last_us = rule->latency_last;
+      info[i].latency_mean_us = rule->events ? rule->latency_sum/rule->events : 0;
+      info[i].latency_max_us = rule->latency_max;
+      info[i].dispatch_max_us = rule->dispatch_max;
+   }
+   return i;
+}
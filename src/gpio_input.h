@@ -0,0 +1,200 @@
+/******************************************************************************
+ *
+ * Relay card control utility: GPIO input triggers
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the GPIO inputs, which switch
+ *   relays when a button is pressed or a sensor contact changes.
+ *
+ *   Input rule syntax:
+ *     <line> rising|falling|both toggle [serial:]<relay>[,<relay>...]
+ *     <line> rising|falling|both pulse [serial:]<relay>[,<relay>...] <ms>
+ *     <line> rising|falling|both scene <name>
+ *
+ *   Example: "23 falling toggle 1", "24 rising pulse A0001:2 500"
+ *
+ *   <line> is the line offset on the GPIO character device. The lines are
+ *   requested with edge detection (and debouncing if configured) from the
+ *   kernel, whose line event file descriptors are polled by the main loop
+ *   of the daemon, so there is no polling of the pin state. Every event
+ *   carries the kernel timestamp of the edge, the reaction latency is
+ *   measured from this timestamp until the relay action is done.
+ *
+ *   A pulse toggles the relays and switches them back after <ms>, without
+ *   blocking the main loop. Edges are ignored while an emergency off is
+ *   held, see emergency.h.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef gpio_input_h
+#define gpio_input_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <poll.h>
+
+#include "relay_drv.h"
+
+#define GPIO_INPUT_MAX        16   /* rules */
+#define GPIO_INPUT_MAX_LINES  16
+#define GPIO_INPUT_CHIP       "/dev/gpiochip0"
+#define GPIO_INPUT_SPEC_LEN   96
+
+/* Input rule and its reaction times, as returned by gpio_input_list() */
+typedef struct
+{
+   uint32_t id;                     /* rule number, starting at 1 */
+   char     spec[GPIO_INPUT_SPEC_LEN];
+   uint64_t events;                 /* edges which triggered the rule */
+   uint64_t failures;               /* actions which failed */
+   uint64_t last_ns;                /* CLOCK_REALTIME of the last edge */
+   double   latency_last_us;        /* edge to end of the action */
+   double   latency_mean_us;
+   double   latency_max_us;
+   double   dispatch_max_us;        /* edge to start of the action */
+}
+gpio_input_info_t;
+
+
+/**********************************************************
+ * Function gpio_input_add()
+ *
+ * Description: Add an input rule, must be called before
+ *              gpio_input_init()
+ *
+ * Parameters: spec (in)   - input rule
+ *             err (out)   - error message
+ *             errlen (in) - size of err
+ *
+ * Return: rule number (>0) on success,
+ *         -EINVAL if the rule is invalid
+ *********************************************************/
+int gpio_input_add(const char *spec, char *err, size_t errlen);
+
+/**********************************************************
+ * Function gpio_input_init()
+ *
+ * Description: Request the input lines of the rules with
+ *              edge detection
+ *
+ * Parameters: chip (in)        - GPIO character device,
+ *                                NULL for the default
+ *             debounce_ms (in) - debounce period, 0 for
+ *                                none
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int gpio_input_init(const char *chip, uint32_t debounce_ms);
+
+/**********************************************************
+ * Function gpio_input_close()
+ *
+ * Description: Release the input lines
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void gpio_input_close(void);
+
+/**********************************************************
+ * Function gpio_input_pollfds()
+ *
+ * Description: Get the file descriptors to be polled for
+ *              POLLIN by the main loop, one per input line
+ *
+ * Parameters: fds (out) - poll descriptors
+ *             max (in)  - max. number of descriptors
+ *
+ * Return: number of descriptors
+ *********************************************************/
+int gpio_input_pollfds(struct pollfd *fds, int max);
+
+/**********************************************************
+ * Function gpio_input_process()
+ *
+ * Description: Read the line events and execute the
+ *              actions of the matching rules
+ *
+ * Parameters: fds (in) - poll descriptors returned by
+ *                        gpio_input_pollfds()
+ *             num (in) - number of descriptors
+ *
+ * Return: none
+ *********************************************************/
+void gpio_input_process(struct pollfd *fds, int num);
+
+/**********************************************************
+ * Function gpio_input_timeout()
+ *
+ * Description: Get the time until the next running pulse
+ *              has to be ended
+ *
+ * Parameters: none
+ *
+ * Return: timeout in ms for poll(), -1 if no pulse running
+ *********************************************************/
+int gpio_input_timeout(void);
+
+/**********************************************************
+ * Function gpio_input_timers()
+ *
+ * Description: End the pulses which are due
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void gpio_input_timers(void);
+
+/**********************************************************
+ * Function gpio_input_cancel_pulses()
+ *
+ * Description: Drop the running pulses, the relays are not
+ *              switched back
+ *
+ * Parameters: none
+ *
+ * Return: number of pulses dropped
+ *********************************************************/
+int gpio_input_cancel_pulses(void);
+
+/**********************************************************
+ * Function gpio_input_list()
+ *
+ * Description: Get the input rules and their reaction
+ *              times
+ *
+ * Parameters: info (out) - input rules
+ *             max (in)   - max. number of entries
+ *
+ * Return: number of entries
+ *********************************************************/
+int gpio_input_list(gpio_input_info_t *info, int max);
+
+#endif
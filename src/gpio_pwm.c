@@ -0,0 +1,494 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Software PWM of GPIO relays
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the PWM mode of the GPIO relays, see gpio_pwm.h.
+ *
+ *   The API changes the channels under a lock, the thread picks the
+ *   changes up when it wakes up next, which is at least every 100ms. A
+ *   new period and duty cycle therefore start 100ms after the request.
+ *   Edges are not recorded in the history and statistics.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <sched.h>
+#include <syslog.h>
+#include <pthread.h>
+
+#include "data_types.h"
+#include "relay_drv.h"
+#include "relay_drv_gpio.h"
+#include "gpio_pwm.h"
+#include "interlock.h"
+#include "realtime.h"
+
+#define NUM_CHANNELS  GENERIC_GPIO_NUM_RELAYS
+#define MAX_SLEEP_NS  100000000ULL    /* changes are picked up within 100ms */
+#define NO_EDGE       UINT64_MAX
+
+extern config_t config;
+
+typedef struct
+{
+   int      active;
+   int      fd;
+   char     on_value;
+   char     off_value;
+   double   period_ms;
+   double   duty;
+   uint64_t period_ns;
+   uint64_t on_ns;
+   uint64_t rise_ns;        /* planned rising edge of the current period */
+   uint64_t next_ns;        /* planned time of the next edge */
+   int      next_on;        /* next edge is a rising edge */
+   uint64_t last_rise_ns;   /* actual time of the last rising edge, 0 if none */
+
+   /* Timing */
+   uint64_t cycles;
+   uint64_t overruns;
+   double   jitter_sum;     /* us */
+   double   jitter_sq;
+   double   jitter_max;
+   uint64_t edges;
+   double   late_sum;       /* us */
+   double   late_max;
+}
+pwm_chan_t;
+
+static pwm_chan_t      g_chan[NUM_CHANNELS];
+static uint16_t        g_mask = 0;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t       g_thread;
+static int             g_started = 0;
+static int             g_stop = 0;
+static int             g_priority = GPIO_PWM_PRIORITY;
+
+
+static uint64_t monotonic_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+static void write_pin(pwm_chan_t *ch, char value)
+{
+   if (pwrite(ch->fd, &value, 1, 0) != 1)
+      syslog(LOG_DAEMON | LOG_WARNING, "PWM: write to GPIO failed: %s\n", strerror(errno));
+}
+
+
+/**********************************************************
+ * Internal function do_edge()
+ *
+ * Description: Write the next edge of a channel which is
+ *              due, measure its timing and plan the next
+ *              one. Must be called with the lock held.
+ *
+ * Parameters: ch (in)  - channel
+ *             now (in) - current time
+ *
+ * Return: none
+ *********************************************************/
+static void do_edge(pwm_chan_t *ch, uint64_t now)
+{
+   uint64_t t, skip, planned;
+   double late, dev;
+
+   /* Skip the periods which were missed completely */
+   if (ch->next_on && now - ch->rise_ns >= ch->period_ns)
+   {
+      skip = (now - ch->rise_ns) / ch->period_ns;
+      ch->rise_ns += skip*ch->period_ns;
+      ch->next_ns = ch->rise_ns;
+      ch->overruns += skip;
+      ch->last_rise_ns = 0;
+   }
+   planned = ch->next_ns;
+
+   if (ch->next_on)
+   {
+      write_pin(ch, ch->on_value);
+      t = monotonic_ns();
+      if (ch->last_rise_ns != 0)
+      {
+         dev = ((double)(t - ch->last_rise_ns) - ch->period_ns) / 1e3;
+         ch->cycles++;
+         ch->jitter_sum += fabs(dev);
+         ch->jitter_sq += dev*dev;
+         if (fabs(dev) > ch->jitter_max) ch->jitter_max = fabs(dev);
+      }
+      ch->last_rise_ns = t;
+      if (ch->on_ns >= ch->period_ns)
+      {
+         ch->next_ns = NO_EDGE;
+      }
+      else
+      {
+         ch->next_ns = ch->rise_ns + ch->on_ns;
+         ch->next_on = 0;
+      }
+   }
+   else
+   {
+      write_pin(ch, ch->off_value);
+      t = monotonic_ns();
+      if (ch->on_ns == 0)
+      {
+         ch->next_ns = NO_EDGE;
+      }
+      else
+      {
+         ch->rise_ns += ch->period_ns;
+         ch->next_ns = ch->rise_ns;
+         ch->next_on = 1;
+      }
+   }
+
+   late = (double)(t - planned) / 1e3;
+   ch->edges++;
+   ch->late_sum += late;
+   if (late > ch->late_max) ch->late_max = late;
+}
+
+
+/**********************************************************
+ * Internal function pwm_thread()
+ *
+ * Description: Sleep until the next edge of any channel
+ *              and write the edges which are due
+ *
+ * Return: NULL
+ *********************************************************/
+static void* pwm_thread(void *arg)
+{
+   struct timespec ts;
+   uint64_t now, wake;
+   int i;
+
+   /* Keeps the PWM priority, pins the thread in realtime mode */
+   realtime_thread("crelay-pwm", g_priority);
+
+   pthread_mutex_lock(&g_lock);
+   while (!g_stop)
+   {
+      if (g_mask == 0)
+      {
+         pthread_cond_wait(&g_cond, &g_lock);
+         continue;
+      }
+
+      now = monotonic_ns();
+      for (i=0; i<NUM_CHANNELS; i++)
+      {
+         if (g_chan[i].active && g_chan[i].next_ns <= now)
+            do_edge(&g_chan[i], now);
+      }
+
+      /* Sleep until the next edge */
+      wake = now + MAX_SLEEP_NS;
+      for (i=0; i<NUM_CHANNELS; i++)
+      {
+         if (g_chan[i].active && g_chan[i].next_ns < wake)
+            wake = g_chan[i].next_ns;
+      }
+      pthread_mutex_unlock(&g_lock);
+      ts.tv_sec = wake / 1000000000ULL;
+      ts.tv_nsec = wake % 1000000000ULL;
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+      pthread_mutex_lock(&g_lock);
+   }
+   pthread_mutex_unlock(&g_lock);
+   return NULL;
+}
+
+
+/**********************************************************
+ * Internal function start_thread()
+ *
+ * Description: Start the PWM thread, with realtime priority
+ *              if allowed
+ *
+ * Return: 0 on success, -1 otherwise
+ *********************************************************/
+static int start_thread(void)
+{
+   struct sched_param param;
+   pthread_attr_t attr;
+   int rc;
+
+   memset(&param, 0, sizeof(param));
+   param.sched_priority = GPIO_PWM_PRIORITY;
+   if (config.gpio_pwm_priority > 0 && config.gpio_pwm_priority <= sched_get_priority_max(SCHED_FIFO))
+      param.sched_priority = config.gpio_pwm_priority;
+   g_priority = param.sched_priority;
+
+   pthread_attr_init(&attr);
+   pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+   pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+   pthread_attr_setschedparam(&attr, &param);
+   rc = pthread_create(&g_thread, &attr, pwm_thread, NULL);
+   pthread_attr_destroy(&attr);
+   if (rc == EPERM)
+   {
+      syslog(LOG_DAEMON | LOG_WARNING, "PWM: no permission for realtime priority, using normal scheduling\n");
+      rc = pthread_create(&g_thread, NULL, pwm_thread, NULL);
+   }
+   if (rc != 0)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "PWM: failed to start thread: %s\n", strerror(rc));
+      return -1;
+   }
+   g_started = 1;
+   return 0;
+}
+
+
+/**********************************************************
+ * Function gpio_pwm_set()
+ *
+ * Description: Start the PWM of a relay, or change its
+ *              period and duty cycle. The relay can not
+ *              be switched otherwise while in PWM mode.
+ *
+ * Parameters: relay (in)     - relay number
+ *             period_ms (in) - PWM period
+ *             duty (in)      - duty cycle in percent
+ *             err (out)      - error message
+ *             errlen (in)    - size of err
+ *
+ * Return:  0 - success
+ *         -EINVAL if a parameter is invalid,
+ *         -ENODEV if there are no GPIO relays,
+ *         -EPERM if the relay is in an interlock rule
+ *********************************************************/
+int gpio_pwm_set(uint8_t relay, double period_ms, double duty, char *err, size_t errlen)
+{
+   pwm_chan_t *ch;
+   uint8_t num_relays = 0;
+   char on_value, off_value;
+   int fd = -1;
+
+   if (!(period_ms >= GPIO_PWM_MIN_PERIOD_MS && period_ms <= GPIO_PWM_MAX_PERIOD_MS))
+   {
+      snprintf(err, errlen, "period must be %d to %d ms", GPIO_PWM_MIN_PERIOD_MS, GPIO_PWM_MAX_PERIOD_MS);
+      return -EINVAL;
+   }
+   if (!(duty >= 0 && duty <= 100))
+   {
+      snprintf(err, errlen, "duty cycle must be 0 to 100");
+      return -EINVAL;
+   }
+   if (detect_relay_card_generic_gpio(NULL, &num_relays, NULL, NULL) < 0)
+   {
+      snprintf(err, errlen, "no GPIO relays configured");
+      return -ENODEV;
+   }
+   if (relay < FIRST_RELAY || relay >= FIRST_RELAY+num_relays)
+   {
+      snprintf(err, errlen, "relay number out of range");
+      return -EINVAL;
+   }
+   if (interlock_covers(NULL, 1 << (relay-FIRST_RELAY)))
+   {
+      /* The edges are not checked, see interlock.h */
+      snprintf(err, errlen, "relay %u is interlocked", relay);
+      return -EPERM;
+   }
+
+   pthread_mutex_lock(&g_lock);
+   ch = &g_chan[relay-FIRST_RELAY];
+   if (!ch->active && (fd = open_relay_generic_gpio(relay, &on_value, &off_value)) < 0)
+   {
+      pthread_mutex_unlock(&g_lock);
+      snprintf(err, errlen, "cannot open GPIO of relay %u", relay);
+      return -ENODEV;
+   }
+   if (!g_started && start_thread() < 0)
+   {
+      pthread_mutex_unlock(&g_lock);
+      if (fd >= 0) close(fd);
+      snprintf(err, errlen, "failed to start PWM thread");
+      return -EINVAL;
+   }
+
+   if (!ch->active)
+   {
+      memset(ch, 0, sizeof(pwm_chan_t));
+      ch->fd = fd;
+      ch->on_value = on_value;
+      ch->off_value = off_value;
+      ch->active = 1;
+   }
+   else
+   {
+      /* New settings, new measurement */
+      ch->cycles = ch->overruns = ch->edges = 0;
+      ch->jitter_sum = ch->jitter_sq = ch->jitter_max = 0;
+      ch->late_sum = ch->late_max = 0;
+   }
+   ch->period_ms = period_ms;
+   ch->duty = duty;
+   ch->period_ns = (uint64_t)(period_ms*1000000);
+   ch->on_ns = (uint64_t)(ch->period_ns*duty/100);
+   /* The thread may sleep MAX_SLEEP_NS before it sees the change, start
+    * then so that the first edge is not late */
+   ch->rise_ns = ch->next_ns = monotonic_ns() + MAX_SLEEP_NS;
+   ch->next_on = (ch->on_ns > 0);
+   ch->last_rise_ns = 0;
+
+   g_mask |= 1 << (relay-FIRST_RELAY);
+   set_pwm_mask_generic_gpio(g_mask);
+   pthread_cond_signal(&g_cond);
+   pthread_mutex_unlock(&g_lock);
+
+   syslog(LOG_DAEMON | LOG_INFO, "PWM of relay %u: period %.1f ms, duty %.1f%%\n", relay, period_ms, duty);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function gpio_pwm_stop()
+ *
+ * Description: End the PWM of a relay, the relay is
+ *              switched off
+ *
+ * Parameters: relay (in) - relay number
+ *
+ * Return:  0 - success
+ *         -1 - relay not in PWM mode
+ *********************************************************/
+int gpio_pwm_stop(uint8_t relay)
+{
+   pwm_chan_t *ch;
+
+   if (relay < FIRST_RELAY || relay >= FIRST_RELAY+NUM_CHANNELS)
+      return -1;
+
+   pthread_mutex_lock(&g_lock);
+   ch = &g_chan[relay-FIRST_RELAY];
+   if (!ch->active)
+   {
+      pthread_mutex_unlock(&g_lock);
+      return -1;
+   }
+   write_pin(ch, ch->off_value);
+   close(ch->fd);
+   ch->active = 0;
+   g_mask &= ~(1 << (relay-FIRST_RELAY));
+   set_pwm_mask_generic_gpio(g_mask);
+   pthread_mutex_unlock(&g_lock);
+
+   syslog(LOG_DAEMON | LOG_INFO, "PWM of relay %u stopped\n", relay);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function gpio_pwm_list()
+ *
+ * Description: Get the relays in PWM mode and their timing
+ *
+ * Parameters: info (out) - PWM of the relays
+ *             max (in)   - max. number of entries
+ *
+ * Return: number of entries
+ *********************************************************/
+int gpio_pwm_list(gpio_pwm_info_t *info, int max)
+{
+   pwm_chan_t *ch;
+   int i, n = 0;
+
+   pthread_mutex_lock(&g_lock);
+   for (i=0; i<NUM_CHANNELS && n<max; i++)
+   {
+      ch = &g_chan[i];
+      if (!ch->active)
+         continue;
+      memset(&info[n], 0, sizeof(gpio_pwm_info_t));
+      info[n].relay = i+FIRST_RELAY;
+      info[n].period_ms = ch->period_ms;
+      info[n].duty = ch->duty;
+      info[n].cycles = ch->cycles;
+      info[n].overruns = ch->overruns;
+      if (ch->cycles > 0)
+      {
+         info[n].jitter_mean_us = ch->jitter_sum / ch->cycles;
+         info[n].jitter_rms_us = sqrt(ch->jitter_sq / ch->cycles);
+         info[n].jitter_max_us = ch->jitter_max;
+      }
+      if (ch->edges > 0)
+      {
+         info[n].late_mean_us = ch->late_sum / ch->edges;
+         info[n].late_max_us = ch->late_max;
+      }
+      n++;
+   }
+   pthread_mutex_unlock(&g_lock);
+   return n;
+}
+
+
+/**********************************************************
+ * Function gpio_pwm_close()
+ *
+ * Description: Stop the PWM of all relays and wait for the
+ *              thread to end
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void gpio_pwm_close(void)
+{
+   int i;
+
+   for (i=0; i<NUM_CHANNELS; i++)
+      gpio_pwm_stop(i+FIRST_RELAY);
+
+   if (g_started)
+   {
+      pthread_mutex_lock(&g_lock);
+      g_stop = 1;
+      pthread_cond_signal(&g_cond);
+      pthread_mutex_unlock(&g_lock);
+      pthread_join(g_thread, NULL);
+      g_started = 0;
+   }
+}
@@ -0,0 +1,133 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Software PWM of GPIO relays
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the PWM mode of the GPIO relays,
+ *   meant for heaters and other slow loads switched by solid state relays.
+ *
+ *   A single thread drives all relays in PWM mode. It sleeps until the
+ *   next edge with clock_nanosleep(TIMER_ABSTIME) on CLOCK_MONOTONIC and
+ *   writes the pins through value files which stay open. The edges are
+ *   planned from the start time of the PWM, so delays do not accumulate.
+ *   The thread runs with SCHED_FIFO priority pwm_priority if the daemon
+ *   is allowed to.
+ *
+ *   For each relay the deviation of the actual period (time between two
+ *   rising edges) from the configured one is measured, and the delay of
+ *   the writes after their planned time. Edges which are more than one
+ *   period late are skipped and counted as overruns.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef gpio_pwm_h
+#define gpio_pwm_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "relay_drv.h"
+
+#define GPIO_PWM_MIN_PERIOD_MS 10
+#define GPIO_PWM_MAX_PERIOD_MS 3600000
+#define GPIO_PWM_PRIORITY      50
+
+/* PWM of a relay and its timing, as returned by gpio_pwm_list() */
+typedef struct
+{
+   uint8_t  relay;
+   double   period_ms;
+   double   duty;             /* percent */
+   uint64_t cycles;           /* periods measured */
+   uint64_t overruns;         /* periods skipped */
+   double   jitter_mean_us;   /* mean absolute period deviation */
+   double   jitter_rms_us;
+   double   jitter_max_us;
+   double   late_mean_us;     /* mean delay of the writes */
+   double   late_max_us;
+}
+gpio_pwm_info_t;
+
+
+/**********************************************************
+ * Function gpio_pwm_set()
+ *
+ * Description: Start the PWM of a relay, or change its
+ *              period and duty cycle. The relay can not
+ *              be switched otherwise while in PWM mode.
+ *
+ * Parameters: relay (in)     - relay number
+ *             period_ms (in) - PWM period
+ *             duty (in)      - duty cycle in percent
+ *             err (out)      - error message
+ *             errlen (in)    - size of err
+ *
+ * Return:  0 - success
+ *         -EINVAL if a parameter is invalid,
+ *         -ENODEV if there are no GPIO relays,
+ *         -EPERM if the relay is in an interlock rule
+ *********************************************************/
+int gpio_pwm_set(uint8_t relay, double period_ms, double duty, char *err, size_t errlen);
+
+/**********************************************************
+ * Function gpio_pwm_stop()
+ *
+ * Description: End the PWM of a relay, the relay is
+ *              switched off
+ *
+ * Parameters: relay (in) - relay number
+ *
+ * Return:  0 - success
+ *         -1 - relay not in PWM mode
+ *********************************************************/
+int gpio_pwm_stop(uint8_t relay);
+
+/**********************************************************
+ * Function gpio_pwm_list()
+ *
+ * Description: Get the relays in PWM mode and their timing
+ *
+ * Parameters: info (out) - PWM of the relays
+ *             max (in)   - max. number of entries
+ *
+ * Return: number of entries
+ *********************************************************/
+int gpio_pwm_list(gpio_pwm_info_t *info, int max);
+
+/**********************************************************
+ * Function gpio_pwm_close()
+ *
+ * Description: Stop the PWM of all relays and wait for the
+ *              thread to end
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void gpio_pwm_close(void);
+
+#endif
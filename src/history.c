@@ -0,0 +1,540 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Relay state change history
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the history store, see history.h.
+ *
+ *   The history directory contains the segment files 00000001.hist,
+ *   00000002.hist, ... Each segment has a header followed by room for
+ *   HISTORY_SEGMENT_SIZE records and is mapped with MAP_SHARED, so adding
+ *   a record is a memory copy and the data survives a crash of the daemon.
+ *   When the last segment is full a new one is created, and the oldest one
+ *   is removed if the configured number of segments is exceeded.
+ *
+ *   The record timestamps never decrease (a clock step backwards is
+ *   recorded with the time of the previous record), so the records of all
+ *   segments form one sorted sequence. A query finds its start segment
+ *   and record by binary search and then reads records sequentially.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <syslog.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "history.h"
+
+#define HISTORY_MAGIC    0x53485243  /* "CRHS" */
+#define HISTORY_VERSION  1
+#define MAX_SEGMENTS     256
+#define MAX_CARDS        32
+
+typedef struct
+{
+   uint32_t magic;
+   uint16_t version;
+   uint16_t record_size;
+   uint32_t capacity;       /* record slots */
+   uint32_t count;          /* records written */
+   uint8_t  reserved[48];
+}
+segment_header_t;
+
+typedef struct
+{
+   uint32_t number;
+   segment_header_t *header;
+   history_record_t *records;
+}
+segment_t;
+
+/* Last known relay states of a card */
+typedef struct
+{
+   char     serial[MAX_SERIAL_LEN];
+   uint8_t  num_relays;
+   uint16_t states;
+}
+card_t;
+
+#define SEGMENT_FILE_SIZE (sizeof(segment_header_t) + HISTORY_SEGMENT_SIZE*sizeof(history_record_t))
+
+static const char *source_names[HISTORY_NUM_SRC] = {"external", "http", "unix", "pulse", "restore", "schedule", "sequence", "scene", "waveform", "input", "emergency", "lease", "poweron"};
+
+static char     *g_dir = NULL;
+static int       g_max_segments;
+static segment_t g_segs[MAX_SEGMENTS];
+static int       g_num_segs = 0;
+static uint64_t  g_last_ts = 0;
+static card_t    g_cards[MAX_CARDS];
+static int       g_num_cards = 0;
+static char      g_default[MAX_SERIAL_LEN];
+
+
+/**********************************************************
+ * Internal function map_segment()
+ *
+ * Description: Open and map a segment file, initialize its
+ *              header if the file is new
+ *
+ * Return: 0 on success, -1 on failure
+ *********************************************************/
+static int map_segment(segment_t *seg, uint32_t number, int create)
+{
+   char path[256];
+   struct stat st;
+   void *p;
+   int fd;
+
+   snprintf(path, sizeof(path), "%s/%08u.hist", g_dir, number);
+   fd = open(path, O_RDWR|O_CLOEXEC|(create ? O_CREAT|O_EXCL : 0), 0644);
+   if (fd < 0)
+      return -1;
+
+   if (fstat(fd, &st) < 0 || (st.st_size != SEGMENT_FILE_SIZE && ftruncate(fd, SEGMENT_FILE_SIZE) < 0))
+   {
+      close(fd);
+      return -1;
+   }
+
+   p = mmap(NULL, SEGMENT_FILE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (p == MAP_FAILED)
+      return -1;
+
+   seg->number = number;
+   seg->header = p;
+   seg->records = (history_record_t*)((char*)p + sizeof(segment_header_t));
+
+   if (create || seg->header->magic != HISTORY_MAGIC || seg->header->version != HISTORY_VERSION ||
+       seg->header->record_size != sizeof(history_record_t) ||
+       seg->header->capacity != HISTORY_SEGMENT_SIZE)
+   {
+      memset(seg->header, 0, sizeof(segment_header_t));
+      seg->header->magic = HISTORY_MAGIC;
+      seg->header->version = HISTORY_VERSION;
+      seg->header->record_size = sizeof(history_record_t);
+      seg->header->capacity = HISTORY_SEGMENT_SIZE;
+   }
+   if (seg->header->count > HISTORY_SEGMENT_SIZE)
+      seg->header->count = HISTORY_SEGMENT_SIZE;
+   return 0;
+}
+
+
+static void remove_oldest_segment(void)
+{
+   char path[256];
+
+   snprintf(path, sizeof(path), "%s/%08u.hist", g_dir, g_segs[0].number);
+   munmap(g_segs[0].header, SEGMENT_FILE_SIZE);
+   unlink(path);
+   memmove(&g_segs[0], &g_segs[1], (g_num_segs-1)*sizeof(segment_t));
+   g_num_segs--;
+}
+
+
+static int compare_numbers(const void *a, const void *b)
+{
+   uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+   return (x > y) - (x < y);
+}
+
+
+/**********************************************************
+ * Function history_open()
+ *
+ * Description: Map the existing segment files of the history
+ *              store (create the directory if needed)
+ *
+ * Parameters: dir (in)          - directory of the segments
+ *             max_segments (in) - number of segment files
+ *                                 kept, older ones are removed
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int history_open(const char *dir, int max_segments)
+{
+   static uint32_t numbers[MAX_SEGMENTS+1];
+   struct dirent *de;
+   DIR *d;
+   unsigned int number;
+   int num = 0, i;
+   segment_t *last;
+
+   if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to create history directory %s: %s", dir, strerror(errno));
+      return -1;
+   }
+   if ((d = opendir(dir)) == NULL)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to open history directory %s: %s", dir, strerror(errno));
+      return -1;
+   }
+   g_dir = strdup(dir);
+   g_max_segments = (max_segments > 0 && max_segments <= MAX_SEGMENTS) ? max_segments : HISTORY_MAX_SEGMENTS;
+
+   /* Find the segment files, keep only the newest ones */
+   while ((de = readdir(d)) != NULL)
+   {
+      char end;
+      if (sscanf(de->d_name, "%8u.hist%c", &number, &end) != 1 || number == 0)
+         continue;
+      numbers[num++] = number;
+      qsort(numbers, num, sizeof(uint32_t), compare_numbers);
+      if (num > g_max_segments)
+      {
+         char path[256];
+         snprintf(path, sizeof(path), "%s/%08u.hist", dir, numbers[0]);
+         unlink(path);
+         memmove(&numbers[0], &numbers[1], (num-1)*sizeof(uint32_t));
+         num--;
+      }
+   }
+   closedir(d);
+
+   for (i=0; i<num; i++)
+   {
+      if (map_segment(&g_segs[g_num_segs], numbers[i], 0) == 0)
+         g_num_segs++;
+   }
+
+   if (g_num_segs > 0)
+   {
+      last = &g_segs[g_num_segs-1];
+      if (last->header->count > 0)
+         g_last_ts = last->records[last->header->count-1].timestamp_ns;
+   }
+
+   syslog(LOG_DAEMON | LOG_NOTICE, "History %s: %d segments\n", dir, g_num_segs);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function history_close()
+ *
+ * Description: Unmap all segment files
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void history_close(void)
+{
+   int i;
+
+   for (i=0; i<g_num_segs; i++)
+   {
+      munmap(g_segs[i].header, SEGMENT_FILE_SIZE);
+   }
+   g_num_segs = 0;
+   free(g_dir);
+   g_dir = NULL;
+}
+
+
+/**********************************************************
+ * Function history_set_default()
+ *
+ * Description: Set the serial number recorded for requests
+ *              without serial number
+ *
+ * Parameters: serial (in) - serial number of the first card
+ *
+ * Return: none
+ *********************************************************/
+void history_set_default(const char *serial)
+{
+   snprintf(g_default, sizeof(g_default), "%s", serial ? serial : "");
+}
+
+
+/**********************************************************
+ * Internal function append()
+ *
+ * Description: Get the next free record slot, start a new
+ *              segment if the last one is full
+ *
+ * Return: record slot, NULL on failure
+ *********************************************************/
+static history_record_t* append(void)
+{
+   segment_t *last = g_num_segs ? &g_segs[g_num_segs-1] : NULL;
+   uint32_t number;
+
+   if (last == NULL || last->header->count == HISTORY_SEGMENT_SIZE)
+   {
+      if (g_num_segs == g_max_segments)
+         remove_oldest_segment();
+
+      number = last ? last->number+1 : 1;
+      if (map_segment(&g_segs[g_num_segs], number, 1) < 0)
+      {
+         syslog(LOG_DAEMON | LOG_ERR, "Failed to create history segment %08u: %s", number, strerror(errno));
+         return NULL;
+      }
+      last = &g_segs[g_num_segs++];
+   }
+   return &last->records[last->header->count];
+}
+
+
+static void add_record(const char *serial, uint8_t relay, uint8_t old_state, uint8_t new_state,
+                       history_source_t source, uint32_t source_id)
+{
+   history_record_t *rec;
+   struct timespec ts;
+   uint64_t now;
+
+   if ((rec = append()) == NULL)
+      return;
+
+   clock_gettime(CLOCK_REALTIME, &ts);
+   now = (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+   if (now < g_last_ts) now = g_last_ts;
+   g_last_ts = now;
+
+   rec->timestamp_ns = now;
+   rec->relay = relay;
+   rec->old_state = old_state;
+   rec->new_state = new_state;
+   rec->source = source;
+   rec->source_id = source_id;
+   strncpy(rec->serial, serial, MAX_SERIAL_LEN-1);
+   rec->serial[MAX_SERIAL_LEN-1] = 0;
+
+   /* Make the record visible to queries */
+   g_segs[g_num_segs-1].header->count++;
+}
+
+
+static card_t* find_card(const char *serial)
+{
+   int i;
+
+   for (i=0; i<g_num_cards; i++)
+   {
+      if (!strcmp(g_cards[i].serial, serial)) return &g_cards[i];
+   }
+   return NULL;
+}
+
+
+/**********************************************************
+ * Function history_record()
+ *
+ * Description: Record the relays whose state differs from
+ *              the last known states of the card. The first
+ *              call for a card only stores its states.
+ *
+ * Parameters: serial (in)     - card serial number, NULL or
+ *                               empty for the default card
+ *             num_relays (in) - number of relays on the card
+ *             states (in)     - current relay states
+ *             source (in)     - source of the change
+ *             source_id (in)  - client address or user id
+ *
+ * Return: none
+ *********************************************************/
+void history_record(const char *serial, uint8_t num_relays, uint16_t states,
+                    history_source_t source, uint32_t source_id)
+{
+   card_t *card;
+   uint16_t changed;
+   int i;
+
+   if (g_dir == NULL)
+      return;
+   if (serial == NULL || serial[0] == 0)
+      serial = g_default;
+
+   if ((card = find_card(serial)) == NULL)
+   {
+      if (g_num_cards == MAX_CARDS) return;
+      card = &g_cards[g_num_cards++];
+      snprintf(card->serial, MAX_SERIAL_LEN, "%s", serial);
+      card->num_relays = num_relays;
+      card->states = states;
+      return;
+   }
+
+   changed = (card->states ^ states) & ((1<<num_relays)-1);
+   for (i=0; changed; i++, changed>>=1)
+   {
+      if (changed & 1)
+         add_record(serial, i+FIRST_RELAY, (card->states>>i) & 1, (states>>i) & 1, source, source_id);
+   }
+   card->num_relays = num_relays;
+   card->states = states;
+}
+
+
+/**********************************************************
+ * Function history_record_relay()
+ *
+ * Description: Record the new state of a single relay
+ *
+ * Parameters: serial (in)     - card serial number, NULL or
+ *                               empty for the default card
+ *             relay (in)      - relay number
+ *             state (in)      - new relay state
+ *             source (in)     - source of the change
+ *             source_id (in)  - client address or user id
+ *
+ * Return: none
+ *********************************************************/
+void history_record_relay(const char *serial, uint8_t relay, relay_state_t state,
+                          history_source_t source, uint32_t source_id)
+{
+   card_t *card;
+   uint16_t bit;
+
+   if (g_dir == NULL || relay < FIRST_RELAY || relay >= FIRST_RELAY+MAX_NUM_RELAYS)
+      return;
+   if (serial == NULL || serial[0] == 0)
+      serial = g_default;
+
+   bit = 1<<(relay-FIRST_RELAY);
+   if ((card = find_card(serial)) == NULL)
+   {
+      add_record(serial, relay, HISTORY_STATE_UNKNOWN, state==ON, source, source_id);
+      return;
+   }
+   if (((card->states & bit) != 0) == (state == ON))
+      return;
+
+   add_record(serial, relay, (card->states & bit) != 0, state==ON, source, source_id);
+   card->states ^= bit;
+}
+
+
+/**********************************************************
+ * Internal function first_record()
+ *
+ * Description: Binary search for the first record of a
+ *              segment with timestamp >= from_ns
+ *
+ * Return: record index, count if there is none
+ *********************************************************/
+static uint32_t first_record(const segment_t *seg, uint64_t from_ns)
+{
+   uint32_t lo = 0, hi = seg->header->count, mid;
+
+   while (lo < hi)
+   {
+      mid = lo + (hi-lo)/2;
+      if (seg->records[mid].timestamp_ns < from_ns)
+         lo = mid+1;
+      else
+         hi = mid;
+   }
+   return lo;
+}
+
+
+/**********************************************************
+ * Function history_query()
+ *
+ * Description: Call a function for each record in a time
+ *              range, in time order
+ *
+ * Parameters: from_ns (in) - start time (CLOCK_REALTIME)
+ *             to_ns (in)   - end time, inclusive
+ *             serial (in)  - card filter [optional]
+ *             relay (in)   - relay filter, 0 for all
+ *             fun (in)     - function called per record,
+ *                            returns non zero to stop
+ *             arg (in)     - argument passed to fun
+ *
+ * Return: number of records passed to fun
+ *********************************************************/
+int history_query(uint64_t from_ns, uint64_t to_ns, const char *serial, uint8_t relay,
+                  int (*fun)(const history_record_t*, void*), void *arg)
+{
+   const history_record_t *rec;
+   int lo = 0, hi = g_num_segs, mid, s;
+   uint32_t i, count;
+   int num = 0;
+
+   /* Binary search for the first segment whose last record is >= from */
+   while (lo < hi)
+   {
+      mid = lo + (hi-lo)/2;
+      count = g_segs[mid].header->count;
+      if (count == 0 || g_segs[mid].records[count-1].timestamp_ns < from_ns)
+         lo = mid+1;
+      else
+         hi = mid;
+   }
+
+   for (s=lo; s<g_num_segs; s++)
+   {
+      count = g_segs[s].header->count;
+      for (i=(s==lo) ? first_record(&g_segs[s], from_ns) : 0; i<count; i++)
+      {
+         rec = &g_segs[s].records[i];
+         if (rec->timestamp_ns > to_ns)
+            return num;
+         if (relay != 0 && rec->relay != relay)
+            continue;
+         if (serial != NULL && serial[0] && strcmp(rec->serial, serial))
+            continue;
+         num++;
+         if (fun(rec, arg))
+            return num;
+      }
+   }
+   return num;
+}
+
+
+/**********************************************************
+ * Function history_source_name()
+ *
+ * Description: Get the name of a change source
+ *
+ * Parameters: source (in) - history_source_t value
+ *
+ * Return: source name
+ *********************************************************/
+const char* history_source_name(uint8_t source)
+{
+   return source < HISTORY_NUM_SRC ? source_names[source] : "unknown";
+}
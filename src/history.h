@@ -0,0 +1,188 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Relay state change history
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the history store functions.
+ *
+ *   Every relay state transition seen by the daemon is stored as a fixed
+ *   size binary record (time, card, relay, old and new state, source of
+ *   the change) in memory mapped segment files. Records are appended in
+ *   time order, so time range queries are answered by binary search.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef history_h
+#define history_h
+
+#include <stdint.h>
+
+#include "relay_drv.h"
+
+#define HISTORY_DIR          "/var/lib/crelay/history"
+#define HISTORY_MAX_SEGMENTS 16     /* default number of segment files kept */
+#define HISTORY_SEGMENT_SIZE 65536  /* records per segment file */
+
+#define HISTORY_STATE_UNKNOWN 0xff
+
+/* Source of a state change */
+typedef enum
+{
+   HISTORY_SRC_EXTERNAL=0,  /* detected on read, not commanded by the daemon */
+   HISTORY_SRC_HTTP,        /* HTTP API or web page, source_id is the IPv4 address */
+   HISTORY_SRC_UNIX,        /* unix socket, source_id is the user id */
+   HISTORY_SRC_PULSE,       /* end of a pulse, source_id is the user id */
+   HISTORY_SRC_RESTORE,     /* restored from the state journal at startup */
+   HISTORY_SRC_SCHEDULE,    /* scheduler, source_id is the schedule id */
+   HISTORY_SRC_SEQUENCE,    /* sequence engine, source_id is the sequence id */
+   HISTORY_SRC_SCENE,       /* scene, source_id is the IPv4 address */
+   HISTORY_SRC_WAVEFORM,    /* end of a waveform, source_id is the waveform id */
+   HISTORY_SRC_INPUT,       /* GPIO input, source_id is the input rule number */
+   HISTORY_SRC_EMERGENCY,   /* emergency off, source_id is its number */
+   HISTORY_SRC_LEASE,       /* expired lease, source_id is the number of the leased set */
+   HISTORY_SRC_POWERON,     /* deferred turn-on of the power-on sequencing */
+   HISTORY_NUM_SRC
+} history_source_t;
+
+typedef struct
+{
+   uint64_t timestamp_ns;            /* CLOCK_REALTIME, never decreasing */
+   uint8_t  relay;                   /* relay number */
+   uint8_t  old_state;               /* 0, 1 or HISTORY_STATE_UNKNOWN */
+   uint8_t  new_state;               /* 0 or 1 */
+   uint8_t  source;                  /* history_source_t */
+   uint32_t source_id;               /* depends on source */
+   char     serial[MAX_SERIAL_LEN];  /* card serial number */
+}
+history_record_t;
+
+
+/**********************************************************
+ * Function history_open()
+ *
+ * Description: Map the existing segment files of the history
+ *              store (create the directory if needed)
+ *
+ * Parameters: dir (in)          - directory of the segments
+ *             max_segments (in) - number of segment files
+ *                                 kept, older ones are removed
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int history_open(const char *dir, int max_segments);
+
+/**********************************************************
+ * Function history_close()
+ *
+ * Description: Unmap all segment files
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void history_close(void);
+
+/**********************************************************
+ * Function history_set_default()
+ *
+ * Description: Set the serial number recorded for requests
+ *              without serial number
+ *
+ * Parameters: serial (in) - serial number of the first card
+ *
+ * Return: none
+ *********************************************************/
+void history_set_default(const char *serial);
+
+/**********************************************************
+ * Function history_record()
+ *
+ * Description: Record the relays whose state differs from
+ *              the last known states of the card. The first
+ *              call for a card only stores its states.
+ *
+ * Parameters: serial (in)     - card serial number, NULL or
+ *                               empty for the default card
+ *             num_relays (in) - number of relays on the card
+ *             states (in)     - current relay states
+ *             source (in)     - source of the change
+ *             source_id (in)  - client address or user id
+ *
+ * Return: none
+ *********************************************************/
+void history_record(const char *serial, uint8_t num_relays, uint16_t states,
+                    history_source_t source, uint32_t source_id);
+
+/**********************************************************
+ * Function history_record_relay()
+ *
+ * Description: Record the new state of a single relay
+ *
+ * Parameters: serial (in)     - card serial number, NULL or
+ *                               empty for the default card
+ *             relay (in)      - relay number
+ *             state (in)      - new relay state
+ *             source (in)     - source of the change
+ *             source_id (in)  - client address or user id
+ *
+ * Return: none
+ *********************************************************/
+void history_record_relay(const char *serial, uint8_t relay, relay_state_t state,
+                          history_source_t source, uint32_t source_id);
+
+/**********************************************************
+ * Function history_query()
+ *
+ * Description: Call a function for each record in a time
+ *              range, in time order
+ *
+ * Parameters: from_ns (in) - start time (CLOCK_REALTIME)
+ *             to_ns (in)   - end time, inclusive
+ *             serial (in)  - card filter [optional]
+ *             relay (in)   - relay filter, 0 for all
+ *             fun (in)     - function called per record,
+ *                            returns non zero to stop
+ *             arg (in)     - argument passed to fun
+ *
+ * Return: number of records passed to fun
+ *********************************************************/
+int history_query(uint64_t from_ns, uint64_t to_ns, const char *serial, uint8_t relay,
+                  int (*fun)(const history_record_t*, void*), void *arg);
+
+/**********************************************************
+ * Function history_source_name()
+ *
+ * Description: Get the name of a change source
+ *
+ * Parameters: source (in) - history_source_t value
+ *
+ * Return: source name
+ *********************************************************/
+const char* history_source_name(uint8_t source);
+
+#endif
@@ -0,0 +1,1000 @@
+/******************************************************************************
+ *
+ * Relay card control utility: JSON HTTP API
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the JSON based HTTP API below /api/v1/. Each
+ *   endpoint has a handler in the endpoints table, which gets the query
+ *   string (or POST data) and writes the complete response.
+ *
+ *   Endpoints:
+ *     GET /api/v1/history?from=&to=&relay=&serial=&limit=
+ *        relay state changes in a time range (times in seconds since
+ *        the epoch, fractions allowed)
+ *     GET /api/v1/stats?serial=
+ *        on-time, number of switching operations and duty cycle
+ *        of the relays
+ *     GET /api/v1/schedules
+ *        list the schedules
+ *     POST /api/v1/schedules spec=<schedule> | delete=<id>
+ *        add or remove a schedule, see scheduler.h for the syntax
+ *     GET /api/v1/sequence
+ *        state and planned/actual step times of the last sequence
+ *     POST /api/v1/sequence program=<program> | cancel=1
+ *        start or cancel a sequence, see sequence.h for the syntax
+ *     GET /api/v1/waveform
+ *        state and timing of the last waveform
+ *     POST /api/v1/waveform pattern=<pattern>[&serial=<serial>] | cancel=1
+ *        start or cancel a waveform, see waveform.h for the syntax
+ *     GET /api/v1/pwm
+ *        GPIO relays in PWM mode and their period jitter
+ *     POST /api/v1/pwm relay=<n>&period_ms=<ms>&duty=<percent> | relay=<n>&stop=1
+ *        start, change or stop the PWM of a GPIO relay, see gpio_pwm.h
+ *     GET /api/v1/inputs
+ *        GPIO input rules and their reaction latency, see gpio_input.h
+ *     GET /api/v1/emergency-off
+ *        report of the last emergency off
+ *     POST /api/v1/emergency-off [release=1]
+ *        switch all relays of all cards off, or release the hold of the
+ *        scheduler and inputs, see emergency.h
+ *     GET /api/v1/leases
+ *        leased relays and the time left until they are switched
+ *        back, see lease.h
+ *     GET /api/v1/interlocks
+ *        interlock rules and the writes they rejected, see interlock.h
+ *     GET /api/v1/scenes
+ *        list the scenes
+ *     POST /api/v1/scenes name=<name>&def=<scene> | delete=<name> | apply=<name>
+ *        define, delete or apply a scene, see scene.h for the syntax
+ *     GET /api/v1/health
+ *        circuit breaker state of the cards, see card_health.h
+ *
+ *   The relay statistics are also available in the Prometheus text
+ *   format on /metrics.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <syslog.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "relay_drv.h"
+#include "history.h"
+#include "relay_stats.h"
+#include "scheduler.h"
+#include "sequence.h"
+#include "waveform.h"
+#include "gpio_pwm.h"
+#include "gpio_input.h"
+#include "emergency.h"
+#include "lease.h"
+#include "interlock.h"
+#include "scene.h"
+#include "card_health.h"
+#include "http_api.h"
+
+#define HISTORY_LIMIT     1000   /* default max. number of events returned */
+#define HISTORY_MAX_LIMIT 100000
+
+typedef struct
+{
+   const char *name;  /* path below /api/v1/ */
+   int (*handler)(FILE *fout, const char *method, const char *query, uint32_t client_ip);
+}
+endpoint_t;
+
+typedef struct
+{
+   FILE *fout;
+   int   num;
+   int   limit;
+}
+history_ctx_t;
+
+typedef struct
+{
+   FILE *fout;
+   int   num;
+}
+lease_ctx_t;
+
+
+/**********************************************************
+ * Internal function query_param()
+ *
+ * Description: Get the value of a parameter from a query
+ *              string (name=value&...), %xx and + decoded
+ *
+ * Return: 0 if found, -1 otherwise
+ *********************************************************/
+static int query_param(const char *query, const char *name, char *value, size_t len)
+{
+   const char *p = query;
+   size_t nlen = strlen(name), n = 0;
+   unsigned int c;
+
+   while (p != NULL && *p)
+   {
+      if (!strncmp(p, name, nlen) && p[nlen] == '=')
+      {
+         p += nlen+1;
+         while (*p && *p != '&' && n+1 < len)
+         {
+            if (*p == '%' && isxdigit((unsigned char)p[1]) && isxdigit((unsigned char)p[2]) &&
+                sscanf(p+1, "%2x", &c) == 1)
+            {
+               value[n++] = c;
+               p += 3;
+            }
+            else
+            {
+               value[n++] = (*p == '+') ? ' ' : *p;
+               p++;
+            }
+         }
+         value[n] = 0;
+         return 0;
+      }
+      if ((p = strchr(p, '&')) != NULL) p++;
+   }
+   return -1;
+}
+
+
+static void json_string(FILE *f, const char *s)
+{
+   fputc('"', f);
+   for (; *s; s++)
+   {
+      if (*s == '"' || *s == '\\')
+         fprintf(f, "\\%c", *s);
+      else if ((unsigned char)*s < 0x20)
+         fprintf(f, "\\u%04x", *s);
+      else
+         fputc(*s, f);
+   }
+   fputc('"', f);
+}
+
+
+static int send_error(FILE *fout, int status, char *title, const char *msg)
+{
+   send_headers(fout, status, title, NULL, "application/json", -1, -1);
+   fprintf(fout, "{\"error\":");
+   json_string(fout, msg);
+   fprintf(fout, "}\n");
+   return status;
+}
+
+
+static int parse_time(const char *str, uint64_t *ns)
+{
+   char *end;
+   double t = strtod(str, &end);
+
+   if (end == str || *end != 0 || t < 0)
+      return -1;
+   *ns = (uint64_t)(t*1e9);
+   return 0;
+}
+
+
+static int print_history_record(const history_record_t *rec, void *arg)
+{
+   history_ctx_t *ctx = arg;
+   struct in_addr addr;
+
+   if (ctx->num == ctx->limit)
+      return 1;
+
+   fprintf(ctx->fout, "%s{\"time\":%llu.%06llu,\"card\":", ctx->num ? ",\n" : "\n",
+           (unsigned long long)(rec->timestamp_ns/1000000000ULL),
+           (unsigned long long)(rec->timestamp_ns%1000000000ULL)/1000);
+   json_string(ctx->fout, rec->serial);
+   fprintf(ctx->fout, ",\"relay\":%u,\"old\":", rec->relay);
+   if (rec->old_state == HISTORY_STATE_UNKNOWN)
+      fprintf(ctx->fout, "null");
+   else
+      fprintf(ctx->fout, "%u", rec->old_state);
+   fprintf(ctx->fout, ",\"new\":%u,\"source\":\"%s\"", rec->new_state, history_source_name(rec->source));
+
+   switch (rec->source)
+   {
+      case HISTORY_SRC_HTTP:
+      case HISTORY_SRC_SCENE:
+         addr.s_addr = rec->source_id;
+         fprintf(ctx->fout, ",\"by\":\"%s\"", inet_ntoa(addr));
+         break;
+      case HISTORY_SRC_UNIX:
+      case HISTORY_SRC_PULSE:
+         fprintf(ctx->fout, ",\"by\":\"uid %u\"", rec->source_id);
+         break;
+      case HISTORY_SRC_SCHEDULE:
+         fprintf(ctx->fout, ",\"by\":\"schedule %u\"", rec->source_id);
+         break;
+      case HISTORY_SRC_SEQUENCE:
+         fprintf(ctx->fout, ",\"by\":\"sequence %u\"", rec->source_id);
+         break;
+      case HISTORY_SRC_WAVEFORM:
+         fprintf(ctx->fout, ",\"by\":\"waveform %u\"", rec->source_id);
+         break;
+      case HISTORY_SRC_INPUT:
+         fprintf(ctx->fout, ",\"by\":\"input %u\"", rec->source_id);
+         break;
+      case HISTORY_SRC_EMERGENCY:
+         fprintf(ctx->fout, ",\"by\":\"emergency %u\"", rec->source_id);
+         break;
+      case HISTORY_SRC_LEASE:
+         fprintf(ctx->fout, ",\"by\":\"lease %u\"", rec->source_id);
+         break;
+      default:
+         break;
+   }
+   fprintf(ctx->fout, "}");
+   ctx->num++;
+   return 0;
+}
+
+
+/**********************************************************
+ * Internal function api_history()
+ *
+ * Description: GET /api/v1/history, list the relay state
+ *              changes in a time range
+ *
+ * Return: HTTP status code
+ *********************************************************/
+static int api_history(FILE *fout, const char *method, const char *query, uint32_t client_ip)
+{
+   char value[64], serial[MAX_SERIAL_LEN] = "";
+   uint64_t from_ns = 0, to_ns = UINT64_MAX;
+   history_ctx_t ctx;
+   int relay = 0, total;
+
+   ctx.fout = fout;
+   ctx.num = 0;
+   ctx.limit = HISTORY_LIMIT;
+
+   if (query_param(query, "from", value, sizeof(value)) == 0 && parse_time(value, &from_ns) < 0)
+      return send_error(fout, 400, "Bad Request", "invalid from time");
+   if (query_param(query, "to", value, sizeof(value)) == 0 && parse_time(value, &to_ns) < 0)
+      return send_error(fout, 400, "Bad Request", "invalid to time");
+   if (query_param(query, "relay", value, sizeof(value)) == 0)
+   {
+      relay = atoi(value);
+      if (relay < FIRST_RELAY || relay >= FIRST_RELAY+MAX_NUM_RELAYS)
+         return send_error(fout, 400, "Bad Request", "relay number out of range");
+   }
+   if (query_param(query, "limit", value, sizeof(value)) == 0)
+   {
+      ctx.limit = atoi(value);
+      if (ctx.limit <= 0 || ctx.limit > HISTORY_MAX_LIMIT)
+         return send_error(fout, 400, "Bad Request", "invalid limit");
+   }
+   query_param(query, "serial", serial, sizeof(serial));
+
+   send_headers(fout, 200, "OK", NULL, "application/json", -1, -1);
+   fprintf(fout, "{\"events\":[");
+   total = history_query(from_ns, to_ns, serial, relay, print_history_record, &ctx);
+   fprintf(fout, "\n],\"count\":%d,\"truncated\":%s}\n", ctx.num, total > ctx.num ? "true" : "false");
+   return 200;
+}
+
+
+/**********************************************************
+ * Internal function api_stats()
+ *
+ * Description: GET /api/v1/stats, list the usage counters
+ *              of the relays
+ *
+ * Return: HTTP status code
+ *********************************************************/
+static int api_stats(FILE *fout, const char *method, const char *query, uint32_t client_ip)
+{
+   char serial[MAX_SERIAL_LEN], filter[MAX_SERIAL_LEN] = "";
+   relay_counters_t counters[MAX_NUM_RELAYS];
+   int card, num, i, found = 0;
+
+   query_param(query, "serial", filter, sizeof(filter));
+
+   send_headers(fout, 200, "OK", NULL, "application/json", -1, -1);
+   fprintf(fout, "{\"cards\":[");
+   for (card=0; (num = relay_stats_get(card, serial, counters)) >= 0; card++)
+   {
+      if (filter[0] && strcmp(filter, serial))
+         continue;
+
+      fprintf(fout, "%s{\"card\":", found++ ? ",\n" : "\n");
+      json_string(fout, serial);
+      fprintf(fout, ",\"relays\":[");
+      for (i=0; i<num; i++)
+      {
+         fprintf(fout, "%s{\"relay\":%d,\"state\":%u,\"on_time\":%llu.%03llu,\"switches\":%llu,"
+                 "\"duty_1h\":%.4f,\"duty_24h\":%.4f}", i ? "," : "", i+FIRST_RELAY, counters[i].state,
+                 (unsigned long long)(counters[i].on_time_ms/1000), (unsigned long long)(counters[i].on_time_ms%1000),
+                 (unsigned long long)counters[i].switch_count, counters[i].duty_1h, counters[i].duty_24h);
+      }
+      fprintf(fout, "]}");
+   }
+   fprintf(fout, "\n]}\n");
+   return 200;
+}
+
+
+/**********************************************************
+ * Internal function api_schedules()
+ *
+ * Description: GET /api/v1/schedules, list the schedules
+ *              POST /api/v1/schedules, add or remove one
+ *
+ * Return: HTTP status code
+ *********************************************************/
+static int api_schedules(FILE *fout, const char *method, const char *query, uint32_t client_ip)
+{
+   scheduler_entry_t entries[SCHEDULER_MAX];
+   char spec[SCHEDULER_SPEC_LEN], value[16], err[64];
+   int id, num, i;
+
+   if (!strcasecmp(method, "POST"))
+   {
+      if (query_param(query, "delete", value, sizeof(value)) == 0)
+      {
+         if (scheduler_remove(atoi(value)) < 0)
+            return send_error(fout, 404, "Not Found", "unknown schedule");
+         send_headers(fout, 200, "OK", NULL, "application/json", -1, -1);
+         fprintf(fout, "{\"deleted\":%d}\n", atoi(value));
+         return 200;
+      }
+      if (query_param(query, "spec", spec, sizeof(spec)) < 0)
+         return send_error(fout, 400, "Bad Request", "missing spec or delete parameter");
+      if ((id = scheduler_add(spec, 0, err, sizeof(err))) < 0)
+         return send_error(fout, 400, "Bad Request", err);
+      syslog(LOG_DAEMON | LOG_NOTICE, "Schedule %d added: %s\n", id, spec);
+      send_headers(fout, 201, "Created", NULL, "application/json", -1, -1);
+      fprintf(fout, "{\"id\":%d}\n", id);
+      return 201;
+   }
+
+   num = scheduler_list(entries, SCHEDULER_MAX);
+   send_headers(fout, 200, "OK", NULL, "application/json", -1, -1);
+   fprintf(fout, "{\"schedules\":[");
+   for (i=0; i<num; i++)
+   {
+      fprintf(fout, "%s{\"id\":%u,\"spec\":", i ? ",\n" : "\n", entries[i].id);
+      json_string(fout, entries[i].spec);
+      fprintf(fout, ",\"source\":\"%s\",\"next\":", entries[i].from_config ? "config" : "api");
+      if (entries[i].next) fprintf(fout, "%lld", (long long)entries[i].next);
+      else fprintf(fout, "null");
+      fprintf(fout, ",\"last\":");
+      if (entries[i].last) fprintf(fout, "%lld}", (long long)entries[i].last);
+      else fprintf(fout, "null}");
+   }
+   fprintf(fout, "\n]}\n");
+   return 200;
+}
+
+
+/**********************************************************
+ * Internal function api_sequence()
+ *
+ * Description: GET /api/v1/sequence, report the last
+ *              sequence, POST to start or cancel one
+ *
+ * Return: HTTP status code
+ *********************************************************/
+static int api_sequence(FILE *fout, const char *method, const char *query, uint32_t client_ip)
+{
+   sequence_step_t steps[SEQUENCE_MAX_STEPS];
+   sequence_info_t info;
+   char program[1024], value[8], err[96];
+   int id, num, i;
+
+   if (!strcasecmp(method, "POST"))
+   {
+      if (query_param(query, "cancel", value, sizeof(value)) == 0)
+      {
+         if (sequence_cancel() < 0)
+            return send_error(fout, 409, "Conflict", "no sequence running");
+      }
+      else if (query_param(query, "program", program, sizeof(program)) == 0)
+      {
+         if ((id = sequence_start(program, err, sizeof(err))) < 0)
+         {
+            if (id == -EBUSY || id == -EPERM) return send_error(fout, 409, "Conflict", err);
+            if (id == -ENODEV) return send_error(fout, 404, "Not Found", err);
+            return send_error(fout, 400, "Bad Request", err);
+         }
+      }
+      else
+      {
+         return send_error(fout, 400, "Bad Request", "missing program or cancel parameter");
+      }
+   }
+
+   num = sequence_get(&info, steps, SEQUENCE_MAX_STEPS);
+   if (!strcasecmp(method, "POST"))
+      send_headers(fout, 202, "Accepted", NULL, "application/json", -1, -1);
+   else
+      send_headers(fout, 200, "OK", NULL, "application/json", -1, -1);
+   fprintf(fout, "{\"id\":%u,\"state\":\"%s\",\"start\":%llu.%06llu,\"executed\":%d,\"steps\":[",
+           info.id, sequence_state_name(info.state), (unsigned long long)(info.start_ns/1000000000ULL),
+           (unsigned long long)(info.start_ns%1000000000ULL)/1000, info.done_steps);
+   for (i=0; i<num; i++)
+   {
+      fprintf(fout, "%s{\"card\":", i ? ",\n" : "\n");
+      json_string(fout, steps[i].serial);
+      fprintf(fout, ",\"mask\":%u,\"states\":%u,\"planned_ms\":%.3f", steps[i].mask, steps[i].states,
+              steps[i].planned_ns/1e6);
+      if (i < info.done_steps)
+         fprintf(fout, ",\"actual_ms\":%.3f,\"late_us\":%.1f,\"write_us\":%.1f,\"ok\":%s}",
+                 steps[i].actual_ns/1e6, ((double)steps[i].actual_ns - steps[i].planned_ns)/1e3,
+                 steps[i].write_ns/1e3, steps[i].rc < 0 ? "false" : "true");
+      else
+         fprintf(fout, ",\"actual_ms\":null}");
+   }
+   fprintf(fout, "\n]}\n");
+   return 200;
+}
+
+
+/**********************************************************
+ * Internal function api_waveform()
+ *
+ * Description: GET /api/v1/waveform, report the last
+ *              waveform, POST to start or cancel one
+ *
+ * Return: HTTP status code
+ *********************************************************/
+static int api_waveform(FILE *fout, const char *method, const char *query, uint32_t client_ip)
+{
+   waveform_info_t info;
+   char pattern[1024], serial[MAX_SERIAL_LEN], value[8], err[128];
+   int id;
+
+   if (!strcasecmp(method, "POST"))
+   {
+      if (query_param(query, "cancel", value, sizeof(value)) == 0)
+      {
+         if (waveform_cancel() < 0)
+            return send_error(fout, 409, "Conflict", "no waveform running");
+      }
+      else if (query_param(query, "pattern", pattern, sizeof(pattern)) == 0)
+      {
+         if (query_param(query, "serial", serial, sizeof(serial)) < 0)
+            serial[0] = 0;
+         if ((id = waveform_start(pattern, serial, err, sizeof(err))) < 0)
+         {
+            if (id == -EBUSY || id == -EPERM) return send_error(fout, 409, "Conflict", err);
+            if (id == -ENODEV) return send_error(fout, 404, "Not Found", err);
+            if (id == -ENOTSUP) return send_error(fout, 501, "Not Implemented", err);
+            return send_error(fout, 400, "Bad Request", err);
+         }
+      }
+      else
+      {
+         return send_error(fout, 400, "Bad Request", "missing pattern or cancel parameter");
+      }
+   }
+
+   waveform_get(&info);
+   if (!strcasecmp(method, "POST"))
+      send_headers(fout, 202, "Accepted", NULL, "application/json", -1, -1);
+   else
+      send_headers(fout, 200, "OK", NULL, "application/json", -1, -1);
+   fprintf(fout, "{\"id\":%u,\"state\":\"%s\",\"card\":", info.id, waveform_state_name(info.state));
+   json_string(fout, info.serial);
+   fprintf(fout, ",\"mask\":%u,\"rate\":%u,\"samples\":%u,\"start\":%llu.%06llu,\"planned_ms\":%.3f",
+           info.mask, info.rate_hz, info.num_samples, (unsigned long long)(info.start_ns/1000000000ULL),
+           (unsigned long long)(info.start_ns%1000000000ULL)/1000, info.planned_ns/1e6);
+   if (info.state == WAVEFORM_IDLE || info.state == WAVEFORM_RUNNING)
+      fprintf(fout, ",\"played\":null}\n");
+   else
+      fprintf(fout, ",\"played\":%u,\"actual_ms\":%.3f,\"effective_rate\":%.1f,\"error\":%d}\n",
+              info.played, info.actual_ns/1e6, info.actual_ns ? info.played*1e9/info.actual_ns : 0,
+              info.rc);
+   return 200;
+}
+
+
+/**********************************************************
+ * Internal function api_pwm()
+ *
+ * Description: GET /api/v1/pwm, list the GPIO relays in
+ *              PWM mode, POST to start, change or stop
+ *              the PWM of one
+ *
+ * Return: HTTP status code
+ *********************************************************/
+static int api_pwm(FILE *fout, const char *method, const char *query, uint32_t client_ip)
+{
+   gpio_pwm_info_t info[GENERIC_GPIO_NUM_RELAYS];
+   char value[16], period[16], duty[16], err[64];
+   int relay, rc, num, i;
+
+   if (!strcasecmp(method, "POST"))
+   {
+      if (query_param(query, "relay", value, sizeof(value)) < 0)
+         return send_error(fout, 400, "Bad Request", "missing relay parameter");
+      relay = atoi(value);
+      if (query_param(query, "stop", value, sizeof(value)) == 0)
+      {
+         if (gpio_pwm_stop(relay) < 0)
+            return send_error(fout, 409, "Conflict", "relay not in PWM mode");
+      }
+      else if (query_param(query, "period_ms", period, sizeof(period)) == 0 &&
+               query_param(query, "duty", duty, sizeof(duty)) == 0)
+      {
+         if ((rc = gpio_pwm_set(relay, atof(period), atof(duty), err, sizeof(err))) < 0)
+         {
+            if (rc == -ENODEV) return send_error(fout, 404, "Not Found", err);
+            if (rc == -EPERM) return send_error(fout, 409, "Conflict", err);
+            return send_error(fout, 400, "Bad Request", err);
+         }
+      }
+      else
+      {
+         return send_error(fout, 400, "Bad Request", "missing period_ms and duty or stop parameter");
+      }
+   }
+
+   num = gpio_pwm_list(info, GENERIC_GPIO_NUM_RELAYS);
+   send_headers(fout, 200, "OK", NULL, "application/json", -1, -1);
+   fprintf(fout, "{\"relays\":[");
+   for (i=0; i<num; i++)
+   {
+      fprintf(fout, "%s{\"relay\":%u,\"period_ms\":%.3f,\"duty\":%.2f,\"cycles\":%llu,\"overruns\":%llu,"
+              "\"jitter_mean_us\":%.1f,\"jitter_rms_us\":%.1f,\"jitter_max_us\":%.1f,"
+              "\"late_mean_us\":%.1f,\"late_max_us\":%.1f}", i ? ",\n" : "\n",
+              info[i].relay, info[i].period_ms, info[i].duty, (unsigned long long)info[i].cycles,
+              (unsigned long long)info[i].overruns, info[i].jitter_mean_us, info[i].jitter_rms_us,
+              info[i].jitter_max_us, info[i].late_mean_us, info[i].late_max_us);
+   }
+   fprintf(fout, "\n]}\n");
+   return 200;
+}
+
+
+/**********************************************************
+ * Internal function api_inputs()
+ *
+ * Description: GET /api/v1/inputs, list the GPIO input
+ *              rules with their reaction latency
+ *
+ * Return: HTTP status code
+ *********************************************************/
+static int api_inputs(FILE *fout, const char *method, const char *query, uint32_t client_ip)
+{
+   gpio_input_info_t info[GPIO_INPUT_MAX];
+   int num, i;
+
+   num = gpio_input_list(info, GPIO_INPUT_MAX);
+   send_headers(fout, 200, "OK", NULL, "application/json", -1, -1);
+   fprintf(fout, "{\"inputs\":[");
+   for (i=0; i<num; i++)
+   {
+      fprintf(fout, "%s{\"id\":%u,\"rule\":", i ? ",\n" : "\n", info[i].id);
+      json_string(fout, info[i].spec);
+      fprintf(fout, ",\"events\":%llu,\"failures\":%llu,\"last\":",
+              (unsigned long long)info[i].events, (unsigned long long)info[i].failures);
+      if (info[i].events == 0)
+         fprintf(fout, "null");
+      else
+         fprintf(fout, "%llu.%06llu", (unsigned long long)(info[i].last_ns/1000000000ULL),
+                 (unsigned long long)(info[i].last_ns%1000000000ULL)/1000);
+      fprintf(fout, ",\"latency_last_us\":%.1f,\"latency_mean_us\":%.1f,\"latency_max_us\":%.1f,"
+              "\"dispatch_max_us\":%.1f}", info[i].latency_last_us, info[i].latency_mean_us,
+              info[i].latency_max_us, info[i].dispatch_max_us);
+   }
+   fprintf(fout, "\n]}\n");
+   return 200;
+}
+
+
+/**********************************************************
+ * Internal function api_emergency()
+ *
+ * Description: POST /api/v1/emergency-off, switch all
+ *              relays off or release the hold, GET to
+ *              report the last emergency off
+ *
+ * Return: HTTP status code
+ *********************************************************/
+static int api_emergency(FILE *fout, const char *method, const char *query, uint32_t client_ip)
+{
+   emergency_info_t info;
+   struct in_addr addr;
+   char by[EMERGENCY_BY_LEN], value[8];
+   int status = 200, i;
+
+   if (!strcasecmp(method, "POST"))
+   {
+      if (query_param(query, "release", value, sizeof(value)) == 0)
+      {
+         if (emergency_release() < 0)
+            return send_error(fout, 409, "Conflict", "no emergency off held");
+      }
+      else
+      {
+         addr.s_addr = client_ip;
+         snprintf(by, sizeof(by), "http %s", inet_ntoa(addr));
+         if (emergency_off(by) < 0)
+            status = 500;
+      }
+   }
+
+   emergency_get(&info);
+   send_headers(fout, status, status == 200 ? "OK" : "Internal Server Error", NULL, "application/json", -1, -1);
+   if (info.id == 0)
+   {
+      fprintf(fout, "{\"id\":0}\n");
+      return status;
+   }
+   fprintf(fout, "{\"id\":%u,\"by\":", info.id);
+   json_string(fout, info.by);
+   fprintf(fout, ",\"time\":%llu.%06llu,\"held\":%s,\"stop_ms\":%.3f,\"total_ms\":%.3f,"
+           "\"cancelled\":{\"sequence\":%d,\"waveform\":%d,\"pwm\":%d,\"pulses\":%d,\"leases\":%d},\"cards\":[",
+           (unsigned long long)(info.time_ns/1000000000ULL), (unsigned long long)(info.time_ns%1000000000ULL)/1000,
+           info.held ? "true" : "false", info.stop_ms, info.total_ms,
+           info.sequence, info.waveform, info.pwm, info.pulses, info.leases);
+   for (i=0; i<info.num_cards; i++)
+   {
+      fprintf(fout, "%s{\"card\":", i ? ",\n" : "\n");
+      json_string(fout, info.cards[i].serial);
+      fprintf(fout, ",\"rc\":%d,\"done_ms\":%.3f,\"write_ms\":%.3f}",
+              info.cards[i].rc, info.cards[i].done_ms, info.cards[i].write_ms);
+   }
+   fprintf(fout, "\n]}\n");
+   return status;
+}
+
+
+/**********************************************************
+ * Internal function lease_entry()
+ *
+ * Description: Write one lease of GET /api/v1/leases
+ *
+ * Return: 0 to continue
+ *********************************************************/
+static int lease_entry(const lease_info_t *info, void *arg)
+{
+   lease_ctx_t *ctx = arg;
+   struct in_addr addr;
+
+   fprintf(ctx->fout, "%s{\"id\":%u,\"card\":", ctx->num ? ",\n" : "\n", info->id);
+   json_string(ctx->fout, info->serial);
+   fprintf(ctx->fout, ",\"relay\":%u,\"state\":%u,\"restore\":%u,\"lease_ms\":%u,\"remaining_ms\":%u,"
+           "\"renewals\":%u,\"by\":", info->relay, info->state, info->restore, info->lease_ms,
+           info->remaining_ms, info->renewals);
+   if (info->source == HISTORY_SRC_HTTP)
+   {
+      addr.s_addr = info->source_id;
+      fprintf(ctx->fout, "\"%s\"}", inet_ntoa(addr));
+   }
+   else
+   {
+      fprintf(ctx->fout, "\"uid %u\"}", info->source_id);
+   }
+   ctx->num++;
+   return 0;
+}
+
+
+/**********************************************************
+ * Internal function api_leases()
+ *
+ * Description: GET /api/v1/leases, list the leased relays
+ *
+ * Return: HTTP status code
+ *********************************************************/
+static int api_leases(FILE *fout, const char *method, const char *query, uint32_t client_ip)
+{
+   lease_ctx_t ctx = { fout, 0 };
+
+   send_headers(fout, 200, "OK", NULL, "application/json", -1, -1);
+   fprintf(fout, "{\"leases\":[");
+   lease_list(lease_entry, &ctx);
+   fprintf(fout, "\n],\"count\":%d,\"expired\":%llu}\n", ctx.num, (unsigned long long)lease_expired());
+   return 200;
+}
+
+
+/**********************************************************
+ * Internal function api_interlocks()
+ *
+ * Description: GET /api/v1/interlocks, list the interlock
+ *              rules
+ *
+ * Return: HTTP status code
+ *********************************************************/
+static int api_interlocks(FILE *fout, const char *method, const char *query, uint32_t client_ip)
+{
+   interlock_info_t info[INTERLOCK_MAX_RULES];
+   int num, i;
+
+   num = interlock_list(info, INTERLOCK_MAX_RULES);
+   send_headers(fout, 200, "OK", NULL, "application/json", -1, -1);
+   fprintf(fout, "{\"interlocks\":[");
+   for (i=0; i<num; i++)
+   {
+      fprintf(fout, "%s{\"rule\":", i ? ",\n" : "\n");
+      json_string(fout, info[i].def);
+      fprintf(fout, ",\"rejected\":%u}", info[i].rejected);
+   }
+   fprintf(fout, "\n]}\n");
+   return 200;
+}
+
+
+/**********************************************************
+ * Internal function api_scenes()
+ *
+ * Description: GET /api/v1/scenes, list the scenes
+ *              POST /api/v1/scenes, define, delete or
+ *              apply one
+ *
+ * Return: HTTP status code
+ *********************************************************/
+static int api_scenes(FILE *fout, const char *method, const char *query, uint32_t client_ip)
+{
+   scene_entry_t entries[SCENE_MAX];
+   scene_write_t writes[SCENE_MAX_CARDS];
+   char name[SCENE_NAME_LEN], def[SCENE_DEF_LEN], err[64];
+   uint64_t first_start = UINT64_MAX, last_start = 0, first_end = UINT64_MAX, last_end = 0;
+   int num, i, rc;
+
+   if (!strcasecmp(method, "POST"))
+   {
+      if (query_param(query, "apply", name, sizeof(name)) == 0)
+      {
+         rc = scene_apply(name, writes, &num, client_ip);
+         if (rc == -ENOENT) return send_error(fout, 404, "Not Found", "unknown scene");
+         if (rc == -ENODEV) return send_error(fout, 404, "Not Found", "relay card not found");
+         if (rc == -EINVAL) return send_error(fout, 400, "Bad Request", "relay not on card");
+         if (rc == -ENOLINK) return send_error(fout, 503, "Service Unavailable", "relay card unavailable");
+         if (rc == -EPERM)
+         {
+            snprintf(err, sizeof(err), "interlock \"%s\" violated", interlock_violation());
+            return send_error(fout, 409, "Conflict", err);
+         }
+         if (rc == -ETIMEDOUT && writes[0].start_ns == 0)
+            return send_error(fout, 504, "Gateway Timeout", "relay card did not answer in time");
+
+         /* Skew between the cards, at the start and at the end of the writes */
+         for (i=0; i<num; i++)
+         {
+            if (writes[i].start_ns < first_start) first_start = writes[i].start_ns;
+            if (writes[i].start_ns > last_start) last_start = writes[i].start_ns;
+            if (writes[i].end_ns < first_end) first_end = writes[i].end_ns;
+            if (writes[i].end_ns > last_end) last_end = writes[i].end_ns;
+         }
+         if (rc == -ETIMEDOUT)
+            send_headers(fout, 504, "Gateway Timeout", NULL, "application/json", -1, -1);
+         else
+            send_headers(fout, rc < 0 ? 500 : 200, rc < 0 ? "Internal Server Error" : "OK", NULL, "application/json", -1, -1);
+         fprintf(fout, "{\"scene\":");
+         json_string(fout, name);
+         fprintf(fout, ",\"ok\":%s,\"skew_us\":%.1f,\"completion_skew_us\":%.1f,\"cards\":[",
+                 rc < 0 ? "false" : "true", (last_start-first_start)/1e3, (last_end-first_end)/1e3);
+         for (i=0; i<num; i++)
+         {
+            fprintf(fout, "%s{\"card\":", i ? ",\n" : "\n");
+            json_string(fout, writes[i].serial);
+            fprintf(fout, ",\"mask\":%u,\"states\":%u,\"start_us\":%.1f,\"write_us\":%.1f,\"ok\":%s}",
+                    writes[i].mask, writes[i].states, (writes[i].start_ns-first_start)/1e3,
+                    (writes[i].end_ns-writes[i].start_ns)/1e3, writes[i].rc < 0 ? "false" : "true");
+         }
+         fprintf(fout, "\n]}\n");
+         return (rc == -ETIMEDOUT) ? 504 : (rc < 0) ? 500 : 200;
+      }
+      if (query_param(query, "delete", name, sizeof(name)) == 0)
+      {
+         if (scene_delete(name) < 0)
+            return send_error(fout, 404, "Not Found", "unknown scene");
+         send_headers(fout, 200, "OK", NULL, "application/json", -1, -1);
+         fprintf(fout, "{\"deleted\":");
+         json_string(fout, name);
+         fprintf(fout, "}\n");
+         return 200;
+      }
+      if (query_param(query, "name", name, sizeof(name)) < 0 ||
+          query_param(query, "def", def, sizeof(def)) < 0)
+         return send_error(fout, 400, "Bad Request", "missing name and def, delete or apply parameter");
+      if (scene_define(name, def, 0, err, sizeof(err)) < 0)
+         return send_error(fout, 400, "Bad Request", err);
+      syslog(LOG_DAEMON | LOG_NOTICE, "Scene %s defined: %s\n", name, def);
+      send_headers(fout, 201, "Created", NULL, "application/json", -1, -1);
+      fprintf(fout, "{\"name\":");
+      json_string(fout, name);
+      fprintf(fout, "}\n");
+      return 201;
+   }
+
+   num = scene_list(entries, SCENE_MAX);
+   send_headers(fout, 200, "OK", NULL, "application/json", -1, -1);
+   fprintf(fout, "{\"scenes\":[");
+   for (i=0; i<num; i++)
+   {
+      fprintf(fout, "%s{\"name\":", i ? ",\n" : "\n");
+      json_string(fout, entries[i].name);
+      fprintf(fout, ",\"def\":");
+      json_string(fout, entries[i].def);
+      fprintf(fout, ",\"source\":\"%s\"}", entries[i].from_config ? "config" : "api");
+   }
+   fprintf(fout, "\n]}\n");
+   return 200;
+}
+
+
+/**********************************************************
+ * Internal function api_health()
+ *
+ * Description: GET /api/v1/health, list the circuit breaker
+ *              state of the cards
+ *
+ * Return: HTTP status code
+ *********************************************************/
+static int api_health(FILE *fout, const char *method, const char *query, uint32_t client_ip)
+{
+   card_health_t cards[CARD_HEALTH_MAX_CARDS];
+   int num, i;
+
+   num = card_health_list(cards, CARD_HEALTH_MAX_CARDS);
+   send_headers(fout, 200, "OK", NULL, "application/json", -1, -1);
+   fprintf(fout, "{\"cards\":[");
+   for (i=0; i<num; i++)
+   {
+      fprintf(fout, "%s{\"card\":", i ? ",\n" : "\n");
+      json_string(fout, cards[i].serial);
+      fprintf(fout, ",\"state\":\"%s\",\"failures\":%u,\"trips\":%u,\"last_error\":%d,\"retry_ms\":%u}",
+              card_health_state_name(cards[i].state), cards[i].failures, cards[i].trips,
+              cards[i].last_error, cards[i].retry_ms);
+   }
+   fprintf(fout, "\n]}\n");
+   return 200;
+}
+
+
+static const endpoint_t endpoints[] =
+{
+   {"history", api_history},
+   {"stats",   api_stats},
+   {"schedules", api_schedules},
+   {"sequence",  api_sequence},
+   {"waveform",  api_waveform},
+   {"pwm",       api_pwm},
+   {"inputs",    api_inputs},
+   {"emergency-off", api_emergency},
+   {"leases",    api_leases},
+   {"interlocks", api_interlocks},
+   {"scenes",    api_scenes},
+   {"health",    api_health},
+   {NULL, NULL}
+};
+
+
+/**********************************************************
+ * Function http_api_process()
+ *
+ * Description: Process a request for an URL below /api/v1/
+ *              and send the JSON response
+ *
+ * Parameters: fout (in)      - output stream of the client
+ *             method (in)    - request method
+ *             url (in)       - request url incl. query
+ *             body (in)      - POST data [optional]
+ *             client_ip (in) - IPv4 address of the client
+ *
+ * Return: HTTP status code sent
+ *********************************************************/
+int http_api_process(FILE *fout, const char *method, const char *url, const char *body,
+                     uint32_t client_ip)
+{
+   const char *path = url + strlen(HTTP_API_URL);
+   const char *query = strchr(path, '?');
+   size_t len = query ? (size_t)(query-path) : strlen(path);
+   const endpoint_t *ep;
+
+   /* Parameters are taken from the POST data if there are any */
+   if (body != NULL && body[0])
+      query = body;
+   else
+      query = query ? query+1 : "";
+
+   for (ep=endpoints; ep->name != NULL; ep++)
+   {
+      if (strlen(ep->name) == len && !strncmp(path, ep->name, len))
+         return ep->handler(fout, method, query, client_ip);
+   }
+   return send_error(fout, 404, "Not Found", "unknown API endpoint");
+}
+
+
+/**********************************************************
+ * Function http_api_metrics()
+ *
+ * Description: Send the relay statistics in the Prometheus
+ *              text exposition format
+ *
+ * Parameters: fout (in) - output stream of the client
+ *
+ * Return: HTTP status code sent
+ *********************************************************/
+int http_api_metrics(FILE *fout)
+{
+   static const char *metrics[][3] =
+   {
+      {"crelay_relay_state", "gauge", "Last known relay state (1 = on)"},
+      {"crelay_relay_on_seconds_total", "counter", "Cumulative time the relay was on"},
+      {"crelay_relay_switches_total", "counter", "Number of relay state changes"},
+      {"crelay_relay_duty_cycle", "gauge", "Fraction of the time window the relay was on"},
+   };
+   char serial[MAX_SERIAL_LEN];
+   relay_counters_t counters[MAX_NUM_RELAYS];
+   int m, card, num, i;
+
+   send_headers(fout, 200, "OK", NULL, "text/plain; version=0.0.4", -1, -1);
+   for (m=0; m<4; m++)
+   {
+      fprintf(fout, "# HELP %s %s\n# TYPE %s %s\n", metrics[m][0], metrics[m][2], metrics[m][0], metrics[m][1]);
+      for (card=0; (num = relay_stats_get(card, serial, counters)) >= 0; card++)
+      {
+         for (i=0; i<num; i++)
+         {
+            switch (m)
+            {
+               case 0:
+                  fprintf(fout, "%s{card=\"%s\",relay=\"%d\"} %u\n", metrics[m][0], serial, i+FIRST_RELAY,
+                          counters[i].state);
+                  break;
+               case 1:
+                  fprintf(fout, "%s{card=\"%s\",relay=\"%d\"} %llu.%03llu\n", metrics[m][0], serial, i+FIRST_RELAY,
+                          (unsigned long long)(counters[i].on_time_ms/1000),
+                          (unsigned long long)(counters[i].on_time_ms%1000));
+                  break;
+               case 2:
+                  fprintf(fout, "%s{card=\"%s\",relay=\"%d\"} %llu\n", metrics[m][0], serial, i+FIRST_RELAY,
+                          (unsigned long long)counters[i].switch_count);
+                  break;
+               case 3:
+                  fprintf(fout, "%s{card=\"%s\",relay=\"%d\",window=\"1h\"} %.4f\n", metrics[m][0], serial,
+                          i+FIRST_RELAY, counters[i].duty_1h);
+                  fprintf(fout, "%s{card=\"%s\",relay=\"%d\",window=\"24h\"} %.4f\n", metrics[m][0], serial,
+                          i+FIRST_RELAY, counters[i].duty_24h);
+                  break;
+            }
+         }
+      }
+   }
+   return 200;
+}
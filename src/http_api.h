@@ -0,0 +1,78 @@
+/******************************************************************************
+ *
+ * Relay card control utility: JSON HTTP API
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the request handler for the
+ *   JSON based HTTP API below /api/v1/.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef http_api_h
+#define http_api_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define HTTP_API_URL "/api/v1/"
+#define HTTP_METRICS_URL "/metrics"
+
+/* Implemented in crelay.c */
+void send_headers(FILE *f, int status, char *title, char *extra, char *mime,
+                  int length, time_t date);
+
+/**********************************************************
+ * Function http_api_process()
+ *
+ * Description: Process a request for an URL below /api/v1/
+ *              and send the JSON response
+ *
+ * Parameters: fout (in)      - output stream of the client
+ *             method (in)    - request method
+ *             url (in)       - request url incl. query
+ *             body (in)      - POST data [optional]
+ *             client_ip (in) - IPv4 address of the client
+ *
+ * Return: HTTP status code sent
+ *********************************************************/
+int http_api_process(FILE *fout, const char *method, const char *url, const char *body,
+                     uint32_t client_ip);
+
+/**********************************************************
+ * Function http_api_metrics()
+ *
+ * Description: Send the relay statistics in the Prometheus
+ *              text exposition format
+ *
+ * Parameters: fout (in) - output stream of the client
+ *
+ * Return: HTTP status code sent
+ *********************************************************/
+int http_api_metrics(FILE *fout);
+
+#endif
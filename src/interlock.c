@@ -0,0 +1,566 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Relay interlocks
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the interlocks, see interlock.h.
+ *
+ *   An exclusive rule is a rule with a limit of one relay. The table of a
+ *   card is compiled when the card is first locked and holds the rules
+ *   which apply to it, with the union of their relays, so a write which
+ *   switches on none of them is allowed with a single test. For the
+ *   others only the rules containing a relay which is switched on are
+ *   looked at, with x & (x-1) for the exclusive ones and a population
+ *   count for the others.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+#include <pthread.h>
+
+#include "relay_drv.h"
+#include "interlock.h"
+#include "data_types.h"
+
+extern config_t config;
+
+typedef struct
+{
+   char        serial[MAX_SERIAL_LEN];  /* empty for all cards */
+   uint16_t    mask;
+   uint8_t     max_on;
+   const char *def;
+   uint32_t    rejected;
+}
+rule_t;
+
+/* Compiled rules of a card */
+typedef struct
+{
+   uint16_t covered;                      /* relays in any rule */
+   uint16_t mask[INTERLOCK_MAX_RULES];
+   uint8_t  max_on[INTERLOCK_MAX_RULES];
+   uint8_t  rule[INTERLOCK_MAX_RULES];    /* index in g_rules */
+   int      num;
+}
+table_t;
+
+struct interlock_card_s
+{
+   char            key[MAX_COM_PORT_NAME_LEN];
+   pthread_mutex_t lock;
+   int             users;
+   uint64_t        used_ns;
+   table_t         table;
+   uint16_t        states;
+   uint64_t        read_ns;                /* 0 if the states are unknown */
+};
+
+static rule_t           g_rules[INTERLOCK_MAX_RULES];
+static int              g_num_rules = 0;
+static interlock_card_t g_cards[INTERLOCK_MAX_CARDS];
+static char             g_default[MAX_SERIAL_LEN] = "";
+
+static pthread_once_t  g_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Rule which rejected the last write of the thread, -1 if none */
+static __thread int g_violated = -1;
+
+
+static uint64_t monotonic_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+/**********************************************************
+ * Internal function parse_rule()
+ *
+ * Description: Parse a rule definition
+ *
+ * Return:  0 - success
+ *         -1 - invalid definition
+ *********************************************************/
+static int parse_rule(const char *def, rule_t *rule)
+{
+   char relays[64], kind[16], *p, *end;
+   unsigned int max_on = 1;
+   long relay;
+   int n;
+
+   n = sscanf(def, "%63s %15s %u", relays, kind, &max_on);
+   if (!(n == 2 && !strcmp(kind, "exclusive")) && !(n == 3 && !strcmp(kind, "max")))
+      return -1;
+
+   memset(rule, 0, sizeof(rule_t));
+   p = relays;
+   if ((end = strchr(p, ':')) != NULL)
+   {
+      if (end-p >= MAX_SERIAL_LEN) return -1;
+      memcpy(rule->serial, p, end-p);
+      p = end+1;
+   }
+   while (*p)
+   {
+      relay = strtol(p, &end, 10);
+      if (end == p || relay < FIRST_RELAY || relay >= FIRST_RELAY+MAX_NUM_RELAYS || (*end && *end != ','))
+         return -1;
+      rule->mask |= 1 << (relay-FIRST_RELAY);
+      p = (*end == ',') ? end+1 : end;
+   }
+
+   /* A limit which all relays of the rule meet is a mistake */
+   if (max_on < 1 || max_on >= (unsigned int)__builtin_popcount(rule->mask))
+      return -1;
+   rule->max_on = max_on;
+   rule->def = def;
+   return 0;
+}
+
+
+/**********************************************************
+ * Internal function interlock_init()
+ *
+ * Description: Parse the rules of the configuration (done
+ *              once)
+ *
+ * Return: none
+ *********************************************************/
+static void interlock_init(void)
+{
+   int i;
+
+   for (i=0; i<config.num_interlocks && g_num_rules < INTERLOCK_MAX_RULES; i++)
+   {
+      if (parse_rule(config.interlocks[i], &g_rules[g_num_rules]) < 0)
+      {
+         syslog(LOG_DAEMON | LOG_ERR, "Invalid interlock rule \"%s\"\n", config.interlocks[i]);
+         continue;
+      }
+      g_num_rules++;
+   }
+   for (i=0; i<INTERLOCK_MAX_CARDS; i++)
+      pthread_mutex_init(&g_cards[i].lock, NULL);
+}
+
+
+/**********************************************************
+ * Internal function resolve()
+ *
+ * Description: Get the serial number of the card of a
+ *              request, the default card for NULL
+ *
+ * Return: serial number, NULL if unknown
+ *********************************************************/
+static const char* resolve(const char *serial)
+{
+   if (serial == NULL && g_default[0])
+      return g_default;
+   return serial;
+}
+
+
+/**********************************************************
+ * Internal function compile()
+ *
+ * Description: Build the table of the rules which apply
+ *              to a card
+ *
+ * Return: none
+ *********************************************************/
+static void compile(const char *serial, table_t *table)
+{
+   int i;
+
+   memset(table, 0, sizeof(table_t));
+   for (i=0; i<g_num_rules; i++)
+   {
+      if (g_rules[i].serial[0] && (serial == NULL || strcmp(g_rules[i].serial, serial)))
+         continue;
+      table->mask[table->num] = g_rules[i].mask;
+      table->max_on[table->num] = g_rules[i].max_on;
+      table->rule[table->num] = i;
+      table->covered |= g_rules[i].mask;
+      table->num++;
+   }
+}
+
+
+/**********************************************************
+ * Internal function check()
+ *
+ * Description: Check new relay states against a table
+ *
+ * Return: index of the broken rule in the table, -1 if none
+ *********************************************************/
+static inline int check(const table_t *table, uint16_t on, uint16_t states)
+{
+   uint16_t x;
+   int i;
+
+   if (!(on & table->covered))
+      return -1;
+   for (i=0; i<table->num; i++)
+   {
+      if (!(on & table->mask[i]))
+         continue;
+      x = states & table->mask[i];
+      if (table->max_on[i] == 1 ? (x & (x-1)) != 0 : __builtin_popcount(x) > table->max_on[i])
+         return i;
+   }
+   return -1;
+}
+
+
+/**********************************************************
+ * Internal function reject()
+ *
+ * Description: Count and log a rejected write
+ *
+ * Return: -EPERM
+ *********************************************************/
+static int reject(const table_t *table, int i, const char *key, uint16_t states)
+{
+   rule_t *rule = &g_rules[table->rule[i]];
+
+   g_violated = table->rule[i];
+   __atomic_fetch_add(&rule->rejected, 1, __ATOMIC_RELAXED);
+   syslog(LOG_DAEMON | LOG_WARNING, "Interlock \"%s\": states 0x%04x of card %s rejected\n",
+          rule->def, states, key);
+   return -EPERM;
+}
+
+
+/**********************************************************
+ * Function interlock_active()
+ *
+ * Description: Check if interlock rules are configured
+ *
+ * Parameters: none
+ *
+ * Return: 1 if rules are configured, 0 otherwise
+ *********************************************************/
+int interlock_active(void)
+{
+   pthread_once(&g_once, interlock_init);
+   return g_num_rules > 0;
+}
+
+
+/**********************************************************
+ * Function interlock_set_default()
+ *
+ * Description: Set the serial number of the card which is
+ *              used for requests without serial number
+ *
+ * Parameters: serial (in) - serial number of the first card
+ *
+ * Return: none
+ *********************************************************/
+void interlock_set_default(const char *serial)
+{
+   pthread_mutex_lock(&g_lock);
+   snprintf(g_default, sizeof(g_default), "%s", serial ? serial : "");
+   pthread_mutex_unlock(&g_lock);
+}
+
+
+/**********************************************************
+ * Function interlock_lock()
+ *
+ * Description: Lock a card for checking and writing its
+ *              relays
+ *
+ * Parameters: portname (in) - communication port
+ *             serial (in)   - serial number, NULL for the
+ *                             default card
+ *
+ * Return: card, NULL if too many cards are locked
+ *********************************************************/
+interlock_card_t* interlock_lock(const char *portname, const char *serial)
+{
+   interlock_card_t *card = NULL;
+   const char *key;
+   int i;
+
+   pthread_once(&g_once, interlock_init);
+   pthread_mutex_lock(&g_lock);
+   serial = resolve(serial);
+   key = serial ? serial : portname;
+
+   /* Reuse the least recently used entry which is not locked */
+   for (i=0; i<INTERLOCK_MAX_CARDS; i++)
+   {
+      if (!strcmp(g_cards[i].key, key))
+      {
+         card = &g_cards[i];
+         break;
+      }
+      if (g_cards[i].users == 0 && (card == NULL || g_cards[i].used_ns < card->used_ns))
+         card = &g_cards[i];
+   }
+   if (card == NULL)
+   {
+      pthread_mutex_unlock(&g_lock);
+      return NULL;
+   }
+   if (i == INTERLOCK_MAX_CARDS)
+   {
+      snprintf(card->key, sizeof(card->key), "%s", key);
+      compile(serial, &card->table);
+      card->read_ns = 0;
+   }
+   card->users++;
+   card->used_ns = monotonic_ns();
+   pthread_mutex_unlock(&g_lock);
+
+   pthread_mutex_lock(&card->lock);
+   return card;
+}
+
+
+/**********************************************************
+ * Function interlock_unlock()
+ *
+ * Description: Unlock a card locked by interlock_lock()
+ *
+ * Parameters: card (in) - card
+ *
+ * Return: none
+ *********************************************************/
+void interlock_unlock(interlock_card_t *card)
+{
+   pthread_mutex_unlock(&card->lock);
+   pthread_mutex_lock(&g_lock);
+   card->users--;
+   pthread_mutex_unlock(&g_lock);
+}
+
+
+/**********************************************************
+ * Function interlock_states()
+ *
+ * Description: Get the relay states kept for a locked card
+ *
+ * Parameters: card (in)    - card
+ *             states (out) - relay states
+ *
+ * Return: 1 if the states are known and recent enough,
+ *         0 if they have to be read from the card
+ *********************************************************/
+int interlock_states(interlock_card_t *card, uint16_t *states)
+{
+   if (card->read_ns == 0 || monotonic_ns()-card->read_ns > INTERLOCK_READ_MS*1000000ULL)
+      return 0;
+   *states = card->states;
+   return 1;
+}
+
+
+/**********************************************************
+ * Function interlock_update()
+ *
+ * Description: Update the relay states kept for a locked
+ *              card after a read or a write
+ *
+ * Parameters: card (in)   - card
+ *             mask (in)   - relays read or written
+ *             states (in) - relay states
+ *             read (in)   - non zero if read from the card
+ *
+ * Return: none
+ *********************************************************/
+void interlock_update(interlock_card_t *card, uint16_t mask, uint16_t states, int read)
+{
+   card->states = (card->states & ~mask) | (states & mask);
+   if (read)
+      card->read_ns = monotonic_ns();
+}
+
+
+/**********************************************************
+ * Function interlock_forget()
+ *
+ * Description: Mark the relay states of a card as unknown,
+ *              after a failed write or a write which did
+ *              not go through interlock_check()
+ *
+ * Parameters: card (in)     - locked card, or NULL to look
+ *                             it up by portname and serial
+ *             portname (in) - communication port
+ *             serial (in)   - serial number, NULL for the
+ *                             default card
+ *
+ * Return: none
+ *********************************************************/
+void interlock_forget(interlock_card_t *card, const char *portname, const char *serial)
+{
+   if (card != NULL)
+   {
+      card->read_ns = 0;
+   }
+   else if ((card = interlock_lock(portname, serial)) != NULL)
+   {
+      card->read_ns = 0;
+      interlock_unlock(card);
+   }
+}
+
+
+/**********************************************************
+ * Function interlock_check()
+ *
+ * Description: Check a write of a locked card against the
+ *              rules of the card
+ *
+ * Parameters: card (in)    - card
+ *             current (in) - current relay states
+ *             mask (in)    - relays to change
+ *             states (in)  - new relay states
+ *
+ * Return: 0 if allowed, -EPERM if a rule would be broken
+ *********************************************************/
+int interlock_check(interlock_card_t *card, uint16_t current, uint16_t mask, uint16_t states)
+{
+   uint16_t next = (current & ~mask) | (states & mask);
+   int i;
+
+   /* Only relays which are switched on can break a rule */
+   if ((i = check(&card->table, next & ~current, next)) < 0)
+      return 0;
+   return reject(&card->table, i, card->key, next);
+}
+
+
+/**********************************************************
+ * Function interlock_check_states()
+ *
+ * Description: Check complete relay states of a card, e.g.
+ *              the samples of a waveform or the relays a
+ *              scene switches on
+ *
+ * Parameters: serial (in) - serial number, NULL for the
+ *                           default card
+ *             states (in) - relay states
+ *             num (in)    - number of states
+ *
+ * Return: 0 if allowed, -EPERM if a rule would be broken
+ *********************************************************/
+int interlock_check_states(const char *serial, const uint16_t *states, uint32_t num)
+{
+   table_t table;
+   uint32_t n;
+   int i;
+
+   if (!interlock_active())
+      return 0;
+   pthread_mutex_lock(&g_lock);
+   serial = resolve(serial);
+   compile(serial, &table);
+   pthread_mutex_unlock(&g_lock);
+
+   for (n=0; n<num; n++)
+   {
+      if (n > 0 && states[n] == states[n-1])
+         continue;
+      if ((i = check(&table, states[n], states[n])) >= 0)
+         return reject(&table, i, serial ? serial : "(default)", states[n]);
+   }
+   return 0;
+}
+
+
+/**********************************************************
+ * Function interlock_covers()
+ *
+ * Description: Check if relays are in a rule of a card
+ *
+ * Parameters: serial (in) - serial number, NULL for a card
+ *                           without one (GPIO)
+ *             mask (in)   - relays
+ *
+ * Return: 1 if a relay is in a rule, 0 otherwise
+ *********************************************************/
+int interlock_covers(const char *serial, uint16_t mask)
+{
+   table_t table;
+
+   if (!interlock_active())
+      return 0;
+   compile(serial, &table);
+   return (table.covered & mask) != 0;
+}
+
+
+/**********************************************************
+ * Function interlock_violation()
+ *
+ * Description: Get the rule which rejected the last write
+ *              of the calling thread
+ *
+ * Parameters: none
+ *
+ * Return: rule as in the config file, "" if none
+ *********************************************************/
+const char* interlock_violation(void)
+{
+   return (g_violated >= 0) ? g_rules[g_violated].def : "";
+}
+
+
+/**********************************************************
+ * Function interlock_list()
+ *
+ * Description: Get the rules and their rejection counts
+ *
+ * Parameters: info (out) - rules
+ *             max (in)   - size of info
+ *
+ * Return: number of rules
+ *********************************************************/
+int interlock_list(interlock_info_t *info, int max)
+{
+   int i;
+
+   pthread_once(&g_once, interlock_init);
+   for (i=0; i<g_num_rules && i<max; i++)
+   {
+      info[i].def = g_rules[i].def;
+      info[i].rejected = __atomic_load_n(&g_rules[i].rejected, __ATOMIC_RELAXED);
+   }
+   return i;
+}
@@ -0,0 +1,235 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Relay interlocks
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the interlocks, which keep
+ *   relays from being on together, e.g. the forward and reverse relays
+ *   of a motor, or limit the number of relays of a group which are on
+ *   at the same time:
+ *     [serial:]<relay>,<relay>[,<relay>...] exclusive
+ *     [serial:]<relay>,<relay>[,<relay>...] max <n>
+ *   A rule without serial number applies to every card, a rule with
+ *   serial number also to the requests without serial number when the
+ *   card is the first one.
+ *
+ *   The rules are compiled into a table of relay masks and limits for
+ *   each card, so checking a write takes a few bit operations per rule
+ *   which contains a relay to be switched on. A write which would break
+ *   a rule is rejected as a whole with -EPERM, no relay is switched.
+ *   Turn-offs are never rejected.
+ *
+ *   The check needs the states of the other relays of the card. They are
+ *   kept from the writes done through the daemon and read from the card
+ *   when they are older than INTERLOCK_READ_MS, to notice changes made
+ *   by others. The check and the write are done with the card locked, so
+ *   concurrent writes can not break a rule together.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef interlock_h
+#define interlock_h
+
+#include <stdint.h>
+
+#define INTERLOCK_MAX_RULES  32
+#define INTERLOCK_MAX_CARDS  32
+#define INTERLOCK_READ_MS    2000   /* max. age of the states read from a card */
+
+typedef struct interlock_card_s interlock_card_t;
+
+/* Rule, as returned by interlock_list() */
+typedef struct
+{
+   const char *def;        /* rule as in the config file */
+   uint32_t    rejected;   /* writes rejected by the rule */
+}
+interlock_info_t;
+
+
+/**********************************************************
+ * Function interlock_active()
+ *
+ * Description: Check if interlock rules are configured
+ *
+ * Parameters: none
+ *
+ * Return: 1 if rules are configured, 0 otherwise
+ *********************************************************/
+int interlock_active(void);
+
+/**********************************************************
+ * Function interlock_set_default()
+ *
+ * Description: Set the serial number of the card which is
+ *              used for requests without serial number
+ *
+ * Parameters: serial (in) - serial number of the first card
+ *
+ * Return: none
+ *********************************************************/
+void interlock_set_default(const char *serial);
+
+/**********************************************************
+ * Function interlock_lock()
+ *
+ * Description: Lock a card for checking and writing its
+ *              relays
+ *
+ * Parameters: portname (in) - communication port
+ *             serial (in)   - serial number, NULL for the
+ *                             default card
+ *
+ * Return: card, NULL if too many cards are locked
+ *********************************************************/
+interlock_card_t* interlock_lock(const char *portname, const char *serial);
+
+/**********************************************************
+ * Function interlock_unlock()
+ *
+ * Description: Unlock a card locked by interlock_lock()
+ *
+ * Parameters: card (in) - card
+ *
+ * Return: none
+ *********************************************************/
+void interlock_unlock(interlock_card_t *card);
+
+/**********************************************************
+ * Function interlock_states()
+ *
+ * Description: Get the relay states kept for a locked card
+ *
+ * Parameters: card (in)    - card
+ *             states (out) - relay states
+ *
+ * Return: 1 if the states are known and recent enough,
+ *         0 if they have to be read from the card
+ *********************************************************/
+int interlock_states(interlock_card_t *card, uint16_t *states);
+
+/**********************************************************
+ * Function interlock_update()
+ *
+ * Description: Update the relay states kept for a locked
+ *              card after a read or a write
+ *
+ * Parameters: card (in)   - card
+ *             mask (in)   - relays read or written
+ *             states (in) - relay states
+ *             read (in)   - non zero if read from the card
+ *
+ * Return: none
+ *********************************************************/
+void interlock_update(interlock_card_t *card, uint16_t mask, uint16_t states, int read);
+
+/**********************************************************
+ * Function interlock_forget()
+ *
+ * Description: Mark the relay states of a card as unknown,
+ *              after a failed write or a write which did
+ *              not go through interlock_check()
+ *
+ * Parameters: card (in)     - locked card, or NULL to look
+ *                             it up by portname and serial
+ *             portname (in) - communication port
+ *             serial (in)   - serial number, NULL for the
+ *                             default card
+ *
+ * Return: none
+ *********************************************************/
+void interlock_forget(interlock_card_t *card, const char *portname, const char *serial);
+
+/**********************************************************
+ * Function interlock_check()
+ *
+ * Description: Check a write of a locked card against the
+ *              rules of the card
+ *
+ * Parameters: card (in)    - card
+ *             current (in) - current relay states
+ *             mask (in)    - relays to change
+ *             states (in)  - new relay states
+ *
+ * Return: 0 if allowed, -EPERM if a rule would be broken
+ *********************************************************/
+int interlock_check(interlock_card_t *card, uint16_t current, uint16_t mask, uint16_t states);
+
+/**********************************************************
+ * Function interlock_check_states()
+ *
+ * Description: Check complete relay states of a card, e.g.
+ *              the samples of a waveform or the relays a
+ *              scene switches on
+ *
+ * Parameters: serial (in) - serial number, NULL for the
+ *                           default card
+ *             states (in) - relay states
+ *             num (in)    - number of states
+ *
+ * Return: 0 if allowed, -EPERM if a rule would be broken
+ *********************************************************/
+int interlock_check_states(const char *serial, const uint16_t *states, uint32_t num);
+
+/**********************************************************
+ * Function interlock_covers()
+ *
+ * Description: Check if relays are in a rule of a card
+ *
+ * Parameters: serial (in) - serial number, NULL for a card
+ *                           without one (GPIO)
+ *             mask (in)   - relays
+ *
+ * Return: 1 if a relay is in a rule, 0 otherwise
+ *********************************************************/
+int interlock_covers(const char *serial, uint16_t mask);
+
+/**********************************************************
+ * Function interlock_violation()
+ *
+ * Description: Get the rule which rejected the last write
+ *              of the calling thread
+ *
+ * Parameters: none
+ *
+ * Return: rule as in the config file, "" if none
+ *********************************************************/
+const char* interlock_violation(void);
+
+/**********************************************************
+ * Function interlock_list()
+ *
+ * Description: Get the rules and their rejection counts
+ *
+ * Parameters: info (out) - rules
+ *             max (in)   - size of info
+ *
+ * Return: number of rules
+ *********************************************************/
+int interlock_list(interlock_info_t *info, int max);
+
+#endif
@@ -0,0 +1,648 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Relay leases
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the implementation of the relay leases, see
+ *   lease.h.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+
+#include "relay_drv.h"
+#include "lease.h"
+#include "timer_wheel.h"
+#include "interlock.h"
+#include "history.h"
+#include "crelay.h"
+
+typedef struct lease_s
+{
+   timer_wheel_entry_t timer;    /* first member, the wheel returns it */
+   struct lease_s *hnext;        /* hash chain or free list */
+   struct lease_s *gnext;        /* next group, while expiring */
+   struct lease_s *bnext;        /* group chain of an expiry bucket */
+   uint8_t  active;
+   uint8_t  relay;
+   uint8_t  num_relays;
+   uint8_t  state;
+   uint8_t  restore;
+   uint8_t  source;
+   uint8_t  failed;              /* switching back failed, retrying */
+   uint32_t id;
+   uint32_t source_id;
+   uint32_t lease_ms;
+   uint32_t renewals;
+   uint64_t expires_ms;          /* CLOCK_MONOTONIC */
+   char     serial[MAX_SERIAL_LEN];
+} lease_t;
+
+static lease_t       *g_leases = NULL;
+static int            g_max = 0;
+static lease_t       *g_free = NULL;
+static int            g_num_free = 0;
+static lease_t      **g_hash = NULL;
+static lease_t      **g_groups = NULL;  /* groups of the expiring leases */
+static uint32_t       g_hash_mask = 0;
+static timer_wheel_t  g_wheel;
+static uint32_t       g_next_id = 0;
+static uint64_t       g_expired = 0;
+static char           g_default[MAX_SERIAL_LEN] = "";
+
+
+static uint64_t now_ms(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+
+/* FNV-1a hash of the serial number, the relay is added by bucket() */
+static uint32_t hash_serial(const char *serial)
+{
+   uint32_t h = 2166136261u;
+
+   while (*serial)
+   {
+      h ^= (uint8_t)*serial++;
+      h *= 16777619u;
+   }
+   return h;
+}
+
+
+/* Serial number of the default card for an empty one */
+static const char* resolve(const char *serial)
+{
+   return serial[0] ? serial : g_default;
+}
+
+
+static lease_t** bucket(uint32_t h, uint8_t relay)
+{
+   h ^= relay;
+   h *= 16777619u;
+   return &g_hash[h & g_hash_mask];
+}
+
+
+static lease_t* find(const char *serial, uint32_t h, uint8_t relay)
+{
+   lease_t *lease;
+
+   for (lease = *bucket(h, relay); lease != NULL; lease = lease->hnext)
+   {
+      if (lease->relay == relay && !strcmp(lease->serial, serial))
+         return lease;
+   }
+   return NULL;
+}
+
+
+/**********************************************************
+ * Internal function free_lease()
+ *
+ * Description: Stop the timer of a lease, remove it from the
+ *              hash table and put it on the free list
+ *
+ * Return: none
+ *********************************************************/
+static void free_lease(lease_t *lease)
+{
+   lease_t **pp;
+
+   timer_wheel_del(&g_wheel, &lease->timer);
+   for (pp = bucket(hash_serial(lease->serial), lease->relay); *pp != NULL; pp = &(*pp)->hnext)
+   {
+      if (*pp == lease)
+      {
+         *pp = lease->hnext;
+         break;
+      }
+   }
+   lease->active = 0;
+   lease->hnext = g_free;
+   g_free = lease;
+   g_num_free++;
+}
+
+
+/**********************************************************
+ * Internal function switch_back()
+ *
+ * Description: Switch back the relays of a group of expired
+ *              leases of the same card and leased set, the
+ *              leases are retried later if this fails
+ *
+ * Parameters: group (in) - leases linked by timer.next
+ *
+ * Return: none
+ *********************************************************/
+static void switch_back(lease_t *group)
+{
+   char portname[MAX_COM_PORT_NAME_LEN];
+   char *serial = group->serial[0] ? group->serial : NULL;
+   uint8_t num_relays = FIRST_RELAY;
+   uint16_t mask = 0, restore = 0, states;
+   lease_t *lease, *next;
+   int n = 0, rc;
+
+   for (lease = group; lease != NULL; lease = (lease_t*)lease->timer.next)
+   {
+      mask |= 1 << (lease->relay-FIRST_RELAY);
+      if (lease->restore) restore |= 1 << (lease->relay-FIRST_RELAY);
+   }
+
+   if ((rc = crelay_detect_relay_card(portname, &num_relays, serial, NULL)) == 0 &&
+       (rc = crelay_set_relay_mask(portname, mask, restore, serial)) == -EPERM)
+   {
+      /* The relays set meanwhile keep theirs, the leased ones stay off */
+      syslog(LOG_DAEMON | LOG_WARNING, "Lease %u: switch back breaks interlock \"%s\", relays 0x%04x of card %s switched off\n",
+             group->id, interlock_violation(), mask, group->serial);
+      rc = crelay_set_relay_mask(portname, mask, 0, serial);
+   }
+   if (rc < 0 || (rc = crelay_get_relay_mask(portname, &states, serial)) < 0)
+   {
+      if (!group->failed)
+         syslog(LOG_DAEMON | LOG_ERR, "Failed to switch back expired lease %u on card %s (%d), retrying\n",
+                group->id, group->serial, rc);
+      for (lease = group; lease != NULL; lease = next)
+      {
+         next = (lease_t*)lease->timer.next;
+         lease->failed = 1;
+         timer_wheel_add(&g_wheel, &lease->timer, now_ms() + LEASE_RETRY_MS);
+      }
+      return;
+   }
+
+   syslog(LOG_DAEMON | LOG_NOTICE, "Lease %u expired, relays 0x%04x of card %s switched back\n",
+          group->id, mask, group->serial);
+   publish_states(group->serial, num_relays, mask, states, HISTORY_SRC_LEASE, group->id);
+
+   for (lease = group; lease != NULL; lease = next)
+   {
+      next = (lease_t*)lease->timer.next;
+      lease->timer.next = NULL;
+      free_lease(lease);
+      n++;
+   }
+   g_expired += n;
+}
+
+
+/**********************************************************
+ * Function lease_init()
+ *
+ * Description: Allocate the leases and the hash table
+ *
+ * Parameters: max_leases (in) - max. number of leased
+ *                               relays, 0 for the default
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int lease_init(int max_leases)
+{
+   uint32_t size = 1;
+   int i;
+
+   if (max_leases <= 0) max_leases = LEASE_DEFAULT_MAX;
+   if (max_leases > LEASE_MAX) max_leases = LEASE_MAX;
+
+   /* At most one lease per bucket on average */
+   while (size < (uint32_t)max_leases) size <<= 1;
+
+   g_leases = calloc(max_leases, sizeof(lease_t));
+   g_hash = calloc(size, sizeof(lease_t*));
+   g_groups = calloc(size, sizeof(lease_t*));
+   if (g_leases == NULL || g_hash == NULL || g_groups == NULL)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to allocate %d leases\n", max_leases);
+      lease_close();
+      return -1;
+   }
+   g_hash_mask = size-1;
+   g_max = max_leases;
+
+   g_free = NULL;
+   for (i=max_leases-1; i>=0; i--)
+   {
+      g_leases[i].hnext = g_free;
+      g_free = &g_leases[i];
+   }
+   g_num_free = max_leases;
+   timer_wheel_init(&g_wheel, now_ms());
+
+   return 0;
+}
+
+
+/**********************************************************
+ * Function lease_close()
+ *
+ * Description: Free the leases, the relays are not switched
+ *              back
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void lease_close(void)
+{
+   free(g_leases);
+   free(g_hash);
+   free(g_groups);
+   g_leases = NULL;
+   g_hash = NULL;
+   g_groups = NULL;
+   g_free = NULL;
+   g_num_free = 0;
+   g_max = 0;
+}
+
+
+/**********************************************************
+ * Function lease_set_default()
+ *
+ * Description: Set the serial number of the card which is
+ *              used for requests without serial number, so
+ *              its leases are the same with and without
+ *              serial number
+ *
+ * Parameters: serial (in) - serial number of the first card
+ *
+ * Return: none
+ *********************************************************/
+void lease_set_default(const char *serial)
+{
+   snprintf(g_default, sizeof(g_default), "%s", serial ? serial : "");
+}
+
+
+/**********************************************************
+ * Function lease_renew()
+ *
+ * Description: Renew the leases of relays without accessing
+ *              the card, if all of them are leased in the
+ *              requested state
+ *
+ * Parameters: serial (in)      - card serial number, empty
+ *                                for the first card
+ *             mask (in)        - relays to renew
+ *             states (in)      - requested relay states
+ *             lease_ms (in)    - new lease duration
+ *             num_relays (out) - number of relays on the card
+ *
+ * Return: 0 on success, -ENOENT if a relay is not leased in
+ *         the requested state (nothing is renewed),
+ *         -EINVAL if the duration is invalid
+ *********************************************************/
+int lease_renew(const char *serial, uint16_t mask, uint16_t states, uint32_t lease_ms, uint8_t *num_relays)
+{
+   lease_t *leases[MAX_NUM_RELAYS];
+   uint64_t expires;
+   uint32_t h;
+   int i, n = 0;
+
+   if (lease_ms < LEASE_MIN_MS || lease_ms > LEASE_MAX_MS)
+      return -EINVAL;
+   if (g_leases == NULL || mask == 0)
+      return -ENOENT;
+
+   serial = resolve(serial);
+   h = hash_serial(serial);
+   for (i=0; i<MAX_NUM_RELAYS; i++)
+   {
+      if (!(mask & (1<<i))) continue;
+      leases[n] = find(serial, h, i+FIRST_RELAY);
+      if (leases[n] == NULL || leases[n]->state != ((states >> i) & 1) || leases[n]->failed)
+         return -ENOENT;
+      n++;
+   }
+
+   expires = now_ms() + lease_ms;
+   for (i=0; i<n; i++)
+   {
+      leases[i]->lease_ms = lease_ms;
+      leases[i]->expires_ms = expires;
+      leases[i]->renewals++;
+      timer_wheel_add(&g_wheel, &leases[i]->timer, expires);
+   }
+   *num_relays = leases[0]->num_relays;
+   return 0;
+}
+
+
+/**********************************************************
+ * Function lease_set()
+ *
+ * Description: Set relays and lease them, relays which are
+ *              leased already keep the state to switch
+ *              back to
+ *
+ * Parameters: portname (in)   - communication port
+ *             serial (in)     - card serial number, empty
+ *                               for the first card
+ *             num_relays (in) - number of relays on the card
+ *             mask (in)       - relays to set
+ *             states (in)     - new relay states
+ *             lease_ms (in)   - lease duration
+ *             source (in)     - history_source_t of the
+ *                               request
+ *             source_id (in)  - IPv4 address or user id
+ *             result (out)    - relay states after the set
+ *
+ * Return: 0 on success, -EINVAL if the mask or duration is
+ *         invalid, -ENOSPC if there are not enough free
+ *         leases, error of the card access otherwise
+ *********************************************************/
+int lease_set(char *portname, char *serial, uint8_t num_relays, uint16_t mask, uint16_t states,
+              uint32_t lease_ms, uint8_t source, uint32_t source_id, uint16_t *result)
+{
+   lease_t *lease, **head;
+   const char *key;
+   uint16_t current;
+   uint64_t expires;
+   uint32_t h;
+   int i, needed = 0, rc;
+
+   if (mask == 0 || (mask >> num_relays) != 0 || lease_ms < LEASE_MIN_MS || lease_ms > LEASE_MAX_MS)
+      return -EINVAL;
+   if (g_leases == NULL)
+      return -ENOSPC;
+
+   /* Check for free leases before switching */
+   key = resolve(serial);
+   h = hash_serial(key);
+   for (i=0; i<num_relays; i++)
+   {
+      if ((mask & (1<<i)) && find(key, h, i+FIRST_RELAY) == NULL) needed++;
+   }
+   if (needed > g_num_free)
+      return -ENOSPC;
+
+   if ((rc = crelay_get_relay_mask(portname, &current, serial[0] ? serial : NULL)) < 0 ||
+       (rc = crelay_set_relay_mask(portname, mask, states, serial[0] ? serial : NULL)) < 0)
+      return rc;
+
+   if (needed > 0) g_next_id++;
+   expires = now_ms() + lease_ms;
+   for (i=0; i<num_relays; i++)
+   {
+      if (!(mask & (1<<i))) continue;
+      if ((lease = find(key, h, i+FIRST_RELAY)) == NULL)
+      {
+         lease = g_free;
+         g_free = lease->hnext;
+         g_num_free--;
+         memset(lease, 0, sizeof(lease_t));
+         strcpy(lease->serial, key);
+         lease->relay = i+FIRST_RELAY;
+         lease->restore = (current >> i) & 1;
+         lease->id = g_next_id;
+         lease->source = source;
+         lease->source_id = source_id;
+         lease->active = 1;
+         head = bucket(h, lease->relay);
+         lease->hnext = *head;
+         *head = lease;
+      }
+      else
+      {
+         lease->renewals++;
+      }
+      lease->state = (states >> i) & 1;
+      lease->num_relays = num_relays;
+      lease->lease_ms = lease_ms;
+      lease->expires_ms = expires;
+      lease->failed = 0;
+      timer_wheel_add(&g_wheel, &lease->timer, expires);
+   }
+
+   *result = (current & ~mask) | (states & mask);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function lease_release()
+ *
+ * Description: End the leases of relays without switching
+ *              them back, called when they are set without
+ *              lease
+ *
+ * Parameters: serial (in) - card serial number, empty for
+ *                           the first card
+ *             mask (in)   - relays
+ *
+ * Return: none
+ *********************************************************/
+void lease_release(const char *serial, uint16_t mask)
+{
+   lease_t *lease;
+   uint32_t h;
+   int i;
+
+   if (g_leases == NULL || g_wheel.count == 0) return;
+
+   serial = resolve(serial);
+   h = hash_serial(serial);
+   for (i=0; i<MAX_NUM_RELAYS; i++)
+   {
+      if ((mask & (1<<i)) && (lease = find(serial, h, i+FIRST_RELAY)) != NULL)
+         free_lease(lease);
+   }
+}
+
+
+/**********************************************************
+ * Function lease_cancel_all()
+ *
+ * Description: End all leases without switching the relays
+ *              back
+ *
+ * Parameters: none
+ *
+ * Return: number of leases ended
+ *********************************************************/
+int lease_cancel_all(void)
+{
+   int i, n = 0;
+
+   for (i=0; i<g_max; i++)
+   {
+      if (g_leases[i].active)
+      {
+         free_lease(&g_leases[i]);
+         n++;
+      }
+   }
+   return n;
+}
+
+
+/**********************************************************
+ * Function lease_timeout()
+ *
+ * Description: Get the time until the next leases may
+ *              expire
+ *
+ * Parameters: none
+ *
+ * Return: timeout in ms for poll(), -1 if no lease running
+ *********************************************************/
+int lease_timeout(void)
+{
+   if (g_leases == NULL) return -1;
+   return timer_wheel_timeout(&g_wheel, now_ms());
+}
+
+
+/**********************************************************
+ * Function lease_timers()
+ *
+ * Description: Switch back the relays of the expired leases
+ *              and record the changes (history, statistics,
+ *              shared memory, local clients)
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void lease_timers(void)
+{
+   timer_wheel_entry_t *expired;
+   lease_t *groups = NULL, **tail = &groups;
+   lease_t *group, *lease, **head;
+
+   if (g_leases == NULL) return;
+
+   /* Collect the leases of the same card and leased set in one pass,
+    * the groups are found through a hash table on card and set */
+   expired = timer_wheel_expire(&g_wheel, now_ms());
+   while (expired != NULL)
+   {
+      lease = (lease_t*)expired;
+      expired = expired->next;
+      head = &g_groups[(hash_serial(lease->serial) ^ lease->id) & g_hash_mask];
+      for (group = *head; group != NULL; group = group->bnext)
+      {
+         if (group->id == lease->id && !strcmp(group->serial, lease->serial))
+            break;
+      }
+      if (group == NULL)
+      {
+         lease->timer.next = NULL;
+         lease->bnext = *head;
+         *head = lease;
+         lease->gnext = NULL;
+         *tail = lease;
+         tail = &lease->gnext;
+      }
+      else
+      {
+         lease->timer.next = group->timer.next;
+         group->timer.next = &lease->timer;
+      }
+   }
+
+   for (group = groups; group != NULL; group = group->gnext)
+      g_groups[(hash_serial(group->serial) ^ group->id) & g_hash_mask] = NULL;
+
+   /* In expiry order, a failed group is put back on the wheel */
+   while (groups != NULL)
+   {
+      group = groups;
+      groups = group->gnext;
+      switch_back(group);
+   }
+}
+
+
+/**********************************************************
+ * Function lease_list()
+ *
+ * Description: Call a function for each running lease
+ *
+ * Parameters: fun (in) - function called per lease,
+ *                        returns non zero to stop
+ *             arg (in) - argument passed to fun
+ *
+ * Return: number of leases passed to fun
+ *********************************************************/
+int lease_list(int (*fun)(const lease_info_t*, void*), void *arg)
+{
+   lease_info_t info;
+   uint64_t now = now_ms();
+   lease_t *lease;
+   int i, n = 0;
+
+   for (i=0; i<g_max; i++)
+   {
+      lease = &g_leases[i];
+      if (!lease->active) continue;
+
+      info.id = lease->id;
+      strcpy(info.serial, lease->serial);
+      info.relay = lease->relay;
+      info.state = lease->state;
+      info.restore = lease->restore;
+      info.source = lease->source;
+      info.source_id = lease->source_id;
+      info.lease_ms = lease->lease_ms;
+      info.remaining_ms = (lease->expires_ms > now) ? lease->expires_ms - now : 0;
+      info.renewals = lease->renewals;
+      n++;
+      if (fun(&info, arg)) break;
+   }
+   return n;
+}
+
+
+/**********************************************************
+ * Function lease_expired()
+ *
+ * Description: Get the number of leases which have expired
+ *              since the start
+ *
+ * Parameters: none
+ *
+ * Return: number of expired leases
+ *********************************************************/
+uint64_t lease_expired(void)
+{
+   return g_expired;
+}
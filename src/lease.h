@@ -0,0 +1,247 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Relay leases
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the relay leases, which switch
+ *   relays back automatically unless the client renews them (dead man
+ *   switch).
+ *
+ *   A leased set switches the relays and gives each of them a lease of
+ *   the given duration. When the lease of a relay expires, the relay is
+ *   switched back to the state it had before the lease. Setting the same
+ *   state again with a lease renews it: if all relays of the request
+ *   are leased in this state, only their expiry time is moved and the
+ *   card is not accessed, so a client can send renewals as heartbeat.
+ *   Setting a relay without lease ends its lease, the relay keeps the
+ *   new state.
+ *
+ *   The leases are kept in a hash table by card and relay and their
+ *   expiry times in a timer wheel (see timer_wheel.h), so renewing and
+ *   expiring a lease costs O(1) also with many leases. Leases which
+ *   expire in the same tick on a card are switched back with one write.
+ *   Leased states are not recorded in the state journal, after a restart
+ *   the relays get the state they had before the lease. The switch back
+ *   is recorded like the other writes. A switch back which would break
+ *   an interlock rule (see interlock.h) switches the leased relays off
+ *   instead.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef lease_h
+#define lease_h
+
+#include <stdint.h>
+
+#include "relay_drv.h"
+
+#define LEASE_DEFAULT_MAX  1024
+#define LEASE_MAX          (1<<20)
+#define LEASE_MIN_MS       100
+#define LEASE_MAX_MS       86400000   /* 1 day */
+#define LEASE_RETRY_MS     1000       /* retry of a failed switch back */
+
+/* Lease of a relay, as passed to the function of lease_list() */
+typedef struct
+{
+   uint32_t id;                      /* number of the leased set */
+   char     serial[MAX_SERIAL_LEN];  /* card serial number, empty for a card without */
+   uint8_t  relay;
+   uint8_t  state;                   /* leased state */
+   uint8_t  restore;                 /* state after the expiry */
+   uint8_t  source;                  /* history_source_t of the leased set */
+   uint32_t source_id;               /* IPv4 address or user id */
+   uint32_t lease_ms;
+   uint32_t remaining_ms;
+   uint32_t renewals;
+}
+lease_info_t;
+
+
+/**********************************************************
+ * Function lease_init()
+ *
+ * Description: Allocate the leases and the hash table
+ *
+ * Parameters: max_leases (in) - max. number of leased
+ *                               relays, 0 for the default
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int lease_init(int max_leases);
+
+/**********************************************************
+ * Function lease_close()
+ *
+ * Description: Free the leases, the relays are not switched
+ *              back
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void lease_close(void);
+
+/**********************************************************
+ * Function lease_set_default()
+ *
+ * Description: Set the serial number of the card which is
+ *              used for requests without serial number, so
+ *              its leases are the same with and without
+ *              serial number
+ *
+ * Parameters: serial (in) - serial number of the first card
+ *
+ * Return: none
+ *********************************************************/
+void lease_set_default(const char *serial);
+
+/**********************************************************
+ * Function lease_renew()
+ *
+ * Description: Renew the leases of relays without accessing
+ *              the card, if all of them are leased in the
+ *              requested state
+ *
+ * Parameters: serial (in)      - card serial number, empty
+ *                                for the first card
+ *             mask (in)        - relays to renew
+ *             states (in)      - requested relay states
+ *             lease_ms (in)    - new lease duration
+ *             num_relays (out) - number of relays on the card
+ *
+ * Return: 0 on success, -ENOENT if a relay is not leased in
+ *         the requested state (nothing is renewed),
+ *         -EINVAL if the duration is invalid
+ *********************************************************/
+int lease_renew(const char *serial, uint16_t mask, uint16_t states, uint32_t lease_ms, uint8_t *num_relays);
+
+/**********************************************************
+ * Function lease_set()
+ *
+ * Description: Set relays and lease them, relays which are
+ *              leased already keep the state to switch
+ *              back to
+ *
+ * Parameters: portname (in)   - communication port
+ *             serial (in)     - card serial number, empty
+ *                               for the first card
+ *             num_relays (in) - number of relays on the card
+ *             mask (in)       - relays to set
+ *             states (in)     - new relay states
+ *             lease_ms (in)   - lease duration
+ *             source (in)     - history_source_t of the
+ *                               request
+ *             source_id (in)  - IPv4 address or user id
+ *             result (out)    - relay states after the set
+ *
+ * Return: 0 on success, -EINVAL if the mask or duration is
+ *         invalid, -ENOSPC if there are not enough free
+ *         leases, error of the card access otherwise
+ *********************************************************/
+int lease_set(char *portname, char *serial, uint8_t num_relays, uint16_t mask, uint16_t states,
+              uint32_t lease_ms, uint8_t source, uint32_t source_id, uint16_t *result);
+
+/**********************************************************
+ * Function lease_release()
+ *
+ * Description: End the leases of relays without switching
+ *              them back, called when they are set without
+ *              lease
+ *
+ * Parameters: serial (in) - card serial number, empty for
+ *                           the first card
+ *             mask (in)   - relays
+ *
+ * Return: none
+ *********************************************************/
+void lease_release(const char *serial, uint16_t mask);
+
+/**********************************************************
+ * Function lease_cancel_all()
+ *
+ * Description: End all leases without switching the relays
+ *              back
+ *
+ * Parameters: none
+ *
+ * Return: number of leases ended
+ *********************************************************/
+int lease_cancel_all(void);
+
+/**********************************************************
+ * Function lease_timeout()
+ *
+ * Description: Get the time until the next leases may
+ *              expire
+ *
+ * Parameters: none
+ *
+ * Return: timeout in ms for poll(), -1 if no lease running
+ *********************************************************/
+int lease_timeout(void);
+
+/**********************************************************
+ * Function lease_timers()
+ *
+ * Description: Switch back the relays of the expired leases
+ *              and record the changes (history, statistics,
+ *              shared memory, local clients)
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void lease_timers(void);
+
+/**********************************************************
+ * Function lease_list()
+ *
+ * Description: Call a function for each running lease
+ *
+ * Parameters: fun (in) - function called per lease,
+ *                        returns non zero to stop
+ *             arg (in) - argument passed to fun
+ *
+ * Return: number of leases passed to fun
+ *********************************************************/
+int lease_list(int (*fun)(const lease_info_t*, void*), void *arg);
+
+/**********************************************************
+ * Function lease_expired()
+ *
+ * Description: Get the number of leases which have expired
+ *              since the start
+ *
+ * Parameters: none
+ *
+ * Return: number of expired leases
+ *********************************************************/
+uint64_t lease_expired(void);
+
+#endif
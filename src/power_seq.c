@@ -0,0 +1,583 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Staggered power-on
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the power-on sequencing, see power_seq.h.
+ *
+ *   For every card and group the time of the last turn-on is kept. A
+ *   group releases up to max_on of its pending relays as soon as gap_ms
+ *   have passed since its last turn-on, independently of the other
+ *   groups, so the whole transition takes the least possible time.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "relay_drv.h"
+#include "power_seq.h"
+#include "interlock.h"
+#include "crelay.h"
+#include "data_types.h"
+
+extern config_t config;
+
+typedef struct
+{
+   char     serial[MAX_SERIAL_LEN];  /* empty for all cards */
+   uint16_t mask;
+   uint8_t  max_on;                  /* 0 for no limit */
+   uint64_t gap_ns;
+}
+group_t;
+
+typedef struct
+{
+   char     key[MAX_COM_PORT_NAME_LEN];
+   uint64_t last_on_ns[POWER_SEQ_MAX_GROUPS+1];
+   uint64_t used_ns;
+}
+card_t;
+
+/* Turn-ons left over by a write, done by power_seq_process() */
+typedef struct
+{
+   char         key[MAX_COM_PORT_NAME_LEN];
+   char         serial[MAX_SERIAL_LEN];
+   char         portname[MAX_COM_PORT_NAME_LEN];
+   relay_type_t rtype;
+   uint8_t      num_relays;
+   uint16_t     on;       /* 0 if the entry is unused */
+   uint64_t     due_ns;
+}
+pending_t;
+
+/* Group 0 holds the card limits */
+static group_t g_groups[POWER_SEQ_MAX_GROUPS+1];
+static int     g_num_groups = 1;
+static int     g_limited = 0;
+static card_t  g_cards[POWER_SEQ_MAX_CARDS];
+static char    g_default[MAX_SERIAL_LEN] = "";
+
+static pending_t g_pending[POWER_SEQ_MAX_CARDS];
+static int       g_timer_fd = -1;
+
+static pthread_once_t  g_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**********************************************************
+ * Internal function parse_group()
+ *
+ * Description: Parse a group definition
+ *
+ * Return:  0 - success
+ *         -1 - invalid definition
+ *********************************************************/
+static int parse_group(const char *def, group_t *group)
+{
+   char relays[64], *p, *end;
+   unsigned int max_on, gap_ms;
+   long relay;
+
+   if (sscanf(def, "%63s %u %u", relays, &max_on, &gap_ms) != 3 || max_on > MAX_NUM_RELAYS)
+      return -1;
+
+   memset(group, 0, sizeof(group_t));
+   p = relays;
+   if ((end = strchr(p, ':')) != NULL)
+   {
+      if (end-p >= MAX_SERIAL_LEN) return -1;
+      memcpy(group->serial, p, end-p);
+      p = end+1;
+   }
+   while (*p)
+   {
+      relay = strtol(p, &end, 10);
+      if (end == p || relay < FIRST_RELAY || relay >= FIRST_RELAY+MAX_NUM_RELAYS || (*end && *end != ','))
+         return -1;
+      group->mask |= 1 << (relay-FIRST_RELAY);
+      p = (*end == ',') ? end+1 : end;
+   }
+   group->max_on = max_on;
+   group->gap_ns = (uint64_t)gap_ms*1000000ULL;
+   return 0;
+}
+
+
+/**********************************************************
+ * Internal function init_limits()
+ *
+ * Description: Set up the limits from the configuration
+ *              (done once)
+ *
+ * Return: none
+ *********************************************************/
+static void init_limits(void)
+{
+   int i;
+
+   g_groups[0].mask = 0xffff;
+   g_groups[0].max_on = config.poweron_max_on;
+   g_groups[0].gap_ns = (uint64_t)config.poweron_gap_ms*1000000ULL;
+   g_limited = (g_groups[0].max_on != 0 || g_groups[0].gap_ns != 0);
+
+   for (i=0; i<config.poweron_num_groups && g_num_groups <= POWER_SEQ_MAX_GROUPS; i++)
+   {
+      if (parse_group(config.poweron_groups[i], &g_groups[g_num_groups]) < 0)
+      {
+         syslog(LOG_DAEMON | LOG_ERR, "Invalid power-on group \"%s\"\n", config.poweron_groups[i]);
+         continue;
+      }
+      if (g_groups[g_num_groups].max_on != 0 || g_groups[g_num_groups].gap_ns != 0)
+         g_limited = 1;
+      g_num_groups++;
+   }
+}
+
+
+/**********************************************************
+ * Internal function resolve()
+ *
+ * Description: Get the serial number of the card of a
+ *              request, the default card for NULL
+ *
+ * Return: serial number, NULL if unknown
+ *********************************************************/
+static const char* resolve(const char *serial)
+{
+   if (serial == NULL && g_default[0])
+      return g_default;
+   return serial;
+}
+
+
+/**********************************************************
+ * Internal function card_key()
+ *
+ * Description: Get the key of a card, its serial number or
+ *              the port name for cards without one
+ *
+ * Return: card key
+ *********************************************************/
+static const char* card_key(const char *portname, const char *serial)
+{
+   serial = resolve(serial);
+   return serial ? serial : portname;
+}
+
+
+/**********************************************************
+ * Internal function find_card()
+ *
+ * Description: Find the state of a card, the least recently
+ *              used entry is replaced if it is not found
+ *
+ * Return: card state
+ *********************************************************/
+static card_t* find_card(const char *key)
+{
+   card_t *card = &g_cards[0];
+   int i;
+
+   for (i=0; i<POWER_SEQ_MAX_CARDS; i++)
+   {
+      if (!strcmp(g_cards[i].key, key))
+         return &g_cards[i];
+      if (g_cards[i].used_ns < card->used_ns)
+         card = &g_cards[i];
+   }
+   memset(card, 0, sizeof(card_t));
+   snprintf(card->key, sizeof(card->key), "%s", key);
+   return card;
+}
+
+
+/**********************************************************
+ * Internal function arm_timer()
+ *
+ * Description: Arm the timer for the earliest pending
+ *              turn-on, or disarm it if none is pending
+ *              (called with g_lock held)
+ *
+ * Return: none
+ *********************************************************/
+static void arm_timer(void)
+{
+   struct itimerspec its;
+   uint64_t due_ns = 0;
+   int i;
+
+   for (i=0; i<POWER_SEQ_MAX_CARDS; i++)
+   {
+      if (g_pending[i].on && (due_ns == 0 || g_pending[i].due_ns < due_ns))
+         due_ns = g_pending[i].due_ns;
+   }
+   memset(&its, 0, sizeof(its));
+   its.it_value.tv_sec = due_ns/1000000000ULL;
+   its.it_value.tv_nsec = due_ns%1000000000ULL;
+   timerfd_settime(g_timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+
+/**********************************************************
+ * Function power_seq_init()
+ *
+ * Description: Create the timer for the deferred turn-ons
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int power_seq_init(void)
+{
+   g_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if (g_timer_fd < 0)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Unable to create power-on timer: %s\n", strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
+
+/**********************************************************
+ * Function power_seq_pollfd()
+ *
+ * Description: Get the file descriptor of the power-on
+ *              timer
+ *
+ * Parameters: none
+ *
+ * Return: file descriptor, -1 if not initialized
+ *********************************************************/
+int power_seq_pollfd(void)
+{
+   return g_timer_fd;
+}
+
+
+/**********************************************************
+ * Function power_seq_defer()
+ *
+ * Description: Queue the turn-ons a write could not do yet.
+ *              They are merged with the ones already pending
+ *              for the card.
+ *
+ * Parameters: rtype (in)      - relay card type
+ *             num_relays (in) - number of relays on the card
+ *             portname (in)   - communication port
+ *             serial (in)     - serial number, NULL for the
+ *                               default card
+ *             on (in)         - relays to be switched on
+ *             due_ns (in)     - CLOCK_MONOTONIC time when the
+ *                               next relays can be switched on
+ *
+ * Return:  0 - success
+ *         <0 - not initialized or too many cards pending,
+ *              the caller has to wait itself
+ *********************************************************/
+int power_seq_defer(relay_type_t rtype, uint8_t num_relays, const char *portname,
+                    const char *serial, uint16_t on, uint64_t due_ns)
+{
+   pending_t *entry = NULL;
+   const char *key;
+   int i;
+
+   if (g_timer_fd < 0)
+      return -ENODEV;
+
+   pthread_mutex_lock(&g_lock);
+   key = card_key(portname, serial);
+   for (i=0; i<POWER_SEQ_MAX_CARDS; i++)
+   {
+      if (g_pending[i].on && !strcmp(g_pending[i].key, key))
+      {
+         entry = &g_pending[i];
+         break;
+      }
+      if (entry == NULL && g_pending[i].on == 0)
+         entry = &g_pending[i];
+   }
+   if (entry == NULL)
+   {
+      pthread_mutex_unlock(&g_lock);
+      return -ENOSPC;
+   }
+   if (entry->on == 0)
+   {
+      snprintf(entry->key, sizeof(entry->key), "%s", key);
+      snprintf(entry->serial, sizeof(entry->serial), "%s", serial ? serial : "");
+      snprintf(entry->portname, sizeof(entry->portname), "%s", portname);
+      entry->rtype = rtype;
+      entry->num_relays = num_relays;
+      entry->due_ns = due_ns;
+   }
+   else if (due_ns < entry->due_ns)
+   {
+      entry->due_ns = due_ns;
+   }
+   entry->on |= on;
+   arm_timer();
+   pthread_mutex_unlock(&g_lock);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function power_seq_cancel()
+ *
+ * Description: Drop pending turn-ons, e.g. because a newer
+ *              write changes the relays
+ *
+ * Parameters: portname (in) - communication port, NULL for
+ *                            all cards
+ *             serial (in)   - serial number, NULL for the
+ *                            default card
+ *             mask (in)     - relays
+ *
+ * Return: none
+ *********************************************************/
+void power_seq_cancel(const char *portname, const char *serial, uint16_t mask)
+{
+   const char *key = NULL;
+   int i;
+
+   if (g_timer_fd < 0)
+      return;
+
+   pthread_mutex_lock(&g_lock);
+   if (portname != NULL)
+      key = card_key(portname, serial);
+   for (i=0; i<POWER_SEQ_MAX_CARDS; i++)
+   {
+      if (g_pending[i].on && (key == NULL || !strcmp(g_pending[i].key, key)))
+         g_pending[i].on &= ~mask;
+   }
+   arm_timer();
+   pthread_mutex_unlock(&g_lock);
+}
+
+
+/**********************************************************
+ * Function power_seq_process()
+ *
+ * Description: Switch on the pending relays which are due,
+ *              called when the power-on timer expired. The
+ *              write goes through the interlocks and limits
+ *              again and may leave relays pending.
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void power_seq_process(void)
+{
+   struct timespec ts;
+   pending_t entry;
+   uint64_t expirations, now_ns;
+   uint16_t states;
+   char *serial;
+   int i, rc;
+
+   if (read(g_timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Power-on timer read failed: %s\n", strerror(errno));
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   now_ns = (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+   for (i=0; i<POWER_SEQ_MAX_CARDS; i++)
+   {
+      pthread_mutex_lock(&g_lock);
+      if (g_pending[i].on == 0 || g_pending[i].due_ns > now_ns)
+      {
+         pthread_mutex_unlock(&g_lock);
+         continue;
+      }
+      entry = g_pending[i];
+      g_pending[i].on = 0;
+      pthread_mutex_unlock(&g_lock);
+
+      serial = entry.serial[0] ? entry.serial : NULL;
+      rc = crelay_set_relay_mask_type(entry.rtype, entry.num_relays, entry.portname,
+                                      entry.on, entry.on, serial);
+      if (rc == 0)
+         rc = crelay_get_relay_mask_type(entry.rtype, entry.num_relays, entry.portname, &states, serial);
+      if (rc < 0)
+      {
+         syslog(LOG_DAEMON | LOG_ERR, "Deferred turn-on of relays 0x%04x on card %s failed: %s%s%s\n",
+                entry.on, entry.key, strerror(-rc), rc == -EPERM ? ", rule " : "",
+                rc == -EPERM ? interlock_violation() : "");
+         continue;
+      }
+      publish_states(serial, entry.num_relays, entry.on, states, HISTORY_SRC_POWERON, 0);
+   }
+
+   pthread_mutex_lock(&g_lock);
+   arm_timer();
+   pthread_mutex_unlock(&g_lock);
+}
+
+
+/**********************************************************
+ * Function power_seq_close()
+ *
+ * Description: Drop the pending turn-ons and close the
+ *              power-on timer
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void power_seq_close(void)
+{
+   if (g_timer_fd < 0)
+      return;
+
+   pthread_mutex_lock(&g_lock);
+   memset(g_pending, 0, sizeof(g_pending));
+   close(g_timer_fd);
+   g_timer_fd = -1;
+   pthread_mutex_unlock(&g_lock);
+}
+
+
+/**********************************************************
+ * Function power_seq_limited()
+ *
+ * Description: Check if turn-ons are limited
+ *
+ * Parameters: none
+ *
+ * Return: 1 if limits are configured, 0 otherwise
+ *********************************************************/
+int power_seq_limited(void)
+{
+   pthread_once(&g_once, init_limits);
+   return g_limited;
+}
+
+
+/**********************************************************
+ * Function power_seq_set_default()
+ *
+ * Description: Set the serial number of the card which is
+ *              used for requests without serial number
+ *
+ * Parameters: serial (in) - serial number of the first card
+ *
+ * Return: none
+ *********************************************************/
+void power_seq_set_default(const char *serial)
+{
+   pthread_mutex_lock(&g_lock);
+   snprintf(g_default, sizeof(g_default), "%s", serial ? serial : "");
+   pthread_mutex_unlock(&g_lock);
+}
+
+
+/**********************************************************
+ * Function power_seq_take()
+ *
+ * Description: Get the relays which can be switched on now
+ *              and reserve their turn-on slot
+ *
+ * Parameters: portname (in) - communication port
+ *             serial (in)   - serial number, NULL for the
+ *                             default card
+ *             on (in)       - relays to be switched on
+ *             now_ns (in)   - current CLOCK_MONOTONIC time
+ *             wait_ns (out) - time until the next relays
+ *                             can be switched on, 0 if none
+ *                             are left
+ *
+ * Return: relays to switch on now
+ *********************************************************/
+uint16_t power_seq_take(const char *portname, const char *serial, uint16_t on,
+                        uint64_t now_ns, uint64_t *wait_ns)
+{
+   group_t *group;
+   card_t *card;
+   uint16_t claimed = 0, pending, take, batch = 0;
+   uint64_t next_ns = UINT64_MAX, ready_ns;
+   int i, n;
+
+   pthread_once(&g_once, init_limits);
+   pthread_mutex_lock(&g_lock);
+   serial = resolve(serial);
+   card = find_card(serial ? serial : portname);
+   card->used_ns = now_ns;
+
+   /* Explicit groups first, the card limits apply to the remaining relays */
+   for (i=1; i<=g_num_groups; i++)
+   {
+      group = &g_groups[i % g_num_groups];
+      if (group->serial[0] && (serial == NULL || strcmp(group->serial, serial)))
+         continue;
+      pending = on & group->mask & ~claimed;
+      claimed |= group->mask;
+      if (pending == 0)
+         continue;
+
+      ready_ns = card->last_on_ns[i % g_num_groups] ? card->last_on_ns[i % g_num_groups] + group->gap_ns : 0;
+      if (now_ns < ready_ns)
+      {
+         if (ready_ns < next_ns) next_ns = ready_ns;
+         continue;
+      }
+
+      /* Lowest numbered relays first */
+      take = pending;
+      if (group->max_on != 0)
+      {
+         for (take=0, n=0; pending && n < group->max_on; n++)
+         {
+            take |= pending & -pending;
+            pending &= pending-1;
+         }
+         if (pending && now_ns+group->gap_ns < next_ns)
+            next_ns = now_ns+group->gap_ns;
+      }
+      card->last_on_ns[i % g_num_groups] = now_ns;
+      batch |= take;
+   }
+   pthread_mutex_unlock(&g_lock);
+
+   *wait_ns = (batch == on || next_ns == UINT64_MAX) ? 0 : next_ns-now_ns;
+   return batch;
+}
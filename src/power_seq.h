@@ -0,0 +1,197 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Staggered power-on
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the power-on sequencing, which
+ *   limits the inrush current when many relays are switched on at once.
+ *   For each card at most max_on relays are switched on with one write
+ *   and consecutive turn-ons are at least gap_ms apart. A bulk turn-on is
+ *   split into as few writes as these limits allow. Turn-offs are never
+ *   delayed, they are done with the first write.
+ *
+ *   In the daemon the caller does not wait for the later writes: the
+ *   turn-ons left over are queued on a timer and done from the main loop
+ *   (power_seq_process), so a bulk turn-on does not block the requests
+ *   of the other clients. A newer write of the same relays or an
+ *   emergency off drops them. Without the timer (command line) the
+ *   caller waits between the writes.
+ *
+ *   The limits can also be set for groups of relays, e.g. the relays
+ *   sharing one power supply:
+ *     [serial:]<relay>[,<relay>...] <max_on> <gap_ms>
+ *   A group without serial number applies to every card. The relays
+ *   which are not in any group use the card limits.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef power_seq_h
+#define power_seq_h
+
+#include <stdint.h>
+
+#include "relay_drv.h"
+
+#define POWER_SEQ_MAX_GROUPS 16
+#define POWER_SEQ_MAX_CARDS  32
+
+
+/**********************************************************
+ * Function power_seq_limited()
+ *
+ * Description: Check if turn-ons are limited
+ *
+ * Parameters: none
+ *
+ * Return: 1 if limits are configured, 0 otherwise
+ *********************************************************/
+int power_seq_limited(void);
+
+/**********************************************************
+ * Function power_seq_set_default()
+ *
+ * Description: Set the serial number of the card which is
+ *              used for requests without serial number, so
+ *              its turn-on gaps and group limits are the
+ *              same with and without serial number
+ *
+ * Parameters: serial (in) - serial number of the first card
+ *
+ * Return: none
+ *********************************************************/
+void power_seq_set_default(const char *serial);
+
+/**********************************************************
+ * Function power_seq_take()
+ *
+ * Description: Get the relays which can be switched on now
+ *              and reserve their turn-on slot
+ *
+ * Parameters: portname (in) - communication port
+ *             serial (in)   - serial number, NULL for the
+ *                             default card
+ *             on (in)       - relays to be switched on
+ *             now_ns (in)   - current CLOCK_MONOTONIC time
+ *             wait_ns (out) - time until the next relays
+ *                             can be switched on, 0 if none
+ *                             are left
+ *
+ * Return: relays to switch on now
+ *********************************************************/
+uint16_t power_seq_take(const char *portname, const char *serial, uint16_t on,
+                        uint64_t now_ns, uint64_t *wait_ns);
+
+/**********************************************************
+ * Function power_seq_init()
+ *
+ * Description: Create the timer for the deferred turn-ons
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int power_seq_init(void);
+
+/**********************************************************
+ * Function power_seq_pollfd()
+ *
+ * Description: Get the file descriptor of the power-on
+ *              timer
+ *
+ * Parameters: none
+ *
+ * Return: file descriptor, -1 if not initialized
+ *********************************************************/
+int power_seq_pollfd(void);
+
+/**********************************************************
+ * Function power_seq_defer()
+ *
+ * Description: Queue the turn-ons a write could not do yet.
+ *              They are merged with the ones already pending
+ *              for the card.
+ *
+ * Parameters: rtype (in)      - relay card type
+ *             num_relays (in) - number of relays on the card
+ *             portname (in)   - communication port
+ *             serial (in)     - serial number, NULL for the
+ *                               default card
+ *             on (in)         - relays to be switched on
+ *             due_ns (in)     - CLOCK_MONOTONIC time when the
+ *                               next relays can be switched on
+ *
+ * Return:  0 - success
+ *         <0 - not initialized or too many cards pending,
+ *              the caller has to wait itself
+ *********************************************************/
+int power_seq_defer(relay_type_t rtype, uint8_t num_relays, const char *portname,
+                    const char *serial, uint16_t on, uint64_t due_ns);
+
+/**********************************************************
+ * Function power_seq_cancel()
+ *
+ * Description: Drop pending turn-ons, e.g. because a newer
+ *              write changes the relays
+ *
+ * Parameters: portname (in) - communication port, NULL for
+ *                            all cards
+ *             serial (in)   - serial number, NULL for the
+ *                            default card
+ *             mask (in)     - relays
+ *
+ * Return: none
+ *********************************************************/
+void power_seq_cancel(const char *portname, const char *serial, uint16_t mask);
+
+/**********************************************************
+ * Function power_seq_process()
+ *
+ * Description: Switch on the pending relays which are due,
+ *              called when the power-on timer expired. The
+ *              write goes through the interlocks and limits
+ *              again and may leave relays pending.
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void power_seq_process(void);
+
+/**********************************************************
+ * Function power_seq_close()
+ *
+ * Description: Drop the pending turn-ons and close the
+ *              power-on timer
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void power_seq_close(void);
+
+#endif
@@ -0,0 +1,262 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Realtime mode
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the realtime mode, see realtime.h.
+ *
+ *   The preallocated heap stays with the process because trimming and
+ *   mmap() based allocations are disabled, so later allocations are
+ *   served from memory which is already locked and mapped.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <malloc.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "realtime.h"
+
+#define PREFAULT_STACK  (64*1024)
+
+static int       g_enabled = 0;
+static int       g_priority = REALTIME_PRIORITY;
+static int       g_locked = 0;
+static int       g_have_cpus = 0;
+static int       g_warned = 0;
+static cpu_set_t g_cpus;
+
+
+/**********************************************************
+ * Internal function parse_cpus()
+ *
+ * Description: Parse a CPU list like "0,2-3"
+ *
+ * Return: 0 on success, -1 if the list is invalid
+ *********************************************************/
+static int parse_cpus(const char *list, cpu_set_t *set)
+{
+   const char *p = list;
+   char *end;
+   long first, last, cpu;
+
+   CPU_ZERO(set);
+   while (*p)
+   {
+      first = strtol(p, &end, 10);
+      if (end == p || first < 0 || first >= CPU_SETSIZE) return -1;
+      last = first;
+      if (*end == '-')
+      {
+         p = end+1;
+         last = strtol(p, &end, 10);
+         if (end == p || last < first || last >= CPU_SETSIZE) return -1;
+      }
+      for (cpu=first; cpu<=last; cpu++)
+         CPU_SET(cpu, set);
+      while (*end == ' ') end++;
+      if (*end == ',') end++;
+      else if (*end != '\0') return -1;
+      p = end;
+      while (*p == ' ') p++;
+   }
+   return CPU_COUNT(set) ? 0 : -1;
+}
+
+
+/**********************************************************
+ * Internal function prefault_stack()
+ *
+ * Description: Touch the top of the stack of the calling
+ *              thread, so it is mapped before the first
+ *              timed operation
+ *
+ * Return: none
+ *********************************************************/
+static void __attribute__((noinline)) prefault_stack(void)
+{
+   volatile char buf[PREFAULT_STACK];
+
+   memset((char*)buf, 0, sizeof(buf));
+}
+
+
+/**********************************************************
+ * Function realtime_init()
+ *
+ * Description: Enable the realtime mode for the process,
+ *              must be called before any thread is
+ *              started (and after daemon())
+ *
+ * Parameters: priority (in)    - SCHED_FIFO priority of the
+ *                                timing threads, 0 for the
+ *                                default
+ *             cpus (in)        - CPU list of the timing
+ *                                threads, e.g. "2,3" or
+ *                                "2-3", NULL for all CPUs
+ *             lock_memory (in) - 1 to lock the memory
+ *             prealloc_kb (in) - heap to be preallocated,
+ *                                0 for the default
+ *
+ * Return:  0 - success
+ *         -1 - fail (invalid CPU list or memory could not be
+ *              locked), the mode is enabled as far as
+ *              possible
+ *********************************************************/
+int realtime_init(uint8_t priority, const char *cpus, int lock_memory, uint32_t prealloc_kb)
+{
+   pthread_attr_t attr;
+   long page = sysconf(_SC_PAGESIZE);
+   size_t size, i;
+   char *heap;
+   int rc = 0;
+
+   g_enabled = 1;
+   g_priority = REALTIME_PRIORITY;
+   if (priority > 0 && priority <= sched_get_priority_max(SCHED_FIFO))
+      g_priority = priority;
+
+   g_have_cpus = 0;
+   if (cpus != NULL && cpus[0])
+   {
+      if (parse_cpus(cpus, &g_cpus) == 0)
+      {
+         g_have_cpus = 1;
+      }
+      else
+      {
+         syslog(LOG_DAEMON | LOG_ERR, "Realtime: invalid CPU list \"%s\"\n", cpus);
+         rc = -1;
+      }
+   }
+
+   if (lock_memory && !g_locked)
+   {
+      /* Keep freed memory in the heap instead of returning it */
+      mallopt(M_TRIM_THRESHOLD, -1);
+      mallopt(M_MMAP_MAX, 0);
+
+      /* Default thread stacks of 8MB would all be locked */
+      if (pthread_getattr_default_np(&attr) == 0)
+      {
+         pthread_attr_setstacksize(&attr, REALTIME_STACK_KB*1024);
+         pthread_setattr_default_np(&attr);
+         pthread_attr_destroy(&attr);
+      }
+
+      if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+      {
+         syslog(LOG_DAEMON | LOG_ERR, "Realtime: failed to lock memory: %s\n", strerror(errno));
+         rc = -1;
+      }
+      else
+      {
+         g_locked = 1;
+      }
+
+      size = (size_t)(prealloc_kb ? prealloc_kb : REALTIME_PREALLOC_KB) * 1024;
+      if ((heap = malloc(size)) != NULL)
+      {
+         for (i=0; i<size; i+=page)
+            heap[i] = 0;
+         free(heap);
+      }
+      prefault_stack();
+   }
+
+   syslog(LOG_DAEMON | LOG_NOTICE, "Realtime mode: priority %d, CPUs %s, memory %s\n", g_priority,
+          g_have_cpus ? cpus : "all", g_locked ? "locked" : "not locked");
+   return rc;
+}
+
+
+/**********************************************************
+ * Function realtime_enabled()
+ *
+ * Description: Check if the realtime mode is enabled
+ *
+ * Parameters: none
+ *
+ * Return: 1 if enabled, 0 otherwise
+ *********************************************************/
+int realtime_enabled(void)
+{
+   return g_enabled;
+}
+
+
+/**********************************************************
+ * Function realtime_thread()
+ *
+ * Description: Name the calling timing thread and, in
+ *              realtime mode, switch it to SCHED_FIFO, pin
+ *              it to the configured CPUs and prefault its
+ *              stack
+ *
+ * Parameters: name (in)     - thread name (max. 15 chars)
+ *             priority (in) - SCHED_FIFO priority, 0 for
+ *                             the configured one
+ *
+ * Return:  0 - success or realtime mode not enabled
+ *         -1 - the policy or affinity could not be set
+ *********************************************************/
+int realtime_thread(const char *name, int priority)
+{
+   struct sched_param param;
+   int rc = 0, err;
+
+   pthread_setname_np(pthread_self(), name);
+   if (!g_enabled)
+      return 0;
+
+   memset(&param, 0, sizeof(param));
+   param.sched_priority = priority ? priority : g_priority;
+   if ((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0)
+   {
+      /* Same for all threads, e.g. no permission, only reported once */
+      if (!g_warned++)
+         syslog(LOG_DAEMON | LOG_WARNING, "Realtime: cannot set SCHED_FIFO for %s: %s\n", name, strerror(err));
+      rc = -1;
+   }
+   if (g_have_cpus && (err = pthread_setaffinity_np(pthread_self(), sizeof(g_cpus), &g_cpus)) != 0)
+   {
+      if (!g_warned++)
+         syslog(LOG_DAEMON | LOG_WARNING, "Realtime: cannot set CPU affinity of %s: %s\n", name, strerror(err));
+      rc = -1;
+   }
+   if (g_locked)
+      prefault_stack();
+   return rc;
+}
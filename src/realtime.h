@@ -0,0 +1,106 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Realtime mode
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the realtime mode, which keeps
+ *   the timing of pulses, sequences, waveforms and scenes stable when
+ *   the host is loaded.
+ *
+ *   In realtime mode the timing and hardware threads (sequence engine,
+ *   waveform player, PWM, scene workers) run with the SCHED_FIFO policy
+ *   and can be pinned to a set of CPUs. The main thread, which serves
+ *   the HTTP and unix socket clients, keeps the normal scheduling. The
+ *   memory of the daemon is locked with mlockall(), a heap of the given
+ *   size is preallocated and kept, and thread stacks are made smaller
+ *   and prefaulted, so the timing threads do not take page faults.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef realtime_h
+#define realtime_h
+
+#include <stdint.h>
+
+#define REALTIME_PRIORITY     60
+#define REALTIME_PREALLOC_KB  4096
+#define REALTIME_STACK_KB     256    /* stack size of threads in realtime mode */
+
+
+/**********************************************************
+ * Function realtime_init()
+ *
+ * Description: Enable the realtime mode for the process,
+ *              must be called before any thread is
+ *              started (and after daemon())
+ *
+ * Parameters: priority (in)    - SCHED_FIFO priority of the
+ *                                timing threads, 0 for the
+ *                                default
+ *             cpus (in)        - CPU list of the timing
+ *                                threads, e.g. "2,3" or
+ *                                "2-3", NULL for all CPUs
+ *             lock_memory (in) - 1 to lock the memory
+ *             prealloc_kb (in) - heap to be preallocated,
+ *                                0 for the default
+ *
+ * Return:  0 - success
+ *         -1 - fail (invalid CPU list or memory could not be
+ *              locked), the mode is enabled as far as
+ *              possible
+ *********************************************************/
+int realtime_init(uint8_t priority, const char *cpus, int lock_memory, uint32_t prealloc_kb);
+
+/**********************************************************
+ * Function realtime_enabled()
+ *
+ * Description: Check if the realtime mode is enabled
+ *
+ * Parameters: none
+ *
+ * Return: 1 if enabled, 0 otherwise
+ *********************************************************/
+int realtime_enabled(void);
+
+/**********************************************************
+ * Function realtime_thread()
+ *
+ * Description: Name the calling timing thread and, in
+ *              realtime mode, switch it to SCHED_FIFO, pin
+ *              it to the configured CPUs and prefault its
+ *              stack
+ *
+ * Parameters: name (in)     - thread name (max. 15 chars)
+ *             priority (in) - SCHED_FIFO priority, 0 for
+ *                             the configured one
+ *
+ * Return:  0 - success or realtime mode not enabled
+ *         -1 - the policy or affinity could not be set
+ *********************************************************/
+int realtime_thread(const char *name, int priority);
+
+#endif
@@ -35,24 +35,59 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "relay_drv.h"
+#include "trace.h"
+#ifndef BUILD_LIB
+#include "power_seq.h"
+#include "interlock.h"
+#include "card_health.h"
+#endif
 
 /* Card driver specific include files */
 #include "relay_drv_conrad.h"
 #include "relay_drv_sainsmart.h"
 #include "relay_drv_hidapi.h"
 #include "relay_drv_sainsmart16.h"
+#include "relay_drv_simulated.h"
 #include "relay_drv_gpio.h"
 
 
 static relay_type_t relay_type=NO_RELAY_TYPE;
+static uint8_t relay_count=0;
+
+static uint32_t io_timeout_ms=RELAY_IO_TIMEOUT_MS;
+static __thread uint64_t io_deadline_ns=0;
+
+/* The I/O of a card is serialized, as threads may access the same card
+ * and the drivers read, modify and write the relay states. Cards are
+ * told apart by their port name, which selects one of the locks.
+ * Detecting opens the devices, so it excludes the I/O of all cards. */
+#define IO_LOCKS 64
+static pthread_mutex_t  io_lock[IO_LOCKS] = { [0 ... IO_LOCKS-1] = PTHREAD_MUTEX_INITIALIZER };
+static pthread_rwlock_t detect_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static int set_relay_mask(relay_type_t rtype, uint8_t num_relays, char* portname,
+                          uint16_t mask, uint16_t states, char* serial);
+static int write_relay_mask(relay_type_t rtype, uint8_t num_relays, char* portname,
+                            uint16_t mask, uint16_t states, char* serial);
+#ifndef BUILD_LIB
+static int set_relay_mask_limited(relay_type_t rtype, uint8_t num_relays, char* portname,
+                                  uint16_t mask, uint16_t states, char* serial);
+static int interlock_begin(relay_type_t rtype, uint8_t num_relays, char* portname,
+                           uint16_t mask, uint16_t states, char* serial, interlock_card_t** card);
+#endif
 
 /*
  *  Table which holds the specific relay card data:
  *    - function to detect the communication port
  *    - function to get the current relay state
  *    - function to set the new relay state
+ *    - function to get all relay states (optional)
+ *    - function to set several relay states (optional)
  *    - card name string
  *    - number of relays on the card
  * 
@@ -61,13 +96,16 @@ static relay_type_t relay_type=NO_RELAY_TYPE;
 static relay_data_t relay_data[LAST_RELAY_TYPE] =
 { 
    {  // NO_RELAY_TYPE (dummy entry)
-      NULL, NULL, NULL, ""
+      NULL, NULL, NULL, NULL, NULL, NULL, ""
    },
 #ifdef DRV_CONRAD
    {  // CONRAD_4CHANNEL_USB_RELAY_TYPE
       detect_relay_card_conrad_4chan,
       get_relay_conrad_4chan,
       set_relay_conrad_4chan,
+      NULL,
+      NULL,
+      NULL,
       CONRAD_4CHANNEL_USB_NAME
    },
 #endif
@@ -76,6 +114,9 @@ static relay_data_t relay_data[LAST_RELAY_TYPE] =
       detect_relay_card_sainsmart_4_8chan,
       get_relay_sainsmart_4_8chan,
       set_relay_sainsmart_4_8chan,
+      NULL,
+      NULL,
+      play_waveform_sainsmart_4_8chan,
       SAINSMART_USB_NAME
    },
 #endif
@@ -84,6 +125,9 @@ static relay_data_t relay_data[LAST_RELAY_TYPE] =
       detect_relay_card_hidapi,
       get_relay_hidapi,
       set_relay_hidapi,
+      get_relay_mask_hidapi,
+      set_relay_mask_hidapi,
+      NULL,
       HID_API_RELAY_NAME
    },
 #endif
@@ -92,20 +136,90 @@ static relay_data_t relay_data[LAST_RELAY_TYPE] =
       detect_relay_card_sainsmart_16chan,
       get_relay_sainsmart_16chan,
       set_relay_sainsmart_16chan,
+      get_relay_mask_sainsmart_16chan,
+      set_relay_mask_sainsmart_16chan,
+      NULL,
       SAINSMART16_USB_NAME
    },
 #endif
+#ifdef DRV_SIMULATED
+   {  // SIMULATED_RELAY_TYPE
+      detect_relay_card_simulated,
+      get_relay_simulated,
+      set_relay_simulated,
+      get_relay_mask_simulated,
+      set_relay_mask_simulated,
+      play_waveform_simulated,
+      SIMULATED_RELAY_NAME
+   },
+#endif
 #ifndef BUILD_LIB
    {  // GENERIC_GPIO_RELAY_TYPE
       detect_relay_card_generic_gpio,
       get_relay_generic_gpio,
       set_relay_generic_gpio,
+      NULL,
+      NULL,
+      NULL,
       GENERIC_GPIO_NAME
    }
 #endif
 };
 
 
+/**********************************************************
+ * Internal function start_deadline()
+ * 
+ * Description: Set the deadline of a card operation of the
+ *              calling thread
+ * 
+ * Return: none
+ *********************************************************/
+static void start_deadline(void)
+{
+   struct timespec ts;
+   
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   io_deadline_ns = (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec + (uint64_t)io_timeout_ms*1000000ULL;
+}
+
+
+/**********************************************************
+ * Internal function io_begin()
+ * 
+ * Description: Lock a card for I/O
+ * 
+ * Return: lock to be passed to io_end()
+ *********************************************************/
+static pthread_mutex_t* io_begin(const char *portname)
+{
+   const char *p;
+   uint32_t hash = 2166136261U;
+   
+   for (p = portname ? portname : ""; *p; p++)
+   {
+      hash = (hash ^ (uint8_t)*p) * 16777619U;
+   }
+   pthread_rwlock_rdlock(&detect_lock);
+   pthread_mutex_lock(&io_lock[hash % IO_LOCKS]);
+   return &io_lock[hash % IO_LOCKS];
+}
+
+
+/**********************************************************
+ * Internal function io_end()
+ * 
+ * Description: Unlock a card locked by io_begin()
+ * 
+ * Return: none
+ *********************************************************/
+static void io_end(pthread_mutex_t *lock)
+{
+   pthread_mutex_unlock(lock);
+   pthread_rwlock_unlock(&detect_lock);
+}
+
+
 /**********************************************************
  * Function crelay_detect_all_relay_cards()
  * 
@@ -119,21 +233,25 @@ static relay_data_t relay_data[LAST_RELAY_TYPE] =
  *********************************************************/
 int crelay_detect_all_relay_cards(relay_info_t** relay_info)
 {
-   int i;
+   int i, rc;
    relay_info_t* my_relay_info;
    
    /* Create first list element */
-   my_relay_info = malloc(sizeof(relay_info_t));
-   my_relay_info->next = NULL;
+   my_relay_info = calloc(1, sizeof(relay_info_t));
 
    /* Return pointer to first element to caller */
    *relay_info = my_relay_info;
    
+   pthread_rwlock_wrlock(&detect_lock);
    for (i=1; i<LAST_RELAY_TYPE; i++)
    {
       /* Create new list element with related info for each detected card */
-      (*relay_data[i].detect_relay_card_fun)(NULL, NULL, NULL, &my_relay_info);
+      CRELAY_TRACE1(drv__detect__start, i);
+      start_deadline();
+      rc = (*relay_data[i].detect_relay_card_fun)(NULL, NULL, NULL, &my_relay_info);
+      CRELAY_TRACE2(drv__detect__done, i, rc);
    }
+   pthread_rwlock_unlock(&detect_lock);
    
    if ((*relay_info)->next == NULL)
       return -1;
@@ -154,22 +272,47 @@ int crelay_detect_all_relay_cards(relay_info_t** relay_info)
  * 
  * Return:  0 - success
  *         -1 - fail, no relay card found
+ *         -ETIMEDOUT - no relay card found, a card did
+ *                      not answer in time
+ *         -ENOLINK - the card failed too often, it is not
+ *                    accessed until its next probe
  *********************************************************/
 int crelay_detect_relay_card(char* portname, uint8_t* num_relays, char* serial, relay_info_t** my_relay_info)
 {
-   int i;
+   int i, rc, timeout=0;
+   
+#ifndef BUILD_LIB
+   if ((rc = card_health_check(serial)) < 0)
+   {
+      relay_type = NO_RELAY_TYPE;
+      return rc;
+   }
+#endif
    
+   pthread_rwlock_wrlock(&detect_lock);
    for (i=1; i<LAST_RELAY_TYPE; i++)
    {
-      if ((*relay_data[i].detect_relay_card_fun)(portname, num_relays, serial, NULL) == 0)
+      CRELAY_TRACE1(drv__detect__start, i);
+      start_deadline();
+      rc = (*relay_data[i].detect_relay_card_fun)(portname, num_relays, serial, NULL);
+      CRELAY_TRACE2(drv__detect__done, i, rc);
+      if (rc == 0)
       {
+         pthread_rwlock_unlock(&detect_lock);
          relay_type=i;
+         if (num_relays != NULL) relay_count = *num_relays;
          return 0;
       }
+      if (rc == -ETIMEDOUT) timeout = 1;
    }
+   pthread_rwlock_unlock(&detect_lock);
    
    relay_type = NO_RELAY_TYPE;
-   return -1;   
+   rc = timeout ? -ETIMEDOUT : -1;
+#ifndef BUILD_LIB
+   card_health_report(serial, rc);
+#endif
+   return rc;
 }
 
 
@@ -187,9 +330,26 @@ int crelay_detect_relay_card(char* portname, uint8_t* num_relays, char* serial,
  *********************************************************/
 int crelay_get_relay(char* portname, uint8_t relay, relay_state_t* relay_state, char* serial)
 {
+   pthread_mutex_t *lock;
+   int rc;
+   
    if (relay_type != NO_RELAY_TYPE)
    {
-      return (*relay_data[relay_type].get_relay_fun)(portname, relay, relay_state, serial);
+#ifndef BUILD_LIB
+      /* An invalid relay number is no card failure */
+      if (relay < FIRST_RELAY || relay >= FIRST_RELAY+relay_count) return -1;
+      if ((rc = card_health_check(serial)) < 0) return rc;
+#endif
+      CRELAY_TRACE2(drv__get__start, relay_type, relay);
+      lock = io_begin(portname);
+      start_deadline();
+      rc = (*relay_data[relay_type].get_relay_fun)(portname, relay, relay_state, serial);
+      io_end(lock);
+      CRELAY_TRACE4(drv__get__done, relay_type, relay, *relay_state, rc);
+#ifndef BUILD_LIB
+      card_health_report(serial, rc);
+#endif
+      return rc;
    }
    else
    {   
@@ -212,9 +372,36 @@ int crelay_get_relay(char* portname, uint8_t relay, relay_state_t* relay_state,
  *********************************************************/
 int crelay_set_relay(char* portname, uint8_t relay, relay_state_t relay_state, char* serial)
 {
+   pthread_mutex_t *lock;
+   int rc;
+   
+#ifndef BUILD_LIB
+   /* A turn-on has to respect the power-on limits, every write the
+    * interlocks */
+   if (relay_type != NO_RELAY_TYPE && relay >= FIRST_RELAY && relay < FIRST_RELAY+relay_count &&
+       ((relay_state == ON && power_seq_limited()) || interlock_active()))
+   {
+      return crelay_set_relay_mask_type(relay_type, relay_count, portname, 1<<(relay-FIRST_RELAY),
+                                        (relay_state == ON) ? 1<<(relay-FIRST_RELAY) : 0, serial);
+   }
+#endif
+   
    if (relay_type != NO_RELAY_TYPE)
    {
-      return (*relay_data[relay_type].set_relay_fun)(portname, relay, relay_state, serial);
+#ifndef BUILD_LIB
+      if (relay < FIRST_RELAY || relay >= FIRST_RELAY+relay_count) return -1;
+      if ((rc = card_health_check(serial)) < 0) return rc;
+#endif
+      CRELAY_TRACE3(drv__set__start, relay_type, relay, relay_state);
+      lock = io_begin(portname);
+      start_deadline();
+      rc = (*relay_data[relay_type].set_relay_fun)(portname, relay, relay_state, serial);
+      io_end(lock);
+      CRELAY_TRACE3(drv__set__done, relay_type, relay, rc);
+#ifndef BUILD_LIB
+      card_health_report(serial, rc);
+#endif
+      return rc;
    }
    else
    {   
@@ -223,6 +410,618 @@ int crelay_set_relay(char* portname, uint8_t relay, relay_state_t relay_state, c
 }
 
 
+/**********************************************************
+ * Function crelay_get_relay_mask()
+ * 
+ * Description: Get the current state of all relays. Cards
+ *              without native support are read relay by
+ *              relay.
+ * 
+ * Parameters: portname (in)     - communication port
+ *             states (out)      - relay states, bit 0 is
+ *                                 relay 1
+ * 
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int crelay_get_relay_mask(char* portname, uint16_t* states, char* serial)
+{
+   return crelay_get_relay_mask_type(relay_type, relay_count, portname, states, serial);
+}
+
+
+/**********************************************************
+ * Function crelay_get_relay_mask_type()
+ * 
+ * Description: Get the current state of all relays of a
+ *              card detected before, see
+ *              crelay_set_relay_mask_type()
+ * 
+ * Parameters: rtype (in)        - relay card type
+ *             num_relays (in)   - number of relays
+ *             portname (in)     - communication port
+ *             states (out)      - relay states, bit 0 is
+ *                                 relay 1
+ *             serial (in)       - serial number [optional]
+ * 
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int crelay_get_relay_mask_type(relay_type_t rtype, uint8_t num_relays, char* portname,
+                               uint16_t* states, char* serial)
+{
+   pthread_mutex_t *lock;
+   relay_state_t rstate;
+   uint16_t mask=0;
+   int i, rc;
+   
+   if (rtype <= NO_RELAY_TYPE || rtype >= LAST_RELAY_TYPE)
+   {
+      return -1;
+   }
+   
+#ifndef BUILD_LIB
+   if ((rc = card_health_check(serial)) < 0)
+   {
+      return rc;
+   }
+#endif
+   
+   lock = io_begin(portname);
+   start_deadline();
+   if (relay_data[rtype].get_relay_mask_fun != NULL)
+   {
+      CRELAY_TRACE1(drv__get__mask__start, rtype);
+      rc = (*relay_data[rtype].get_relay_mask_fun)(portname, states, serial);
+      CRELAY_TRACE3(drv__get__mask__done, rtype, *states, rc);
+   }
+   else
+   {
+      for (i=FIRST_RELAY, rc=0; i<FIRST_RELAY+num_relays && rc >= 0; i++)
+      {
+         CRELAY_TRACE2(drv__get__start, rtype, i);
+         rc = (*relay_data[rtype].get_relay_fun)(portname, i, &rstate, serial);
+         CRELAY_TRACE4(drv__get__done, rtype, i, rstate, rc);
+         if (rc == 0 && rstate == ON) mask |= 1<<(i-FIRST_RELAY);
+      }
+      if (rc >= 0) *states = mask;
+   }
+   io_end(lock);
+   
+#ifndef BUILD_LIB
+   card_health_report(serial, rc < 0 ? rc : 0);
+#endif
+   return rc < 0 ? rc : 0;
+}
+
+
+/**********************************************************
+ * Function crelay_set_relay_mask()
+ * 
+ * Description: Set the state of several relays at once.
+ *              Cards without native support are written
+ *              relay by relay.
+ * 
+ * Parameters: portname (in)     - communication port
+ *             mask (in)         - relays to change, bit 0
+ *                                 is relay 1
+ *             states (in)       - new relay states
+ * 
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int crelay_set_relay_mask(char* portname, uint16_t mask, uint16_t states, char* serial)
+{
+   return crelay_set_relay_mask_type(relay_type, relay_count, portname, mask, states, serial);
+}
+
+
+/**********************************************************
+ * Function crelay_set_relay_mask_type()
+ * 
+ * Description: Set the state of several relays of a card
+ *              detected before. Unlike the other functions
+ *              it does not depend on the last detected card,
+ *              so it can be used by other threads. The I/O
+ *              of a card is serialized, different cards
+ *              are accessed in parallel.
+ *              When power-on limits are configured, the
+ *              turn-ons may be split into several writes,
+ *              see power_seq.h. When interlocks are
+ *              configured, a write which breaks one is
+ *              rejected, see interlock.h.
+ * 
+ * Parameters: rtype (in)        - relay card type
+ *             num_relays (in)   - number of relays
+ *             portname (in)     - communication port
+ *             mask (in)         - relays to change, bit 0
+ *                                 is relay 1
+ *             states (in)       - new relay states
+ *             serial (in)       - serial number [optional]
+ * 
+ * Return:   0 - success
+ *          -EPERM if an interlock rule would be broken
+ *          <0 - other failure
+ *********************************************************/
+int crelay_set_relay_mask_type(relay_type_t rtype, uint8_t num_relays, char* portname,
+                               uint16_t mask, uint16_t states, char* serial)
+{
+#ifndef BUILD_LIB
+   interlock_card_t *card;
+   int rc;
+#endif
+   
+   if (rtype <= NO_RELAY_TYPE || rtype >= LAST_RELAY_TYPE)
+   {
+      return -1;
+   }
+   
+#ifndef BUILD_LIB
+   if (!interlock_active())
+   {
+      return set_relay_mask_limited(rtype, num_relays, portname, mask, states, serial);
+   }
+   
+   /* The card stays locked until the write is done, so that no other
+    * write can switch on a relay in between */
+   if ((rc = interlock_begin(rtype, num_relays, portname, mask, states, serial, &card)) < 0)
+   {
+      return rc;
+   }
+   rc = set_relay_mask_limited(rtype, num_relays, portname, mask, states, serial);
+   if (rc < 0)
+      interlock_forget(card, portname, serial);
+   else
+      interlock_update(card, mask, states, 0);
+   interlock_unlock(card);
+   return rc;
+#else
+   return set_relay_mask(rtype, num_relays, portname, mask, states, serial);
+#endif
+}
+
+
+/**********************************************************
+ * Function crelay_check_relay_mask_type()
+ * 
+ * Description: Check a write of several relays of a card
+ *              detected before against the interlocks
+ *              without writing, e.g. to reject a write to
+ *              several cards before any of them is written
+ * 
+ * Parameters: rtype (in)        - relay card type
+ *             num_relays (in)   - number of relays
+ *             portname (in)     - communication port
+ *             mask (in)         - relays to change, bit 0
+ *                                 is relay 1
+ *             states (in)       - new relay states
+ *             serial (in)       - serial number [optional]
+ * 
+ * Return:   0 - allowed
+ *          -EPERM if an interlock rule would be broken
+ *          <0 - other failure
+ *********************************************************/
+int crelay_check_relay_mask_type(relay_type_t rtype, uint8_t num_relays, char* portname,
+                                 uint16_t mask, uint16_t states, char* serial)
+{
+#ifndef BUILD_LIB
+   interlock_card_t *card;
+   int rc;
+   
+   if (rtype <= NO_RELAY_TYPE || rtype >= LAST_RELAY_TYPE)
+   {
+      return -1;
+   }
+   if (!interlock_active())
+   {
+      return 0;
+   }
+   if ((rc = interlock_begin(rtype, num_relays, portname, mask, states, serial, &card)) < 0)
+   {
+      return rc;
+   }
+   interlock_unlock(card);
+#endif
+   return 0;
+}
+
+
+#ifndef BUILD_LIB
+/**********************************************************
+ * Function crelay_detect_relay_card_type()
+ * 
+ * Description: Detect a card of a known type, for the
+ *              emergency off: only the driver of the type
+ *              is asked and the card health is not checked,
+ *              so a card with open circuit is found too
+ * 
+ * Parameters: rtype (in)       - relay card type
+ *             portname (out)   - communication port
+ *             num_relays (out) - number of relays
+ *             serial (in)      - serial number [optional]
+ * 
+ * Return:  0 - success
+ *         <0 - fail, card not found
+ *********************************************************/
+int crelay_detect_relay_card_type(relay_type_t rtype, char* portname, uint8_t* num_relays, char* serial)
+{
+   int rc;
+   
+   if (rtype <= NO_RELAY_TYPE || rtype >= LAST_RELAY_TYPE)
+   {
+      return -1;
+   }
+   
+   pthread_rwlock_wrlock(&detect_lock);
+   CRELAY_TRACE1(drv__detect__start, rtype);
+   start_deadline();
+   rc = (*relay_data[rtype].detect_relay_card_fun)(portname, num_relays, serial, NULL);
+   CRELAY_TRACE2(drv__detect__done, rtype, rc);
+   pthread_rwlock_unlock(&detect_lock);
+   return rc;
+}
+
+
+/**********************************************************
+ * Function crelay_force_relay_mask_type()
+ * 
+ * Description: Write the state of several relays of a card
+ *              for the emergency off: the card health,
+ *              interlocks and power-on limits are bypassed,
+ *              so a card with open circuit is written too.
+ *              The I/O of the card is serialized as for
+ *              crelay_set_relay_mask_type().
+ * 
+ * Parameters: rtype (in)        - relay card type
+ *             num_relays (in)   - number of relays
+ *             portname (in)     - communication port
+ *             mask (in)         - relays to change, bit 0
+ *                                 is relay 1
+ *             states (in)       - new relay states
+ *             serial (in)       - serial number [optional]
+ * 
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int crelay_force_relay_mask_type(relay_type_t rtype, uint8_t num_relays, char* portname,
+                                 uint16_t mask, uint16_t states, char* serial)
+{
+   int rc;
+   
+   if (rtype <= NO_RELAY_TYPE || rtype >= LAST_RELAY_TYPE)
+   {
+      return -1;
+   }
+   
+   rc = write_relay_mask(rtype, num_relays, portname, mask, states, serial);
+   
+   /* A successful write closes the circuit of the card, the states kept
+    * for the interlocks are out of date */
+   card_health_report(serial, rc);
+   interlock_forget(NULL, portname, serial);
+   return rc;
+}
+#endif
+
+
+#ifndef BUILD_LIB
+/**********************************************************
+ * Internal function interlock_begin()
+ * 
+ * Description: Lock a card and check a write against the
+ *              interlocks, the states of the card are read
+ *              if the ones kept are too old
+ * 
+ * Return:   0 - allowed, the card is locked
+ *          <0 - rejected or failed, the card is not locked
+ *********************************************************/
+static int interlock_begin(relay_type_t rtype, uint8_t num_relays, char* portname,
+                           uint16_t mask, uint16_t states, char* serial, interlock_card_t** card)
+{
+   uint16_t current;
+   int rc;
+   
+   if ((*card = interlock_lock(portname, serial)) == NULL)
+   {
+      return -EBUSY;
+   }
+   
+   /* Turn-offs are always allowed */
+   if ((mask & states) == 0)
+   {
+      return 0;
+   }
+   
+   if (!interlock_states(*card, &current))
+   {
+      if ((rc = crelay_get_relay_mask_type(rtype, num_relays, portname, &current, serial)) < 0)
+      {
+         interlock_unlock(*card);
+         return rc;
+      }
+      interlock_update(*card, 0xffff, current, 1);
+   }
+   if ((rc = interlock_check(*card, current, mask, states)) < 0)
+   {
+      interlock_unlock(*card);
+      return rc;
+   }
+   return 0;
+}
+
+
+/**********************************************************
+ * Internal function set_relay_mask_limited()
+ * 
+ * Description: Write the state of several relays within
+ *              the power-on limits
+ * 
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+static int set_relay_mask_limited(relay_type_t rtype, uint8_t num_relays, char* portname,
+                                  uint16_t mask, uint16_t states, char* serial)
+{
+   struct timespec ts;
+   uint16_t pending, batch, current, write;
+   uint64_t now_ns, wait_ns;
+   int rc, first = 1;
+   
+   if (!power_seq_limited())
+   {
+      return set_relay_mask(rtype, num_relays, portname, mask, states, serial);
+   }
+   
+   /* This write overrides the turn-ons still pending for its relays */
+   power_seq_cancel(portname, serial, mask);
+   pending = mask & states;
+   if (pending == 0)
+   {
+      return set_relay_mask(rtype, num_relays, portname, mask, states, serial);
+   }
+   
+   /* Relays which are on already are not turned on again */
+   if (crelay_get_relay_mask_type(rtype, num_relays, portname, &current, serial) == 0)
+   {
+      pending &= ~current;
+   }
+   
+   /* Turn-offs go with the first write, turn-ons are released by the
+    * power-on sequencing as soon as the limits allow. In the daemon the
+    * ones left over are switched on from the main loop. */
+   do
+   {
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      now_ns = (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+      batch = power_seq_take(portname, serial, pending, now_ns, &wait_ns);
+      write = first ? (mask & ~pending) | batch : batch;
+      if (write)
+      {
+         rc = set_relay_mask(rtype, num_relays, portname, write, states, serial);
+         if (rc < 0)
+         {
+            return rc;
+         }
+      }
+      first = 0;
+      pending &= ~batch;
+      if (pending && wait_ns)
+      {
+         if (power_seq_defer(rtype, num_relays, portname, serial, pending, now_ns+wait_ns) == 0)
+         {
+            return 0;
+         }
+         ts.tv_sec = wait_ns/1000000000ULL;
+         ts.tv_nsec = wait_ns%1000000000ULL;
+         while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR);
+      }
+   }
+   while (pending);
+   return 0;
+}
+#endif
+
+
+/**********************************************************
+ * Internal function set_relay_mask()
+ * 
+ * Description: Write the state of several relays, with the
+ *              mask function of the driver if it has one
+ * 
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+static int set_relay_mask(relay_type_t rtype, uint8_t num_relays, char* portname,
+                          uint16_t mask, uint16_t states, char* serial)
+{
+   int rc;
+   
+#ifndef BUILD_LIB
+   if ((rc = card_health_check(serial)) < 0)
+   {
+      return rc;
+   }
+#endif
+   
+   rc = write_relay_mask(rtype, num_relays, portname, mask, states, serial);
+   
+#ifndef BUILD_LIB
+   card_health_report(serial, rc);
+#endif
+   return rc;
+}
+
+
+/**********************************************************
+ * Internal function write_relay_mask()
+ * 
+ * Description: Write the state of several relays with the
+ *              card locked for I/O, without any check
+ * 
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+static int write_relay_mask(relay_type_t rtype, uint8_t num_relays, char* portname,
+                            uint16_t mask, uint16_t states, char* serial)
+{
+   pthread_mutex_t *lock;
+   relay_state_t rstate;
+   uint16_t bit;
+   int i, pass, rc;
+   
+   lock = io_begin(portname);
+   start_deadline();
+   if (relay_data[rtype].set_relay_mask_fun != NULL)
+   {
+      CRELAY_TRACE3(drv__set__mask__start, rtype, mask, states);
+      rc = (*relay_data[rtype].set_relay_mask_fun)(portname, mask, states, serial);
+      CRELAY_TRACE2(drv__set__mask__done, rtype, rc);
+   }
+   else
+   {
+      /* Turn-offs first, so that a relay is never switched on while
+       * the one it replaces is still on */
+      for (pass=0, rc=0; pass<2 && rc >= 0; pass++)
+      {
+         for (i=FIRST_RELAY; i<FIRST_RELAY+num_relays && rc >= 0; i++)
+         {
+            bit = 1<<(i-FIRST_RELAY);
+            if (!(mask & bit) || ((states & bit) != 0) != pass) continue;
+            rstate = pass ? ON : OFF;
+            CRELAY_TRACE3(drv__set__start, rtype, i, rstate);
+            rc = (*relay_data[rtype].set_relay_fun)(portname, i, rstate, serial);
+            CRELAY_TRACE3(drv__set__done, rtype, i, rc);
+         }
+      }
+   }
+   io_end(lock);
+   return rc < 0 ? rc : 0;
+}
+
+
+/**********************************************************
+ * Function crelay_play_waveform_type()
+ * 
+ * Description: Play a sampled waveform on a card detected
+ *              before. The samples are clocked out by the
+ *              card itself at the sample rate, so their
+ *              timing does not depend on the USB transfers.
+ *              The call returns when the waveform has been
+ *              played or cancelled.
+ * 
+ * Parameters: rtype (in)        - relay card type
+ *             portname (in)     - communication port
+ *             samples (in)      - relay states of all
+ *                                 relays, bit 0 is relay 1
+ *             num_samples (in)  - number of samples
+ *             rate_hz (in)      - sample rate
+ *             cancel (in)       - set to non-zero by another
+ *                                 thread to cancel
+ *             serial (in)       - serial number [optional]
+ * 
+ * Return:  >=0 - number of samples played
+ *          -ENOTSUP if the card has no waveform mode
+ *          -EPERM if a sample breaks an interlock rule
+ *          <0  - other failure
+ *********************************************************/
+int crelay_play_waveform_type(relay_type_t rtype, char* portname, const uint16_t* samples,
+                              uint32_t num_samples, uint32_t rate_hz, const int* cancel, char* serial)
+{
+   int rc;
+   
+   if (!crelay_waveform_supported(rtype))
+   {
+      return -ENOTSUP;
+   }
+   
+#ifndef BUILD_LIB
+   if ((rc = card_health_check(serial)) < 0)
+   {
+      return rc;
+   }
+   if ((rc = interlock_check_states(serial, samples, num_samples)) < 0)
+   {
+      return rc;
+   }
+#endif
+   
+   /* The deadline applies to opening the card, the driver allows each
+    * chunk of samples the time it takes to play. The card is not locked
+    * for I/O while it plays, the driver rejects other accesses. */
+   start_deadline();
+   CRELAY_TRACE2(drv__waveform__start, rtype, num_samples);
+   rc = (*relay_data[rtype].play_waveform_fun)(portname, samples, num_samples, rate_hz, cancel, serial);
+   CRELAY_TRACE2(drv__waveform__done, rtype, rc);
+   
+#ifndef BUILD_LIB
+   card_health_report(serial, rc < 0 ? rc : 0);
+   if (interlock_active())
+   {
+      interlock_forget(NULL, portname, serial);
+   }
+#endif
+   return rc;
+}
+
+
+/**********************************************************
+ * Function crelay_waveform_supported()
+ * 
+ * Description: Check if a card type has a waveform mode
+ * 
+ * Parameters: rtype (in) - relay card type
+ * 
+ * Return: 1 if supported, 0 otherwise
+ *********************************************************/
+int crelay_waveform_supported(relay_type_t rtype)
+{
+   return (rtype > NO_RELAY_TYPE && rtype < LAST_RELAY_TYPE &&
+           relay_data[rtype].play_waveform_fun != NULL);
+}
+
+
+/**********************************************************
+ * Function crelay_set_io_timeout()
+ * 
+ * Description: Set the deadline of the card operations
+ * 
+ * Parameters: timeout_ms (in) - max. duration of one
+ *                               operation in ms
+ * 
+ * Return: none
+ *********************************************************/
+void crelay_set_io_timeout(uint32_t timeout_ms)
+{
+   if (timeout_ms > 0) io_timeout_ms = timeout_ms;
+}
+
+
+/**********************************************************
+ * Function crelay_io_timeout()
+ * 
+ * Description: Get the time left until the deadline of the
+ *              current operation of the calling thread, to
+ *              be used by the drivers as USB timeout
+ * 
+ * Parameters: none
+ * 
+ * Return: time left in ms, 0 if the deadline has passed
+ *********************************************************/
+unsigned int crelay_io_timeout(void)
+{
+   struct timespec ts;
+   uint64_t now;
+   
+   /* Driver called directly, not through this layer */
+   if (io_deadline_ns == 0) return io_timeout_ms;
+   
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   now = (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+   if (now >= io_deadline_ns) return 0;
+   return (io_deadline_ns-now+999999)/1000000;
+}
+
+
 /**********************************************************
  * Function crelay_get_relay_card_type()
  * 
@@ -50,6 +50,10 @@
 #define SAINSMART16_USB_NAME          "Sainsmart USB-HID 16-channel relay card"
 #define SAINSMART16_USB_NUM_RELAYS     16
 
+/* Simulated relay card (for benchmarking and testing) */
+#define SIMULATED_RELAY_NAME           "Simulated relay card"
+#define SIMULATED_NUM_RELAYS           8
+
 /* Generic GPIO connected relay cards */
 #define GENERIC_GPIO_NAME              "Generic GPIO relays"
 #define GENERIC_GPIO_NUM_RELAYS        8
@@ -61,6 +65,10 @@
 #define MAX_COM_PORT_NAME_LEN 32
 #define MAX_SERIAL_LEN 32
 
+/* Deadline of one card operation (detect, get or set), drivers
+ * return -ETIMEDOUT when the card does not answer in time */
+#define RELAY_IO_TIMEOUT_MS 1000
+
 
 typedef enum
 {
@@ -78,6 +86,9 @@ typedef enum
 #ifdef DRV_SAINSMART16
    SAINSMART16_USB_RELAY_TYPE,     /* Sainsmart USB-HID relay card */
 #endif
+#ifdef DRV_SIMULATED
+   SIMULATED_RELAY_TYPE,           /* Simulated relay card */
+#endif
    
    /* Add other relay types here */
    
@@ -100,6 +111,8 @@ typedef struct relay_info
 {
    relay_type_t relay_type;
    char         serial[MAX_SERIAL_LEN]; 
+   char         portname[MAX_COM_PORT_NAME_LEN]; /* empty if not known from the enumeration */
+   uint8_t      num_relays;                      /* 0 if not known from the enumeration */
    struct relay_info *next;
 } 
 relay_info_t;
@@ -109,6 +122,9 @@ typedef struct
    int (*detect_relay_card_fun)(char*, uint8_t*, char*, relay_info_t **); /* function to detect the relay card */
    int (*get_relay_fun)(char*, uint8_t, relay_state_t*, char*); /* function to get the current relay state */
    int (*set_relay_fun)(char*, uint8_t, relay_state_t, char*);  /* function to set the new relay state */
+   int (*get_relay_mask_fun)(char*, uint16_t*, char*);          /* function to get all relay states [optional] */
+   int (*set_relay_mask_fun)(char*, uint16_t, uint16_t, char*); /* function to set several relay states [optional] */
+   int (*play_waveform_fun)(char*, const uint16_t*, uint32_t, uint32_t, const int*, char*); /* function to play a sampled waveform [optional] */
    char *card_name;                                           /* card name string */
 }
 relay_data_t;
@@ -140,6 +156,10 @@ int crelay_detect_all_relay_cards(relay_info_t** relay_info);
  * 
  * Return:  0 - success
  *         -1 - fail, no relay card found
+ *         -ETIMEDOUT - no relay card found, a card did
+ *                      not answer in time
+ *         -ENOLINK - the card failed too often, it is not
+ *                    accessed until its next probe
  *********************************************************/
 int crelay_detect_relay_card(char* portname, uint8_t* num_relays, char* serial, relay_info_t** relay_info);
 
@@ -171,6 +191,216 @@ int crelay_get_relay(char* portname, uint8_t relay, relay_state_t* relay_state,
  *********************************************************/
 int crelay_set_relay(char* portname, uint8_t relay, relay_state_t relay_state, char* serial);
 
+/**********************************************************
+ * Function crelay_get_relay_mask()
+ * 
+ * Description: Get the current state of all relays
+ * 
+ * Parameters: portname (in)     - communication port
+ *             states (out)      - relay states, bit 0 is
+ *                                 relay 1
+ *             serial (in)       - serial number [optional]
+ * 
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int crelay_get_relay_mask(char* portname, uint16_t* states, char* serial);
+
+/**********************************************************
+ * Function crelay_set_relay_mask()
+ * 
+ * Description: Set the state of several relays at once
+ * 
+ * Parameters: portname (in)     - communication port
+ *             mask (in)         - relays to change, bit 0
+ *                                 is relay 1
+ *             states (in)       - new relay states
+ *             serial (in)       - serial number [optional]
+ * 
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int crelay_set_relay_mask(char* portname, uint16_t mask, uint16_t states, char* serial);
+
+/**********************************************************
+ * Function crelay_set_relay_mask_type()
+ * 
+ * Description: Set the state of several relays of a card
+ *              detected before. Unlike the other functions
+ *              it does not depend on the last detected card,
+ *              so it can be used by other threads. The I/O
+ *              of a card is serialized, different cards
+ *              are accessed in parallel.
+ *              When power-on limits are configured, the
+ *              turn-ons may be split into several writes,
+ *              see power_seq.h. When interlocks are
+ *              configured, a write which breaks one is
+ *              rejected, see interlock.h.
+ * 
+ * Parameters: rtype (in)        - relay card type
+ *             num_relays (in)   - number of relays
+ *             portname (in)     - communication port
+ *             mask (in)         - relays to change, bit 0
+ *                                 is relay 1
+ *             states (in)       - new relay states
+ *             serial (in)       - serial number [optional]
+ * 
+ * Return:   0 - success
+ *          -EPERM if an interlock rule would be broken
+ *          <0 - other failure
+ *********************************************************/
+int crelay_set_relay_mask_type(relay_type_t rtype, uint8_t num_relays, char* portname,
+                               uint16_t mask, uint16_t states, char* serial);
+
+/**********************************************************
+ * Function crelay_check_relay_mask_type()
+ * 
+ * Description: Check a write of several relays of a card
+ *              detected before against the interlocks
+ *              without writing, e.g. to reject a write to
+ *              several cards before any of them is written
+ * 
+ * Parameters: rtype (in)        - relay card type
+ *             num_relays (in)   - number of relays
+ *             portname (in)     - communication port
+ *             mask (in)         - relays to change, bit 0
+ *                                 is relay 1
+ *             states (in)       - new relay states
+ *             serial (in)       - serial number [optional]
+ * 
+ * Return:   0 - allowed
+ *          -EPERM if an interlock rule would be broken
+ *          <0 - other failure
+ *********************************************************/
+int crelay_check_relay_mask_type(relay_type_t rtype, uint8_t num_relays, char* portname,
+                                 uint16_t mask, uint16_t states, char* serial);
+
+/**********************************************************
+ * Function crelay_detect_relay_card_type()
+ * 
+ * Description: Detect a card of a known type, for the
+ *              emergency off: only the driver of the type
+ *              is asked and the card health is not checked,
+ *              so a card with open circuit is found too
+ * 
+ * Parameters: rtype (in)       - relay card type
+ *             portname (out)   - communication port
+ *             num_relays (out) - number of relays
+ *             serial (in)      - serial number [optional]
+ * 
+ * Return:  0 - success
+ *         <0 - fail, card not found
+ *********************************************************/
+int crelay_detect_relay_card_type(relay_type_t rtype, char* portname, uint8_t* num_relays, char* serial);
+
+/**********************************************************
+ * Function crelay_force_relay_mask_type()
+ * 
+ * Description: Write the state of several relays of a card
+ *              for the emergency off: the card health,
+ *              interlocks and power-on limits are bypassed,
+ *              so a card with open circuit is written too.
+ *              The I/O of the card is serialized as for
+ *              crelay_set_relay_mask_type().
+ * 
+ * Parameters: rtype (in)        - relay card type
+ *             num_relays (in)   - number of relays
+ *             portname (in)     - communication port
+ *             mask (in)         - relays to change, bit 0
+ *                                 is relay 1
+ *             states (in)       - new relay states
+ *             serial (in)       - serial number [optional]
+ * 
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int crelay_force_relay_mask_type(relay_type_t rtype, uint8_t num_relays, char* portname,
+                                 uint16_t mask, uint16_t states, char* serial);
+
+/**********************************************************
+ * Function crelay_get_relay_mask_type()
+ * 
+ * Description: Get the current state of all relays of a
+ *              card detected before, see
+ *              crelay_set_relay_mask_type()
+ * 
+ * Parameters: rtype (in)        - relay card type
+ *             num_relays (in)   - number of relays
+ *             portname (in)     - communication port
+ *             states (out)      - relay states, bit 0 is
+ *                                 relay 1
+ *             serial (in)       - serial number [optional]
+ * 
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int crelay_get_relay_mask_type(relay_type_t rtype, uint8_t num_relays, char* portname,
+                               uint16_t* states, char* serial);
+
+/**********************************************************
+ * Function crelay_play_waveform_type()
+ * 
+ * Description: Play a sampled waveform on a card detected
+ *              before. The samples are clocked out by the
+ *              card itself at the sample rate, so their
+ *              timing does not depend on the USB transfers.
+ *              The call returns when the waveform has been
+ *              played or cancelled.
+ * 
+ * Parameters: rtype (in)        - relay card type
+ *             portname (in)     - communication port
+ *             samples (in)      - relay states of all
+ *                                 relays, bit 0 is relay 1
+ *             num_samples (in)  - number of samples
+ *             rate_hz (in)      - sample rate
+ *             cancel (in)       - set to non-zero by another
+ *                                 thread to cancel
+ *             serial (in)       - serial number [optional]
+ * 
+ * Return:  >=0 - number of samples played
+ *          -ENOTSUP if the card has no waveform mode
+ *          -EPERM if a sample breaks an interlock rule
+ *          <0  - other failure
+ *********************************************************/
+int crelay_play_waveform_type(relay_type_t rtype, char* portname, const uint16_t* samples,
+                              uint32_t num_samples, uint32_t rate_hz, const int* cancel, char* serial);
+
+/**********************************************************
+ * Function crelay_waveform_supported()
+ * 
+ * Description: Check if a card type has a waveform mode
+ * 
+ * Parameters: rtype (in) - relay card type
+ * 
+ * Return: 1 if supported, 0 otherwise
+ *********************************************************/
+int crelay_waveform_supported(relay_type_t rtype);
+
+/**********************************************************
+ * Function crelay_set_io_timeout()
+ * 
+ * Description: Set the deadline of the card operations
+ * 
+ * Parameters: timeout_ms (in) - max. duration of one
+ *                               operation in ms
+ * 
+ * Return: none
+ *********************************************************/
+void crelay_set_io_timeout(uint32_t timeout_ms);
+
+/**********************************************************
+ * Function crelay_io_timeout()
+ * 
+ * Description: Get the time left until the deadline of the
+ *              current operation of the calling thread, to
+ *              be used by the drivers as USB timeout
+ * 
+ * Parameters: none
+ * 
+ * Return: time left in ms, 0 if the deadline has passed
+ *********************************************************/
+unsigned int crelay_io_timeout(void);
+
 /**********************************************************
  * Function crelay_get_relay_card_type()
  * 
@@ -198,9 +198,10 @@ static libusb_device_handle* open_device_with_vid_pid_serial(uint16_t vendorid,
          // Save serial number and type in current relay info struct
          (*relay_info)->relay_type = CONRAD_4CHANNEL_USB_RELAY_TYPE;
          strcpy((*relay_info)->serial, (char *)sernum);
+         snprintf((*relay_info)->portname, MAX_COM_PORT_NAME_LEN, "Serial number %s", (char *)sernum);
+         (*relay_info)->num_relays = CONRAD_4CHANNEL_USB_NUM_RELAYS;
          // Allocate new struct
-         rinfo = malloc(sizeof(relay_info_t));
-         rinfo->next = NULL;
+         rinfo = calloc(1, sizeof(relay_info_t));
          // Link current to new struct
          (*relay_info)->next = rinfo;
          // Move pointer to new struct
@@ -282,10 +283,12 @@ int detect_relay_card_conrad_4chan(char* portname, uint8_t* num_relays, char* se
  * 
  * Return:   0 - success
  *          -1 - fail
+ *          -ETIMEDOUT - card did not answer in time
  *********************************************************/
 int get_relay_conrad_4chan(char* portname, uint8_t relay, relay_state_t* relay_state, char* serial)
 {
    struct libusb_device_handle *dev = NULL; 
+   unsigned int timeout;
    int r;  
    uint8_t gpio=0;
    
@@ -309,6 +312,12 @@ int get_relay_conrad_4chan(char* portname, uint8_t relay, relay_state_t* relay_s
    }
    
    /* Get relay state from the card */ 
+   if ((timeout = crelay_io_timeout()) == 0)
+   {
+      libusb_close(dev);
+      libusb_exit(NULL);
+      return -ETIMEDOUT;
+   }
    r = libusb_control_transfer (
                 dev,                    // libusb_device_handle *  dev_handle,
                 REQTYPE_DEVICE_TO_HOST, // uint8_t         bmRequestType,
@@ -317,14 +326,14 @@ int get_relay_conrad_4chan(char* portname, uint8_t relay, relay_state_t* relay_s
                 0,                      // uint16_t        wIndex,
                 &gpio,                  // unsigned char * data,
                 1,                      // uint16_t        wLength,
-                0);                     // unsigned int    timeout
+                timeout);               // unsigned int    timeout
 
    if (r < 0) 
    {
       fprintf(stderr, "libusb_control_transfer error (%s)\n", libusb_error_name(r));
       libusb_close(dev);
       libusb_exit(NULL);
-      return -3;
+      return (r == LIBUSB_ERROR_TIMEOUT) ? -ETIMEDOUT : -3;
    }
 
    relay = relay-1;
@@ -347,10 +356,12 @@ int get_relay_conrad_4chan(char* portname, uint8_t relay, relay_state_t* relay_s
  * 
  * Return:   o - success
  *          -1 - fail
+ *          -ETIMEDOUT - card did not answer in time
  *********************************************************/
 int set_relay_conrad_4chan(char* portname, uint8_t relay, relay_state_t relay_state, char* serial)
 {
    struct libusb_device_handle *dev = NULL; 
+   unsigned int timeout;
    int r;  
    uint16_t gpio=0;
    
@@ -381,6 +392,12 @@ int set_relay_conrad_4chan(char* portname, uint8_t relay, relay_state_t relay_st
    gpio = gpio | (0x0001<<relay);
 
    /* Set relay state on the card */ 
+   if ((timeout = crelay_io_timeout()) == 0)
+   {
+      libusb_close(dev);
+      libusb_exit(NULL);
+      return -ETIMEDOUT;
+   }
    r = libusb_control_transfer (
                 dev,                    // libusb_device_handle *  dev_handle,
                 REQTYPE_HOST_TO_DEVICE, // uint8_t         bmRequestType,
@@ -389,14 +406,14 @@ int set_relay_conrad_4chan(char* portname, uint8_t relay, relay_state_t relay_st
                 gpio,                   // uint16_t        wIndex,
                 NULL,                   // unsigned char * data,
                 0,                      // uint16_t        wLength,
-                0);                     // unsigned int    timeout
+                timeout);               // unsigned int    timeout
    
    if (r < 0) 
    {
       fprintf(stderr, "libusb_control_transfer error (%s)\n", libusb_error_name(r));
       libusb_close(dev);
       libusb_exit(NULL);
-      return -3;
+      return (r == LIBUSB_ERROR_TIMEOUT) ? -ETIMEDOUT : -3;
    }
 
    libusb_close(dev);
@@ -68,6 +68,7 @@ static uint16_t pins[] =
 
 static uint8_t g_num_relays=GENERIC_GPIO_NUM_RELAYS;
 static uint8_t g_active_value=1;
+static uint16_t g_pwm_mask=0;   /* relays driven by the PWM thread */
 
 extern config_t config;
 
@@ -237,7 +238,7 @@ int detect_relay_card_generic_gpio(char* portname, uint8_t* num_relays, char* se
    
    /* Return parameters */
    if (num_relays!=NULL) *num_relays = g_num_relays; 
-   strcpy(portname, GPIO_BASE_DIR);
+   if (portname!=NULL) strcpy(portname, GPIO_BASE_DIR);
    close(fd);
    
    return 0;
@@ -331,6 +332,10 @@ int set_relay_generic_gpio(char* portname, uint8_t relay, relay_state_t relay_st
       fprintf(stderr, "ERROR: Relay number out of range\n");
       return -1;
    }
+   if (__atomic_load_n(&g_pwm_mask, __ATOMIC_ACQUIRE) & (1<<(relay-FIRST_RELAY)))
+   {
+      return -EBUSY;
+   }
  
    /* Get pin number */
    pin=pins[relay];
@@ -368,3 +373,56 @@ int set_relay_generic_gpio(char* portname, uint8_t relay, relay_state_t relay_st
    
    return 0;
 }
+
+
+/**********************************************************
+ * Function open_relay_generic_gpio()
+ * 
+ * Description: Open the value file of a relay's GPIO pin
+ *              for repeated writes, and get the values
+ *              which switch the relay on and off
+ * 
+ * Parameters: relay (in)      - relay number
+ *             on_value (out)  - value to write for ON
+ *             off_value (out) - value to write for OFF
+ * 
+ * Return:  >=0 - file descriptor
+ *          -1  - fail
+ *********************************************************/
+int open_relay_generic_gpio(uint8_t relay, char* on_value, char* off_value)
+{
+   char b[64];
+   int fd;
+   
+   if (relay<FIRST_RELAY || relay>(FIRST_RELAY+g_num_relays-1) || g_active_value > 1)
+   {
+      return -1;
+   }
+   
+   snprintf(b, sizeof(b), "%s%d/value", GPIO_BASE_FILE, pins[relay]);
+   fd = open(b, O_WRONLY|O_CLOEXEC);
+   if (fd < 0) 
+   {
+      fprintf(stderr, "ERROR: Open %s: %s\n", b, strerror(errno));
+      return -1;
+   }
+   *on_value  = g_active_value ? '1' : '0';
+   *off_value = g_active_value ? '0' : '1';
+   return fd;
+}
+
+
+/**********************************************************
+ * Function set_pwm_mask_generic_gpio()
+ * 
+ * Description: Set the relays driven by the PWM thread,
+ *              writes to them fail with -EBUSY
+ * 
+ * Parameters: mask (in) - relays in PWM mode
+ * 
+ * Return: none
+ *********************************************************/
+void set_pwm_mask_generic_gpio(uint16_t mask)
+{
+   __atomic_store_n(&g_pwm_mask, mask, __ATOMIC_RELEASE);
+}
@@ -77,4 +77,32 @@ int get_relay_generic_gpio(char* portname, uint8_t relay, relay_state_t* relay_s
  *********************************************************/
 int set_relay_generic_gpio(char* portname, uint8_t relay, relay_state_t relay_state, char* serial);
 
+/**********************************************************
+ * Function open_relay_generic_gpio()
+ * 
+ * Description: Open the value file of a relay's GPIO pin
+ *              for repeated writes, and get the values
+ *              which switch the relay on and off
+ * 
+ * Parameters: relay (in)      - relay number
+ *             on_value (out)  - value to write for ON
+ *             off_value (out) - value to write for OFF
+ * 
+ * Return:  >=0 - file descriptor
+ *          -1  - fail
+ *********************************************************/
+int open_relay_generic_gpio(uint8_t relay, char* on_value, char* off_value);
+
+/**********************************************************
+ * Function set_pwm_mask_generic_gpio()
+ * 
+ * Description: Set the relays driven by the PWM thread,
+ *              writes to them fail with -EBUSY
+ * 
+ * Parameters: mask (in) - relays in PWM mode
+ * 
+ * Return: none
+ *********************************************************/
+void set_pwm_mask_generic_gpio(uint16_t mask);
+
 #endif
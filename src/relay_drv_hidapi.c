@@ -81,12 +81,22 @@
  * S: Relay state (0xff=on, 0xfe=all_on, 0xfd=off, 0xfc=all_off)
  * R: Relay number (integer)
  * 
+ * Timeouts
+ * -----------------------------
+ * 
+ * hid_get_feature_report() and hid_write() have no timeout parameter,
+ * the transfers are bounded by the backend (5s control request timeout
+ * of the kernel for hidraw, 1s for libusb). A transfer which fails
+ * after the deadline of the operation is reported as a timeout, and no
+ * further transfer is started once the deadline has passed.
+ * 
  *****************************************************************************/ 
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
 #include <hidapi/hidapi.h>
 
 #include "relay_drv.h"
@@ -109,6 +119,22 @@
 static uint8_t g_num_relays=HID_API_NUM_RELAYS;
 
 
+/**********************************************************
+ * Internal function xfer_error()
+ * 
+ * Description: Get the error code of a failed transfer
+ * 
+ * Parameters: rc (in) - error code if not timed out
+ * 
+ * Return: -ETIMEDOUT if the deadline has passed, rc
+ *         otherwise
+ *********************************************************/
+static int xfer_error(int rc)
+{
+   return (crelay_io_timeout() == 0) ? -ETIMEDOUT : rc;
+}
+
+
 /**********************************************************
  * Function detect_relay_card_hidapi()
  * 
@@ -173,9 +199,11 @@ int detect_relay_card_hidapi(char* portname, uint8_t* num_relays, char* serial,
          // Save serial number and type in current relay info struct
          (*relay_info)->relay_type = HID_API_RELAY_TYPE;
          strcpy((*relay_info)->serial, (char *)buf);
+         snprintf((*relay_info)->portname, MAX_COM_PORT_NAME_LEN, "%s", nextdev->path);
+         num = atoi((const char *)(nextdev->product_string+strlen(PRODUCT_STR_BASE)));
+         (*relay_info)->num_relays = (num > 0) ? num : g_num_relays;
          // Allocate new struct
-         rinfo = malloc(sizeof(relay_info_t));
-         rinfo->next = NULL;
+         rinfo = calloc(1, sizeof(relay_info_t));
          // Link current to new struct
          (*relay_info)->next = rinfo;
          // Move pointer to new struct
@@ -248,7 +276,7 @@ int get_relay_hidapi(char* portname, uint8_t relay, relay_state_t* relay_state,
    if (hid_get_feature_report(hid_dev, buf, sizeof(buf)) != REPORT_LEN)
    {
       fprintf(stderr, "unable to read feature report from device %s (%ls)\n", portname, hid_error(hid_dev));
-      return -3;
+      return xfer_error(-3);
    }
    //printf("DBG: Relay ID: %s\n", buf);
    //printf("DBG: Read relay bits %02X\n", buf[REPORT_RDDAT_OFFSET]);
@@ -299,7 +327,116 @@ int set_relay_hidapi(char* portname, uint8_t relay, relay_state_t relay_state, c
    if (hid_write(hid_dev, buf, sizeof(buf)) < 0)
    {
       fprintf(stderr, "unable to write output report to device %s (%ls)\n", portname, hid_error(hid_dev));
-      return -3;
+      return xfer_error(-3);
+   }
+   
+   hid_close(hid_dev);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function get_relay_mask_hidapi()
+ * 
+ * Description: Get the current state of all relays with
+ *              a single feature report
+ * 
+ * Parameters: portname (in)     - communication port
+ *             states (out)      - relay states
+ *             serial (in)       - serial number [not used]
+ *
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int get_relay_mask_hidapi(char* portname, uint16_t* states, char* serial)
+{
+   hid_device *hid_dev;
+   unsigned char buf[REPORT_LEN];  
+
+   /* Open HID API device */
+   if ((hid_dev = hid_open_path(portname)) == NULL)
+   {
+      fprintf(stderr, "unable to open HID API device %s\n", portname);
+      return -2;
+   }
+
+   /* Read relay states requesting a feature report with Id 0x01 */
+   buf[0] = 0x01;
+   if (hid_get_feature_report(hid_dev, buf, sizeof(buf)) != REPORT_LEN)
+   {
+      fprintf(stderr, "unable to read feature report from device %s (%ls)\n", portname, hid_error(hid_dev));
+      hid_close(hid_dev);
+      return xfer_error(-3);
+   }
+   *states = buf[REPORT_RDDAT_OFFSET] & ((1<<g_num_relays)-1);
+   
+   hid_close(hid_dev);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function set_relay_mask_hidapi()
+ * 
+ * Description: Set the state of several relays opening
+ *              the device only once. If all relays are
+ *              switched to the same state the ALL ON/OFF
+ *              command is used.
+ * 
+ * Parameters: portname (in)     - communication port
+ *             mask (in)         - relays to change
+ *             states (in)       - new relay states
+ *             serial (in)       - serial number [not used]
+ *
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int set_relay_mask_hidapi(char* portname, uint16_t mask, uint16_t states, char* serial)
+{ 
+   hid_device *hid_dev;
+   unsigned char buf[REPORT_LEN];  
+   uint16_t all = (1<<g_num_relays)-1;
+   int i;
+
+   if (mask & ~all)
+   {  
+      fprintf(stderr, "ERROR: Relay number out of range\n");
+      return -1;      
+   }
+
+   /* Open HID API device */
+   if ((hid_dev = hid_open_path(portname)) == NULL)
+   {
+      fprintf(stderr, "unable to open HID API device %s\n", portname);
+      return -2;
+   }
+
+   for (i=0; i<g_num_relays; i++)
+   {
+      if (!(mask & (1<<i))) continue;
+      if (crelay_io_timeout() == 0)
+      {
+         hid_close(hid_dev);
+         return -ETIMEDOUT;
+      }
+      
+      memset(buf, 0, sizeof(buf));
+      if (mask == all && ((states & all) == all || (states & all) == 0))
+      {
+         buf[REPORT_WRCMD_OFFSET] = (states & all) ? CMD_ALL_ON : CMD_ALL_OFF;
+         i = g_num_relays;
+      }
+      else
+      {
+         buf[REPORT_WRCMD_OFFSET] = (states & (1<<i)) ? CMD_ON : CMD_OFF;
+         buf[REPORT_WRREL_OFFSET] = i+1;
+      }
+      if (hid_write(hid_dev, buf, sizeof(buf)) < 0)
+      {
+         fprintf(stderr, "unable to write output report to device %s (%ls)\n", portname, hid_error(hid_dev));
+         hid_close(hid_dev);
+         return xfer_error(-3);
+      }
    }
    
    hid_close(hid_dev);
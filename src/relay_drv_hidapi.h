@@ -79,4 +79,33 @@ int get_relay_hidapi(char* portname, uint8_t relay, relay_state_t* relay_state,
  *********************************************************/
 int set_relay_hidapi(char* portname, uint8_t relay, relay_state_t relay_state, char* serial);
 
+
+/**********************************************************
+ * Function get_relay_mask_hidapi()
+ * 
+ * Description: Get the current state of all relays
+ * 
+ * Parameters: portname (in)     - communication port
+ *             states (out)      - relay states
+ * 
+ * Return:   0 - success
+ *          -1 - fail
+ *********************************************************/
+int get_relay_mask_hidapi(char* portname, uint16_t* states, char* serial);
+
+
+/**********************************************************
+ * Function set_relay_mask_hidapi()
+ * 
+ * Description: Set the state of several relays
+ * 
+ * Parameters: portname (in)     - communication port
+ *             mask (in)         - relays to change
+ *             states (in)       - new relay states
+ * 
+ * Return:   0 - success
+ *          -1 - fail
+ *********************************************************/
+int set_relay_mask_hidapi(char* portname, uint16_t mask, uint16_t states, char* serial);
+
 #endif
@@ -63,12 +63,24 @@
  *  0: NO contact open, NC contact closed, led is off
  *  1: NO contact closed, NC contact open, led is on
  * 
+ * Waveforms:
+ * ----------
+ * In asynchronous bitbang mode the chip writes the bytes it receives to
+ * the pins at a rate derived from the baud rate generator (16 bytes per
+ * baud on the FT245RL, see wave_clock_div in the config file). A waveform
+ * is therefore played by setting the baud rate to rate/16 and streaming
+ * one byte per sample in large USB transfers. The chip's FIFO absorbs the
+ * gaps between the transfers, so the timing of the relay signals comes
+ * from the chip's clock and not from the host.
+ * 
  *****************************************************************************/ 
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include <ftdi.h>
 #include <libusb-1.0/libusb.h>
 
@@ -77,14 +89,213 @@
 #define VENDOR_ID 0x0403
 #define DEVICE_ID 0x6001
 
+#define WAVE_CLOCK_DIV  16     /* bitbang bytes per baud (FT245RL) */
+#define WAVE_CHUNK_MS   20     /* duration of one USB transfer */
+#define WAVE_CHUNK_MIN  64     /* bytes */
+#define WAVE_CHUNK_MAX  4096   /* bytes */
+#define WAVE_FIFO_BYTES 256    /* chip FIFO still to be played after the last transfer */
+#define WAVE_IDLE_BAUD  9600
+
 #ifndef BUILD_LIB
 #include "data_types.h"
 extern config_t config;
 #endif
 
-static struct ftdi_context *ftdi;
 static uint8_t g_num_relays=SAINSMART_USB_NUM_RELAYS;
 
+/* FTDI context of each thread, so that threads accessing different
+ * cards at the same time do not open and close each other's device */
+static pthread_once_t g_ctx_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  g_ctx_key;
+
+/* Cards busy playing a waveform, by serial number ("" for the
+ * default card) */
+#define WAVE_MAX_CARDS 8
+typedef struct
+{
+   int  used;
+   char serial[MAX_SERIAL_LEN];
+   char portname[MAX_COM_PORT_NAME_LEN];
+}
+wave_card_t;
+
+static wave_card_t     g_wave[WAVE_MAX_CARDS];
+static pthread_mutex_t g_wave_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void free_context(void *ctx)
+{
+   ftdi_free(ctx);
+}
+
+
+static void create_context_key(void)
+{
+   pthread_key_create(&g_ctx_key, free_context);
+}
+
+
+/**********************************************************
+ * Internal function thread_context()
+ * 
+ * Description: Get the FTDI context of the calling thread,
+ *              it is created on first use and freed when
+ *              the thread exits
+ * 
+ * Parameters: none
+ * 
+ * Return: FTDI context, NULL on failure
+ *********************************************************/
+static struct ftdi_context* thread_context(void)
+{
+   struct ftdi_context *ctx;
+   
+   pthread_once(&g_ctx_once, create_context_key);
+   if ((ctx = pthread_getspecific(g_ctx_key)) == NULL)
+   {
+      if ((ctx = ftdi_new()) == 0)
+      {
+         fprintf(stderr, "ftdi_new failed\n");
+         return NULL;
+      }
+      pthread_setspecific(g_ctx_key, ctx);
+   }
+   return ctx;
+}
+
+
+/**********************************************************
+ * Internal function wave_playing()
+ * 
+ * Description: Check if a card plays a waveform
+ * 
+ * Parameters: serial (in)    - serial number, NULL for the
+ *                              default card
+ *             portname (out) - port of the card if playing
+ *                              [optional]
+ * 
+ * Return: 1 if playing, 0 otherwise
+ *********************************************************/
+static int wave_playing(const char *serial, char *portname)
+{
+   int i, playing = 0;
+   
+   pthread_mutex_lock(&g_wave_lock);
+   for (i=0; i<WAVE_MAX_CARDS; i++)
+   {
+      if (g_wave[i].used && !strcmp(g_wave[i].serial, serial ? serial : ""))
+      {
+         if (portname)
+            strcpy(portname, g_wave[i].portname);
+         playing = 1;
+         break;
+      }
+   }
+   pthread_mutex_unlock(&g_wave_lock);
+   return playing;
+}
+
+
+/**********************************************************
+ * Internal function wave_begin()
+ * 
+ * Description: Mark a card as playing a waveform
+ * 
+ * Parameters: serial (in)   - serial number, NULL for the
+ *                             default card
+ *             portname (in) - port of the card
+ * 
+ * Return: 0 on success, -EBUSY if the card plays already
+ *         or too many cards play
+ *********************************************************/
+static int wave_begin(const char *serial, const char *portname)
+{
+   wave_card_t *card = NULL;
+   int i;
+   
+   pthread_mutex_lock(&g_wave_lock);
+   for (i=0; i<WAVE_MAX_CARDS; i++)
+   {
+      if (g_wave[i].used && !strcmp(g_wave[i].serial, serial ? serial : ""))
+      {
+         pthread_mutex_unlock(&g_wave_lock);
+         return -EBUSY;
+      }
+      if (!g_wave[i].used && card == NULL)
+         card = &g_wave[i];
+   }
+   if (card != NULL)
+   {
+      card->used = 1;
+      snprintf(card->serial, sizeof(card->serial), "%s", serial ? serial : "");
+      snprintf(card->portname, sizeof(card->portname), "%s", portname ? portname : "");
+   }
+   pthread_mutex_unlock(&g_wave_lock);
+   return (card != NULL) ? 0 : -EBUSY;
+}
+
+
+/**********************************************************
+ * Internal function wave_end()
+ * 
+ * Description: Mark a card as no longer playing
+ * 
+ * Parameters: serial (in) - serial number, NULL for the
+ *                           default card
+ * 
+ * Return: none
+ *********************************************************/
+static void wave_end(const char *serial)
+{
+   int i;
+   
+   pthread_mutex_lock(&g_wave_lock);
+   for (i=0; i<WAVE_MAX_CARDS; i++)
+   {
+      if (g_wave[i].used && !strcmp(g_wave[i].serial, serial ? serial : ""))
+         g_wave[i].used = 0;
+   }
+   pthread_mutex_unlock(&g_wave_lock);
+}
+
+
+/**********************************************************
+ * Internal function set_timeouts()
+ * 
+ * Description: Limit the USB transfers of the FTDI context
+ *              to the time left until the deadline of the
+ *              current operation
+ * 
+ * Parameters: ftdi (in) - FTDI context
+ * 
+ * Return: time left in ms, 0 if the deadline has passed
+ *********************************************************/
+static unsigned int set_timeouts(struct ftdi_context *ftdi)
+{
+   unsigned int timeout = crelay_io_timeout();
+   
+   ftdi->usb_read_timeout = timeout;
+   ftdi->usb_write_timeout = timeout;
+   return timeout;
+}
+
+
+/**********************************************************
+ * Internal function xfer_error()
+ * 
+ * Description: Get the error code of a failed transfer,
+ *              libftdi does not pass on the libusb error
+ * 
+ * Parameters: rc (in) - error code if not timed out
+ * 
+ * Return: -ETIMEDOUT if the deadline has passed, rc
+ *         otherwise
+ *********************************************************/
+static int xfer_error(int rc)
+{
+   return (crelay_io_timeout() == 0) ? -ETIMEDOUT : rc;
+}
+
 
 /**********************************************************
  * Function open_device_with_vid_pid_serial()
@@ -183,8 +394,7 @@ static libusb_device_handle* open_device_with_vid_pid_serial(uint16_t vendorid,
          (*relay_info)->relay_type = SAINSMART_USB_RELAY_TYPE;
          strcpy((*relay_info)->serial, (char *)sernum);
          // Allocate new struct
-         rinfo = malloc(sizeof(relay_info_t));
-         rinfo->next = NULL;
+         rinfo = calloc(1, sizeof(relay_info_t));
          // Link current to new struct
          (*relay_info)->next = rinfo;
          // Move pointer to new struct
@@ -225,7 +435,8 @@ static libusb_device_handle* open_device_with_vid_pid_serial(uint16_t vendorid,
  *********************************************************/
 int detect_relay_card_sainsmart_4_8chan(char* portname, uint8_t* num_relays, char* serial, relay_info_t** relay_info)
 {
-    unsigned int chipid;
+   struct ftdi_context *ftdi;
+   unsigned int chipid;
    
    /* Find all connected devices, if requested */
    if (relay_info)
@@ -237,16 +448,24 @@ int detect_relay_card_sainsmart_4_8chan(char* portname, uint8_t* num_relays, cha
       return -1;
    }
 
-   if ((ftdi = ftdi_new()) == 0)
+   /* The card can not be opened while it plays a waveform, only the
+    * requested card is reported as found */
+   if (wave_playing(serial, portname))
+   {
+      if (num_relays) 
+         *num_relays = g_num_relays;
+      return 0;
+   }
+
+   if ((ftdi = thread_context()) == NULL)
    {
-      fprintf(stderr, "ftdi_new failed\n");
       return -1;
    }
 
    /* Try to open FTDI USB device */
+   set_timeouts(ftdi);
    if ((ftdi_usb_open_desc(ftdi, VENDOR_ID, DEVICE_ID, NULL, serial)) < 0)
    {
-      ftdi_free(ftdi);
       return -1;
    }
    
@@ -254,7 +473,7 @@ int detect_relay_card_sainsmart_4_8chan(char* portname, uint8_t* num_relays, cha
    if (ftdi_set_bitmode(ftdi, 0xFF, BITMODE_BITBANG) < 0)
    {
       fprintf(stderr, "unable to set bitbang mode: (%s)\n", ftdi_get_error_string(ftdi));
-      ftdi_free(ftdi);
+      ftdi_usb_close(ftdi);
       return -1;
    }
 
@@ -262,7 +481,7 @@ int detect_relay_card_sainsmart_4_8chan(char* portname, uint8_t* num_relays, cha
    if (ftdi->type != TYPE_R)
    {
       fprintf(stderr, "unable to continue, not an R-type chip\n");
-      ftdi_free(ftdi);
+      ftdi_usb_close(ftdi);
       return -1;
    }
    
@@ -305,6 +524,7 @@ int detect_relay_card_sainsmart_4_8chan(char* portname, uint8_t* num_relays, cha
  *********************************************************/
 int get_relay_sainsmart_4_8chan(char* portname, uint8_t relay, relay_state_t* relay_state, char* serial)
 {
+   struct ftdi_context *ftdi;
    unsigned char buf[1];
    
    if (relay<FIRST_RELAY || relay>(FIRST_RELAY+g_num_relays-1))
@@ -312,19 +532,32 @@ int get_relay_sainsmart_4_8chan(char* portname, uint8_t relay, relay_state_t* re
       fprintf(stderr, "ERROR: Relay number out of range\n");
       return -1;      
    }
-
+   if (wave_playing(serial, NULL))
+   {
+      return -EBUSY;
+   }
+   if ((ftdi = thread_context()) == NULL)
+   {
+      return -1;
+   }
+   
    /* Open FTDI USB device */
+   if (set_timeouts(ftdi) == 0)
+   {
+      return -ETIMEDOUT;
+   }
    if ((ftdi_usb_open_desc(ftdi, VENDOR_ID, DEVICE_ID, NULL, serial)) < 0)
    {
       fprintf(stderr, "unable to open ftdi device (get): (%s)\n", ftdi_get_error_string(ftdi));
-      return -2;
+      return xfer_error(-2);
    }
    
    /* Get relay state from the card */
-   if (ftdi_read_pins(ftdi, &buf[0]) < 0)
+   if (set_timeouts(ftdi) == 0 || ftdi_read_pins(ftdi, &buf[0]) < 0)
    {
       fprintf(stderr,"read failed for 0x%x, error %s\n",buf[0], ftdi_get_error_string(ftdi));
-      return -3;
+      ftdi_usb_close(ftdi);
+      return xfer_error(-3);
    }
    //printf("DBG: Read GPIO bits %02X\n", buf[0]);
    relay = relay-1;
@@ -349,6 +582,7 @@ int get_relay_sainsmart_4_8chan(char* portname, uint8_t relay, relay_state_t* re
  *********************************************************/
 int set_relay_sainsmart_4_8chan(char* portname, uint8_t relay, relay_state_t relay_state, char* serial)
 {
+   struct ftdi_context *ftdi;
    unsigned char buf[1];
    
    if (relay<FIRST_RELAY || relay>(FIRST_RELAY+g_num_relays-1))
@@ -356,19 +590,32 @@ int set_relay_sainsmart_4_8chan(char* portname, uint8_t relay, relay_state_t rel
       fprintf(stderr, "ERROR: Relay number out of range\n");
       return -1;      
    }
+   if (wave_playing(serial, NULL))
+   {
+      return -EBUSY;
+   }
+   if ((ftdi = thread_context()) == NULL)
+   {
+      return -1;
+   }
    
    /* Open FTDI USB device */
+   if (set_timeouts(ftdi) == 0)
+   {
+      return -ETIMEDOUT;
+   }
    if ((ftdi_usb_open_desc(ftdi, VENDOR_ID, DEVICE_ID, NULL, serial)) < 0)
    {
       fprintf(stderr, "unable to open ftdi device (set): (%s)\n", ftdi_get_error_string(ftdi));
-      return -2;
+      return xfer_error(-2);
    }
 
    /* Get relay state from the card */
-   if (ftdi_read_pins(ftdi, buf) < 0)
+   if (set_timeouts(ftdi) == 0 || ftdi_read_pins(ftdi, buf) < 0)
    {
       fprintf(stderr,"read failed for 0x%x, error %s\n",buf[0], ftdi_get_error_string(ftdi));
-      return -3;
+      ftdi_usb_close(ftdi);
+      return xfer_error(-3);
    }
    
    /* Set the new relay state bit */
@@ -387,12 +634,126 @@ int set_relay_sainsmart_4_8chan(char* portname, uint8_t relay, relay_state_t rel
    //printf("DBG: Writing GPIO bits %02X\n", buf[0]);
    
    /* Set relay on the card */
-   if (ftdi_write_data(ftdi, buf, 1) < 0)
+   if (set_timeouts(ftdi) == 0 || ftdi_write_data(ftdi, buf, 1) < 0)
    {
       fprintf(stderr,"read failed for 0x%x, error %s\n",buf[0], ftdi_get_error_string(ftdi));
-      return -4;
+      ftdi_usb_close(ftdi);
+      return xfer_error(-4);
    }
    
    ftdi_usb_close(ftdi);
    return 0;
 }
+
+
+/**********************************************************
+ * Function play_waveform_sainsmart_4_8chan()
+ * 
+ * Description: Play a sampled waveform in asynchronous
+ *              bitbang mode. The samples are written in
+ *              chunks of WAVE_CHUNK_MS, the write of a
+ *              chunk blocks until the chip has room for
+ *              it, which paces the transfers.
+ * 
+ * Parameters: portname (in)     - communication port
+ *             samples (in)      - relay states
+ *             num_samples (in)  - number of samples
+ *             rate_hz (in)      - sample rate
+ *             cancel (in)       - cancel request
+ *             serial (in)       - serial number [optional]
+ * 
+ * Return:  >=0 - number of samples played
+ *          -EBUSY if the card plays a waveform already
+ *          < 0 - other failure
+ *********************************************************/
+int play_waveform_sainsmart_4_8chan(char* portname, const uint16_t* samples, uint32_t num_samples,
+                                    uint32_t rate_hz, const int* cancel, char* serial)
+{
+   struct ftdi_context *wave;
+   unsigned char buf[WAVE_CHUNK_MAX];
+   unsigned int clock_div = WAVE_CLOCK_DIV;
+   uint32_t chunk, played=0, n, i;
+   uint64_t fifo_ns;
+   struct timespec ts;
+   int rc = 0;
+   
+   if (rate_hz == 0)
+   {
+      return -EINVAL;
+   }
+   if (wave_begin(serial, portname) < 0)
+   {
+      return -EBUSY;
+   }
+   
+#ifndef BUILD_LIB
+   if (config.sainsmart_wave_clock_div > 0)
+   {
+      clock_div = config.sainsmart_wave_clock_div;
+   }
+#endif
+   
+   /* The waveform has its own context, it changes the baud rate */
+   if ((wave = ftdi_new()) == 0)
+   {
+      fprintf(stderr, "ftdi_new failed\n");
+      wave_end(serial);
+      return -1;
+   }
+   wave->usb_read_timeout = crelay_io_timeout();
+   wave->usb_write_timeout = crelay_io_timeout();
+   if ((ftdi_usb_open_desc(wave, VENDOR_ID, DEVICE_ID, NULL, serial)) < 0)
+   {
+      fprintf(stderr, "unable to open ftdi device (waveform): (%s)\n", ftdi_get_error_string(wave));
+      ftdi_free(wave);
+      wave_end(serial);
+      return xfer_error(-2);
+   }
+   
+   chunk = (uint64_t)rate_hz*WAVE_CHUNK_MS/1000;
+   if (chunk < WAVE_CHUNK_MIN) chunk = WAVE_CHUNK_MIN;
+   if (chunk > WAVE_CHUNK_MAX) chunk = WAVE_CHUNK_MAX;
+   
+   if (ftdi_set_bitmode(wave, 0xFF, BITMODE_BITBANG) < 0 ||
+       ftdi_set_baudrate(wave, (rate_hz+clock_div/2)/clock_div) < 0 ||
+       ftdi_write_data_set_chunksize(wave, chunk) < 0)
+   {
+      fprintf(stderr, "unable to set waveform clock: (%s)\n", ftdi_get_error_string(wave));
+      rc = xfer_error(-3);
+   }
+   
+   while (rc == 0 && played < num_samples && !__atomic_load_n(cancel, __ATOMIC_ACQUIRE))
+   {
+      n = num_samples-played;
+      if (n > chunk) n = chunk;
+      for (i=0; i<n; i++)
+      {
+         buf[i] = samples[played+i] & 0xFF;
+      }
+      
+      /* The chip takes a chunk when it has played most of the previous one */
+      wave->usb_write_timeout = (uint64_t)n*1000/rate_hz + RELAY_IO_TIMEOUT_MS;
+      if (ftdi_write_data(wave, buf, n) < 0)
+      {
+         fprintf(stderr, "waveform write failed, error %s\n", ftdi_get_error_string(wave));
+         rc = -4;
+         break;
+      }
+      played += n;
+   }
+   
+   /* Let the chip play what is left in its FIFO */
+   n = (played < WAVE_FIFO_BYTES) ? played : WAVE_FIFO_BYTES;
+   fifo_ns = (uint64_t)n*1000000000ULL/rate_hz;
+   ts.tv_sec  = fifo_ns / 1000000000ULL;
+   ts.tv_nsec = fifo_ns % 1000000000ULL;
+   while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR);
+   
+   wave->usb_write_timeout = RELAY_IO_TIMEOUT_MS;
+   ftdi_set_baudrate(wave, WAVE_IDLE_BAUD);
+   ftdi_usb_close(wave);
+   ftdi_free(wave);
+   wave_end(serial);
+   
+   return (rc < 0) ? rc : (int)played;
+}
@@ -77,4 +77,23 @@ int get_relay_sainsmart_4_8chan(char* portname, uint8_t relay, relay_state_t* re
  *********************************************************/
 int set_relay_sainsmart_4_8chan(char* portname, uint8_t relay, relay_state_t relay_state, char* serial);
 
+/**********************************************************
+ * Function play_waveform_sainsmart_4_8chan()
+ * 
+ * Description: Play a sampled waveform in asynchronous
+ *              bitbang mode
+ * 
+ * Parameters: portname (in)     - communication port
+ *             samples (in)      - relay states
+ *             num_samples (in)  - number of samples
+ *             rate_hz (in)      - sample rate
+ *             cancel (in)       - cancel request
+ *             serial (in)       - serial number [optional]
+ * 
+ * Return:  >=0 - number of samples played
+ *          < 0 - fail
+ *********************************************************/
+int play_waveform_sainsmart_4_8chan(char* portname, const uint16_t* samples, uint32_t num_samples,
+                                    uint32_t rate_hz, const int* cancel, char* serial);
+
 #endif
@@ -96,14 +96,25 @@
  *   +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
  *   | 15| 14| 13| 12| 11| 10| 9 | 8 | 7 | 6 | 5 | 4 | 3 | 2 | 1 | 0 |  relay number
  *   +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+ *
+ * Shadow mask
+ * -----------
+ *
+ *   The write command sets all 16 relays, so changing single relays needs
+ *   the current states. The driver keeps the states of each card from its
+ *   last read (updated by the following writes) and uses them instead of
+ *   reading the card again, as long as the read is not older than
+ *   SHADOW_VALID_MS. A failed transfer drops the shadow mask of the card.
 
  *****************************************************************************/ 
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
 #include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include <hidapi/hidapi.h>
 
 #include "relay_drv.h"
@@ -115,6 +126,9 @@
 #define CMD_WRITE 0xC3
 #define CMD_SIGNATURE "HIDC"
 
+#define SHADOW_MAX_CARDS 8
+#define SHADOW_VALID_MS  2000
+
 
 /* USB HID message structure */
 typedef struct
@@ -132,6 +146,96 @@ static uint8_t relay_bit_pos[] = {7 , 8 , 6 , 9 , 5 , 10, 4 , 11, 3 , 12, 2 , 13
 
 static uint8_t g_num_relays=SAINSMART16_USB_NUM_RELAYS;
 
+/* Last known relay states of the cards */
+typedef struct
+{
+   char     path[MAX_COM_PORT_NAME_LEN];
+   uint16_t mask;
+   uint64_t read_ns;      /* time of the last read, 0 if not valid */
+} shadow_t;
+
+static shadow_t        g_shadow[SHADOW_MAX_CARDS];
+static pthread_mutex_t g_shadow_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static uint64_t now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+/* Find the shadow entry of a card, if it is not found and
+ * create is set the oldest entry is replaced, otherwise NULL
+ * is returned (call with the lock held) */
+static shadow_t* shadow_find(const char *path, int create)
+{
+   shadow_t *shadow = &g_shadow[0];
+   int i;
+
+   for (i=0; i<SHADOW_MAX_CARDS; i++)
+   {
+      if (!strcmp(g_shadow[i].path, path))
+         return &g_shadow[i];
+      if (g_shadow[i].read_ns < shadow->read_ns)
+         shadow = &g_shadow[i];
+   }
+   if (!create)
+      return NULL;
+   snprintf(shadow->path, sizeof(shadow->path), "%s", path);
+   shadow->read_ns = 0;
+   return shadow;
+}
+
+
+/* Get the shadow mask of a card, returns -1 if it is not valid */
+static int shadow_get(const char *path, uint16_t *mask)
+{
+   shadow_t *shadow;
+   int rc = -1;
+
+   pthread_mutex_lock(&g_shadow_lock);
+   shadow = shadow_find(path, 0);
+   if (shadow != NULL && shadow->read_ns != 0 && now_ns() - shadow->read_ns < SHADOW_VALID_MS*1000000ULL)
+   {
+      *mask = shadow->mask;
+      rc = 0;
+   }
+   pthread_mutex_unlock(&g_shadow_lock);
+   return rc;
+}
+
+
+/* Update the shadow mask of a card after a read (read=1)
+ * or a write (read=0), or drop it (valid=0). Only a
+ * successful read adds a card, the others just update
+ * its entry if it has one. */
+static void shadow_put(const char *path, uint16_t mask, int read, int valid)
+{
+   shadow_t *shadow;
+
+   pthread_mutex_lock(&g_shadow_lock);
+   if ((shadow = shadow_find(path, read && valid)) != NULL)
+   {
+      shadow->mask = mask;
+      if (!valid)
+         shadow->read_ns = 0;
+      else if (read)
+         shadow->read_ns = now_ns();
+   }
+   pthread_mutex_unlock(&g_shadow_lock);
+}
+
+
+/* Error code of a failed transfer: hid_write() has no timeout parameter,
+ * a write which fails after the deadline is reported as a timeout */
+static int xfer_error(int rc)
+{
+   return (crelay_io_timeout() == 0) ? -ETIMEDOUT : rc;
+}
+
 
 static void init_hid_msg(hid_msg_t *hid_msg, uint8_t cmd, uint16_t bitmap)
 {
@@ -158,22 +262,33 @@ static void init_hid_msg(hid_msg_t *hid_msg, uint8_t cmd, uint16_t bitmap)
 
 static int get_mask(hid_device *handle, uint16_t *bitmap)
 {
-  int i;
+  int i, rc;
   hid_msg_t  hid_msg;
   uint16_t mask;
+  unsigned int timeout;
   
   init_hid_msg(&hid_msg, CMD_READ, 0x1111);
 
   if (hid_write(handle, (unsigned char *)&hid_msg, sizeof(hid_msg)) < 0)
   {
-    return -1;
+    return xfer_error(-1);
   }
-  usleep(1000);
   
-  if (hid_read(handle, (unsigned char *)&hid_msg, sizeof(hid_msg)) < 0)
+  /* Wait for the response on the interrupt IN endpoint, it is returned
+   * as soon as it arrives, until the deadline of the operation */
+  if ((timeout = crelay_io_timeout()) == 0)
+  {
+    return -ETIMEDOUT;
+  }
+  rc = hid_read_timeout(handle, (unsigned char *)&hid_msg, sizeof(hid_msg), timeout);
+  if (rc < 0)
   {
     return -2;
   }
+  if (rc == 0)
+  {
+    return -ETIMEDOUT;
+  }
   
   mask = 0;
   for ( i = 0 ; i < g_num_relays; i ++) {
@@ -197,7 +312,7 @@ static int set_mask(hid_device *handle, uint16_t bitmap)
   init_hid_msg(&hid_msg, CMD_WRITE, bitmap);
   if (hid_write(handle, (unsigned char *)&hid_msg, sizeof(hid_msg)) < 0)
   {
-    return -1;
+    return xfer_error(-1);
   }
   return 0;
 }
@@ -242,9 +357,10 @@ int detect_relay_card_sainsmart_16chan(char* portname, uint8_t* num_relays, char
          // Save serial number and type in current relay info struct
          (*relay_info)->relay_type = SAINSMART16_USB_RELAY_TYPE;
          strcpy((*relay_info)->serial, nextdev->path);
+         snprintf((*relay_info)->portname, MAX_COM_PORT_NAME_LEN, "%s", nextdev->path);
+         (*relay_info)->num_relays = g_num_relays;
          // Allocate new struct
-         rinfo = malloc(sizeof(relay_info_t));
-         rinfo->next = NULL;
+         rinfo = calloc(1, sizeof(relay_info_t));
          // Link current to new struct
          (*relay_info)->next = rinfo;
          // Move pointer to new struct
@@ -275,6 +391,27 @@ int detect_relay_card_sainsmart_16chan(char* portname, uint8_t* num_relays, char
    return 0;
 }
 
+/* Read the relay states and update the shadow mask */
+static int read_mask(hid_device *handle, const char *path, uint16_t *bitmap)
+{
+  int rc;
+  
+  rc = get_mask(handle, bitmap);
+  shadow_put(path, (rc == 0) ? *bitmap : 0, 1, rc == 0);
+  return rc;
+}
+
+
+/* Write the relay states and update the shadow mask */
+static int write_mask(hid_device *handle, const char *path, uint16_t bitmap)
+{
+  int rc;
+  
+  rc = set_mask(handle, bitmap);
+  shadow_put(path, bitmap, 0, rc == 0);
+  return rc;
+}
+
 
 /**********************************************************
  * Function get_relay_sainsmart_16chan()
@@ -291,6 +428,7 @@ int detect_relay_card_sainsmart_16chan(char* portname, uint8_t* num_relays, char
 int get_relay_sainsmart_16chan(char* portname, uint8_t relay, relay_state_t* relay_state, char* serial)
 {
    hid_device *hid_dev;
+   int rc;
    uint16_t bitmap, bit;
    
    if (relay<FIRST_RELAY || relay>(FIRST_RELAY+g_num_relays-1))
@@ -303,14 +441,16 @@ int get_relay_sainsmart_16chan(char* portname, uint8_t relay, relay_state_t* rel
    if ((hid_dev = hid_open_path(portname)) == NULL)
    {
       fprintf(stderr, "unable to open HID API device %s\n", portname);
+      shadow_put(portname, 0, 0, 0);
       return -2;
    }
    
    /* Read relay states */
-   if (get_mask(hid_dev, &bitmap) < 0)
+   if ((rc = read_mask(hid_dev, portname, &bitmap)) < 0)
    {
       fprintf(stderr, "unable to read data from device %s (%ls)\n", portname, hid_error(hid_dev));
-      return -3;
+      hid_close(hid_dev);
+      return (rc == -ETIMEDOUT) ? rc : -3;
    }
    
    bit = 1 << (relay-1);
@@ -340,6 +480,7 @@ int get_relay_sainsmart_16chan(char* portname, uint8_t relay, relay_state_t* rel
 int set_relay_sainsmart_16chan(char* portname, uint8_t relay, relay_state_t relay_state, char* serial)
 { 
    hid_device *hid_dev;
+   int rc;
    uint16_t     bitmap;
    
    if (relay<FIRST_RELAY || relay>(FIRST_RELAY+g_num_relays-1))
@@ -352,6 +493,7 @@ int set_relay_sainsmart_16chan(char* portname, uint8_t relay, relay_state_t rela
    if ((hid_dev = hid_open_path(portname)) == NULL)
    {
       fprintf(stderr, "unable to open HID API device %s\n", portname);
+      shadow_put(portname, 0, 0, 0);
       return -2;
    }
 
@@ -359,11 +501,13 @@ int set_relay_sainsmart_16chan(char* portname, uint8_t relay, relay_state_t rela
    printf("DBG: Sain16 USB: portname=%s, relay=%d, state=%s\n",
           portname, relay, relay_state == ON? "ON" : "OFF");
    */
-   /* Read relay states */
-   if (get_mask(hid_dev, &bitmap) < 0)
+   /* Read relay states, unless the shadow mask is recent enough */
+   if (shadow_get(portname, &bitmap) < 0 &&
+       (rc = read_mask(hid_dev, portname, &bitmap)) < 0)
    {
       fprintf(stderr, "unable to read data from device %s (%ls)\n", portname, hid_error(hid_dev));
-      return -3;
+      hid_close(hid_dev);
+      return (rc == -ETIMEDOUT) ? rc : -3;
    }
    
    /* Set the new relay state bit */
@@ -379,10 +523,107 @@ int set_relay_sainsmart_16chan(char* portname, uint8_t relay, relay_state_t rela
    }
    
    /* Write relay states */
-   if (set_mask(hid_dev, bitmap) < 0)
+   if ((rc = write_mask(hid_dev, portname, bitmap)) < 0)
+   {
+      fprintf(stderr, "unable to write data to device %s (%ls)\n", portname, hid_error(hid_dev));
+      hid_close(hid_dev);
+      return (rc == -ETIMEDOUT) ? rc : -4;
+   }
+  
+   hid_close(hid_dev);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function get_relay_mask_sainsmart_16chan()
+ * 
+ * Description: Get the current state of all relays
+ * 
+ * Parameters: portname (in)     - communication port
+ *             states (out)      - relay states
+ * 
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int get_relay_mask_sainsmart_16chan(char* portname, uint16_t* states, char* serial)
+{
+   hid_device *hid_dev;
+   int rc;
+   
+   /* Open HID API device */
+   if ((hid_dev = hid_open_path(portname)) == NULL)
+   {
+      fprintf(stderr, "unable to open HID API device %s\n", portname);
+      shadow_put(portname, 0, 0, 0);
+      return -2;
+   }
+   
+   /* Read relay states */
+   if ((rc = read_mask(hid_dev, portname, states)) < 0)
+   {
+      fprintf(stderr, "unable to read data from device %s (%ls)\n", portname, hid_error(hid_dev));
+      hid_close(hid_dev);
+      return (rc == -ETIMEDOUT) ? rc : -3;
+   }
+   
+   hid_close(hid_dev);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function set_relay_mask_sainsmart_16chan()
+ * 
+ * Description: Set the state of several relays with one
+ *              write, the other relays keep the states of
+ *              the shadow mask or of a read before
+ * 
+ * Parameters: portname (in)     - communication port
+ *             mask (in)         - relays to change
+ *             states (in)       - new relay states
+ * 
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int set_relay_mask_sainsmart_16chan(char* portname, uint16_t mask, uint16_t states, char* serial)
+{ 
+   hid_device *hid_dev;
+   int rc;
+   uint16_t     bitmap;
+   
+   if (g_num_relays < 16 && (mask & ~((1<<g_num_relays)-1)))
+   {  
+      fprintf(stderr, "ERROR: Relay number out of range\n");
+      return -1;      
+   }
+   
+   /* Open HID API device */
+   if ((hid_dev = hid_open_path(portname)) == NULL)
+   {
+      fprintf(stderr, "unable to open HID API device %s\n", portname);
+      shadow_put(portname, 0, 0, 0);
+      return -2;
+   }
+
+   /* Read relay states, unless all of them are written or the shadow
+    * mask is recent enough */
+   bitmap = 0;
+   if (mask != 0xffff && shadow_get(portname, &bitmap) < 0 &&
+       (rc = read_mask(hid_dev, portname, &bitmap)) < 0)
+   {
+      fprintf(stderr, "unable to read data from device %s (%ls)\n", portname, hid_error(hid_dev));
+      hid_close(hid_dev);
+      return (rc == -ETIMEDOUT) ? rc : -3;
+   }
+   bitmap = (bitmap & ~mask) | (states & mask);
+   
+   /* Write relay states */
+   if ((rc = write_mask(hid_dev, portname, bitmap)) < 0)
    {
       fprintf(stderr, "unable to write data to device %s (%ls)\n", portname, hid_error(hid_dev));
-      return -4;
+      hid_close(hid_dev);
+      return (rc == -ETIMEDOUT) ? rc : -4;
    }
   
    hid_close(hid_dev);
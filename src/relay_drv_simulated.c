@@ -0,0 +1,715 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Driver for simulated relay cards
+ *
+ * Description:
+ *   This software is used to simulate relay cards without any real
+ *   hardware attached. It is intended for load testing the daemon,
+ *   reproducing latency problems and testing the error handling on a
+ *   plain Linux machine.
+ *   This file contains the implementation of the specific functions.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Build instructions:
+ *   gcc -c relay_drv_simulated.c
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/******************************************************************************
+ * Communication protocol description
+ * ==================================
+ *
+ * There is no communication with any device. Every simulated card keeps
+ * its relay states in a bitmap in memory, bit 0 being relay 1:
+ *
+ *  15 ...  7  6  5  4    3  2  1  0   bit no
+ *  R16 ... R8 R7 R6 R5  R4 R3 R2 R1   relay state
+ *
+ * The cards are named SIM0, SIM1, ... and are spread round robin over
+ * the configured number of buses. All operations on cards sharing a bus
+ * are serialized, like transfers on a real USB bus/hub.
+ *
+ * Timing model
+ * ------------
+ * Every driver call costs the time to open the device (enumeration and
+ * open, as done by the real drivers on every call) plus one or more
+ * transfers. The duration of a transfer is
+ *
+ *    base + uniform(0, spread) [+ exponential tail with mean tail_us]
+ *
+ * where the tail is added with a small probability. The profiles below
+ * approximate the behaviour of the real drivers on a full speed USB bus:
+ *
+ *    fixed   latency_us +- jitter_us per transfer, no open cost
+ *    cp2104  Conrad card, libusb control transfers
+ *    ftdi    Sainsmart 4/8 card, FT245R bitbang with read-modify-write,
+ *            occasional 16ms latency timer stalls
+ *    hid     HID API and Sainsmart 16 cards, HID reports
+ *
+ * Fault injection
+ * ---------------
+ *    timeout     a transfer stalls for timeout_ms, at most until the
+ *                deadline of the operation, and then fails with a
+ *                timeout
+ *    disconnect  the card disappears for disconnect_ms, it can not be
+ *                detected or opened during that time
+ *    stuck bits  relays in stuck_bits keep their state on every write
+ *
+ * Faults hit all cards, or only the card named by fault_card.
+ *
+ * Waveforms
+ * ---------
+ * The cards have a waveform mode like the Sainsmart 4/8 card. The bitmap
+ * is updated once per chunk of 20ms to the last sample of the chunk, at
+ * the time the chunk ends. Reads and writes of the card fail with -EBUSY
+ * while it plays a waveform.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "relay_drv.h"
+
+#ifndef BUILD_LIB
+#include "data_types.h"
+extern config_t config;
+#endif
+
+#define SIM_SERIAL_BASE  "SIM"
+#define SIM_MAX_CARDS    64
+#define SIM_MAX_BUSES    16
+#define SIM_WAVE_CHUNK_MS 20
+
+/* Timing profile of a simulated card type */
+typedef struct
+{
+   const char *name;
+   uint32_t open_us;        /* cost of enumerating and opening the device */
+   uint32_t base_us;        /* minimum duration of one transfer */
+   uint32_t spread_us;      /* uniformly distributed share (frame alignment) */
+   uint32_t tail_permille;  /* probability of a slow transfer */
+   uint32_t tail_us;        /* mean extra duration of a slow transfer */
+   uint8_t  set_xfers;      /* transfers needed to set a relay */
+} sim_profile_t;
+
+static sim_profile_t profiles[] =
+{
+   /* name     open   base  spread  tail  tail_us  set_xfers */
+   { "fixed",     0,     0,     0,    0,       0,  1 },
+   { "cp2104", 2500,   250,  1000,    5,    4000,  1 },
+   { "ftdi",   6000,   200,  1000,   10,   16000,  2 },
+   { "hid",    1500,   500,  1000,    5,    8000,  1 },
+};
+
+typedef struct
+{
+   pthread_mutex_t lock;
+   unsigned int    seed;
+} sim_bus_t;
+
+typedef struct
+{
+   char      serial[MAX_SERIAL_LEN];
+   sim_bus_t *bus;
+   uint16_t  bitmap;
+   uint64_t  disconnected_until;  /* ns, CLOCK_MONOTONIC, accessed atomically */
+   uint8_t   faulty;              /* faults are injected on this card */
+   uint8_t   playing;             /* waveform mode, protected by the bus lock */
+} sim_card_t;
+
+static pthread_once_t g_init_once = PTHREAD_ONCE_INIT;
+static sim_profile_t *g_profile = &profiles[0];
+static sim_card_t g_cards[SIM_MAX_CARDS];
+static sim_bus_t  g_buses[SIM_MAX_BUSES];
+static uint8_t  g_num_cards=1;
+static uint8_t  g_num_buses=1;
+static uint8_t  g_num_relays=SIMULATED_NUM_RELAYS;
+
+/* Fault injection parameters */
+static double   g_timeout_rate=0;     /* percent of transfers */
+static uint32_t g_timeout_ms=1000;
+static double   g_disconnect_rate=0;  /* percent of operations */
+static uint32_t g_disconnect_ms=5000;
+static uint16_t g_stuck_bits=0;
+
+
+static uint64_t now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+static void sleep_us(uint64_t us)
+{
+   struct timespec ts;
+
+   ts.tv_sec  = us / 1000000;
+   ts.tv_nsec = (us % 1000000) * 1000;
+   while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR);
+}
+
+
+/* Uniform random number in [0,1) from the bus' generator */
+static double bus_random(sim_bus_t *bus)
+{
+   return rand_r(&bus->seed) / ((double)RAND_MAX + 1.0);
+}
+
+
+/**********************************************************
+ * Internal function sim_init()
+ *
+ * Description: Set up the simulated cards and buses from
+ *              the configuration (done once)
+ *
+ * Parameters: none
+ *
+ * Return:  none
+ *********************************************************/
+static void sim_init(void)
+{
+   int i;
+
+#ifndef BUILD_LIB
+   if (config.sim_num_relays >= FIRST_RELAY &&
+       config.sim_num_relays <= MAX_NUM_RELAYS)
+   {
+      g_num_relays = config.sim_num_relays;
+   }
+   if (config.sim_num_cards > 0 && config.sim_num_cards <= SIM_MAX_CARDS)
+   {
+      g_num_cards = config.sim_num_cards;
+   }
+   if (config.sim_num_buses > 0 && config.sim_num_buses <= SIM_MAX_BUSES)
+   {
+      g_num_buses = config.sim_num_buses;
+   }
+   if (config.sim_profile != NULL)
+   {
+      for (i=0; i<sizeof(profiles)/sizeof(profiles[0]); i++)
+      {
+         if (!strcmp(config.sim_profile, profiles[i].name))
+            g_profile = &profiles[i];
+      }
+   }
+   if (g_profile == &profiles[0])
+   {
+      /* Fixed profile: latency +- jitter per transfer */
+      uint32_t jitter = config.sim_jitter_us;
+      if (jitter > config.sim_latency_us) jitter = config.sim_latency_us;
+      profiles[0].base_us   = config.sim_latency_us - jitter;
+      profiles[0].spread_us = 2*jitter;
+   }
+   g_timeout_rate    = config.sim_timeout_rate;
+   g_disconnect_rate = config.sim_disconnect_rate;
+   g_stuck_bits      = config.sim_stuck_bits;
+   if (config.sim_timeout_ms > 0)    g_timeout_ms = config.sim_timeout_ms;
+   if (config.sim_disconnect_ms > 0) g_disconnect_ms = config.sim_disconnect_ms;
+#endif
+
+   for (i=0; i<g_num_buses; i++)
+   {
+      pthread_mutex_init(&g_buses[i].lock, NULL);
+      g_buses[i].seed = 0x5eed + i;
+   }
+   for (i=0; i<g_num_cards; i++)
+   {
+      snprintf(g_cards[i].serial, MAX_SERIAL_LEN, "%s%d", SIM_SERIAL_BASE, i);
+      g_cards[i].bus = &g_buses[i % g_num_buses];
+      g_cards[i].bitmap = 0;
+      g_cards[i].disconnected_until = 0;
+#ifndef BUILD_LIB
+      g_cards[i].faulty = (config.sim_fault_card == NULL ||
+                           !strcmp(config.sim_fault_card, g_cards[i].serial));
+#else
+      g_cards[i].faulty = 1;
+#endif
+   }
+}
+
+
+/**********************************************************
+ * Internal function find_card()
+ *
+ * Description: Find a connected simulated card by its
+ *              serial number
+ *
+ * Parameters: serial (in) - serial number or NULL for
+ *                           the first connected card
+ *
+ * Return:  pointer to card, NULL if not found
+ *********************************************************/
+static sim_card_t* find_card(const char *serial)
+{
+   uint64_t now = now_ns();
+   int i;
+
+   for (i=0; i<g_num_cards; i++)
+   {
+      if (__atomic_load_n(&g_cards[i].disconnected_until, __ATOMIC_RELAXED) > now) continue;
+      if (serial == NULL || !strcmp(serial, g_cards[i].serial))
+         return &g_cards[i];
+   }
+   return NULL;
+}
+
+
+/**********************************************************
+ * Internal function simulate_transfer()
+ *
+ * Description: Delay the caller for the duration of one
+ *              transfer with the card. Must be called with
+ *              the card's bus locked.
+ *
+ * Parameters: card (in) - simulated card
+ *
+ * Return:  0 - success
+ *         -ETIMEDOUT - transfer timed out (injected fault)
+ *********************************************************/
+static int simulate_transfer(sim_card_t *card)
+{
+   sim_bus_t *bus = card->bus;
+   uint64_t us = g_profile->base_us;
+   unsigned int timeout;
+
+   if (card->faulty && g_timeout_rate > 0 &&
+       bus_random(bus)*100 < g_timeout_rate)
+   {
+      timeout = crelay_io_timeout();
+      sleep_us((uint64_t)(g_timeout_ms < timeout ? g_timeout_ms : timeout)*1000);
+      return -ETIMEDOUT;
+   }
+
+   if (g_profile->spread_us > 0)
+      us += (uint64_t)(bus_random(bus) * g_profile->spread_us);
+   if (g_profile->tail_permille > 0 &&
+       bus_random(bus)*1000 < g_profile->tail_permille)
+      us += (uint64_t)(-log(1.0 - bus_random(bus)) * g_profile->tail_us);
+
+   if (us > 0) sleep_us(us);
+   return 0;
+}
+
+
+/**********************************************************
+ * Internal function open_card()
+ *
+ * Description: Simulate opening the card, lock its bus
+ *              and inject a disconnect fault if configured.
+ *              On success the bus stays locked.
+ *
+ * Parameters: serial (in) - serial number [optional]
+ *
+ * Return:  pointer to card, NULL if the card is not
+ *          available
+ *********************************************************/
+static sim_card_t* open_card(const char *serial)
+{
+   sim_card_t *card;
+
+   pthread_once(&g_init_once, sim_init);
+
+   if ((card = find_card(serial)) == NULL)
+      return NULL;
+
+   pthread_mutex_lock(&card->bus->lock);
+   if (g_profile->open_us > 0) sleep_us(g_profile->open_us);
+
+   if (card->faulty && g_disconnect_rate > 0 &&
+       bus_random(card->bus)*100 < g_disconnect_rate)
+   {
+      fprintf(stderr, "simulated card %s disconnected for %u ms\n", card->serial, g_disconnect_ms);
+      __atomic_store_n(&card->disconnected_until, now_ns() + (uint64_t)g_disconnect_ms*1000000, __ATOMIC_RELAXED);
+      pthread_mutex_unlock(&card->bus->lock);
+      return NULL;
+   }
+
+   return card;
+}
+
+
+static void close_card(sim_card_t *card)
+{
+   pthread_mutex_unlock(&card->bus->lock);
+}
+
+
+/**********************************************************
+ * Function detect_relay_card_simulated()
+ *
+ * Description: Detect the simulated relay cards
+ *
+ * Parameters: portname (out) - pointer to a string where
+ *                              the detected com port will
+ *                              be stored
+ *             num_relays(out)- pointer to number of relays
+ *             serial(in)     - pointer to a string containing
+ *                              serial number [optional]
+ *
+ * Return:  0 - success
+ *         -1 - fail, no relay card found
+ *********************************************************/
+int detect_relay_card_simulated(char* portname, uint8_t* num_relays, char* serial, relay_info_t** relay_info)
+{
+   relay_info_t* rinfo;
+   sim_card_t *card;
+   uint64_t now;
+   int i;
+
+   pthread_once(&g_init_once, sim_init);
+
+   if (relay_info != NULL)
+   {
+      now = now_ns();
+      for (i=0; i<g_num_cards; i++)
+      {
+         if (__atomic_load_n(&g_cards[i].disconnected_until, __ATOMIC_RELAXED) > now) continue;
+         // Save serial number and type in current relay info struct
+         (*relay_info)->relay_type = SIMULATED_RELAY_TYPE;
+         strcpy((*relay_info)->serial, g_cards[i].serial);
+         snprintf((*relay_info)->portname, MAX_COM_PORT_NAME_LEN, "simulated bus %d", (int)(g_cards[i].bus - g_buses));
+         (*relay_info)->num_relays = g_num_relays;
+         // Allocate new struct
+         rinfo = calloc(1, sizeof(relay_info_t));
+         // Link current to new struct
+         (*relay_info)->next = rinfo;
+         // Move pointer to new struct
+         *relay_info = rinfo;
+      }
+      return 0;
+   }
+
+   /* Enumeration costs as much as opening the device */
+   if ((card = open_card(serial)) == NULL)
+      return -1;
+   close_card(card);
+
+   /* Return parameters */
+   if (num_relays != NULL) *num_relays = g_num_relays;
+   if (portname != NULL)
+      sprintf(portname, "simulated bus %d", (int)(card->bus - g_buses));
+
+   return 0;
+}
+
+
+/**********************************************************
+ * Function get_relay_simulated()
+ *
+ * Description: Get the current relay state
+ *
+ * Parameters: portname (in)     - communication port
+ *             relay (in)        - relay number
+ *             relay_state (out) - current relay state
+ *             serial (in)       - serial number [optional]
+ *
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int get_relay_simulated(char* portname, uint8_t relay, relay_state_t* relay_state, char* serial)
+{
+   sim_card_t *card;
+
+   pthread_once(&g_init_once, sim_init);
+
+   if (relay<FIRST_RELAY || relay>(FIRST_RELAY+g_num_relays-1))
+   {
+      fprintf(stderr, "ERROR: Relay number out of range\n");
+      return -1;
+   }
+
+   if ((card = open_card(serial)) == NULL)
+   {
+      fprintf(stderr, "unable to open simulated card %s\n", serial ? serial : "");
+      return -2;
+   }
+   if (card->playing)
+   {
+      close_card(card);
+      return -EBUSY;
+   }
+
+   if (simulate_transfer(card) < 0)
+   {
+      fprintf(stderr, "simulated transfer timeout on card %s\n", card->serial);
+      close_card(card);
+      return -ETIMEDOUT;
+   }
+   *relay_state = (card->bitmap & (0x0001<<(relay-1))) ? ON : OFF;
+
+   close_card(card);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function set_relay_simulated()
+ *
+ * Description: Set new relay state
+ *
+ * Parameters: portname (in)     - communication port
+ *             relay (in)        - relay number
+ *             relay_state (in)  - current relay state
+ *             serial (in)       - serial number [optional]
+ *
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int set_relay_simulated(char* portname, uint8_t relay, relay_state_t relay_state, char* serial)
+{
+   sim_card_t *card;
+   uint16_t bitmap;
+   int i;
+
+   pthread_once(&g_init_once, sim_init);
+
+   if (relay<FIRST_RELAY || relay>(FIRST_RELAY+g_num_relays-1))
+   {
+      fprintf(stderr, "ERROR: Relay number out of range\n");
+      return -1;
+   }
+
+   if ((card = open_card(serial)) == NULL)
+   {
+      fprintf(stderr, "unable to open simulated card %s\n", serial ? serial : "");
+      return -2;
+   }
+   if (card->playing)
+   {
+      close_card(card);
+      return -EBUSY;
+   }
+
+   for (i=0; i<g_profile->set_xfers; i++)
+   {
+      if (simulate_transfer(card) < 0)
+      {
+         fprintf(stderr, "simulated transfer timeout on card %s\n", card->serial);
+         close_card(card);
+         return -ETIMEDOUT;
+      }
+   }
+
+   bitmap = card->bitmap;
+   if (relay_state == OFF)
+      bitmap &= ~(0x0001<<(relay-1));
+   else
+      bitmap |= (0x0001<<(relay-1));
+
+   /* Stuck relays keep their current state */
+   if (card->faulty)
+      bitmap = (bitmap & ~g_stuck_bits) | (card->bitmap & g_stuck_bits);
+   card->bitmap = bitmap;
+
+   close_card(card);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function get_relay_mask_simulated()
+ *
+ * Description: Get the current state of all relays with
+ *              a single transfer
+ *
+ * Parameters: portname (in)     - communication port
+ *             states (out)      - relay states
+ *             serial (in)       - serial number [optional]
+ *
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int get_relay_mask_simulated(char* portname, uint16_t* states, char* serial)
+{
+   sim_card_t *card;
+
+   if ((card = open_card(serial)) == NULL)
+   {
+      fprintf(stderr, "unable to open simulated card %s\n", serial ? serial : "");
+      return -2;
+   }
+   if (card->playing)
+   {
+      close_card(card);
+      return -EBUSY;
+   }
+
+   if (simulate_transfer(card) < 0)
+   {
+      fprintf(stderr, "simulated transfer timeout on card %s\n", card->serial);
+      close_card(card);
+      return -ETIMEDOUT;
+   }
+   *states = card->bitmap;
+
+   close_card(card);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function set_relay_mask_simulated()
+ *
+ * Description: Set the state of several relays with the
+ *              same number of transfers as a single relay
+ *
+ * Parameters: portname (in)     - communication port
+ *             mask (in)         - relays to change
+ *             states (in)       - new relay states
+ *             serial (in)       - serial number [optional]
+ *
+ * Return:   0 - success
+ *          <0 - fail
+ *********************************************************/
+int set_relay_mask_simulated(char* portname, uint16_t mask, uint16_t states, char* serial)
+{
+   sim_card_t *card;
+   uint16_t bitmap;
+   int i;
+
+   pthread_once(&g_init_once, sim_init);
+
+   if (mask & ~((1<<g_num_relays)-1))
+   {
+      fprintf(stderr, "ERROR: Relay number out of range\n");
+      return -1;
+   }
+
+   if ((card = open_card(serial)) == NULL)
+   {
+      fprintf(stderr, "unable to open simulated card %s\n", serial ? serial : "");
+      return -2;
+   }
+   if (card->playing)
+   {
+      close_card(card);
+      return -EBUSY;
+   }
+
+   for (i=0; i<g_profile->set_xfers; i++)
+   {
+      if (simulate_transfer(card) < 0)
+      {
+         fprintf(stderr, "simulated transfer timeout on card %s\n", card->serial);
+         close_card(card);
+         return -ETIMEDOUT;
+      }
+   }
+
+   bitmap = (card->bitmap & ~mask) | (states & mask);
+
+   /* Stuck relays keep their current state */
+   if (card->faulty)
+      bitmap = (bitmap & ~g_stuck_bits) | (card->bitmap & g_stuck_bits);
+   card->bitmap = bitmap;
+
+   close_card(card);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function play_waveform_simulated()
+ *
+ * Description: Play a sampled waveform. The bus is locked
+ *              only to update the bitmap after each chunk,
+ *              other cards on the bus are not blocked.
+ *
+ * Parameters: portname (in)     - communication port
+ *             samples (in)      - relay states
+ *             num_samples (in)  - number of samples
+ *             rate_hz (in)      - sample rate
+ *             cancel (in)       - cancel request
+ *             serial (in)       - serial number [optional]
+ *
+ * Return:  >=0 - number of samples played
+ *          -EBUSY if the card plays a waveform already
+ *          <0  - other failure
+ *********************************************************/
+int play_waveform_simulated(char* portname, const uint16_t* samples, uint32_t num_samples,
+                            uint32_t rate_hz, const int* cancel, char* serial)
+{
+   sim_card_t *card;
+   uint16_t valid, bitmap;
+   uint32_t chunk, played=0, n;
+   uint64_t start, end;
+   struct timespec ts;
+
+   pthread_once(&g_init_once, sim_init);
+
+   if (rate_hz == 0)
+      return -EINVAL;
+
+   if ((card = open_card(serial)) == NULL)
+   {
+      fprintf(stderr, "unable to open simulated card %s\n", serial ? serial : "");
+      return -2;
+   }
+   if (card->playing)
+   {
+      close_card(card);
+      return -EBUSY;
+   }
+   card->playing = 1;
+   close_card(card);
+
+   valid = (1<<g_num_relays)-1;
+   chunk = (uint64_t)rate_hz*SIM_WAVE_CHUNK_MS/1000;
+   if (chunk == 0) chunk = 1;
+   start = now_ns();
+
+   while (played < num_samples && !__atomic_load_n(cancel, __ATOMIC_ACQUIRE))
+   {
+      n = num_samples-played;
+      if (n > chunk) n = chunk;
+      played += n;
+
+      end = start + (uint64_t)played*1000000000ULL/rate_hz;
+      ts.tv_sec  = end / 1000000000ULL;
+      ts.tv_nsec = end % 1000000000ULL;
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+      pthread_mutex_lock(&card->bus->lock);
+      bitmap = (card->bitmap & ~valid) | (samples[played-1] & valid);
+      if (card->faulty)
+         bitmap = (bitmap & ~g_stuck_bits) | (card->bitmap & g_stuck_bits);
+      card->bitmap = bitmap;
+      pthread_mutex_unlock(&card->bus->lock);
+   }
+
+   pthread_mutex_lock(&card->bus->lock);
+   card->playing = 0;
+   pthread_mutex_unlock(&card->bus->lock);
+   return (int)played;
+}
@@ -0,0 +1,131 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Driver for a simulated relay card
+ *
+ * Description:
+ *   This software is used to simulate a relay card without any real
+ *   hardware attached.
+ *   This file contains the declaration of the specific functions.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef relay_drv_simulated_h
+#define relay_drv_simulated_h
+
+/**********************************************************
+ * Function detect_relay_card_simulated()
+ *
+ * Description: Detect the simulated relay card
+ *
+ * Parameters: portname (out) - pointer to a string where
+ *                              the detected com port will
+ *                              be stored
+ *             num_relays(out)- pointer to number of relays
+ *
+ * Return:  0 - success
+ *         -1 - fail, no relay card found
+ *********************************************************/
+int detect_relay_card_simulated(char* portname, uint8_t* num_relays, char* serial, relay_info_t** relay_info);
+
+
+/**********************************************************
+ * Function get_relay_simulated()
+ *
+ * Description: Get the current relay state
+ *
+ * Parameters: portname (in)     - communication port
+ *             relay (in)        - relay number
+ *             relay_state (out) - current relay state
+ *
+ * Return:   0 - success
+ *          -1 - fail
+ *********************************************************/
+int get_relay_simulated(char* portname, uint8_t relay, relay_state_t* relay_state, char* serial);
+
+
+/**********************************************************
+ * Function set_relay_simulated()
+ *
+ * Description: Set new relay state
+ *
+ * Parameters: portname (in)     - communication port
+ *             relay (in)        - relay number
+ *             relay_state (in)  - current relay state
+ *
+ * Return:   0 - success
+ *          -1 - fail
+ *********************************************************/
+int set_relay_simulated(char* portname, uint8_t relay, relay_state_t relay_state, char* serial);
+
+
+/**********************************************************
+ * Function get_relay_mask_simulated()
+ *
+ * Description: Get the current state of all relays
+ *
+ * Parameters: portname (in)     - communication port
+ *             states (out)      - relay states
+ *
+ * Return:   0 - success
+ *          -1 - fail
+ *********************************************************/
+int get_relay_mask_simulated(char* portname, uint16_t* states, char* serial);
+
+
+/**********************************************************
+ * Function set_relay_mask_simulated()
+ *
+ * Description: Set the state of several relays
+ *
+ * Parameters: portname (in)     - communication port
+ *             mask (in)         - relays to change
+ *             states (in)       - new relay states
+ *
+ * Return:   0 - success
+ *          -1 - fail
+ *********************************************************/
+int set_relay_mask_simulated(char* portname, uint16_t mask, uint16_t states, char* serial);
+
+
+/**********************************************************
+ * Function play_waveform_simulated()
+ *
+ * Description: Play a sampled waveform
+ *
+ * Parameters: portname (in)     - communication port
+ *             samples (in)      - relay states
+ *             num_samples (in)  - number of samples
+ *             rate_hz (in)      - sample rate
+ *             cancel (in)       - cancel request
+ *             serial (in)       - serial number [optional]
+ *
+ * Return:  >=0 - number of samples played
+ *           <0 - fail
+ *********************************************************/
+int play_waveform_simulated(char* portname, const uint16_t* samples, uint32_t num_samples,
+                            uint32_t rate_hz, const int* cancel, char* serial);
+
+#endif
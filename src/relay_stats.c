@@ -0,0 +1,496 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Relay usage statistics
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the relay statistics, see relay_stats.h.
+ *
+ *   The on-time of a relay is accounted up to the current time whenever
+ *   its card is updated or the counters are read. The accounted time is
+ *   added to the cumulative counter and to two ring buffers of time
+ *   buckets (60 buckets of 1 minute, 24 buckets of 1 hour). Each ring
+ *   keeps the sum of its buckets; when the ring moves on to a new bucket,
+ *   the contents of the recycled bucket are subtracted from the sum. The
+ *   duty cycle is the ring sum divided by the time covered by the ring,
+ *   so reading it does not need to walk over the buckets.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "relay_stats.h"
+
+#define STATS_MAGIC     0x54535243  /* "CRST" */
+#define STATS_VERSION   1
+#define STATS_MAX_CARDS 32
+#define MAX_BUCKETS     60
+
+/* Ring of time buckets holding on-time in ms */
+typedef struct
+{
+   uint64_t head;                  /* absolute index of the current bucket (time/width) */
+   uint64_t sum;                   /* sum of all buckets */
+   uint32_t buckets[MAX_BUCKETS];
+}
+ring_t;
+
+typedef struct
+{
+   uint64_t on_time_ms;
+   uint64_t switch_count;
+   uint64_t accounted_ms;          /* CLOCK_REALTIME of the last accounting, 0 if never */
+   uint8_t  on;
+   uint8_t  reserved[7];
+   ring_t   hour;                  /* 60 buckets of 1 minute */
+   ring_t   day;                   /* 24 buckets of 1 hour */
+}
+stats_relay_t;
+
+typedef struct
+{
+   char     serial[MAX_SERIAL_LEN];
+   uint8_t  num_relays;
+   uint8_t  reserved[7];
+   stats_relay_t relays[MAX_NUM_RELAYS];
+}
+stats_card_t;
+
+typedef struct
+{
+   uint32_t magic;
+   uint16_t version;
+   uint16_t max_cards;
+   uint32_t size;
+   uint32_t num_cards;
+   uint8_t  reserved[48];
+   stats_card_t cards[STATS_MAX_CARDS];
+}
+stats_file_t;
+
+/* Ring geometry */
+#define HOUR_WIDTH_MS   60000ULL
+#define HOUR_BUCKETS    60
+#define DAY_WIDTH_MS    3600000ULL
+#define DAY_BUCKETS     24
+
+/* Time of an accounting: the on-time is measured with CLOCK_MONOTONIC,
+ * so steps of the system time do not change it, CLOCK_REALTIME only
+ * places it in the buckets and is kept in the file for the restart */
+typedef struct
+{
+   uint64_t real_ms;
+   uint64_t mono_ms;
+}
+stats_time_t;
+
+static stats_file_t *g_stats = NULL;
+static char g_default[MAX_SERIAL_LEN];
+
+/* CLOCK_MONOTONIC of the last accounting of each relay by this
+ * process, 0 if not accounted since the file was opened */
+static uint64_t g_mono_ms[STATS_MAX_CARDS][MAX_NUM_RELAYS];
+
+
+static void now_ms(stats_time_t *now)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_REALTIME, &ts);
+   now->real_ms = (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   now->mono_ms = (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+
+/**********************************************************
+ * Internal function ring_advance()
+ *
+ * Description: Move the ring to the bucket of a time,
+ *              recycling the buckets passed over
+ *
+ * Return: none
+ *********************************************************/
+static void ring_advance(ring_t *ring, uint64_t width, uint32_t num, uint64_t t)
+{
+   uint64_t idx = t / width;
+   uint32_t *b;
+
+   if (idx <= ring->head)
+      return;
+
+   if (idx - ring->head >= num)
+   {
+      memset(ring->buckets, 0, sizeof(ring->buckets));
+      ring->sum = 0;
+   }
+   else
+   {
+      while (ring->head < idx)
+      {
+         ring->head++;
+         b = &ring->buckets[ring->head % num];
+         ring->sum -= *b;
+         *b = 0;
+      }
+   }
+   ring->head = idx;
+}
+
+
+/**********************************************************
+ * Internal function ring_add()
+ *
+ * Description: Add on-time from start to end, split over
+ *              the buckets it touches
+ *
+ * Return: none
+ *********************************************************/
+static void ring_add(ring_t *ring, uint64_t width, uint32_t num, uint64_t start, uint64_t end)
+{
+   uint64_t part;
+
+   /* Older on-time would only be recycled again */
+   if (end - start > width*num)
+      start = end - width*num;
+   if (start < ring->head*width)
+      start = ring->head*width;
+
+   while (start < end)
+   {
+      ring_advance(ring, width, num, start);
+      part = (start/width + 1)*width;
+      if (part > end) part = end;
+      ring->buckets[(start/width) % num] += part - start;
+      ring->sum += part - start;
+      start = part;
+   }
+}
+
+
+static double ring_duty(ring_t *ring, uint64_t width, uint32_t num, uint64_t now)
+{
+   uint64_t covered;
+
+   ring_advance(ring, width, num, now);
+   covered = (num-1)*width + now % width;
+   return covered ? (double)ring->sum / covered : 0;
+}
+
+
+/**********************************************************
+ * Internal function account()
+ *
+ * Description: Account the on-time of a relay up to now.
+ *              The time since the last accounting is taken
+ *              from CLOCK_MONOTONIC, only the first one
+ *              after a restart has to use CLOCK_REALTIME.
+ *
+ * Return: none
+ *********************************************************/
+static void account(stats_card_t *card, int relay, const stats_time_t *now)
+{
+   stats_relay_t *r = &card->relays[relay];
+   uint64_t *mono = &g_mono_ms[card - g_stats->cards][relay];
+   uint64_t elapsed = 0;
+
+   if (*mono != 0)
+      elapsed = now->mono_ms - *mono;
+   else if (r->accounted_ms != 0 && now->real_ms > r->accounted_ms)
+      elapsed = now->real_ms - r->accounted_ms;
+
+   if (r->on && r->accounted_ms != 0 && elapsed != 0)
+   {
+      r->on_time_ms += elapsed;
+      if (elapsed > now->real_ms) elapsed = now->real_ms;
+      ring_add(&r->hour, HOUR_WIDTH_MS, HOUR_BUCKETS, now->real_ms - elapsed, now->real_ms);
+      ring_add(&r->day, DAY_WIDTH_MS, DAY_BUCKETS, now->real_ms - elapsed, now->real_ms);
+   }
+   r->accounted_ms = now->real_ms;
+   *mono = now->mono_ms;
+}
+
+
+static stats_card_t* find_card(const char *serial)
+{
+   stats_card_t *card;
+   uint32_t i;
+
+   if (serial == NULL || serial[0] == 0)
+      serial = g_default;
+
+   for (i=0; i<g_stats->num_cards; i++)
+   {
+      if (!strcmp(g_stats->cards[i].serial, serial))
+         return &g_stats->cards[i];
+   }
+   if (g_stats->num_cards == STATS_MAX_CARDS)
+      return NULL;
+
+   card = &g_stats->cards[g_stats->num_cards];
+   memset(card, 0, sizeof(stats_card_t));
+   snprintf(card->serial, MAX_SERIAL_LEN, "%s", serial);
+   g_stats->num_cards++;
+   return card;
+}
+
+
+/**********************************************************
+ * Function relay_stats_open()
+ *
+ * Description: Map the statistics file (create it if
+ *              needed)
+ *
+ * Parameters: path (in) - statistics file path
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int relay_stats_open(const char *path)
+{
+   struct stat st;
+   int fd;
+
+   fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+   if (fd < 0 || fstat(fd, &st) < 0 ||
+       (st.st_size != sizeof(stats_file_t) && ftruncate(fd, sizeof(stats_file_t)) < 0))
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to open statistics %s: %s", path, strerror(errno));
+      if (fd >= 0) close(fd);
+      return -1;
+   }
+
+   g_stats = mmap(NULL, sizeof(stats_file_t), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (g_stats == MAP_FAILED)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to map statistics %s: %s", path, strerror(errno));
+      g_stats = NULL;
+      return -1;
+   }
+
+   if (g_stats->magic != STATS_MAGIC || g_stats->version != STATS_VERSION ||
+       g_stats->max_cards != STATS_MAX_CARDS || g_stats->size != sizeof(stats_file_t) ||
+       g_stats->num_cards > STATS_MAX_CARDS)
+   {
+      memset(g_stats, 0, sizeof(stats_file_t));
+      g_stats->magic = STATS_MAGIC;
+      g_stats->version = STATS_VERSION;
+      g_stats->max_cards = STATS_MAX_CARDS;
+      g_stats->size = sizeof(stats_file_t);
+   }
+   memset(g_mono_ms, 0, sizeof(g_mono_ms));
+
+   syslog(LOG_DAEMON | LOG_NOTICE, "Relay statistics %s: %u cards\n", path, g_stats->num_cards);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function relay_stats_close()
+ *
+ * Description: Account the on-time up to now and unmap the
+ *              statistics file
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void relay_stats_close(void)
+{
+   stats_time_t now;
+   uint32_t i, j;
+
+   if (g_stats == NULL)
+      return;
+
+   now_ms(&now);
+   for (i=0; i<g_stats->num_cards; i++)
+   {
+      for (j=0; j<MAX_NUM_RELAYS; j++)
+         account(&g_stats->cards[i], j, &now);
+   }
+   munmap(g_stats, sizeof(stats_file_t));
+   g_stats = NULL;
+}
+
+
+/**********************************************************
+ * Function relay_stats_set_default()
+ *
+ * Description: Set the serial number used for requests
+ *              without serial number
+ *
+ * Parameters: serial (in) - serial number of the first card
+ *
+ * Return: none
+ *********************************************************/
+void relay_stats_set_default(const char *serial)
+{
+   snprintf(g_default, sizeof(g_default), "%s", serial ? serial : "");
+}
+
+
+/**********************************************************
+ * Function relay_stats_update()
+ *
+ * Description: Update the counters with the current relay
+ *              states of a card
+ *
+ * Parameters: serial (in)     - card serial number, NULL or
+ *                               empty for the default card
+ *             num_relays (in) - number of relays on the card
+ *             states (in)     - current relay states
+ *
+ * Return: none
+ *********************************************************/
+void relay_stats_update(const char *serial, uint8_t num_relays, uint16_t states)
+{
+   stats_card_t *card;
+   stats_relay_t *r;
+   stats_time_t now;
+   int i;
+
+   if (g_stats == NULL || (card = find_card(serial)) == NULL)
+      return;
+
+   now_ms(&now);
+   if (num_relays > MAX_NUM_RELAYS) num_relays = MAX_NUM_RELAYS;
+   card->num_relays = num_relays;
+
+   for (i=0; i<num_relays; i++)
+   {
+      r = &card->relays[i];
+      if (r->on == ((states>>i) & 1) && r->accounted_ms != 0)
+         continue;
+
+      if (r->accounted_ms != 0)
+         r->switch_count++;
+      account(card, i, &now);
+      r->on = (states>>i) & 1;
+   }
+}
+
+
+/**********************************************************
+ * Function relay_stats_update_relay()
+ *
+ * Description: Update the counters with the new state of a
+ *              single relay
+ *
+ * Parameters: serial (in) - card serial number, NULL or
+ *                           empty for the default card
+ *             relay (in)  - relay number
+ *             state (in)  - new relay state
+ *
+ * Return: none
+ *********************************************************/
+void relay_stats_update_relay(const char *serial, uint8_t relay, relay_state_t state)
+{
+   stats_card_t *card;
+   stats_relay_t *r;
+   stats_time_t now;
+
+   if (g_stats == NULL || relay < FIRST_RELAY || relay >= FIRST_RELAY+MAX_NUM_RELAYS ||
+       (card = find_card(serial)) == NULL)
+      return;
+
+   r = &card->relays[relay-FIRST_RELAY];
+   if (r->accounted_ms != 0 && r->on == (state == ON))
+      return;
+
+   if (r->accounted_ms != 0)
+      r->switch_count++;
+   now_ms(&now);
+   account(card, relay-FIRST_RELAY, &now);
+   r->on = (state == ON);
+}
+
+
+/**********************************************************
+ * Function relay_stats_num_cards()
+ *
+ * Description: Get the number of cards with statistics
+ *
+ * Parameters: none
+ *
+ * Return: number of cards
+ *********************************************************/
+int relay_stats_num_cards(void)
+{
+   return g_stats ? g_stats->num_cards : 0;
+}
+
+
+/**********************************************************
+ * Function relay_stats_get()
+ *
+ * Description: Get the counters of all relays of a card,
+ *              the on-time of relays which are on is
+ *              accounted up to now
+ *
+ * Parameters: card (in)      - card index
+ *             serial (out)   - card serial number
+ *             counters (out) - counters, MAX_NUM_RELAYS
+ *                              entries
+ *
+ * Return: number of relays, -1 if card index is invalid
+ *********************************************************/
+int relay_stats_get(int card, char *serial, relay_counters_t *counters)
+{
+   stats_card_t *c;
+   stats_relay_t *r;
+   stats_time_t now;
+   int i;
+
+   if (g_stats == NULL || card < 0 || card >= (int)g_stats->num_cards)
+      return -1;
+
+   now_ms(&now);
+   c = &g_stats->cards[card];
+   strcpy(serial, c->serial);
+   for (i=0; i<c->num_relays; i++)
+   {
+      r = &c->relays[i];
+      account(c, i, &now);
+      counters[i].state = r->on;
+      counters[i].on_time_ms = r->on_time_ms;
+      counters[i].switch_count = r->switch_count;
+      counters[i].duty_1h = ring_duty(&r->hour, HOUR_WIDTH_MS, HOUR_BUCKETS, now.real_ms);
+      counters[i].duty_24h = ring_duty(&r->day, DAY_WIDTH_MS, DAY_BUCKETS, now.real_ms);
+   }
+   return c->num_relays;
+}
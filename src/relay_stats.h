@@ -0,0 +1,156 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Relay usage statistics
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the relay statistics functions.
+ *
+ *   For every relay the daemon keeps the cumulative on-time, the number
+ *   of switching operations and the duty cycle over the last hour and the
+ *   last 24 hours. The counters are updated incrementally on each state
+ *   change and are stored in a memory mapped file, so they survive a
+ *   restart of the daemon. While the daemon is not running, the relays
+ *   are assumed to keep their last known states.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef relay_stats_h
+#define relay_stats_h
+
+#include <stdint.h>
+
+#include "relay_drv.h"
+
+#define RELAY_STATS_PATH "/var/lib/crelay/stats.dat"
+
+/* Counters of a relay, as returned by relay_stats_get() */
+typedef struct
+{
+   uint8_t  state;         /* last known state, 0 or 1 */
+   uint64_t on_time_ms;    /* cumulative on-time */
+   uint64_t switch_count;  /* number of state changes */
+   double   duty_1h;       /* fraction of the last hour the relay was on */
+   double   duty_24h;      /* fraction of the last 24 hours the relay was on */
+}
+relay_counters_t;
+
+
+/**********************************************************
+ * Function relay_stats_open()
+ *
+ * Description: Map the statistics file (create it if
+ *              needed)
+ *
+ * Parameters: path (in) - statistics file path
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int relay_stats_open(const char *path);
+
+/**********************************************************
+ * Function relay_stats_close()
+ *
+ * Description: Account the on-time up to now and unmap the
+ *              statistics file
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void relay_stats_close(void);
+
+/**********************************************************
+ * Function relay_stats_set_default()
+ *
+ * Description: Set the serial number used for requests
+ *              without serial number
+ *
+ * Parameters: serial (in) - serial number of the first card
+ *
+ * Return: none
+ *********************************************************/
+void relay_stats_set_default(const char *serial);
+
+/**********************************************************
+ * Function relay_stats_update()
+ *
+ * Description: Update the counters with the current relay
+ *              states of a card
+ *
+ * Parameters: serial (in)     - card serial number, NULL or
+ *                               empty for the default card
+ *             num_relays (in) - number of relays on the card
+ *             states (in)     - current relay states
+ *
+ * Return: none
+ *********************************************************/
+void relay_stats_update(const char *serial, uint8_t num_relays, uint16_t states);
+
+/**********************************************************
+ * Function relay_stats_update_relay()
+ *
+ * Description: Update the counters with the new state of a
+ *              single relay
+ *
+ * Parameters: serial (in) - card serial number, NULL or
+ *                           empty for the default card
+ *             relay (in)  - relay number
+ *             state (in)  - new relay state
+ *
+ * Return: none
+ *********************************************************/
+void relay_stats_update_relay(const char *serial, uint8_t relay, relay_state_t state);
+
+/**********************************************************
+ * Function relay_stats_num_cards()
+ *
+ * Description: Get the number of cards with statistics
+ *
+ * Parameters: none
+ *
+ * Return: number of cards
+ *********************************************************/
+int relay_stats_num_cards(void);
+
+/**********************************************************
+ * Function relay_stats_get()
+ *
+ * Description: Get the counters of all relays of a card,
+ *              the on-time of relays which are on is
+ *              accounted up to now
+ *
+ * Parameters: card (in)      - card index
+ *             serial (out)   - card serial number
+ *             counters (out) - counters, MAX_NUM_RELAYS
+ *                              entries
+ *
+ * Return: number of relays, -1 if card index is invalid
+ *********************************************************/
+int relay_stats_get(int card, char *serial, relay_counters_t *counters);
+
+#endif
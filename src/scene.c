@@ -0,0 +1,617 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Scenes
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the scenes, see scene.h.
+ *
+ *   Each worker thread of the pool executes the write to one card. To
+ *   start the writes at the same time, the workers are first woken up
+ *   and then meet at a barrier, which releases all of them together
+ *   when the last one arrives. So the time to wake up the workers one
+ *   by one is kept out of the skew between the cards. The workers block
+ *   at the barrier instead of spinning, they run with SCHED_FIFO and
+ *   could otherwise starve each other with fewer CPUs than cards.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+#include <pthread.h>
+
+#include "relay_drv.h"
+#include "scene.h"
+#include "interlock.h"
+#include "history.h"
+#include "crelay.h"
+#include "realtime.h"
+
+typedef struct
+{
+   uint8_t       used;
+   uint8_t       from_config;
+   char          name[SCENE_NAME_LEN];
+   char          def[SCENE_DEF_LEN];
+   scene_write_t writes[SCENE_MAX_CARDS];
+   int           num_writes;
+}
+scene_t;
+
+typedef struct
+{
+   pthread_t      thread;
+   int            idx;
+   scene_write_t *job;
+   char           portname[MAX_COM_PORT_NAME_LEN];
+   relay_type_t   type;
+   int            urgent;  /* no read back */
+}
+worker_t;
+
+static scene_t  g_scenes[SCENE_MAX];
+static worker_t g_workers[SCENE_MAX_CARDS];
+static int      g_num_workers = 0;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  g_done = PTHREAD_COND_INITIALIZER;
+static unsigned int    g_generation = 0;
+static int             g_num_jobs = 0;
+static int             g_finished = 0;
+static pthread_barrier_t g_start;      /* all workers of a scene */
+static int             g_quit = 0;
+
+
+static uint64_t monotonic_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+/**********************************************************
+ * Internal function execute()
+ *
+ * Description: Write the mask of a job and read back the
+ *              card states
+ *
+ * Return: none
+ *********************************************************/
+static void execute(worker_t *w)
+{
+   scene_write_t *job = w->job;
+   char *serial = job->serial[0] ? job->serial : NULL;
+
+   job->start_ns = monotonic_ns();
+   if (w->urgent)
+      job->rc = crelay_force_relay_mask_type(w->type, job->num_relays, w->portname, job->mask, job->states, serial);
+   else
+      job->rc = crelay_set_relay_mask_type(w->type, job->num_relays, w->portname, job->mask, job->states, serial);
+   job->end_ns = monotonic_ns();
+   if (w->urgent)
+      job->result = job->states & job->mask;
+   else if (job->rc == 0)
+      job->rc = crelay_get_relay_mask_type(w->type, job->num_relays, w->portname, &job->result, serial);
+}
+
+
+static void* worker_thread(void *arg)
+{
+   worker_t *w = arg;
+   unsigned int gen = 0;
+
+   realtime_thread("crelay-scene", 0);
+   pthread_mutex_lock(&g_lock);
+   for (;;)
+   {
+      while (g_generation == gen && !g_quit)
+         pthread_cond_wait(&g_wake, &g_lock);
+      if (g_quit)
+         break;
+      gen = g_generation;
+      if (w->idx >= g_num_jobs)
+         continue;
+      pthread_mutex_unlock(&g_lock);
+
+      pthread_barrier_wait(&g_start);
+      execute(w);
+
+      pthread_mutex_lock(&g_lock);
+      if (++g_finished == g_num_jobs)
+         pthread_cond_signal(&g_done);
+   }
+   pthread_mutex_unlock(&g_lock);
+   return NULL;
+}
+
+
+/**********************************************************
+ * Internal function compile()
+ *
+ * Description: Compile a scene definition into one mask
+ *              write per card
+ *
+ * Return: NULL on success, error message otherwise
+ *********************************************************/
+static const char* compile(const char *def, scene_write_t *writes, int *num)
+{
+   char buf[SCENE_DEF_LEN], *item, *save, *tok[3], *tsave, *p, *end;
+   char serial[MAX_SERIAL_LEN];
+   uint16_t mask, states;
+   long relay;
+   int n, i;
+
+   if (strlen(def) >= sizeof(buf))
+      return "definition too long";
+   strcpy(buf, def);
+   *num = 0;
+
+   for (item=strtok_r(buf, ";", &save); item != NULL; item=strtok_r(NULL, ";", &save))
+   {
+      for (n=0, p=strtok_r(item, " \t", &tsave); p != NULL && n < 3; p=strtok_r(NULL, " \t", &tsave))
+         tok[n++] = p;
+      if (n == 0)
+         continue;
+      if (n != 2)
+         return "expected [serial:]relay[,relay...] on|off";
+
+      serial[0] = 0;
+      p = tok[0];
+      if ((end = strchr(p, ':')) != NULL)
+      {
+         if (end-p >= MAX_SERIAL_LEN) return "serial number too long";
+         memcpy(serial, p, end-p);
+         serial[end-p] = 0;
+         p = end+1;
+      }
+      mask = 0;
+      while (*p)
+      {
+         relay = strtol(p, &end, 10);
+         if (end == p || relay < FIRST_RELAY || relay >= FIRST_RELAY+MAX_NUM_RELAYS || (*end && *end != ','))
+            return "invalid relay number";
+         mask |= 1 << (relay-FIRST_RELAY);
+         p = (*end == ',') ? end+1 : end;
+      }
+      if (!strcasecmp(tok[1], "on") || !strcmp(tok[1], "1"))
+         states = mask;
+      else if (!strcasecmp(tok[1], "off") || !strcmp(tok[1], "0"))
+         states = 0;
+      else
+         return "state must be on or off";
+
+      for (i=0; i<*num && strcmp(writes[i].serial, serial); i++);
+      if (i == *num)
+      {
+         if (*num == SCENE_MAX_CARDS) return "too many cards";
+         memset(&writes[i], 0, sizeof(scene_write_t));
+         strcpy(writes[i].serial, serial);
+         (*num)++;
+      }
+      writes[i].mask |= mask;
+      writes[i].states = (writes[i].states & ~mask) | states;
+   }
+   return (*num == 0) ? "scene has no relays" : NULL;
+}
+
+
+/**********************************************************
+ * Function scene_init()
+ *
+ * Description: Start the worker threads
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int scene_init(void)
+{
+   int i;
+
+   g_quit = 0;
+   for (i=0; i<SCENE_MAX_CARDS; i++)
+   {
+      g_workers[i].idx = i;
+      if (pthread_create(&g_workers[i].thread, NULL, worker_thread, &g_workers[i]) != 0)
+      {
+         syslog(LOG_DAEMON | LOG_ERR, "Failed to start scene workers\n");
+         scene_close();
+         return -1;
+      }
+      g_num_workers++;
+   }
+   return 0;
+}
+
+
+/**********************************************************
+ * Function scene_close()
+ *
+ * Description: Stop the worker threads
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void scene_close(void)
+{
+   int i;
+
+   pthread_mutex_lock(&g_lock);
+   g_quit = 1;
+   pthread_cond_broadcast(&g_wake);
+   pthread_mutex_unlock(&g_lock);
+   for (i=0; i<g_num_workers; i++)
+      pthread_join(g_workers[i].thread, NULL);
+   g_num_workers = 0;
+}
+
+
+/**********************************************************
+ * Function scene_define()
+ *
+ * Description: Define a scene or replace its definition.
+ *              A scene which breaks an interlock rule by
+ *              the relays it switches on is rejected; with
+ *              the other relays of the cards it is checked
+ *              when it is applied.
+ *
+ * Parameters: name (in)        - scene name
+ *             def (in)         - scene definition
+ *             from_config (in) - 1 if read from the config
+ *                                file
+ *             err (out)        - error message
+ *             errlen (in)      - size of err
+ *
+ * Return:  0 - success
+ *         -1 - invalid definition or too many scenes
+ *********************************************************/
+int scene_define(const char *name, const char *def, int from_config, char *err, size_t errlen)
+{
+   scene_t *scene = NULL;
+   scene_write_t writes[SCENE_MAX_CARDS];
+   const char *msg;
+   uint16_t on;
+   int i, num;
+
+   if (name[0] == 0 || strlen(name) >= SCENE_NAME_LEN)
+   {
+      snprintf(err, errlen, "invalid scene name");
+      return -1;
+   }
+   for (i=0; i<SCENE_MAX; i++)
+   {
+      if (g_scenes[i].used && !strcmp(g_scenes[i].name, name))
+      {
+         scene = &g_scenes[i];
+         break;
+      }
+      if (!g_scenes[i].used && scene == NULL)
+         scene = &g_scenes[i];
+   }
+   if (scene == NULL)
+   {
+      snprintf(err, errlen, "too many scenes");
+      return -1;
+   }
+
+   if ((msg = compile(def, writes, &num)) != NULL)
+   {
+      snprintf(err, errlen, "%s", msg);
+      return -1;
+   }
+
+   /* Relays which the scene switches on together must be allowed to be.
+    * This check is partial: the relays a scene does not touch keep the
+    * state they have when it is applied, so the merged states can only
+    * be checked then, before any card is written (see dispatch()). */
+   for (i=0; i<num; i++)
+   {
+      on = writes[i].states & writes[i].mask;
+      if (interlock_check_states(writes[i].serial[0] ? writes[i].serial : NULL, &on, 1) < 0)
+      {
+         snprintf(err, errlen, "breaks interlock \"%s\"", interlock_violation());
+         return -1;
+      }
+   }
+   memcpy(scene->writes, writes, num*sizeof(scene_write_t));
+   scene->num_writes = num;
+   scene->used = 1;
+   scene->from_config = from_config;
+   strcpy(scene->name, name);
+   strcpy(scene->def, def);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function scene_delete()
+ *
+ * Description: Delete a scene
+ *
+ * Parameters: name (in) - scene name
+ *
+ * Return:  0 - success
+ *         -1 - scene not found
+ *********************************************************/
+int scene_delete(const char *name)
+{
+   int i;
+
+   for (i=0; i<SCENE_MAX; i++)
+   {
+      if (g_scenes[i].used && !strcmp(g_scenes[i].name, name))
+      {
+         g_scenes[i].used = 0;
+         return 0;
+      }
+   }
+   return -1;
+}
+
+
+/**********************************************************
+ * Function scene_list()
+ *
+ * Description: Get the names and definitions of all scenes
+ *
+ * Parameters: entries (out) - scene information
+ *             max (in)      - max. number of entries
+ *
+ * Return: number of entries
+ *********************************************************/
+int scene_list(scene_entry_t *entries, int max)
+{
+   int i, n = 0;
+
+   for (i=0; i<SCENE_MAX && n < max; i++)
+   {
+      if (!g_scenes[i].used) continue;
+      strcpy(entries[n].name, g_scenes[i].name);
+      strcpy(entries[n].def, g_scenes[i].def);
+      entries[n].from_config = g_scenes[i].from_config;
+      n++;
+   }
+   return n;
+}
+
+
+/**********************************************************
+ * Internal function dispatch()
+ *
+ * Description: Detect the cards and execute mask writes to
+ *              several cards in parallel, see
+ *              scene_dispatch() and scene_dispatch_urgent()
+ *
+ * Return: see scene_dispatch()
+ *********************************************************/
+static int dispatch(scene_write_t *writes, int num, int urgent)
+{
+   worker_t *w;
+   int i, n, rc;
+
+   if (num <= 0 || num > SCENE_MAX_CARDS)
+      return -EINVAL;
+
+   /* Detection is done before, so it does not add to the skew */
+   for (i=0, n=0; i<num; i++)
+   {
+      w = &g_workers[n];
+      w->job = &writes[i];
+      w->urgent = urgent;
+      writes[i].rc = 0;
+      writes[i].start_ns = writes[i].end_ns = 0;
+      if (urgent && writes[i].type != NO_RELAY_TYPE && writes[i].portname[0] && writes[i].num_relays != 0)
+      {
+         /* Known from the enumeration */
+         strcpy(w->portname, writes[i].portname);
+         rc = 0;
+      }
+      else if (urgent && writes[i].type != NO_RELAY_TYPE)
+      {
+         writes[i].num_relays = FIRST_RELAY;
+         rc = crelay_detect_relay_card_type(writes[i].type, w->portname, &writes[i].num_relays,
+                                            writes[i].serial[0] ? writes[i].serial : NULL);
+      }
+      else
+      {
+         writes[i].num_relays = FIRST_RELAY;
+         rc = crelay_detect_relay_card(w->portname, &writes[i].num_relays,
+                                       writes[i].serial[0] ? writes[i].serial : NULL, NULL);
+         writes[i].type = crelay_get_relay_card_type();
+      }
+      if (rc < 0)
+      {
+         rc = (rc == -ETIMEDOUT || rc == -ENOLINK) ? rc : -ENODEV;
+         if (!urgent)
+            return rc;
+         writes[i].rc = rc;
+         continue;
+      }
+      if ((writes[i].mask >> writes[i].num_relays) != 0)
+      {
+         if (!urgent)
+            return -EINVAL;
+         writes[i].mask &= (1 << writes[i].num_relays) - 1;
+      }
+      w->type = writes[i].type;
+      n++;
+   }
+
+   /* A write which breaks an interlock rejects the whole scene, before
+    * any card is written */
+   for (i=0; i<n && !urgent; i++)
+   {
+      if ((rc = crelay_check_relay_mask_type(g_workers[i].type, g_workers[i].job->num_relays, g_workers[i].portname,
+                                             g_workers[i].job->mask, g_workers[i].job->states,
+                                             g_workers[i].job->serial[0] ? g_workers[i].job->serial : NULL)) < 0)
+         return (rc == -EPERM || rc == -ETIMEDOUT || rc == -ENOLINK) ? rc : -ENODEV;
+   }
+
+   if (n <= 1 || g_num_workers < n)
+   {
+      /* Nothing to synchronize, or no workers */
+      for (i=0; i<n; i++)
+         execute(&g_workers[i]);
+   }
+   else
+   {
+      /* The workers of the last scene have all left the barrier, it can
+       * be set up for the new number of workers */
+      pthread_barrier_init(&g_start, NULL, n);
+      pthread_mutex_lock(&g_lock);
+      g_num_jobs = n;
+      g_finished = 0;
+      g_generation++;
+      pthread_cond_broadcast(&g_wake);
+      while (g_finished < n)
+         pthread_cond_wait(&g_done, &g_lock);
+      pthread_mutex_unlock(&g_lock);
+      pthread_barrier_destroy(&g_start);
+   }
+
+   rc = 0;
+   for (i=0; i<num; i++)
+   {
+      if (writes[i].rc == -ETIMEDOUT && !urgent)
+         return -ETIMEDOUT;
+      if (writes[i].rc < 0)
+         rc = -EIO;
+   }
+   return rc;
+}
+
+
+/**********************************************************
+ * Function scene_dispatch()
+ *
+ * Description: Detect the cards and execute mask writes to
+ *              several cards in parallel
+ *
+ * Parameters: writes (in/out) - mask writes, results are
+ *                               filled in
+ *             num (in)        - number of writes (max.
+ *                               SCENE_MAX_CARDS)
+ *
+ * Return:  0 - success
+ *         -ENODEV if a card is not found,
+ *         -EINVAL if a relay is not on its card,
+ *         -ETIMEDOUT if a card did not answer in time,
+ *         -ENOLINK if the circuit of a card is open,
+ *         -EPERM if a write would break an interlock rule
+ *                (no card is written),
+ *         -EIO if a write failed
+ *********************************************************/
+int scene_dispatch(scene_write_t *writes, int num)
+{
+   return dispatch(writes, num, 0);
+}
+
+
+/**********************************************************
+ * Function scene_dispatch_urgent()
+ *
+ * Description: Like scene_dispatch(), for the emergency
+ *              off: a card which can not be detected does
+ *              not stop the writes to the others, masks
+ *              are limited to the relays of the card and
+ *              the states are not read back (result is
+ *              states & mask)
+ *
+ * Parameters: writes (in/out) - mask writes, results are
+ *                               filled in
+ *             num (in)        - number of writes (max.
+ *                               SCENE_MAX_CARDS)
+ *
+ * Return:  0 - success
+ *         -EIO if a card was not found or a write failed,
+ *              see the results of the writes
+ *********************************************************/
+int scene_dispatch_urgent(scene_write_t *writes, int num)
+{
+   return dispatch(writes, num, 1);
+}
+
+
+/**********************************************************
+ * Function scene_apply()
+ *
+ * Description: Apply a scene and record the new states
+ *
+ * Parameters: name (in)      - scene name
+ *             writes (out)   - mask writes with results,
+ *                              SCENE_MAX_CARDS entries
+ *             num (out)      - number of mask writes
+ *             client_ip (in) - IPv4 address of the client
+ *
+ * Return:  0 - success
+ *         -ENOENT if the scene is not defined,
+ *         -ENODEV if a card is not found,
+ *         -ETIMEDOUT if a card did not answer in time,
+ *         -ENOLINK if the circuit of a card is open,
+ *         -EPERM if a write would break an interlock rule
+ *                (no card is written),
+ *         -EIO if a write failed
+ *********************************************************/
+int scene_apply(const char *name, scene_write_t *writes, int *num, uint32_t client_ip)
+{
+   scene_write_t *w;
+   int i, rc;
+
+   *num = 0;
+   for (i=0; i<SCENE_MAX && !(g_scenes[i].used && !strcmp(g_scenes[i].name, name)); i++);
+   if (i == SCENE_MAX)
+      return -ENOENT;
+
+   *num = g_scenes[i].num_writes;
+   memcpy(writes, g_scenes[i].writes, *num * sizeof(scene_write_t));
+   rc = scene_dispatch(writes, *num);
+   if (rc == -ENODEV || rc == -EINVAL || rc == -ENOLINK || rc == -EPERM || (rc == -ETIMEDOUT && writes[0].start_ns == 0))
+      return rc;
+
+   for (i=0; i<*num; i++)
+   {
+      w = &writes[i];
+      if (w->rc < 0)
+      {
+         syslog(LOG_DAEMON | LOG_ERR, "Scene %s: write to card %s failed\n", name,
+                w->serial[0] ? w->serial : "(default)");
+         continue;
+      }
+      publish_states(w->serial, w->num_relays, w->mask, w->result, HISTORY_SRC_SCENE, client_ip);
+   }
+   return rc;
+}
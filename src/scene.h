@@ -0,0 +1,213 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Scenes
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the scene functions. A scene
+ *   is a named set of relay states, possibly on several cards, which is
+ *   applied with one mask write per card. The writes to the different
+ *   cards are done in parallel by a pool of worker threads, so that they
+ *   take effect as close to simultaneously as possible.
+ *
+ *   Scene definition, separated by ';':
+ *     [serial:]<relay>[,<relay>...] on|off
+ *
+ *   Example: "A0001:1,2 on; A0001:3 off; A0002:1 on"
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef scene_h
+#define scene_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "relay_drv.h"
+
+#define SCENE_MAX       32    /* max. number of scenes */
+#define SCENE_MAX_CARDS 8     /* max. number of cards written in parallel */
+#define SCENE_NAME_LEN  32
+#define SCENE_DEF_LEN   256
+
+/* Mask write to one card and its result */
+typedef struct
+{
+   char     serial[MAX_SERIAL_LEN];
+   uint16_t mask;
+   uint16_t states;
+   relay_type_t type;        /* card known to scene_dispatch_urgent(), NO_RELAY_TYPE to detect it */
+   char     portname[MAX_COM_PORT_NAME_LEN];  /* known port, empty to detect it */
+   uint8_t  num_relays;      /* set by scene_dispatch(), known with the port */
+   uint16_t result;          /* card states after the write */
+   int      rc;              /* result of the write */
+   uint64_t start_ns;        /* write issued, CLOCK_MONOTONIC, 0 if not started */
+   uint64_t end_ns;          /* write completed, CLOCK_MONOTONIC */
+}
+scene_write_t;
+
+/* Scene information, as returned by scene_list() */
+typedef struct
+{
+   char    name[SCENE_NAME_LEN];
+   char    def[SCENE_DEF_LEN];
+   uint8_t from_config;
+}
+scene_entry_t;
+
+
+/**********************************************************
+ * Function scene_init()
+ *
+ * Description: Start the worker threads
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int scene_init(void);
+
+/**********************************************************
+ * Function scene_close()
+ *
+ * Description: Stop the worker threads
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void scene_close(void);
+
+/**********************************************************
+ * Function scene_define()
+ *
+ * Description: Define a scene or replace its definition
+ *
+ * Parameters: name (in)        - scene name
+ *             def (in)         - scene definition
+ *             from_config (in) - 1 if read from the config
+ *                                file
+ *             err (out)        - error message
+ *             errlen (in)      - size of err
+ *
+ * Return:  0 - success
+ *         -1 - invalid definition or too many scenes
+ *********************************************************/
+int scene_define(const char *name, const char *def, int from_config, char *err, size_t errlen);
+
+/**********************************************************
+ * Function scene_delete()
+ *
+ * Description: Delete a scene
+ *
+ * Parameters: name (in) - scene name
+ *
+ * Return:  0 - success
+ *         -1 - scene not found
+ *********************************************************/
+int scene_delete(const char *name);
+
+/**********************************************************
+ * Function scene_list()
+ *
+ * Description: Get the names and definitions of all scenes
+ *
+ * Parameters: entries (out) - scene information
+ *             max (in)      - max. number of entries
+ *
+ * Return: number of entries
+ *********************************************************/
+int scene_list(scene_entry_t *entries, int max);
+
+/**********************************************************
+ * Function scene_apply()
+ *
+ * Description: Apply a scene and record the new states
+ *
+ * Parameters: name (in)      - scene name
+ *             writes (out)   - mask writes with results,
+ *                              SCENE_MAX_CARDS entries
+ *             num (out)      - number of mask writes
+ *             client_ip (in) - IPv4 address of the client
+ *
+ * Return:  0 - success
+ *         -ENOENT if the scene is not defined,
+ *         -ENODEV if a card is not found,
+ *         -ETIMEDOUT if a card did not answer in time,
+ *         -EPERM if a write would break an interlock rule
+ *                (no card is written),
+ *         -EIO if a write failed
+ *********************************************************/
+int scene_apply(const char *name, scene_write_t *writes, int *num, uint32_t client_ip);
+
+/**********************************************************
+ * Function scene_dispatch()
+ *
+ * Description: Detect the cards and execute mask writes to
+ *              several cards in parallel
+ *
+ * Parameters: writes (in/out) - mask writes, results are
+ *                               filled in
+ *             num (in)        - number of writes (max.
+ *                               SCENE_MAX_CARDS)
+ *
+ * Return:  0 - success
+ *         -ENODEV if a card is not found,
+ *         -EINVAL if a relay is not on its card,
+ *         -ETIMEDOUT if a card did not answer in time,
+ *         -EPERM if a write would break an interlock rule
+ *                (no card is written),
+ *         -EIO if a write failed
+ *********************************************************/
+int scene_dispatch(scene_write_t *writes, int num);
+
+/**********************************************************
+ * Function scene_dispatch_urgent()
+ *
+ * Description: Like scene_dispatch(), for the emergency
+ *              off: a card which can not be detected does
+ *              not stop the writes to the others, masks
+ *              are limited to the relays of the card and
+ *              the states are not read back (result is
+ *              states & mask). A card given with type, port
+ *              and number of relays is not detected again,
+ *              one given with type only is detected by its
+ *              driver. The card health, interlocks and
+ *              power-on limits are bypassed.
+ *
+ * Parameters: writes (in/out) - mask writes, results are
+ *                               filled in
+ *             num (in)        - number of writes (max.
+ *                               SCENE_MAX_CARDS)
+ *
+ * Return:  0 - success
+ *         -EIO if a card was not found or a write failed,
+ *              see the results of the writes
+ *********************************************************/
+int scene_dispatch_urgent(scene_write_t *writes, int num);
+
+#endif
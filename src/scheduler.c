@@ -0,0 +1,796 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Scheduler
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the scheduler, see scheduler.h.
+ *
+ *   The schedules are kept in a binary min-heap ordered by their next
+ *   fire time. A timerfd on CLOCK_REALTIME is armed with the absolute
+ *   time of the heap top, so the main loop only wakes up when a schedule
+ *   is due and the firing follows the wall clock. When the system time
+ *   is set, the timer is cancelled and all fire times are recomputed.
+ *   Firing a schedule and inserting or removing one costs O(log n).
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <syslog.h>
+#include <sys/timerfd.h>
+
+#include "relay_drv.h"
+#include "scheduler.h"
+#include "history.h"
+#include "crelay.h"
+
+#define CRON_MAX_STEPS  2000   /* max. field increments when searching the next cron time */
+#define SUN_MAX_DAYS    366
+
+typedef enum
+{
+   SCHED_CRON=0,
+   SCHED_SUNRISE,
+   SCHED_SUNSET,
+   SCHED_ONCE
+} sched_type_t;
+
+typedef struct
+{
+   uint8_t  used;
+   uint8_t  type;
+   uint8_t  from_config;
+   uint32_t id;
+   char     spec[SCHEDULER_SPEC_LEN];
+
+   /* Cron fields as bitmaps */
+   uint64_t minutes;
+   uint32_t hours;
+   uint32_t mdays;           /* bit 1..31 */
+   uint16_t months;          /* bit 1..12 */
+   uint8_t  wdays;           /* bit 0..6 */
+   uint8_t  mday_any;
+   uint8_t  wday_any;
+
+   int32_t  offset;          /* sunrise/sunset offset in seconds */
+   time_t   at;              /* one-shot time */
+
+   /* Action */
+   char     serial[MAX_SERIAL_LEN];
+   uint16_t mask;
+   uint16_t states;
+
+   time_t   next;
+   time_t   last;
+   int      heap_idx;        /* -1 if not queued */
+}
+schedule_t;
+
+static schedule_t  g_sched[SCHEDULER_MAX];
+static schedule_t *g_heap[SCHEDULER_MAX];
+static int         g_heap_len = 0;
+static uint32_t    g_next_id = 1;
+static int         g_timer_fd = -1;
+static double      g_latitude, g_longitude;
+static int         g_location = 0;
+static int         g_hold = 0;
+
+
+/**********************************************************
+ * Heap operations, ordered by next fire time
+ *********************************************************/
+static void heap_swap(int a, int b)
+{
+   schedule_t *tmp = g_heap[a];
+
+   g_heap[a] = g_heap[b];
+   g_heap[b] = tmp;
+   g_heap[a]->heap_idx = a;
+   g_heap[b]->heap_idx = b;
+}
+
+
+static void heap_up(int i)
+{
+   while (i > 0 && g_heap[(i-1)/2]->next > g_heap[i]->next)
+   {
+      heap_swap(i, (i-1)/2);
+      i = (i-1)/2;
+   }
+}
+
+
+static void heap_down(int i)
+{
+   int min, c;
+
+   for (;;)
+   {
+      min = i;
+      c = 2*i+1;
+      if (c < g_heap_len && g_heap[c]->next < g_heap[min]->next) min = c;
+      if (c+1 < g_heap_len && g_heap[c+1]->next < g_heap[min]->next) min = c+1;
+      if (min == i) break;
+      heap_swap(i, min);
+      i = min;
+   }
+}
+
+
+static void heap_push(schedule_t *s)
+{
+   s->heap_idx = g_heap_len;
+   g_heap[g_heap_len++] = s;
+   heap_up(s->heap_idx);
+}
+
+
+static void heap_remove(schedule_t *s)
+{
+   int i = s->heap_idx;
+
+   if (i < 0) return;
+   s->heap_idx = -1;
+   if (--g_heap_len == i) return;
+
+   g_heap[i] = g_heap[g_heap_len];
+   g_heap[i]->heap_idx = i;
+   heap_up(i);
+   heap_down(g_heap[i]->heap_idx);
+}
+
+
+/**********************************************************
+ * Internal function parse_field()
+ *
+ * Description: Parse a cron field into a bitmap
+ *
+ * Return: 0 on success, -1 if the field is invalid
+ *********************************************************/
+static int parse_field(const char *field, int min, int max, uint64_t *bits, uint8_t *any)
+{
+   const char *p = field;
+   char *end;
+   long a, b, step;
+
+   *bits = 0;
+   *any = !strcmp(field, "*");
+   while (*p)
+   {
+      if (*p == '*')
+      {
+         a = min;
+         b = max;
+         p++;
+      }
+      else
+      {
+         a = b = strtol(p, &end, 10);
+         if (end == p) return -1;
+         p = end;
+         if (*p == '-')
+         {
+            b = strtol(p+1, &end, 10);
+            if (end == p+1) return -1;
+            p = end;
+         }
+      }
+      step = 1;
+      if (*p == '/')
+      {
+         step = strtol(p+1, &end, 10);
+         if (end == p+1 || step <= 0) return -1;
+         p = end;
+      }
+      if (a < min || b > max || a > b) return -1;
+      for (; a<=b; a+=step)
+         *bits |= 1ULL << a;
+
+      if (*p == ',') p++;
+      else if (*p) return -1;
+   }
+   return *bits ? 0 : -1;
+}
+
+
+/**********************************************************
+ * Internal function next_cron()
+ *
+ * Description: Find the next local time after t matching
+ *              the cron fields
+ *
+ * Return: fire time, 0 if there is none
+ *********************************************************/
+static time_t next_cron(const schedule_t *s, time_t t)
+{
+   struct tm tm;
+   int i, mday, wday;
+
+   t = (t/60 + 1)*60;
+   localtime_r(&t, &tm);
+
+   for (i=0; i<CRON_MAX_STEPS; i++)
+   {
+      mday = (s->mdays >> tm.tm_mday) & 1;
+      wday = (s->wdays >> tm.tm_wday) & 1;
+
+      if (!((s->months >> (tm.tm_mon+1)) & 1))
+      {
+         tm.tm_mon++;
+         tm.tm_mday = 1;
+         tm.tm_hour = tm.tm_min = 0;
+      }
+      else if (!(s->mday_any || s->wday_any ? mday && wday : mday || wday))
+      {
+         tm.tm_mday++;
+         tm.tm_hour = tm.tm_min = 0;
+      }
+      else if (!((s->hours >> tm.tm_hour) & 1))
+      {
+         tm.tm_hour++;
+         tm.tm_min = 0;
+      }
+      else if (!((s->minutes >> tm.tm_min) & 1))
+      {
+         tm.tm_min++;
+      }
+      else
+      {
+         return t;
+      }
+      tm.tm_sec = 0;
+      tm.tm_isdst = -1;
+      t = mktime(&tm);
+      localtime_r(&t, &tm);
+   }
+   return 0;
+}
+
+
+/**********************************************************
+ * Internal function sun_time()
+ *
+ * Description: Calculate sunrise or sunset on a day with
+ *              the algorithm of the Almanac for Computers
+ *              (zenith 90.833 degrees)
+ *
+ * Return: 0 on success, -1 if the sun does not rise or set
+ *         on that day
+ *********************************************************/
+static int sun_time(int year, int mon, int mday, int yday, int rise, time_t noon, time_t *t)
+{
+   const double rad = M_PI/180;
+   double lng_hour = g_longitude/15;
+   double tt, m, l, ra, sin_dec, cos_dec, cos_h, h, ut;
+   struct tm tm;
+
+   tt = yday + 1 + ((rise ? 6 : 18) - lng_hour)/24;
+   m = 0.9856*tt - 3.289;
+   l = fmod(m + 1.916*sin(m*rad) + 0.020*sin(2*m*rad) + 282.634 + 360, 360);
+   ra = fmod(atan(0.91764*tan(l*rad))/rad + 360, 360);
+   ra = (ra + floor(l/90)*90 - floor(ra/90)*90)/15;
+   sin_dec = 0.39782*sin(l*rad);
+   cos_dec = cos(asin(sin_dec));
+   cos_h = (cos(90.833*rad) - sin_dec*sin(g_latitude*rad))/(cos_dec*cos(g_latitude*rad));
+   if (cos_h > 1 || cos_h < -1)
+      return -1;
+
+   h = (rise ? 360 - acos(cos_h)/rad : acos(cos_h)/rad)/15;
+   ut = fmod(h + ra - 0.06571*tt - 6.622 - lng_hour + 48, 24);
+
+   memset(&tm, 0, sizeof(tm));
+   tm.tm_year = year;
+   tm.tm_mon = mon;
+   tm.tm_mday = mday;
+   *t = timegm(&tm) + (time_t)(ut*3600);
+
+   /* UT may belong to the previous or next UTC day */
+   if (*t - noon > 12*3600) *t -= 24*3600;
+   else if (noon - *t > 12*3600) *t += 24*3600;
+   return 0;
+}
+
+
+static time_t next_sun(const schedule_t *s, time_t t)
+{
+   struct tm tm, day;
+   time_t noon, ev;
+   int i;
+
+   localtime_r(&t, &tm);
+   for (i=-1; i<SUN_MAX_DAYS; i++)
+   {
+      day = tm;
+      day.tm_mday += i;
+      day.tm_hour = 12;
+      day.tm_min = day.tm_sec = 0;
+      day.tm_isdst = -1;
+      noon = mktime(&day);
+      if (sun_time(day.tm_year, day.tm_mon, day.tm_mday, day.tm_yday, s->type == SCHED_SUNRISE, noon, &ev) == 0 &&
+          ev + s->offset > t)
+         return ev + s->offset;
+   }
+   return 0;
+}
+
+
+static time_t next_fire(const schedule_t *s, time_t t)
+{
+   switch (s->type)
+   {
+      case SCHED_CRON:
+         return next_cron(s, t);
+      case SCHED_SUNRISE:
+      case SCHED_SUNSET:
+         return next_sun(s, t);
+      default:
+         return (s->at > t) ? s->at : 0;
+   }
+}
+
+
+/**********************************************************
+ * Internal function parse_spec()
+ *
+ * Description: Parse a schedule specification
+ *
+ * Return: NULL on success, error message otherwise
+ *********************************************************/
+static const char* parse_spec(schedule_t *s, const char *spec)
+{
+   char buf[SCHEDULER_SPEC_LEN], *tok[8], *save, *p, *end;
+   uint64_t bits;
+   struct tm tm;
+   int num = 0, n = 0;
+   uint8_t any;
+   long relay;
+
+   if (strlen(spec) >= sizeof(buf))
+      return "specification too long";
+   strcpy(buf, spec);
+   for (p=strtok_r(buf, " \t", &save); p != NULL && num < 8; p=strtok_r(NULL, " \t", &save))
+      tok[num++] = p;
+   if (p != NULL)
+      return "too many fields";
+
+   /* When */
+   if (num > 0 && (!strncmp(tok[0], "sunrise", 7) || !strncmp(tok[0], "sunset", 6)))
+   {
+      if (!g_location)
+         return "sunrise/sunset needs latitude and longitude";
+      s->type = (tok[0][3] == 'r') ? SCHED_SUNRISE : SCHED_SUNSET;
+      p = tok[0] + ((s->type == SCHED_SUNRISE) ? 7 : 6);
+      s->offset = 0;
+      if (*p)
+      {
+         if (*p != '+' && *p != '-') return "invalid sunrise/sunset offset";
+         s->offset = strtol(p, &end, 10)*60;
+         if (end == p+1 || *end) return "invalid sunrise/sunset offset";
+      }
+      n = 1;
+   }
+   else if (num > 0 && tok[0][0] == '@')
+   {
+      s->type = SCHED_ONCE;
+      memset(&tm, 0, sizeof(tm));
+      if ((end = strptime(tok[0]+1, "%Y-%m-%dT%H:%M", &tm)) != NULL && (*end == 0 || *end == ':'))
+      {
+         if (*end == ':') tm.tm_sec = atoi(end+1);
+         tm.tm_isdst = -1;
+         s->at = mktime(&tm);
+      }
+      else
+      {
+         s->at = strtoll(tok[0]+1, &end, 10);
+         if (end == tok[0]+1 || *end) return "invalid one-shot time";
+      }
+      n = 1;
+   }
+   else if (num >= 5)
+   {
+      s->type = SCHED_CRON;
+      if (parse_field(tok[0], 0, 59, &s->minutes, &any) < 0) return "invalid minute field";
+      if (parse_field(tok[1], 0, 23, &bits, &any) < 0) return "invalid hour field";
+      s->hours = bits;
+      if (parse_field(tok[2], 1, 31, &bits, &s->mday_any) < 0) return "invalid day field";
+      s->mdays = bits;
+      if (parse_field(tok[3], 1, 12, &bits, &any) < 0) return "invalid month field";
+      s->months = bits;
+      if (parse_field(tok[4], 0, 7, &bits, &s->wday_any) < 0) return "invalid weekday field";
+      s->wdays = (bits | (bits >> 7)) & 0x7f;
+      n = 5;
+   }
+   else
+   {
+      return "invalid time specification";
+   }
+
+   /* Action */
+   if (num != n+2)
+      return "expected [serial:]relay[,relay...] on|off";
+   s->serial[0] = 0;
+   p = tok[n];
+   if ((end = strchr(p, ':')) != NULL)
+   {
+      if (end-p >= MAX_SERIAL_LEN) return "serial number too long";
+      memcpy(s->serial, p, end-p);
+      s->serial[end-p] = 0;
+      p = end+1;
+   }
+   s->mask = 0;
+   while (*p)
+   {
+      relay = strtol(p, &end, 10);
+      if (end == p || relay < FIRST_RELAY || relay >= FIRST_RELAY+MAX_NUM_RELAYS)
+         return "invalid relay number";
+      s->mask |= 1 << (relay-FIRST_RELAY);
+      p = end;
+      if (*p == ',') p++;
+      else if (*p) return "invalid relay number";
+   }
+   if (!strcasecmp(tok[n+1], "on") || !strcmp(tok[n+1], "1"))
+      s->states = s->mask;
+   else if (!strcasecmp(tok[n+1], "off") || !strcmp(tok[n+1], "0"))
+      s->states = 0;
+   else
+      return "state must be on or off";
+
+   return NULL;
+}
+
+
+/**********************************************************
+ * Internal function run_action()
+ *
+ * Description: Switch the relays of a schedule
+ *
+ * Return: none
+ *********************************************************/
+static void run_action(schedule_t *s)
+{
+   char portname[MAX_COM_PORT_NAME_LEN];
+   char *serial = s->serial[0] ? s->serial : NULL;
+   uint8_t num_relays = FIRST_RELAY;
+   uint16_t states;
+
+   if (crelay_detect_relay_card(portname, &num_relays, serial, NULL) < 0 ||
+       (s->mask >> num_relays) != 0 ||
+       crelay_set_relay_mask(portname, s->mask, s->states, serial) < 0 ||
+       crelay_get_relay_mask(portname, &states, serial) < 0)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Schedule %u (%s) failed\n", s->id, s->spec);
+      return;
+   }
+   syslog(LOG_DAEMON | LOG_INFO, "Schedule %u (%s) executed\n", s->id, s->spec);
+
+   publish_states(s->serial, num_relays, s->mask, states, HISTORY_SRC_SCHEDULE, s->id);
+}
+
+
+/**********************************************************
+ * Internal function arm_timer()
+ *
+ * Description: Arm the timer with the fire time of the
+ *              heap top, or disarm it if the heap is empty
+ *
+ * Return: none
+ *********************************************************/
+static void arm_timer(void)
+{
+   struct itimerspec its;
+
+   memset(&its, 0, sizeof(its));
+   if (g_heap_len > 0)
+      its.it_value.tv_sec = g_heap[0]->next;
+   if (timerfd_settime(g_timer_fd, TFD_TIMER_ABSTIME|TFD_TIMER_CANCEL_ON_SET, &its, NULL) < 0)
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to arm scheduler timer: %s\n", strerror(errno));
+}
+
+
+/**********************************************************
+ * Internal function reschedule_all()
+ *
+ * Description: Recompute all fire times after the system
+ *              time was set
+ *
+ * Return: none
+ *********************************************************/
+static void reschedule_all(void)
+{
+   time_t now = time(NULL);
+   int i;
+
+   g_heap_len = 0;
+   for (i=0; i<SCHEDULER_MAX; i++)
+   {
+      if (!g_sched[i].used) continue;
+      g_sched[i].heap_idx = -1;
+      if ((g_sched[i].next = next_fire(&g_sched[i], now)) != 0)
+         heap_push(&g_sched[i]);
+   }
+}
+
+
+/**********************************************************
+ * Function scheduler_init()
+ *
+ * Description: Create the scheduler timer
+ *
+ * Parameters: latitude (in)  - location for sunrise/sunset
+ *                              in degrees north [optional]
+ *             longitude (in) - location for sunrise/sunset
+ *                              in degrees east [optional]
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int scheduler_init(const char *latitude, const char *longitude)
+{
+   g_timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK|TFD_CLOEXEC);
+   if (g_timer_fd < 0)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to create scheduler timer: %s\n", strerror(errno));
+      return -1;
+   }
+
+   g_location = 0;
+   if (latitude != NULL && longitude != NULL)
+   {
+      g_latitude = atof(latitude);
+      g_longitude = atof(longitude);
+      g_location = (g_latitude >= -90 && g_latitude <= 90 && g_longitude >= -180 && g_longitude <= 180);
+      if (!g_location)
+         syslog(LOG_DAEMON | LOG_ERR, "Invalid scheduler location %s, %s\n", latitude, longitude);
+   }
+   return 0;
+}
+
+
+/**********************************************************
+ * Function scheduler_close()
+ *
+ * Description: Remove all schedules and close the timer
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void scheduler_close(void)
+{
+   memset(g_sched, 0, sizeof(g_sched));
+   g_heap_len = 0;
+   if (g_timer_fd >= 0)
+      close(g_timer_fd);
+   g_timer_fd = -1;
+}
+
+
+/**********************************************************
+ * Function scheduler_add()
+ *
+ * Description: Add a schedule
+ *
+ * Parameters: spec (in)        - schedule specification
+ *             from_config (in) - 1 if read from the config
+ *                                file
+ *             err (out)        - error message
+ *             errlen (in)      - size of err
+ *
+ * Return: schedule id (>0), -1 if the specification is
+ *         invalid or there is no free entry
+ *********************************************************/
+int scheduler_add(const char *spec, int from_config, char *err, size_t errlen)
+{
+   schedule_t *s = NULL, tmp;
+   const char *msg;
+   int i;
+
+   for (i=0; i<SCHEDULER_MAX && s == NULL; i++)
+   {
+      if (!g_sched[i].used) s = &g_sched[i];
+   }
+   if (g_timer_fd < 0 || s == NULL)
+   {
+      snprintf(err, errlen, "%s", (g_timer_fd < 0) ? "scheduler not running" : "too many schedules");
+      return -1;
+   }
+
+   memset(&tmp, 0, sizeof(tmp));
+   if ((msg = parse_spec(&tmp, spec)) != NULL)
+   {
+      snprintf(err, errlen, "%s", msg);
+      return -1;
+   }
+   if ((tmp.next = next_fire(&tmp, time(NULL))) == 0)
+   {
+      snprintf(err, errlen, "schedule never fires");
+      return -1;
+   }
+
+   *s = tmp;
+   s->used = 1;
+   s->from_config = from_config;
+   s->id = g_next_id++;
+   strcpy(s->spec, spec);
+   heap_push(s);
+   if (s->heap_idx == 0)
+      arm_timer();
+   return s->id;
+}
+
+
+/**********************************************************
+ * Function scheduler_remove()
+ *
+ * Description: Remove a schedule
+ *
+ * Parameters: id (in) - schedule id
+ *
+ * Return:  0 - success
+ *         -1 - schedule not found
+ *********************************************************/
+int scheduler_remove(uint32_t id)
+{
+   int i, top;
+
+   for (i=0; i<SCHEDULER_MAX; i++)
+   {
+      if (g_sched[i].used && g_sched[i].id == id)
+      {
+         top = (g_sched[i].heap_idx == 0);
+         heap_remove(&g_sched[i]);
+         g_sched[i].used = 0;
+         if (top)
+            arm_timer();
+         return 0;
+      }
+   }
+   return -1;
+}
+
+
+/**********************************************************
+ * Function scheduler_list()
+ *
+ * Description: Get the information of all schedules
+ *
+ * Parameters: entries (out) - schedule information
+ *             max (in)      - max. number of entries
+ *
+ * Return: number of entries
+ *********************************************************/
+int scheduler_list(scheduler_entry_t *entries, int max)
+{
+   int i, n = 0;
+
+   for (i=0; i<SCHEDULER_MAX && n < max; i++)
+   {
+      if (!g_sched[i].used) continue;
+      entries[n].id = g_sched[i].id;
+      entries[n].from_config = g_sched[i].from_config;
+      strcpy(entries[n].spec, g_sched[i].spec);
+      entries[n].next = (g_sched[i].heap_idx >= 0) ? g_sched[i].next : 0;
+      entries[n].last = g_sched[i].last;
+      n++;
+   }
+   return n;
+}
+
+
+/**********************************************************
+ * Function scheduler_pollfd()
+ *
+ * Description: Get the timer file descriptor to be polled
+ *              for POLLIN by the main loop
+ *
+ * Parameters: none
+ *
+ * Return: file descriptor, -1 if the scheduler is not
+ *         initialized
+ *********************************************************/
+int scheduler_pollfd(void)
+{
+   return g_timer_fd;
+}
+
+
+/**********************************************************
+ * Function scheduler_process()
+ *
+ * Description: Execute the schedules which are due and
+ *              arm the timer for the next one
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void scheduler_process(void)
+{
+   uint64_t expirations;
+   schedule_t *s;
+   time_t now;
+
+   if (read(g_timer_fd, &expirations, sizeof(expirations)) < 0)
+   {
+      if (errno != ECANCELED)
+         return;
+      syslog(LOG_DAEMON | LOG_NOTICE, "System time changed, recomputing schedules\n");
+      reschedule_all();
+   }
+
+   now = time(NULL);
+   while (g_heap_len > 0 && g_heap[0]->next <= now)
+   {
+      s = g_heap[0];
+      if (g_hold)
+      {
+         syslog(LOG_DAEMON | LOG_NOTICE, "Schedule %u (%s) skipped, scheduler held\n", s->id, s->spec);
+      }
+      else
+      {
+         s->last = now;
+         run_action(s);
+      }
+
+      /* Missed fire times are skipped */
+      if (s->type == SCHED_ONCE || (s->next = next_fire(s, now)) == 0)
+      {
+         heap_remove(s);
+         if (s->type == SCHED_ONCE)
+            s->used = 0;
+      }
+      else
+      {
+         heap_down(0);
+      }
+   }
+   arm_timer();
+}
+
+
+/**********************************************************
+ * Function scheduler_hold()
+ *
+ * Description: Hold or release the scheduler. While it is
+ *              held, schedules which are due are skipped,
+ *              one-time schedules are dropped.
+ *
+ * Parameters: hold (in) - 1 to hold, 0 to release
+ *
+ * Return: none
+ *********************************************************/
+void scheduler_hold(int hold)
+{
+   g_hold = hold;
+}
@@ -0,0 +1,177 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Scheduler
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the scheduler, which switches
+ *   relays at times given by cron expressions, sunrise/sunset offsets
+ *   or as one-shot timers.
+ *
+ *   Schedule specification:
+ *     <when> [serial:]<relay>[,<relay>...] on|off
+ *
+ *     <when> is one of
+ *       <minute> <hour> <day> <month> <weekday>
+ *                     cron fields in local time: * (any), n, a-b,
+ *                     lists a,b,... and steps x/s, where x is * or a
+ *                     range; weekday 0-7 (0 and 7 are sunday)
+ *       sunrise[+|-<minutes>], sunset[+|-<minutes>]
+ *                     needs the location (latitude, longitude)
+ *       @<time>       one-shot, seconds since the epoch or local time
+ *                     as YYYY-MM-DDTHH:MM[:SS]
+ *
+ *   Examples: "30 6 * * 1-5 1,2 on", "sunset+15 A0001:3 on",
+ *             "@2026-12-24T18:00 4 off"
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef scheduler_h
+#define scheduler_h
+
+#include <stdint.h>
+#include <time.h>
+
+#define SCHEDULER_MAX      64    /* max. number of schedules */
+#define SCHEDULER_SPEC_LEN 128
+
+/* Schedule information, as returned by scheduler_list() */
+typedef struct
+{
+   uint32_t id;
+   uint8_t  from_config;         /* 1 if read from the config file */
+   char     spec[SCHEDULER_SPEC_LEN];
+   time_t   next;                /* next fire time, 0 if none */
+   time_t   last;                /* last fire time, 0 if never */
+}
+scheduler_entry_t;
+
+
+/**********************************************************
+ * Function scheduler_init()
+ *
+ * Description: Create the scheduler timer
+ *
+ * Parameters: latitude (in)  - location for sunrise/sunset
+ *                              in degrees north [optional]
+ *             longitude (in) - location for sunrise/sunset
+ *                              in degrees east [optional]
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int scheduler_init(const char *latitude, const char *longitude);
+
+/**********************************************************
+ * Function scheduler_close()
+ *
+ * Description: Remove all schedules and close the timer
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void scheduler_close(void);
+
+/**********************************************************
+ * Function scheduler_add()
+ *
+ * Description: Add a schedule
+ *
+ * Parameters: spec (in)        - schedule specification
+ *             from_config (in) - 1 if read from the config
+ *                                file
+ *             err (out)        - error message
+ *             errlen (in)      - size of err
+ *
+ * Return: schedule id (>0), -1 if the specification is
+ *         invalid or there is no free entry
+ *********************************************************/
+int scheduler_add(const char *spec, int from_config, char *err, size_t errlen);
+
+/**********************************************************
+ * Function scheduler_remove()
+ *
+ * Description: Remove a schedule
+ *
+ * Parameters: id (in) - schedule id
+ *
+ * Return:  0 - success
+ *         -1 - schedule not found
+ *********************************************************/
+int scheduler_remove(uint32_t id);
+
+/**********************************************************
+ * Function scheduler_list()
+ *
+ * Description: Get the information of all schedules
+ *
+ * Parameters: entries (out) - schedule information
+ *             max (in)      - max. number of entries
+ *
+ * Return: number of entries
+ *********************************************************/
+int scheduler_list(scheduler_entry_t *entries, int max);
+
+/**********************************************************
+ * Function scheduler_pollfd()
+ *
+ * Description: Get the timer file descriptor to be polled
+ *              for POLLIN by the main loop
+ *
+ * Parameters: none
+ *
+ * Return: file descriptor, -1 if the scheduler is not
+ *         initialized
+ *********************************************************/
+int scheduler_pollfd(void);
+
+/**********************************************************
+ * Function scheduler_process()
+ *
+ * Description: Execute the schedules which are due and
+ *              arm the timer for the next one
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void scheduler_process(void);
+
+/**********************************************************
+ * Function scheduler_hold()
+ *
+ * Description: Hold or release the scheduler. While it is
+ *              held, schedules which are due are skipped,
+ *              one-time schedules are dropped.
+ *
+ * Parameters: hold (in) - 1 to hold, 0 to release
+ *
+ * Return: none
+ *********************************************************/
+void scheduler_hold(int hold);
+
+#endif
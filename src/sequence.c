@@ -0,0 +1,656 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Relay sequences
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the sequence engine, see sequence.h.
+ *
+ *   The sequence thread only executes the mask writes. After each step it
+ *   writes a byte to a pipe, the main loop then records the new states in
+ *   the journal, history and statistics, so these are never accessed by
+ *   two threads.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include "relay_drv.h"
+#include "sequence.h"
+#include "interlock.h"
+#include "history.h"
+#include "crelay.h"
+#include "realtime.h"
+
+#define MAX_PROGRAM_LEN 1024
+
+typedef struct
+{
+   char         serial[MAX_SERIAL_LEN];
+   char         portname[MAX_COM_PORT_NAME_LEN];
+   relay_type_t type;
+   uint8_t      num_relays;
+   uint16_t     states;            /* states while compiling */
+}
+seq_card_t;
+
+typedef struct
+{
+   sequence_step_t pub;
+   int      card;
+   uint16_t result;                /* card states after the step */
+}
+seq_step_t;
+
+static seq_card_t g_cards[SEQUENCE_MAX_CARDS];
+static int        g_num_cards;
+static seq_step_t g_steps[SEQUENCE_MAX_STEPS];
+static int        g_num_steps = 0;
+static sequence_info_t g_info;
+static uint32_t   g_next_id = 1;
+
+static pthread_t  g_thread;
+static int        g_running = 0;   /* thread started, not joined yet */
+static int        g_done = 0;      /* steps executed, written by the thread */
+static int        g_finished = 0;  /* set by the thread at its end */
+static int        g_reported = 0;  /* steps recorded by the main loop */
+static int        g_pipe[2] = {-1, -1};
+static int        g_cancel_fd = -1;
+
+
+static uint64_t monotonic_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+/**********************************************************
+ * Internal function find_card()
+ *
+ * Description: Get the index of a card used by the program,
+ *              detect it when it is used the first time
+ *
+ * Return: card index, -1 if the card is not found
+ *********************************************************/
+static int find_card(const char *serial)
+{
+   seq_card_t *card;
+   int i;
+
+   for (i=0; i<g_num_cards; i++)
+   {
+      if (!strcmp(g_cards[i].serial, serial))
+         return i;
+   }
+   if (g_num_cards == SEQUENCE_MAX_CARDS)
+      return -1;
+
+   card = &g_cards[g_num_cards];
+   strcpy(card->serial, serial);
+   card->num_relays = FIRST_RELAY;
+   if (crelay_detect_relay_card(card->portname, &card->num_relays, serial[0] ? card->serial : NULL, NULL) < 0 ||
+       crelay_get_relay_mask(card->portname, &card->states, serial[0] ? card->serial : NULL) < 0)
+      return -1;
+   card->type = crelay_get_relay_card_type();
+   return g_num_cards++;
+}
+
+
+/**********************************************************
+ * Internal function compile()
+ *
+ * Description: Compile a program into mask writes
+ *
+ * Return: 0 on success, negative errno value otherwise
+ *********************************************************/
+static int compile(const char *program, char *err, size_t errlen)
+{
+   char buf[MAX_PROGRAM_LEN], *line, *save, *tok[3], *p, *end, *tsave;
+   char serial[MAX_SERIAL_LEN];
+   uint16_t mask, states;
+   uint64_t t = 0;
+   seq_step_t *step;
+   double ms;
+   long relay;
+   int n, c, i, lineno = 0;
+
+   g_num_cards = 0;
+   g_num_steps = 0;
+   if (strlen(program) >= sizeof(buf))
+   {
+      snprintf(err, errlen, "program too long");
+      return -EINVAL;
+   }
+   strcpy(buf, program);
+
+   for (line=strtok_r(buf, ";\n", &save); line != NULL; line=strtok_r(NULL, ";\n", &save))
+   {
+      lineno++;
+      for (n=0, p=strtok_r(line, " \t\r", &tsave); p != NULL && n < 3; p=strtok_r(NULL, " \t\r", &tsave))
+         tok[n++] = p;
+      if (n == 0)
+         continue;
+      if (n != 2 || p != NULL)
+      {
+         snprintf(err, errlen, "step %d: expected [serial:]relay[,relay...] on|off or wait <ms>", lineno);
+         return -EINVAL;
+      }
+
+      if (!strcmp(tok[0], "wait"))
+      {
+         ms = strtod(tok[1], &end);
+         if (end == tok[1] || *end || ms < 0 || ms > 86400000)
+         {
+            snprintf(err, errlen, "step %d: invalid wait time", lineno);
+            return -EINVAL;
+         }
+         t += (uint64_t)(ms*1000000);
+         continue;
+      }
+
+      /* Relays and state */
+      serial[0] = 0;
+      p = tok[0];
+      if ((end = strchr(p, ':')) != NULL)
+      {
+         if (end-p >= MAX_SERIAL_LEN)
+         {
+            snprintf(err, errlen, "step %d: serial number too long", lineno);
+            return -EINVAL;
+         }
+         memcpy(serial, p, end-p);
+         serial[end-p] = 0;
+         p = end+1;
+      }
+      mask = 0;
+      while (*p)
+      {
+         relay = strtol(p, &end, 10);
+         if (end == p || relay < FIRST_RELAY || relay >= FIRST_RELAY+MAX_NUM_RELAYS || (*end && *end != ','))
+         {
+            snprintf(err, errlen, "step %d: invalid relay number", lineno);
+            return -EINVAL;
+         }
+         mask |= 1 << (relay-FIRST_RELAY);
+         p = (*end == ',') ? end+1 : end;
+      }
+      if (!strcasecmp(tok[1], "on") || !strcmp(tok[1], "1"))
+         states = mask;
+      else if (!strcasecmp(tok[1], "off") || !strcmp(tok[1], "0"))
+         states = 0;
+      else
+      {
+         snprintf(err, errlen, "step %d: state must be on or off", lineno);
+         return -EINVAL;
+      }
+
+      if ((c = find_card(serial)) < 0)
+      {
+         snprintf(err, errlen, "step %d: card %s not found", lineno, serial[0] ? serial : "(default)");
+         return -ENODEV;
+      }
+      if ((mask >> g_cards[c].num_relays) != 0)
+      {
+         snprintf(err, errlen, "step %d: relay number out of range", lineno);
+         return -EINVAL;
+      }
+
+      /* Merge with a write to the same card at the same time */
+      for (i=g_num_steps-1; i>=0 && g_steps[i].pub.planned_ns == t && g_steps[i].card != c; i--);
+      step = (i >= 0 && g_steps[i].pub.planned_ns == t) ? &g_steps[i] : NULL;
+      if (step != NULL)
+      {
+         step->pub.mask |= mask;
+         step->pub.states = (step->pub.states & ~mask) | states;
+      }
+      else
+      {
+         if (g_num_steps == SEQUENCE_MAX_STEPS)
+         {
+            snprintf(err, errlen, "too many steps (max. %d writes)", SEQUENCE_MAX_STEPS);
+            return -EINVAL;
+         }
+         step = &g_steps[g_num_steps++];
+         memset(step, 0, sizeof(seq_step_t));
+         strcpy(step->pub.serial, serial);
+         step->card = c;
+         step->pub.mask = mask;
+         step->pub.states = states;
+         step->pub.planned_ns = t;
+      }
+      g_cards[c].states = (g_cards[c].states & ~mask) | states;
+      step->result = g_cards[c].states;
+   }
+
+   if (g_num_steps == 0)
+   {
+      snprintf(err, errlen, "program has no switching steps");
+      return -EINVAL;
+   }
+   return 0;
+}
+
+
+/**********************************************************
+ * Internal function check_interlocks()
+ *
+ * Description: Check the compiled writes against the
+ *              interlocks, starting from the current
+ *              states of the cards
+ *
+ * Return: 0 on success, -EPERM if a write breaks a rule
+ *********************************************************/
+static int check_interlocks(char *err, size_t errlen)
+{
+   uint16_t states[SEQUENCE_MAX_CARDS], next;
+   seq_step_t *step;
+   int i, c;
+
+   for (c=0; c<g_num_cards; c++)
+      states[c] = g_cards[c].states;
+   for (i=0; i<g_num_steps; i++)
+   {
+      step = &g_steps[i];
+      c = step->card;
+      next = (states[c] & ~step->pub.mask) | (step->pub.states & step->pub.mask);
+      if ((next & ~states[c]) &&
+          interlock_check_states(g_cards[c].serial[0] ? g_cards[c].serial : NULL, &next, 1) < 0)
+      {
+         snprintf(err, errlen, "write %d breaks interlock \"%s\"", i+1, interlock_violation());
+         return -EPERM;
+      }
+      states[c] = next;
+   }
+   return 0;
+}
+
+
+/**********************************************************
+ * Internal function sequence_thread()
+ *
+ * Description: Execute the compiled steps at their planned
+ *              times
+ *
+ * Return: NULL
+ *********************************************************/
+static void* sequence_thread(void *arg)
+{
+   struct itimerspec its;
+   struct pollfd fds[2];
+   seq_step_t *step;
+   seq_card_t *card;
+   uint64_t base, due, t0;
+   int timer_fd, i;
+   sequence_state_t state = SEQUENCE_DONE;
+   char c = 0;
+
+   realtime_thread("crelay-seq", 0);
+   timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+   base = monotonic_ns();
+
+   for (i=0; i<g_num_steps && timer_fd >= 0; i++)
+   {
+      step = &g_steps[i];
+      card = &g_cards[step->card];
+
+      /* Wait for the planned time, or for cancellation */
+      due = base + step->pub.planned_ns;
+      memset(&its, 0, sizeof(its));
+      its.it_value.tv_sec = due / 1000000000ULL;
+      its.it_value.tv_nsec = due % 1000000000ULL;
+      timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+      fds[0].fd = timer_fd;
+      fds[0].events = POLLIN;
+      fds[1].fd = g_cancel_fd;
+      fds[1].events = POLLIN;
+      while (poll(fds, 2, -1) < 0 && errno == EINTR);
+      if (fds[1].revents & POLLIN)
+      {
+         state = SEQUENCE_CANCELLED;
+         break;
+      }
+
+      t0 = monotonic_ns();
+      step->pub.rc = crelay_set_relay_mask_type(card->type, card->num_relays, card->portname,
+                                                step->pub.mask, step->pub.states,
+                                                card->serial[0] ? card->serial : NULL);
+      step->pub.write_ns = monotonic_ns() - t0;
+      step->pub.actual_ns = t0 - base;
+
+      __atomic_store_n(&g_done, i+1, __ATOMIC_RELEASE);
+      if (write(g_pipe[1], &c, 1) < 0) {}
+      if (step->pub.rc < 0)
+      {
+         state = SEQUENCE_FAILED;
+         break;
+      }
+   }
+   if (timer_fd < 0)
+      state = SEQUENCE_FAILED;
+   else
+      close(timer_fd);
+
+   g_info.state = state;
+   __atomic_store_n(&g_finished, 1, __ATOMIC_RELEASE);
+   if (write(g_pipe[1], &c, 1) < 0) {}
+   return NULL;
+}
+
+
+/**********************************************************
+ * Function sequence_init()
+ *
+ * Description: Initialize the sequence engine
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int sequence_init(void)
+{
+   if (pipe2(g_pipe, O_NONBLOCK|O_CLOEXEC) < 0 ||
+       (g_cancel_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) < 0)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to init sequence engine: %s\n", strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
+
+/**********************************************************
+ * Function sequence_close()
+ *
+ * Description: Cancel a running sequence and wait for its
+ *              thread to end
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void sequence_close(void)
+{
+   if (g_running)
+   {
+      sequence_cancel();
+      pthread_join(g_thread, NULL);
+      g_running = 0;
+   }
+   if (g_pipe[0] >= 0)
+   {
+      close(g_pipe[0]);
+      close(g_pipe[1]);
+      close(g_cancel_fd);
+   }
+   g_pipe[0] = g_pipe[1] = g_cancel_fd = -1;
+}
+
+
+/**********************************************************
+ * Function sequence_start()
+ *
+ * Description: Compile a program and start its execution
+ *
+ * Parameters: program (in) - sequence program
+ *             err (out)    - error message
+ *             errlen (in)  - size of err
+ *
+ * Return: sequence id (>0) on success,
+ *         -EINVAL if the program is invalid,
+ *         -ENODEV if a card was not found,
+ *         -EPERM if a write breaks an interlock rule,
+ *         -EBUSY if a sequence is running
+ *********************************************************/
+int sequence_start(const char *program, char *err, size_t errlen)
+{
+   struct timespec ts;
+   uint64_t val;
+   int rc;
+
+   if (g_pipe[0] < 0)
+   {
+      snprintf(err, errlen, "sequence engine not running");
+      return -EINVAL;
+   }
+   if (g_running)
+   {
+      snprintf(err, errlen, "sequence %u is running", g_info.id);
+      return -EBUSY;
+   }
+
+   memset(&g_info, 0, sizeof(g_info));
+   if ((rc = compile(program, err, errlen)) < 0 ||
+       (rc = check_interlocks(err, errlen)) < 0)
+   {
+      g_num_steps = 0;
+      return rc;
+   }
+
+   /* Drop a cancellation which came too late for the last sequence */
+   if (read(g_cancel_fd, &val, sizeof(val)) < 0) {}
+
+   clock_gettime(CLOCK_REALTIME, &ts);
+   g_info.id = g_next_id++;
+   g_info.state = SEQUENCE_RUNNING;
+   g_info.num_steps = g_num_steps;
+   g_info.start_ns = (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+   g_done = g_reported = g_finished = 0;
+
+   if (pthread_create(&g_thread, NULL, sequence_thread, NULL) != 0)
+   {
+      snprintf(err, errlen, "failed to start sequence thread");
+      g_info.state = SEQUENCE_FAILED;
+      return -EINVAL;
+   }
+   g_running = 1;
+   syslog(LOG_DAEMON | LOG_INFO, "Sequence %u started, %d writes\n", g_info.id, g_num_steps);
+   return g_info.id;
+}
+
+
+/**********************************************************
+ * Function sequence_cancel()
+ *
+ * Description: Cancel the running sequence, steps not
+ *              executed yet are skipped
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - no sequence running
+ *********************************************************/
+int sequence_cancel(void)
+{
+   uint64_t val = 1;
+
+   if (!g_running || __atomic_load_n(&g_finished, __ATOMIC_ACQUIRE))
+      return -1;
+   if (write(g_cancel_fd, &val, sizeof(val)) < 0)
+      return -1;
+   return 0;
+}
+
+
+/**********************************************************
+ * Function sequence_stop()
+ *
+ * Description: Cancel the running sequence and wait until its
+ *              thread has ended, the writes done so far are
+ *              recorded
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - no sequence running
+ *********************************************************/
+int sequence_stop(void)
+{
+   struct pollfd fd;
+
+   if (sequence_cancel() < 0)
+      return -1;
+
+   /* The thread ends after its current card write at the latest */
+   fd.fd = g_pipe[0];
+   fd.events = POLLIN;
+   while (!__atomic_load_n(&g_finished, __ATOMIC_ACQUIRE))
+      poll(&fd, 1, 10);
+   sequence_process();
+   return 0;
+}
+
+
+/**********************************************************
+ * Function sequence_get()
+ *
+ * Description: Get the state and steps of the running or
+ *              last sequence
+ *
+ * Parameters: info (out)  - sequence state
+ *             steps (out) - compiled steps
+ *             max (in)    - max. number of steps
+ *
+ * Return: number of steps
+ *********************************************************/
+int sequence_get(sequence_info_t *info, sequence_step_t *steps, int max)
+{
+   int i;
+
+   *info = g_info;
+   info->done_steps = g_reported;
+   if (g_running)
+      info->state = SEQUENCE_RUNNING;
+
+   /* Execution times are only valid for the steps already reported by the thread */
+   for (i=0; i<g_num_steps && i<max; i++)
+   {
+      steps[i] = g_steps[i].pub;
+      if (i >= g_reported)
+      {
+         steps[i].actual_ns = 0;
+         steps[i].write_ns = 0;
+         steps[i].rc = 0;
+      }
+   }
+   return i;
+}
+
+
+/**********************************************************
+ * Function sequence_state_name()
+ *
+ * Description: Get the name of a sequence state
+ *
+ * Parameters: state (in) - sequence state
+ *
+ * Return: state name
+ *********************************************************/
+const char* sequence_state_name(sequence_state_t state)
+{
+   static const char *names[] = {"idle", "running", "done", "failed", "cancelled"};
+
+   return (state <= SEQUENCE_CANCELLED) ? names[state] : "unknown";
+}
+
+
+/**********************************************************
+ * Function sequence_pollfd()
+ *
+ * Description: Get the file descriptor to be polled for
+ *              POLLIN by the main loop, it is readable
+ *              when steps have been executed
+ *
+ * Parameters: none
+ *
+ * Return: file descriptor, -1 if not initialized
+ *********************************************************/
+int sequence_pollfd(void)
+{
+   return g_pipe[0];
+}
+
+
+/**********************************************************
+ * Function sequence_process()
+ *
+ * Description: Record the steps executed by the sequence
+ *              thread (history, statistics, shared memory,
+ *              local clients) and clean up when it ends
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void sequence_process(void)
+{
+   char buf[64];
+   seq_step_t *step;
+   seq_card_t *card;
+   int done, finished;
+
+   while (read(g_pipe[0], buf, sizeof(buf)) > 0);
+   if (!g_running)
+      return;
+
+   finished = __atomic_load_n(&g_finished, __ATOMIC_ACQUIRE);
+   done = __atomic_load_n(&g_done, __ATOMIC_ACQUIRE);
+   for (; g_reported < done; g_reported++)
+   {
+      step = &g_steps[g_reported];
+      card = &g_cards[step->card];
+      if (step->pub.rc < 0)
+      {
+         syslog(LOG_DAEMON | LOG_ERR, "Sequence %u: write to card %s failed\n", g_info.id,
+                card->serial[0] ? card->serial : "(default)");
+         continue;
+      }
+      publish_states(card->serial, card->num_relays, step->pub.mask, step->result, HISTORY_SRC_SEQUENCE, g_info.id);
+   }
+
+   if (finished)
+   {
+      pthread_join(g_thread, NULL);
+      g_running = 0;
+      syslog(LOG_DAEMON | LOG_INFO, "Sequence %u %s\n", g_info.id, sequence_state_name(g_info.state));
+   }
+}
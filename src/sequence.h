@@ -0,0 +1,210 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Relay sequences
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the sequence engine, which
+ *   executes a timed program of relay switching steps.
+ *
+ *   Program syntax, steps separated by ';' or newlines:
+ *     [serial:]<relay>[,<relay>...] on|off
+ *     wait <ms>
+ *
+ *   Example: "1 on; wait 150; 2 on; wait 2000; 1,2 off"
+ *
+ *   The program is compiled before it is started: the cards are detected
+ *   once and all switching steps at the same time on the same card are
+ *   merged into a single mask write. The writes are then executed by a
+ *   separate thread, which waits for the planned time of each write with
+ *   a timerfd on CLOCK_MONOTONIC, and records the actual time.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef sequence_h
+#define sequence_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "relay_drv.h"
+
+#define SEQUENCE_MAX_STEPS 64   /* max. number of mask writes */
+#define SEQUENCE_MAX_CARDS 8
+
+typedef enum
+{
+   SEQUENCE_IDLE=0,
+   SEQUENCE_RUNNING,
+   SEQUENCE_DONE,
+   SEQUENCE_FAILED,
+   SEQUENCE_CANCELLED
+} sequence_state_t;
+
+/* Compiled step (one mask write) and its execution times */
+typedef struct
+{
+   char     serial[MAX_SERIAL_LEN];
+   uint16_t mask;
+   uint16_t states;
+   uint64_t planned_ns;     /* planned time, relative to the start */
+   uint64_t actual_ns;      /* time the write was issued, relative to the start */
+   uint32_t write_ns;       /* duration of the write */
+   int      rc;             /* result of the write */
+}
+sequence_step_t;
+
+typedef struct
+{
+   uint32_t id;
+   sequence_state_t state;
+   int      num_steps;
+   int      done_steps;     /* steps executed */
+   uint64_t start_ns;       /* CLOCK_REALTIME of the start */
+}
+sequence_info_t;
+
+
+/**********************************************************
+ * Function sequence_init()
+ *
+ * Description: Initialize the sequence engine
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int sequence_init(void);
+
+/**********************************************************
+ * Function sequence_close()
+ *
+ * Description: Cancel a running sequence and wait for its
+ *              thread to end
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void sequence_close(void);
+
+/**********************************************************
+ * Function sequence_start()
+ *
+ * Description: Compile a program and start its execution
+ *
+ * Parameters: program (in) - sequence program
+ *             err (out)    - error message
+ *             errlen (in)  - size of err
+ *
+ * Return: sequence id (>0) on success,
+ *         -EINVAL if the program is invalid,
+ *         -ENODEV if a card was not found,
+ *         -EPERM if a write breaks an interlock rule,
+ *         -EBUSY if a sequence is running
+ *********************************************************/
+int sequence_start(const char *program, char *err, size_t errlen);
+
+/**********************************************************
+ * Function sequence_cancel()
+ *
+ * Description: Cancel the running sequence, steps not
+ *              executed yet are skipped
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - no sequence running
+ *********************************************************/
+int sequence_cancel(void);
+
+/**********************************************************
+ * Function sequence_stop()
+ *
+ * Description: Cancel the running sequence and wait until its
+ *              thread has ended, the writes done so far are
+ *              recorded
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - no sequence running
+ *********************************************************/
+int sequence_stop(void);
+
+/**********************************************************
+ * Function sequence_get()
+ *
+ * Description: Get the state and steps of the running or
+ *              last sequence
+ *
+ * Parameters: info (out)  - sequence state
+ *             steps (out) - compiled steps
+ *             max (in)    - max. number of steps
+ *
+ * Return: number of steps
+ *********************************************************/
+int sequence_get(sequence_info_t *info, sequence_step_t *steps, int max);
+
+/**********************************************************
+ * Function sequence_state_name()
+ *
+ * Description: Get the name of a sequence state
+ *
+ * Parameters: state (in) - sequence state
+ *
+ * Return: state name
+ *********************************************************/
+const char* sequence_state_name(sequence_state_t state);
+
+/**********************************************************
+ * Function sequence_pollfd()
+ *
+ * Description: Get the file descriptor to be polled for
+ *              POLLIN by the main loop, it is readable
+ *              when steps have been executed
+ *
+ * Parameters: none
+ *
+ * Return: file descriptor, -1 if not initialized
+ *********************************************************/
+int sequence_pollfd(void);
+
+/**********************************************************
+ * Function sequence_process()
+ *
+ * Description: Record the steps executed by the sequence
+ *              thread (history, statistics, shared memory,
+ *              local clients) and clean up when it ends
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void sequence_process(void);
+
+#endif
@@ -0,0 +1,450 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Persistent relay state journal
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the state journal, see state_journal.h.
+ *
+ *   The journal file consists of a header followed by a fixed number of
+ *   record slots and is mapped into memory with MAP_SHARED. Appending a
+ *   record is a plain memory copy, the data is in the page cache as soon
+ *   as the copy is done and is written back to disk by the kernel, so it
+ *   survives a crash of the daemon. A record is only valid if its sequence
+ *   number is the successor of the previous one and its checksum matches,
+ *   which also detects a record which was only partially written.
+ *
+ *   When all slots are used, the journal is compacted: a new file with one
+ *   record per card (the current commanded states) is written and synced,
+ *   and atomically renamed over the old one.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "relay_drv.h"
+#include "state_journal.h"
+#include "history.h"
+#include "relay_stats.h"
+
+#define JOURNAL_MAGIC    0x4c4a5243  /* "CRJL" */
+#define JOURNAL_VERSION  1
+#define JOURNAL_RECORDS  1023        /* record slots, file size 64 KiB */
+#define JOURNAL_MAX_CARDS 32
+
+typedef struct
+{
+   uint32_t magic;
+   uint16_t version;
+   uint16_t record_size;
+   uint32_t num_records;
+   uint8_t  reserved[52];
+}
+journal_header_t;
+
+typedef struct
+{
+   uint32_t seq;                     /* 1, 2, 3, ... */
+   uint32_t checksum;                /* over the whole record with checksum 0 */
+   uint64_t timestamp_ns;            /* CLOCK_REALTIME */
+   uint16_t mask;                    /* relays set by the command */
+   uint16_t states;                  /* new states of these relays */
+   uint8_t  reserved[4];
+   char     serial[MAX_SERIAL_LEN];  /* empty for the default card */
+   uint8_t  reserved2[8];
+}
+journal_record_t;
+
+typedef struct
+{
+   journal_header_t header;
+   journal_record_t records[JOURNAL_RECORDS];
+}
+journal_file_t;
+
+/* Commanded states, as result of all records */
+typedef struct
+{
+   char     serial[MAX_SERIAL_LEN];
+   uint16_t mask;                    /* relays with known state */
+   uint16_t states;
+}
+journal_card_t;
+
+static journal_file_t *g_journal = NULL;
+static char    *g_path = NULL;
+static uint32_t g_tail;              /* next free record slot */
+static uint32_t g_seq;               /* sequence number of last record */
+static journal_card_t g_cards[JOURNAL_MAX_CARDS];
+static int      g_num_cards;
+static char     g_default[MAX_SERIAL_LEN] = "";
+
+
+static uint32_t record_checksum(const journal_record_t *rec)
+{
+   journal_record_t tmp = *rec;
+   const uint8_t *p = (const uint8_t*)&tmp;
+   uint32_t h = 2166136261U;  /* FNV-1a */
+   size_t i;
+
+   tmp.checksum = 0;
+   for (i=0; i<sizeof(tmp); i++)
+   {
+      h ^= p[i];
+      h *= 16777619U;
+   }
+   return h;
+}
+
+
+/**********************************************************
+ * Internal function resolve()
+ *
+ * Description: Map an empty serial number to the one of
+ *              the default card
+ *
+ * Return: serial number to use as key
+ *********************************************************/
+static const char* resolve(const char *serial)
+{
+   return (serial == NULL || serial[0] == 0) ? g_default : serial;
+}
+
+
+/**********************************************************
+ * Internal function apply_record()
+ *
+ * Description: Merge a record into the commanded states
+ *
+ * Return: none
+ *********************************************************/
+static void apply_record(const char *serial, uint16_t mask, uint16_t states)
+{
+   int i;
+
+   for (i=0; i<g_num_cards; i++)
+   {
+      if (!strcmp(g_cards[i].serial, serial)) break;
+   }
+   if (i == g_num_cards)
+   {
+      if (g_num_cards == JOURNAL_MAX_CARDS) return;
+      snprintf(g_cards[i].serial, MAX_SERIAL_LEN, "%s", serial);
+      g_cards[i].mask = 0;
+      g_cards[i].states = 0;
+      g_num_cards++;
+   }
+   g_cards[i].mask |= mask;
+   g_cards[i].states = (g_cards[i].states & ~mask) | (states & mask);
+}
+
+
+static void write_record(journal_file_t *journal, uint32_t slot, uint32_t seq,
+                         const char *serial, uint16_t mask, uint16_t states)
+{
+   journal_record_t rec;
+   struct timespec ts;
+
+   memset(&rec, 0, sizeof(rec));
+   clock_gettime(CLOCK_REALTIME, &ts);
+   rec.seq = seq;
+   rec.timestamp_ns = (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+   rec.mask = mask;
+   rec.states = states;
+   snprintf(rec.serial, MAX_SERIAL_LEN, "%s", serial);
+   rec.checksum = record_checksum(&rec);
+   journal->records[slot] = rec;
+}
+
+
+/**********************************************************
+ * Internal function map_file()
+ *
+ * Description: Open and map a journal file, initialize it
+ *              if it is new or not a valid journal
+ *
+ * Return: mapped journal, NULL on failure
+ *********************************************************/
+static journal_file_t* map_file(const char *path, int create)
+{
+   journal_file_t *journal;
+   struct stat st;
+   int fd;
+
+   fd = open(path, O_RDWR|O_CLOEXEC|(create ? O_CREAT|O_TRUNC : O_CREAT), 0644);
+   if (fd < 0)
+      return NULL;
+
+   if (fstat(fd, &st) < 0 || (st.st_size != sizeof(journal_file_t) && ftruncate(fd, sizeof(journal_file_t)) < 0))
+   {
+      close(fd);
+      return NULL;
+   }
+
+   journal = mmap(NULL, sizeof(journal_file_t), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (journal == MAP_FAILED)
+      return NULL;
+
+   if (journal->header.magic != JOURNAL_MAGIC || journal->header.version != JOURNAL_VERSION ||
+       journal->header.record_size != sizeof(journal_record_t) ||
+       journal->header.num_records != JOURNAL_RECORDS)
+   {
+      memset(journal, 0, sizeof(journal_file_t));
+      journal->header.magic = JOURNAL_MAGIC;
+      journal->header.version = JOURNAL_VERSION;
+      journal->header.record_size = sizeof(journal_record_t);
+      journal->header.num_records = JOURNAL_RECORDS;
+   }
+   return journal;
+}
+
+
+/**********************************************************
+ * Internal function compact()
+ *
+ * Description: Replace the journal by a new one containing
+ *              one record per card
+ *
+ * Return: 0 on success, -1 on failure
+ *********************************************************/
+static int compact(void)
+{
+   journal_file_t *journal;
+   char tmp_path[256];
+   int i;
+
+   snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", g_path);
+   if ((journal = map_file(tmp_path, 1)) == NULL)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to create journal %s: %s", tmp_path, strerror(errno));
+      return -1;
+   }
+
+   for (i=0; i<g_num_cards; i++)
+   {
+      write_record(journal, i, i+1, g_cards[i].serial, g_cards[i].mask, g_cards[i].states);
+   }
+
+   /* The new file must be on disk before it replaces the old one */
+   if (msync(journal, sizeof(journal_file_t), MS_SYNC) < 0 || rename(tmp_path, g_path) < 0)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to compact journal %s: %s", g_path, strerror(errno));
+      munmap(journal, sizeof(journal_file_t));
+      unlink(tmp_path);
+      return -1;
+   }
+
+   munmap(g_journal, sizeof(journal_file_t));
+   g_journal = journal;
+   g_tail = g_num_cards;
+   g_seq = g_num_cards;
+   return 0;
+}
+
+
+/**********************************************************
+ * Function state_journal_set_default()
+ *
+ * Description: Set the serial number used for requests
+ *              without serial number
+ *
+ * Parameters: serial (in) - serial number of the first card
+ *
+ * Return: none
+ *********************************************************/
+void state_journal_set_default(const char *serial)
+{
+   snprintf(g_default, sizeof(g_default), "%s", serial ? serial : "");
+}
+
+
+/**********************************************************
+ * Function state_journal_open()
+ *
+ * Description: Map the journal file (create it if needed)
+ *              and replay its records
+ *
+ * Parameters: path (in) - journal file path
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int state_journal_open(const char *path)
+{
+   journal_record_t *rec;
+   uint32_t i;
+
+   if ((g_journal = map_file(path, 0)) == NULL)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to open journal %s: %s", path, strerror(errno));
+      return -1;
+   }
+   g_path = strdup(path);
+
+   /* Replay all valid records, stop at the first gap */
+   g_num_cards = 0;
+   for (i=0; i<JOURNAL_RECORDS; i++)
+   {
+      rec = &g_journal->records[i];
+      if (rec->seq != i+1 || rec->checksum != record_checksum(rec))
+         break;
+      rec->serial[MAX_SERIAL_LEN-1] = 0;
+      apply_record(resolve(rec->serial), rec->mask, rec->states);
+   }
+   g_tail = i;
+   g_seq = i;
+   syslog(LOG_DAEMON | LOG_NOTICE, "State journal %s: %u records, %d cards\n", path, i, g_num_cards);
+
+   /* Start with a compact journal, this also drops a partial record
+    * and the records of the default card without serial number */
+   if (g_tail > (uint32_t)g_num_cards)
+      compact();
+
+   return 0;
+}
+
+
+/**********************************************************
+ * Function state_journal_restore()
+ *
+ * Description: Write the last commanded relay states found
+ *              in the journal to the cards, one mask write
+ *              per card
+ *
+ * Parameters: none
+ *
+ * Return: number of cards restored
+ *********************************************************/
+int state_journal_restore(void)
+{
+   char com_port[MAX_COM_PORT_NAME_LEN];
+   uint8_t num_relays;
+   uint16_t mask, states;
+   char *serial;
+   int i, rc, restored = 0;
+
+   for (i=0; i<g_num_cards; i++)
+   {
+      serial = g_cards[i].serial[0] ? g_cards[i].serial : NULL;
+      num_relays = FIRST_RELAY;
+      if (crelay_detect_relay_card(com_port, &num_relays, serial, NULL) < 0)
+      {
+         syslog(LOG_DAEMON | LOG_WARNING, "Card %s from journal not found\n", serial ? serial : "(default)");
+         continue;
+      }
+
+      mask = g_cards[i].mask & ((1<<num_relays)-1);
+      if (mask == 0) continue;
+
+      /* Current states, to record the restored changes in the history */
+      if (crelay_get_relay_mask(com_port, &states, serial) == 0)
+      {
+         history_record(serial, num_relays, states, HISTORY_SRC_EXTERNAL, 0);
+         relay_stats_update(serial, num_relays, states);
+      }
+
+      /* Checked against the interlock rules like any other write */
+      if ((rc = crelay_set_relay_mask(com_port, mask, g_cards[i].states, serial)) < 0)
+      {
+         syslog(LOG_DAEMON | LOG_ERR, "Failed to restore states of card %s: %s\n",
+                serial ? serial : "(default)", (rc == -EPERM) ? "interlock violation" : strerror(-rc));
+         continue;
+      }
+      states = (states & ~mask) | (g_cards[i].states & mask);
+      history_record(serial, num_relays, states, HISTORY_SRC_RESTORE, 0);
+      relay_stats_update(serial, num_relays, states);
+      syslog(LOG_DAEMON | LOG_NOTICE, "Restored states 0x%04x (mask 0x%04x) of card %s\n",
+             g_cards[i].states & mask, mask, serial ? serial : "(default)");
+      restored++;
+   }
+   return restored;
+}
+
+
+/**********************************************************
+ * Function state_journal_record()
+ *
+ * Description: Append a commanded state change
+ *
+ * Parameters: serial (in) - card serial number, NULL or
+ *                           empty for the default card
+ *             mask (in)   - relays which have been set
+ *             states (in) - new states of these relays
+ *
+ * Return: none
+ *********************************************************/
+void state_journal_record(const char *serial, uint16_t mask, uint16_t states)
+{
+   if (g_journal == NULL || mask == 0)
+      return;
+
+   serial = resolve(serial);
+   apply_record(serial, mask, states);
+
+   if (g_tail < JOURNAL_RECORDS)
+   {
+      write_record(g_journal, g_tail, ++g_seq, serial, mask, states);
+      g_tail++;
+   }
+   else
+   {
+      /* Journal full, the compacted journal contains this change too */
+      compact();
+   }
+}
+
+
+/**********************************************************
+ * Function state_journal_close()
+ *
+ * Description: Flush and unmap the journal
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void state_journal_close(void)
+{
+   if (g_journal == NULL)
+      return;
+
+   msync(g_journal, sizeof(journal_file_t), MS_SYNC);
+   munmap(g_journal, sizeof(journal_file_t));
+   g_journal = NULL;
+   free(g_path);
+   g_path = NULL;
+}
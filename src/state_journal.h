@@ -0,0 +1,116 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Persistent relay state journal
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the state journal functions.
+ *
+ *   Every relay state change commanded through the daemon is appended to
+ *   a memory mapped journal file, so it survives a crash or restart of the
+ *   daemon. At startup the journal is replayed and the last commanded
+ *   states are written back to the cards, with one mask write per card.
+ *   When the journal is full it is compacted to one record per card.
+ *   Changes made without the daemon (direct command line access while it
+ *   is not running) are not in the journal and are overwritten by the
+ *   restore at the next start.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef state_journal_h
+#define state_journal_h
+
+#include <stdint.h>
+
+#define STATE_JOURNAL_PATH "/var/lib/crelay/state.journal"
+
+/**********************************************************
+ * Function state_journal_set_default()
+ *
+ * Description: Set the serial number used for requests
+ *              without serial number, so the records of
+ *              the default card are merged with the ones
+ *              carrying its serial number. Must be called
+ *              before state_journal_open().
+ *
+ * Parameters: serial (in) - serial number of the first card
+ *
+ * Return: none
+ *********************************************************/
+void state_journal_set_default(const char *serial);
+
+/**********************************************************
+ * Function state_journal_open()
+ *
+ * Description: Map the journal file (create it if needed)
+ *              and replay its records
+ *
+ * Parameters: path (in) - journal file path
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int state_journal_open(const char *path);
+
+/**********************************************************
+ * Function state_journal_restore()
+ *
+ * Description: Write the last commanded relay states found
+ *              in the journal to the cards, one mask write
+ *              per card
+ *
+ * Parameters: none
+ *
+ * Return: number of cards restored
+ *********************************************************/
+int state_journal_restore(void);
+
+/**********************************************************
+ * Function state_journal_record()
+ *
+ * Description: Append a commanded state change
+ *
+ * Parameters: serial (in) - card serial number, NULL or
+ *                           empty for the default card
+ *             mask (in)   - relays which have been set
+ *             states (in) - new states of these relays
+ *
+ * Return: none
+ *********************************************************/
+void state_journal_record(const char *serial, uint16_t mask, uint16_t states);
+
+/**********************************************************
+ * Function state_journal_close()
+ *
+ * Description: Flush and unmap the journal
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void state_journal_close(void);
+
+#endif
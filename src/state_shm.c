@@ -0,0 +1,399 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Shared memory state segment
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the shared memory segment in which the daemon
+ *   publishes the relay states of all cards (writer side), and the
+ *   functions used by local clients to read them (reader side, part of
+ *   libcrelay). See state_shm.h for the segment layout.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "state_shm.h"
+
+#define LOAD(p)      __atomic_load_n(p, __ATOMIC_RELAXED)
+#define STORE(p, v)  __atomic_store_n(p, v, __ATOMIC_RELAXED)
+
+#ifndef BUILD_LIB
+
+#include <syslog.h>
+
+static state_shm_t *g_shm = NULL;
+
+
+static uint64_t realtime_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+/**********************************************************
+ * Internal function find_card()
+ *
+ * Description: Find the entry of a card, add a new entry if
+ *              the card is not yet in the segment
+ *
+ * Return: entry index, -1 if the segment is full
+ *********************************************************/
+static int find_card(const char *serial)
+{
+   uint32_t i, num = g_shm->num_cards;
+
+   if (serial == NULL || serial[0] == 0)
+   {
+      /* Cards without serial number (GPIO) get an entry with empty name */
+      if (num > 0) return g_shm->default_card;
+      serial = "";
+   }
+
+   for (i=0; i<num; i++)
+   {
+      if (!strncmp(g_shm->cards[i].serial, serial, STATE_SHM_SERIAL_LEN))
+         return i;
+   }
+   if (num == STATE_SHM_MAX_CARDS)
+      return -1;
+
+   /* The serial number must be complete before readers see the entry */
+   memset(&g_shm->cards[num], 0, sizeof(state_shm_card_t));
+   strncpy(g_shm->cards[num].serial, serial, STATE_SHM_SERIAL_LEN-1);
+   __atomic_store_n(&g_shm->num_cards, num+1, __ATOMIC_RELEASE);
+   return num;
+}
+
+
+/**********************************************************
+ * Function state_shm_init()
+ *
+ * Description: Create (or reuse) the shared memory segment
+ *              and mark the daemon as running. A segment
+ *              which is not owned by the daemon user or is
+ *              writable by others is replaced.
+ *
+ * Parameters: name (in) - shared memory object name
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int state_shm_init(const char *name)
+{
+   struct stat st;
+   mode_t old_umask;
+   uint32_t i;
+   int fd;
+
+   old_umask = umask(022);
+   fd = shm_open(name, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+   if (fd >= 0 && fstat(fd, &st) == 0 && (st.st_uid != geteuid() || (st.st_mode & 022)))
+   {
+      /* Created by another user, who could still write to it: replace
+         it by a new segment, O_EXCL fails if it is created again */
+      syslog(LOG_DAEMON | LOG_WARNING, "Shared memory %s not owned by the daemon, recreating it\n", name);
+      close(fd);
+      shm_unlink(name);
+      fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC, 0644);
+   }
+   umask(old_umask);
+   if (fd < 0)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to open shared memory %s: %s", name, strerror(errno));
+      return -1;
+   }
+
+   if (fstat(fd, &st) < 0 || (st.st_size != sizeof(state_shm_t) && ftruncate(fd, sizeof(state_shm_t)) < 0))
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to size shared memory %s: %s", name, strerror(errno));
+      close(fd);
+      return -1;
+   }
+
+   g_shm = mmap(NULL, sizeof(state_shm_t), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (g_shm == MAP_FAILED)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to map shared memory %s: %s", name, strerror(errno));
+      g_shm = NULL;
+      return -1;
+   }
+
+   /* Keep the entries of a previous daemon run, so the card indexes
+      used by readers stay valid */
+   if (g_shm->magic != STATE_SHM_MAGIC || g_shm->version != STATE_SHM_VERSION ||
+       g_shm->max_cards != STATE_SHM_MAX_CARDS || g_shm->num_cards > STATE_SHM_MAX_CARDS)
+   {
+      memset(g_shm, 0, sizeof(state_shm_t));
+      g_shm->version = STATE_SHM_VERSION;
+      g_shm->max_cards = STATE_SHM_MAX_CARDS;
+      __atomic_store_n(&g_shm->magic, STATE_SHM_MAGIC, __ATOMIC_RELEASE);
+   }
+   else
+   {
+      /* A daemon which died during an update left the sequence
+         number odd, make the entry readable again */
+      for (i=0; i<g_shm->num_cards; i++)
+      {
+         if (g_shm->cards[i].seq & 1)
+            __atomic_store_n(&g_shm->cards[i].seq, g_shm->cards[i].seq+1, __ATOMIC_RELEASE);
+      }
+   }
+   g_shm->start_time_ns = realtime_ns();
+   __atomic_store_n(&g_shm->pid, getpid(), __ATOMIC_RELEASE);
+
+   syslog(LOG_DAEMON | LOG_NOTICE, "Relay states published in shared memory %s\n", name);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function state_shm_close()
+ *
+ * Description: Mark the daemon as not running and unmap
+ *              the segment. The segment is not removed, so
+ *              readers keep a valid mapping.
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void state_shm_close(void)
+{
+   if (g_shm == NULL)
+      return;
+
+   __atomic_store_n(&g_shm->pid, 0, __ATOMIC_RELEASE);
+   munmap(g_shm, sizeof(state_shm_t));
+   g_shm = NULL;
+}
+
+
+/**********************************************************
+ * Function state_shm_set_default()
+ *
+ * Description: Set the serial number of the card which is
+ *              used when no serial number is given
+ *
+ * Parameters: serial (in) - serial number
+ *
+ * Return: none
+ *********************************************************/
+void state_shm_set_default(const char *serial)
+{
+   int i;
+
+   if (g_shm == NULL)
+      return;
+
+   if ((i = find_card(serial)) >= 0)
+      __atomic_store_n(&g_shm->default_card, i, __ATOMIC_RELEASE);
+}
+
+
+/**********************************************************
+ * Function state_shm_update()
+ *
+ * Description: Publish the relay states of a card. The
+ *              version and timestamp are only changed if
+ *              the states differ from the published ones.
+ *
+ * Parameters: serial (in)     - card serial number, NULL or
+ *                               empty for the default card
+ *             num_relays (in) - number of relays on the card
+ *             states (in)     - relay states
+ *
+ * Return: none
+ *********************************************************/
+void state_shm_update(const char *serial, uint8_t num_relays, uint16_t states)
+{
+   state_shm_card_t *card;
+   int i;
+
+   if (g_shm == NULL || (i = find_card(serial)) < 0)
+      return;
+
+   card = &g_shm->cards[i];
+   if (card->num_relays == num_relays && card->states == states && card->version > 0)
+      return;
+
+   /* Seqlock write: odd sequence number while the entry changes */
+   STORE(&card->seq, card->seq+1);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+
+   STORE(&card->num_relays, num_relays);
+   STORE(&card->states, states);
+   STORE(&card->version, card->version+1);
+   STORE(&card->timestamp_ns, realtime_ns());
+
+   __atomic_store_n(&card->seq, card->seq+1, __ATOMIC_RELEASE);
+}
+
+#endif
+
+
+/**********************************************************
+ * Function crelay_state_open()
+ *
+ * Description: Map the state segment of the daemon for
+ *              reading
+ *
+ * Parameters: name (in) - shared memory object name, NULL
+ *                         for the default name
+ *
+ * Return: segment pointer, NULL on failure
+ *********************************************************/
+const state_shm_t* crelay_state_open(const char *name)
+{
+   const state_shm_t *shm;
+   struct stat st;
+   int fd;
+
+   fd = shm_open(name ? name : STATE_SHM_NAME, O_RDONLY|O_CLOEXEC, 0);
+   if (fd < 0)
+      return NULL;
+
+   if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(state_shm_t))
+   {
+      close(fd);
+      return NULL;
+   }
+
+   shm = mmap(NULL, sizeof(state_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (shm == MAP_FAILED)
+      return NULL;
+
+   if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != STATE_SHM_MAGIC ||
+       shm->version != STATE_SHM_VERSION || shm->max_cards != STATE_SHM_MAX_CARDS)
+   {
+      munmap((void*)shm, sizeof(state_shm_t));
+      return NULL;
+   }
+   return shm;
+}
+
+
+/**********************************************************
+ * Function crelay_state_close()
+ *
+ * Description: Unmap the state segment
+ *
+ * Parameters: shm (in) - segment returned by
+ *                        crelay_state_open()
+ *
+ * Return: none
+ *********************************************************/
+void crelay_state_close(const state_shm_t *shm)
+{
+   if (shm != NULL)
+      munmap((void*)shm, sizeof(state_shm_t));
+}
+
+
+/**********************************************************
+ * Function crelay_state_read()
+ *
+ * Description: Get a consistent copy of the relay states of
+ *              a card, without any system call
+ *
+ * Parameters: shm (in)    - segment returned by
+ *                           crelay_state_open()
+ *             serial (in) - card serial number, NULL or
+ *                           empty for the default card
+ *             state (out) - card state
+ *
+ * Return:  0 - success
+ *         -1 - card not found, daemon not running or entry
+ *              not readable within STATE_SHM_READ_SPINS
+ *********************************************************/
+int crelay_state_read(const state_shm_t *shm, const char *serial, crelay_card_state_t *state)
+{
+   const state_shm_card_t *card;
+   uint32_t i, num, seq;
+   uint32_t spins = 0;
+
+   if (shm == NULL || __atomic_load_n(&shm->pid, __ATOMIC_ACQUIRE) == 0)
+      return -1;
+
+   num = __atomic_load_n(&shm->num_cards, __ATOMIC_ACQUIRE);
+   if (num > STATE_SHM_MAX_CARDS)
+      return -1;
+
+   if (serial == NULL || serial[0] == 0)
+   {
+      i = LOAD(&shm->default_card);
+      if (i >= num)
+         return -1;
+   }
+   else
+   {
+      for (i=0; i<num; i++)
+      {
+         if (!strncmp(shm->cards[i].serial, serial, STATE_SHM_SERIAL_LEN))
+            break;
+      }
+      if (i == num)
+         return -1;
+   }
+   card = &shm->cards[i];
+
+   /* Seqlock read: retry while the daemon updates the entry, but
+      give up if it stays odd, e.g. the daemon died in an update */
+   do
+   {
+      while ((seq = __atomic_load_n(&card->seq, __ATOMIC_ACQUIRE)) & 1)
+      {
+         if (++spins > STATE_SHM_READ_SPINS)
+            return -1;
+      }
+      state->num_relays   = LOAD(&card->num_relays);
+      state->states       = LOAD(&card->states);
+      state->version      = LOAD(&card->version);
+      state->timestamp_ns = LOAD(&card->timestamp_ns);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+   }
+   while (LOAD(&card->seq) != seq && ++spins <= STATE_SHM_READ_SPINS);
+
+   if (spins > STATE_SHM_READ_SPINS)
+      return -1;
+
+   memcpy(state->serial, card->serial, STATE_SHM_SERIAL_LEN);
+   state->serial[STATE_SHM_SERIAL_LEN-1] = 0;
+   return 0;
+}
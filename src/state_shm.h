@@ -0,0 +1,205 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Shared memory state segment
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the layout of the shared memory segment in which
+ *   the daemon publishes the relay states of all cards, and the
+ *   declaration of the writer (daemon) and reader (libcrelay) functions.
+ *
+ *   The segment is a POSIX shared memory object (/dev/shm/crelay-state by
+ *   default), created by the daemon with mode 0644. Local processes map it
+ *   read-only and get the current relay states with plain memory reads:
+ *   no system call, no socket round-trip and no USB transfer. The daemon
+ *   remains the only process accessing the relay cards.
+ *
+ *   Each card entry is protected by a sequence lock: the daemon increments
+ *   seq before and after updating the entry, so seq is odd while an update
+ *   is in progress. A reader copies the entry and retries if seq was odd
+ *   or has changed meanwhile.
+ *
+ *   Entries are only ever added, the index of a card does not change while
+ *   the segment exists (even across daemon restarts).
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef state_shm_h
+#define state_shm_h
+
+#include <stdint.h>
+
+#define STATE_SHM_NAME      "/crelay-state"
+#define STATE_SHM_MAGIC     0x594c5243  /* "CRLY" */
+#define STATE_SHM_VERSION   1
+#define STATE_SHM_MAX_CARDS 32
+#define STATE_SHM_SERIAL_LEN 32         /* same as MAX_SERIAL_LEN */
+#define STATE_SHM_READ_SPINS 100000     /* max. reader spins on an entry being updated */
+
+/* Card entry, one cache line */
+typedef struct
+{
+   uint32_t seq;                           /* sequence lock, odd during update */
+   uint8_t  num_relays;                    /* number of relays on the card */
+   uint8_t  reserved;
+   uint16_t states;                        /* relay states, bit 0 is relay 1 */
+   uint64_t version;                       /* number of state changes */
+   uint64_t timestamp_ns;                  /* CLOCK_REALTIME of the last change */
+   char     serial[STATE_SHM_SERIAL_LEN];  /* card serial number */
+   uint8_t  reserved2[8];
+}
+state_shm_card_t;
+
+typedef struct
+{
+   uint32_t magic;                         /* STATE_SHM_MAGIC */
+   uint16_t version;                       /* STATE_SHM_VERSION */
+   uint16_t max_cards;                     /* STATE_SHM_MAX_CARDS */
+   uint32_t num_cards;                     /* entries in use */
+   uint32_t default_card;                  /* entry used if no serial is given */
+   uint32_t pid;                           /* daemon process id, 0 if not running */
+   uint32_t reserved;
+   uint64_t start_time_ns;                 /* CLOCK_REALTIME of daemon start */
+   uint8_t  reserved2[32];
+   state_shm_card_t cards[STATE_SHM_MAX_CARDS];
+}
+state_shm_t;
+
+/* Relay states as returned to readers */
+typedef struct
+{
+   char     serial[STATE_SHM_SERIAL_LEN];
+   uint8_t  num_relays;
+   uint16_t states;
+   uint64_t version;
+   uint64_t timestamp_ns;
+}
+crelay_card_state_t;
+
+
+#ifndef BUILD_LIB
+
+/**********************************************************
+ * Function state_shm_init()
+ *
+ * Description: Create (or reuse) the shared memory segment
+ *              and mark the daemon as running
+ *
+ * Parameters: name (in) - shared memory object name
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int state_shm_init(const char *name);
+
+/**********************************************************
+ * Function state_shm_close()
+ *
+ * Description: Mark the daemon as not running and unmap
+ *              the segment. The segment is not removed, so
+ *              readers keep a valid mapping.
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void state_shm_close(void);
+
+/**********************************************************
+ * Function state_shm_set_default()
+ *
+ * Description: Set the serial number of the card which is
+ *              used when no serial number is given
+ *
+ * Parameters: serial (in) - serial number
+ *
+ * Return: none
+ *********************************************************/
+void state_shm_set_default(const char *serial);
+
+/**********************************************************
+ * Function state_shm_update()
+ *
+ * Description: Publish the relay states of a card. The
+ *              version and timestamp are only changed if
+ *              the states differ from the published ones.
+ *
+ * Parameters: serial (in)     - card serial number, NULL or
+ *                               empty for the default card
+ *             num_relays (in) - number of relays on the card
+ *             states (in)     - relay states
+ *
+ * Return: none
+ *********************************************************/
+void state_shm_update(const char *serial, uint8_t num_relays, uint16_t states);
+
+#endif
+
+
+/**********************************************************
+ * Function crelay_state_open()
+ *
+ * Description: Map the state segment of the daemon for
+ *              reading
+ *
+ * Parameters: name (in) - shared memory object name, NULL
+ *                         for the default name
+ *
+ * Return: segment pointer, NULL on failure
+ *********************************************************/
+const state_shm_t* crelay_state_open(const char *name);
+
+/**********************************************************
+ * Function crelay_state_close()
+ *
+ * Description: Unmap the state segment
+ *
+ * Parameters: shm (in) - segment returned by
+ *                        crelay_state_open()
+ *
+ * Return: none
+ *********************************************************/
+void crelay_state_close(const state_shm_t *shm);
+
+/**********************************************************
+ * Function crelay_state_read()
+ *
+ * Description: Get a consistent copy of the relay states of
+ *              a card, without any system call
+ *
+ * Parameters: shm (in)    - segment returned by
+ *                           crelay_state_open()
+ *             serial (in) - card serial number, NULL or
+ *                           empty for the default card
+ *             state (out) - card state
+ *
+ * Return:  0 - success
+ *         -1 - card not found, daemon not running or entry
+ *              not readable within STATE_SHM_READ_SPINS
+ *********************************************************/
+int crelay_state_read(const state_shm_t *shm, const char *serial, crelay_card_state_t *state);
+
+#endif
@@ -0,0 +1,225 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Timer wheel
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the implementation of the hashed timer wheel,
+ *   see timer_wheel.h.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+#include <stddef.h>
+#include <string.h>
+
+#include "timer_wheel.h"
+
+#define SLOT_MASK  (TIMER_WHEEL_SLOTS-1)
+#define NUM_WORDS  (TIMER_WHEEL_SLOTS/64)
+
+
+/**********************************************************
+ * Function timer_wheel_init()
+ *
+ * Description: Initialize an empty timer wheel
+ *
+ * Parameters: wheel (in)  - timer wheel
+ *             now_ms (in) - current time (CLOCK_MONOTONIC)
+ *
+ * Return: none
+ *********************************************************/
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now_ms)
+{
+   int i;
+
+   for (i=0; i<TIMER_WHEEL_SLOTS; i++)
+   {
+      wheel->slots[i].next = &wheel->slots[i];
+      wheel->slots[i].prev = &wheel->slots[i];
+   }
+   memset(wheel->occupied, 0, sizeof(wheel->occupied));
+   wheel->tick = now_ms/TIMER_WHEEL_TICK_MS;
+   wheel->count = 0;
+}
+
+
+/**********************************************************
+ * Function timer_wheel_del()
+ *
+ * Description: Stop a timer, nothing is done if it is not
+ *              running
+ *
+ * Parameters: wheel (in) - timer wheel
+ *             entry (in) - timer
+ *
+ * Return: none
+ *********************************************************/
+void timer_wheel_del(timer_wheel_t *wheel, timer_wheel_entry_t *entry)
+{
+   unsigned slot;
+
+   if (entry->prev == NULL) return;
+
+   entry->prev->next = entry->next;
+   entry->next->prev = entry->prev;
+   entry->next = NULL;
+   entry->prev = NULL;
+   wheel->count--;
+
+   slot = entry->expires & SLOT_MASK;
+   if (wheel->slots[slot].next == &wheel->slots[slot])
+      wheel->occupied[slot/64] &= ~(1ULL << (slot%64));
+}
+
+
+/**********************************************************
+ * Function timer_wheel_add()
+ *
+ * Description: Start a timer, a running timer is moved to
+ *              the new expiry time. The timer expires with
+ *              the first tick at or after expires_ms.
+ *
+ * Parameters: wheel (in)      - timer wheel
+ *             entry (in)      - timer, with prev set to NULL
+ *                               if it was never started
+ *             expires_ms (in) - expiry time (CLOCK_MONOTONIC)
+ *
+ * Return: none
+ *********************************************************/
+void timer_wheel_add(timer_wheel_t *wheel, timer_wheel_entry_t *entry, uint64_t expires_ms)
+{
+   timer_wheel_entry_t *head;
+   unsigned slot;
+
+   timer_wheel_del(wheel, entry);
+
+   /* Round up, a timer never expires early */
+   entry->expires = (expires_ms + TIMER_WHEEL_TICK_MS-1)/TIMER_WHEEL_TICK_MS;
+   if (entry->expires <= wheel->tick)
+      entry->expires = wheel->tick+1;
+
+   slot = entry->expires & SLOT_MASK;
+   head = &wheel->slots[slot];
+   entry->next = head;
+   entry->prev = head->prev;
+   head->prev->next = entry;
+   head->prev = entry;
+   wheel->occupied[slot/64] |= 1ULL << (slot%64);
+   wheel->count++;
+}
+
+
+/**********************************************************
+ * Function timer_wheel_timeout()
+ *
+ * Description: Get the time until the next slot with
+ *              timers is due
+ *
+ * Parameters: wheel (in)  - timer wheel
+ *             now_ms (in) - current time (CLOCK_MONOTONIC)
+ *
+ * Return: timeout in ms for poll(), -1 if no timer running
+ *********************************************************/
+int timer_wheel_timeout(const timer_wheel_t *wheel, uint64_t now_ms)
+{
+   unsigned start, word, i, slot;
+   uint64_t bits, due_ms;
+
+   if (wheel->count == 0) return -1;
+
+   /* Find the next occupied slot after the last tick, the first word
+    * is looked at twice: for the slots from start and, after going
+    * round, for the slots before start */
+   start = (wheel->tick+1) & SLOT_MASK;
+   for (i=0; i<=NUM_WORDS; i++)
+   {
+      word = (start/64 + i) % NUM_WORDS;
+      bits = wheel->occupied[word];
+      if (i == 0)
+         bits &= ~0ULL << (start%64);
+      else if (i == NUM_WORDS)
+         bits &= ~(~0ULL << (start%64));
+      if (bits == 0) continue;
+
+      slot = word*64 + __builtin_ctzll(bits);
+      due_ms = (wheel->tick+1 + ((slot-start) & SLOT_MASK)) * TIMER_WHEEL_TICK_MS;
+      return (due_ms > now_ms) ? (int)(due_ms-now_ms) : 0;
+   }
+   return -1;
+}
+
+
+/**********************************************************
+ * Function timer_wheel_expire()
+ *
+ * Description: Advance the wheel to the current time and
+ *              stop the timers which have expired
+ *
+ * Parameters: wheel (in)  - timer wheel
+ *             now_ms (in) - current time (CLOCK_MONOTONIC)
+ *
+ * Return: list of the expired timers linked by next,
+ *         NULL if none
+ *********************************************************/
+timer_wheel_entry_t* timer_wheel_expire(timer_wheel_t *wheel, uint64_t now_ms)
+{
+   timer_wheel_entry_t *expired = NULL, *entry, *next, *head;
+   uint64_t now = now_ms/TIMER_WHEEL_TICK_MS;
+   uint64_t tick;
+   unsigned slot;
+
+   if (now <= wheel->tick) return NULL;
+
+   /* After more than one turn every slot is looked at once */
+   tick = (now - wheel->tick > TIMER_WHEEL_SLOTS) ? now-TIMER_WHEEL_SLOTS+1 : wheel->tick+1;
+   wheel->tick = now;
+   if (wheel->count == 0) return NULL;
+
+   for (; tick <= now; tick++)
+   {
+      slot = tick & SLOT_MASK;
+      if (!(wheel->occupied[slot/64] & (1ULL << (slot%64)))) continue;
+
+      head = &wheel->slots[slot];
+      for (entry = head->next; entry != head; entry = next)
+      {
+         next = entry->next;
+         if (entry->expires > now) continue;   /* a later turn */
+
+         entry->prev->next = entry->next;
+         entry->next->prev = entry->prev;
+         entry->prev = NULL;
+         entry->next = expired;
+         expired = entry;
+         wheel->count--;
+      }
+      if (head->next == head)
+         wheel->occupied[slot/64] &= ~(1ULL << (slot%64));
+   }
+
+   return expired;
+}
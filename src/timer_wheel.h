@@ -0,0 +1,140 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Timer wheel
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of a hashed timer wheel, which
+ *   keeps a large number of timers with O(1) cost for adding, moving
+ *   (renewing) and removing a timer and for expiring it.
+ *
+ *   The time is divided into ticks of TIMER_WHEEL_TICK_MS. A timer is
+ *   kept in the slot of the tick it expires in, modulo the number of
+ *   slots; timers more than one turn of the wheel ahead stay in their
+ *   slot until the wheel has come round often enough. A bitmap of the
+ *   slots which hold timers gives the time until the next slot to be
+ *   looked at, so an idle wheel does not cause wakeups.
+ *
+ *   The timers are embedded in the structures of the caller, the wheel
+ *   does not allocate memory.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef timer_wheel_h
+#define timer_wheel_h
+
+#include <stdint.h>
+
+#define TIMER_WHEEL_TICK_MS  10
+#define TIMER_WHEEL_SLOTS    4096   /* power of 2, one turn is 40.96 s */
+
+typedef struct timer_wheel_entry_s
+{
+   struct timer_wheel_entry_s *next;
+   struct timer_wheel_entry_s *prev;  /* NULL if the timer is not running */
+   uint64_t expires;                  /* tick */
+}
+timer_wheel_entry_t;
+
+typedef struct
+{
+   timer_wheel_entry_t slots[TIMER_WHEEL_SLOTS];     /* list heads */
+   uint64_t occupied[TIMER_WHEEL_SLOTS/64];          /* slots with timers */
+   uint64_t tick;                                    /* last tick expired */
+   uint32_t count;                                   /* running timers */
+}
+timer_wheel_t;
+
+
+/**********************************************************
+ * Function timer_wheel_init()
+ *
+ * Description: Initialize an empty timer wheel
+ *
+ * Parameters: wheel (in)  - timer wheel
+ *             now_ms (in) - current time (CLOCK_MONOTONIC)
+ *
+ * Return: none
+ *********************************************************/
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now_ms);
+
+/**********************************************************
+ * Function timer_wheel_add()
+ *
+ * Description: Start a timer, a running timer is moved to
+ *              the new expiry time. The timer expires with
+ *              the first tick at or after expires_ms.
+ *
+ * Parameters: wheel (in)      - timer wheel
+ *             entry (in)      - timer, with prev set to NULL
+ *                               if it was never started
+ *             expires_ms (in) - expiry time (CLOCK_MONOTONIC)
+ *
+ * Return: none
+ *********************************************************/
+void timer_wheel_add(timer_wheel_t *wheel, timer_wheel_entry_t *entry, uint64_t expires_ms);
+
+/**********************************************************
+ * Function timer_wheel_del()
+ *
+ * Description: Stop a timer, nothing is done if it is not
+ *              running
+ *
+ * Parameters: wheel (in) - timer wheel
+ *             entry (in) - timer
+ *
+ * Return: none
+ *********************************************************/
+void timer_wheel_del(timer_wheel_t *wheel, timer_wheel_entry_t *entry);
+
+/**********************************************************
+ * Function timer_wheel_timeout()
+ *
+ * Description: Get the time until the next slot with
+ *              timers is due
+ *
+ * Parameters: wheel (in)  - timer wheel
+ *             now_ms (in) - current time (CLOCK_MONOTONIC)
+ *
+ * Return: timeout in ms for poll(), -1 if no timer running
+ *********************************************************/
+int timer_wheel_timeout(const timer_wheel_t *wheel, uint64_t now_ms);
+
+/**********************************************************
+ * Function timer_wheel_expire()
+ *
+ * Description: Advance the wheel to the current time and
+ *              stop the timers which have expired
+ *
+ * Parameters: wheel (in)  - timer wheel
+ *             now_ms (in) - current time (CLOCK_MONOTONIC)
+ *
+ * Return: list of the expired timers linked by next,
+ *         NULL if none
+ *********************************************************/
+timer_wheel_entry_t* timer_wheel_expire(timer_wheel_t *wheel, uint64_t now_ms);
+
+#endif
@@ -0,0 +1,68 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Static tracepoints
+ *
+ * Description:
+ *   Wrapper macros for the USDT (user statically defined tracing) probes
+ *   in the hot paths of crelay. The probes are compiled in when the
+ *   systemtap sys/sdt.h header is available (HAVE_SDT defined), otherwise
+ *   they expand to nothing. A disabled probe costs a single nop
+ *   instruction, so they are left in production builds.
+ *
+ *   The probes are listed with:
+ *     perf list 'sdt_crelay:*'      (after "perf buildid-cache --add crelay")
+ *     bpftrace -l 'usdt:/usr/local/bin/crelay:*'
+ *
+ *   Double underscores in the probe names are shown as dashes by the
+ *   tracing tools, e.g. drv__get__done becomes drv-get-done.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef trace_h
+#define trace_h
+
+#ifdef HAVE_SDT
+
+#include <sys/sdt.h>
+
+#define CRELAY_TRACE(probe)                 DTRACE_PROBE(crelay, probe)
+#define CRELAY_TRACE1(probe, a1)            DTRACE_PROBE1(crelay, probe, a1)
+#define CRELAY_TRACE2(probe, a1, a2)        DTRACE_PROBE2(crelay, probe, a1, a2)
+#define CRELAY_TRACE3(probe, a1, a2, a3)    DTRACE_PROBE3(crelay, probe, a1, a2, a3)
+#define CRELAY_TRACE4(probe, a1, a2, a3, a4) DTRACE_PROBE4(crelay, probe, a1, a2, a3, a4)
+
+#else
+
+/* Arguments are referenced but never evaluated */
+#define CRELAY_TRACE(probe)                 do {} while (0)
+#define CRELAY_TRACE1(probe, a1)            do { if (0) { (void)(a1); } } while (0)
+#define CRELAY_TRACE2(probe, a1, a2)        do { if (0) { (void)(a1); (void)(a2); } } while (0)
+#define CRELAY_TRACE3(probe, a1, a2, a3)    do { if (0) { (void)(a1); (void)(a2); (void)(a3); } } while (0)
+#define CRELAY_TRACE4(probe, a1, a2, a3, a4) do { if (0) { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,864 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Unix domain socket API
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the binary control API for local clients on a
+ *   unix domain socket of type SOCK_SEQPACKET. Compared to the HTTP API
+ *   it avoids the TCP connection setup and the text formatting and
+ *   parsing on every command.
+ *
+ *   Access is controlled with the credentials of the connecting process
+ *   (SO_PEERCRED): root, the user running the daemon and the configured
+ *   users and groups are allowed to connect.
+ *
+ *   The requests are processed in the main loop of the daemon, which
+ *   polls the listening socket and all connected clients. Pulses do not
+ *   block the main loop, they are ended by a timer which is checked on
+ *   every loop iteration.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "data_types.h"
+#include "relay_drv.h"
+#include "unix_api.h"
+#include "history.h"
+#include "crelay.h"
+#include "emergency.h"
+#include "lease.h"
+#include "trace.h"
+
+#define MAX_PULSES   32
+#define MAX_ALLOWED  16
+
+extern config_t config;
+
+typedef struct
+{
+   int     fd;
+   uid_t   uid;
+   uint8_t subscribed;
+} client_t;
+
+/* Running pulse, the relays in mask are restored to their
+ * previous states at the deadline */
+typedef struct
+{
+   uint8_t  active;
+   char     serial[MAX_SERIAL_LEN];
+   uint16_t mask;
+   uint16_t restore;
+   uint64_t deadline_ms;  /* CLOCK_MONOTONIC */
+   history_source_t source;  /* recorded for the end of the pulse */
+   uint32_t id;
+} pulse_t;
+
+static int      listen_fd = -1;
+static char     socket_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static client_t clients[UNIX_API_MAX_CLIENTS];
+static int      num_clients = 0;
+static pulse_t  pulses[MAX_PULSES];
+
+static uid_t    allowed_uids[MAX_ALLOWED];
+static int      num_allowed_uids = 0;
+static gid_t    allowed_gids[MAX_ALLOWED];
+static int      num_allowed_gids = 0;
+
+
+static uint64_t now_ms(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+
+/**********************************************************
+ * Internal function parse_id_list()
+ *
+ * Description: Parse a comma separated list of user or
+ *              group names (or numeric ids)
+ *
+ * Parameters: list (in)   - list string [optional]
+ *             groups (in) - 1 for groups, 0 for users
+ *             ids (out)   - array of ids
+ *
+ * Return: number of ids found
+ *********************************************************/
+static int parse_id_list(const char *list, int groups, unsigned int *ids)
+{
+   char *copy, *tok, *save, *end;
+   struct passwd *pw;
+   struct group *gr;
+   unsigned long id;
+   int num = 0;
+
+   if (list == NULL) return 0;
+
+   copy = strdup(list);
+   for (tok = strtok_r(copy, ", ", &save); tok != NULL && num < MAX_ALLOWED;
+        tok = strtok_r(NULL, ", ", &save))
+   {
+      id = strtoul(tok, &end, 10);
+      if (*end == 0)
+      {
+         ids[num++] = id;
+      }
+      else if (!groups && (pw = getpwnam(tok)) != NULL)
+      {
+         ids[num++] = pw->pw_uid;
+      }
+      else if (groups && (gr = getgrnam(tok)) != NULL)
+      {
+         ids[num++] = gr->gr_gid;
+      }
+      else
+      {
+         syslog(LOG_DAEMON | LOG_WARNING, "Unix socket: unknown %s %s\n", groups ? "group" : "user", tok);
+      }
+   }
+   free(copy);
+
+   return num;
+}
+
+
+/**********************************************************
+ * Internal function peer_allowed()
+ *
+ * Description: Check the credentials of a connecting
+ *              process against the allowed users and groups
+ *
+ * Parameters: cred (in) - peer credentials
+ *
+ * Return: 1 if allowed, 0 otherwise
+ *********************************************************/
+static int peer_allowed(const struct ucred *cred)
+{
+   struct passwd *pw;
+   gid_t groups[64];
+   int ngroups = sizeof(groups)/sizeof(groups[0]);
+   int i, j;
+
+   if (cred->uid == 0 || cred->uid == geteuid())
+      return 1;
+
+   for (i=0; i<num_allowed_uids; i++)
+   {
+      if (cred->uid == allowed_uids[i]) return 1;
+   }
+
+   if (num_allowed_gids == 0)
+      return 0;
+
+   /* Check the primary and the supplementary groups of the user */
+   for (i=0; i<num_allowed_gids; i++)
+   {
+      if (cred->gid == allowed_gids[i]) return 1;
+   }
+   if ((pw = getpwuid(cred->uid)) != NULL &&
+       getgrouplist(pw->pw_name, pw->pw_gid, groups, &ngroups) >= 0)
+   {
+      for (i=0; i<ngroups; i++)
+      {
+         for (j=0; j<num_allowed_gids; j++)
+         {
+            if (groups[i] == allowed_gids[j]) return 1;
+         }
+      }
+   }
+
+   return 0;
+}
+
+
+static void client_accept(void)
+{
+   struct ucred cred;
+   socklen_t len = sizeof(cred);
+   int fd;
+
+   fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+   if (fd < 0) return;
+
+   if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+   {
+      syslog(LOG_DAEMON | LOG_WARNING, "Unix socket: cannot get peer credentials: %s\n", strerror(errno));
+      close(fd);
+      return;
+   }
+
+   if (!peer_allowed(&cred))
+   {
+      syslog(LOG_DAEMON | LOG_WARNING, "Unix socket: connection from pid %d (uid %d) refused\n",
+             (int)cred.pid, (int)cred.uid);
+      close(fd);
+      return;
+   }
+
+   if (num_clients >= UNIX_API_MAX_CLIENTS)
+   {
+      syslog(LOG_DAEMON | LOG_WARNING, "Unix socket: too many clients, connection from pid %d refused\n",
+             (int)cred.pid);
+      close(fd);
+      return;
+   }
+
+   clients[num_clients].fd = fd;
+   clients[num_clients].uid = cred.uid;
+   clients[num_clients].subscribed = 0;
+   num_clients++;
+}
+
+
+static void client_remove(int idx)
+{
+   close(clients[idx].fd);
+   clients[idx] = clients[--num_clients];
+}
+
+
+/**********************************************************
+ * Internal function select_card()
+ *
+ * Description: Detect the card addressed by a request
+ *
+ * Parameters: serial (in)      - serial number, empty for
+ *                                the first card
+ *             portname (out)   - communication port
+ *             num_relays (out) - number of relays
+ *
+ * Return: 0 on success, -ENODEV if the card is not found,
+ *         -ETIMEDOUT if it did not answer in time,
+ *         -ENOLINK if its circuit is open
+ *********************************************************/
+static int select_card(char *serial, char *portname, uint8_t *num_relays)
+{
+   int rc;
+   
+   *num_relays = FIRST_RELAY;
+   if ((rc = crelay_detect_relay_card(portname, num_relays, serial[0] ? serial : NULL, NULL)) < 0)
+      return (rc == -ETIMEDOUT || rc == -ENOLINK) ? rc : -ENODEV;
+   return 0;
+}
+
+
+/**********************************************************
+ * Internal function io_error()
+ *
+ * Description: Map a driver error to the status of a
+ *              response
+ *
+ * Return: -ETIMEDOUT if the card did not answer in time,
+ *         -ENOLINK if its circuit is open,
+ *         -EBUSY if it plays a waveform,
+ *         -EPERM if an interlock rule would be broken,
+ *         -EIO otherwise
+ *********************************************************/
+static int io_error(int rc)
+{
+   return (rc == -ETIMEDOUT || rc == -ENOLINK || rc == -EBUSY || rc == -EPERM) ? rc : -EIO;
+}
+
+
+/**********************************************************
+ * Function unix_api_start_pulse()
+ *
+ * Description: Toggle relays and register the timer which
+ *              switches them back, the pulse is ended by
+ *              unix_api_timers() from the main loop
+ *
+ * Parameters: portname (in)    - communication port
+ *             serial (in)      - serial number, "" for the
+ *                                default card
+ *             mask (in)        - relays to toggle
+ *             duration_ms (in) - pulse duration, 0 for the
+ *                                configured duration
+ *             source (in)      - history source of the end
+ *                                of the pulse
+ *             id (in)          - source specific id
+ *             states (out)     - relay states after the
+ *                                toggle
+ *
+ * Return: 0 on success, negative errno value otherwise
+ *         (-EBUSY if too many pulses are running)
+ *********************************************************/
+int unix_api_start_pulse(char *portname, const char *serial, uint16_t mask, uint32_t duration_ms,
+                         history_source_t source, uint32_t id, uint16_t *states)
+{
+   pulse_t *pulse = NULL;
+   uint16_t current;
+   int i, rc;
+
+   for (i=0; i<MAX_PULSES; i++)
+   {
+      if (!pulses[i].active)
+      {
+         pulse = &pulses[i];
+         break;
+      }
+   }
+   if (pulse == NULL)
+      return -EBUSY;
+
+   if ((rc = crelay_get_relay_mask(portname, &current, serial[0] ? (char*)serial : NULL)) < 0)
+      return io_error(rc);
+   if ((rc = crelay_set_relay_mask(portname, mask, ~current, serial[0] ? (char*)serial : NULL)) < 0)
+      return io_error(rc);
+
+   if (duration_ms == 0)
+      duration_ms = config.pulse_duration*1000;
+
+   pulse->active = 1;
+   strcpy(pulse->serial, serial);
+   pulse->mask = mask;
+   pulse->restore = current & mask;
+   pulse->deadline_ms = now_ms() + duration_ms;
+   pulse->source = source;
+   pulse->id = id;
+
+   *states = (current & ~mask) | (~current & mask);
+   return 0;
+}
+
+
+/**********************************************************
+ * Internal function process_request()
+ *
+ * Description: Execute a request and send the response
+ *
+ * Parameters: client (in) - client which sent the request
+ *             req (in)    - request message
+ *
+ * Return: none
+ *********************************************************/
+static void process_request(client_t *client, unix_api_request_t *req)
+{
+   unix_api_response_t resp;
+   char portname[MAX_COM_PORT_NAME_LEN];
+   uint8_t num_relays = 0;
+   uint16_t states = 0, journal = 0;
+   int changed = 0, renewed = 0;
+   int rc;
+
+   req->serial[MAX_SERIAL_LEN-1] = 0;
+   CRELAY_TRACE3(unix__request__start, req->cmd, req->mask, req->states);
+
+   if (req->version != UNIX_API_VERSION)
+   {
+      rc = -EPROTO;
+   }
+   else if (req->cmd == UNIX_API_EMERGENCY_OFF)
+   {
+      char by[EMERGENCY_BY_LEN];
+
+      /* All cards, recorded by emergency_off() */
+      snprintf(by, sizeof(by), "unix uid %u", client->uid);
+      rc = emergency_off(by);
+      rc = (rc == 0 || rc == -ENODEV) ? rc : -EIO;
+   }
+   else if (req->cmd == UNIX_API_LEASE &&
+            (rc = lease_renew(req->serial, req->mask, req->states, req->duration_ms, &num_relays)) != -ENOENT)
+   {
+      /* Renewal (or invalid duration), the card is not accessed */
+      states = req->states & req->mask;
+      renewed = 1;
+   }
+   else if ((rc = select_card(req->serial, portname, &num_relays)) == 0)
+   {
+      switch (req->cmd)
+      {
+         case UNIX_API_GET_MASK:
+         case UNIX_API_SUBSCRIBE:
+            if ((rc = crelay_get_relay_mask(portname, &states, req->serial[0] ? req->serial : NULL)) < 0)
+               rc = io_error(rc);
+            if (req->cmd == UNIX_API_SUBSCRIBE)
+               client->subscribed = 1;
+            break;
+
+         case UNIX_API_SET_MASK:
+            if (req->mask == 0 || (req->mask >> num_relays) != 0)
+            {
+               rc = -EINVAL;
+            }
+            else if ((rc = crelay_set_relay_mask(portname, req->mask, req->states, req->serial[0] ? req->serial : NULL)) < 0 ||
+                     (rc = crelay_get_relay_mask(portname, &states, req->serial[0] ? req->serial : NULL)) < 0)
+            {
+               rc = io_error(rc);
+            }
+            else
+            {
+               journal = req->mask;
+               lease_release(req->serial, req->mask);
+            }
+            changed = 1;
+            break;
+
+         case UNIX_API_LEASE:
+            rc = lease_set(portname, req->serial, num_relays, req->mask, req->states, req->duration_ms,
+                           HISTORY_SRC_UNIX, client->uid, &states);
+            if (rc < 0 && rc != -EINVAL && rc != -ENOSPC)
+               rc = io_error(rc);
+            changed = 1;
+            break;
+
+         case UNIX_API_PULSE:
+            if (req->mask == 0 || (req->mask >> num_relays) != 0)
+            {
+               rc = -EINVAL;
+               break;
+            }
+            rc = unix_api_start_pulse(portname, req->serial, req->mask, req->duration_ms,
+                                      HISTORY_SRC_PULSE, client->uid, &states);
+            changed = (rc == 0);
+            break;
+
+         default:
+            rc = -EINVAL;
+            break;
+      }
+   }
+
+   memset(&resp, 0, sizeof(resp));
+   resp.version = UNIX_API_VERSION;
+   resp.type = UNIX_API_RESPONSE;
+   resp.seq = req->seq;
+   resp.status = rc;
+   resp.num_relays = num_relays;
+   resp.states = states;
+   strcpy(resp.serial, req->serial);
+   send(client->fd, &resp, sizeof(resp), MSG_DONTWAIT | MSG_NOSIGNAL);
+   CRELAY_TRACE2(unix__request__done, req->cmd, rc);
+
+   if (rc == 0 && req->cmd != UNIX_API_EMERGENCY_OFF && !renewed)
+      publish_states(req->serial, num_relays, journal, states, changed ? HISTORY_SRC_UNIX : HISTORY_SRC_EXTERNAL, client->uid);
+}
+
+
+/**********************************************************
+ * Function unix_api_init()
+ *
+ * Description: Create the unix domain socket and start
+ *              listening for local clients
+ *
+ * Parameters: path (in)   - socket path
+ *             users (in)  - comma separated list of user
+ *                           names or ids allowed to connect
+ *             groups (in) - comma separated list of group
+ *                           names or ids allowed to connect
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int unix_api_init(const char *path, const char *users, const char *groups)
+{
+   struct sockaddr_un sun;
+   int fd;
+
+   if (strlen(path) >= sizeof(sun.sun_path))
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Unix socket path too long: %s\n", path);
+      return -1;
+   }
+   memset(&sun, 0, sizeof(sun));
+   sun.sun_family = AF_UNIX;
+   strcpy(sun.sun_path, path);
+
+   fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+   if (fd < 0)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to create unix socket: %s\n", strerror(errno));
+      return -1;
+   }
+
+   /* Remove a stale socket, unless another daemon is still using it */
+   if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == 0)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Unix socket %s is in use by another process\n", path);
+      close(fd);
+      return -1;
+   }
+   unlink(path);
+
+   if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to bind unix socket %s: %s\n", path, strerror(errno));
+      close(fd);
+      return -1;
+   }
+
+   /* Everybody may connect, access is checked with the peer credentials */
+   chmod(path, 0666);
+
+   if (listen(fd, 16) != 0)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to listen on unix socket %s: %s\n", path, strerror(errno));
+      close(fd);
+      unlink(path);
+      return -1;
+   }
+
+   num_allowed_uids = parse_id_list(users, 0, allowed_uids);
+   num_allowed_gids = parse_id_list(groups, 1, allowed_gids);
+
+   listen_fd = fd;
+   strcpy(socket_path, path);
+   syslog(LOG_DAEMON | LOG_NOTICE, "Unix socket API listening on %s\n", path);
+
+   return 0;
+}
+
+
+/**********************************************************
+ * Function unix_api_close()
+ *
+ * Description: Close all connections and remove the socket
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void unix_api_close(void)
+{
+   while (num_clients > 0)
+   {
+      client_remove(0);
+   }
+   if (listen_fd >= 0)
+   {
+      close(listen_fd);
+      unlink(socket_path);
+      listen_fd = -1;
+   }
+}
+
+
+/**********************************************************
+ * Function unix_api_pollfds()
+ *
+ * Description: Fill in the descriptors of the listening
+ *              socket and the connected clients
+ *
+ * Parameters: fds (out) - poll descriptor array
+ *             max (in)  - size of array
+ *
+ * Return: number of descriptors filled in
+ *********************************************************/
+int unix_api_pollfds(struct pollfd *fds, int max)
+{
+   int i, n = 0;
+
+   if (listen_fd < 0 || max < 1)
+      return 0;
+
+   fds[n].fd = listen_fd;
+   fds[n].events = POLLIN;
+   n++;
+   for (i=0; i<num_clients && n<max; i++)
+   {
+      fds[n].fd = clients[i].fd;
+      fds[n].events = POLLIN;
+      n++;
+   }
+
+   return n;
+}
+
+
+/**********************************************************
+ * Function unix_api_process()
+ *
+ * Description: Accept new clients and process the requests
+ *              signaled by poll()
+ *
+ * Parameters: fds (in) - descriptors filled in by
+ *                        unix_api_pollfds()
+ *             num (in) - number of descriptors
+ *
+ * Return: none
+ *********************************************************/
+void unix_api_process(struct pollfd *fds, int num)
+{
+   unix_api_request_t req;
+   ssize_t len;
+   int i, j;
+
+   /* Clients first, the client table changes on accept */
+   for (i=1; i<num; i++)
+   {
+      if (fds[i].revents == 0) continue;
+
+      for (j=0; j<num_clients; j++)
+      {
+         if (clients[j].fd == fds[i].fd) break;
+      }
+      if (j == num_clients) continue;
+
+      len = recv(clients[j].fd, &req, sizeof(req), MSG_DONTWAIT);
+      if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR))
+      {
+         client_remove(j);
+      }
+      else if (len == sizeof(req))
+      {
+         process_request(&clients[j], &req);
+      }
+      else if (len > 0)
+      {
+         /* Answer malformed requests, the sequence number may be unusable */
+         unix_api_response_t resp;
+
+         memset(&resp, 0, sizeof(resp));
+         resp.version = UNIX_API_VERSION;
+         resp.type = UNIX_API_RESPONSE;
+         resp.status = -EINVAL;
+         send(clients[j].fd, &resp, sizeof(resp), MSG_DONTWAIT | MSG_NOSIGNAL);
+      }
+   }
+
+   if (num > 0 && fds[0].revents & POLLIN)
+   {
+      client_accept();
+   }
+}
+
+
+/**********************************************************
+ * Function unix_api_timeout()
+ *
+ * Description: Get the time until the next running pulse
+ *              has to be ended
+ *
+ * Parameters: none
+ *
+ * Return: timeout in ms for poll(), -1 if no pulse running
+ *********************************************************/
+int unix_api_timeout(void)
+{
+   uint64_t now = now_ms();
+   int64_t timeout = -1;
+   int i;
+
+   for (i=0; i<MAX_PULSES; i++)
+   {
+      if (!pulses[i].active) continue;
+      if (pulses[i].deadline_ms <= now) return 0;
+      if (timeout < 0 || pulses[i].deadline_ms - now < timeout)
+         timeout = pulses[i].deadline_ms - now;
+   }
+
+   return (int)timeout;
+}
+
+
+/**********************************************************
+ * Function unix_api_timers()
+ *
+ * Description: End the pulses which are due
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void unix_api_timers(void)
+{
+   char portname[MAX_COM_PORT_NAME_LEN];
+   uint8_t num_relays;
+   uint16_t states;
+   uint64_t now = now_ms();
+   pulse_t *pulse;
+   char *serial;
+   int i;
+
+   for (i=0; i<MAX_PULSES; i++)
+   {
+      pulse = &pulses[i];
+      if (!pulse->active || pulse->deadline_ms > now) continue;
+
+      pulse->active = 0;
+      serial = pulse->serial[0] ? pulse->serial : NULL;
+      if (select_card(pulse->serial, portname, &num_relays) < 0 ||
+          crelay_set_relay_mask(portname, pulse->mask, pulse->restore, serial) < 0 ||
+          crelay_get_relay_mask(portname, &states, serial) < 0)
+      {
+         syslog(LOG_DAEMON | LOG_ERR, "Failed to end pulse on card %s\n", pulse->serial);
+         continue;
+      }
+      publish_states(pulse->serial, num_relays, 0, states, pulse->source, pulse->id);
+   }
+}
+
+
+/**********************************************************
+ * Function unix_api_cancel_pulses()
+ *
+ * Description: Drop the running pulses, the relays are not
+ *              switched back
+ *
+ * Parameters: none
+ *
+ * Return: number of pulses dropped
+ *********************************************************/
+int unix_api_cancel_pulses(void)
+{
+   int i, n = 0;
+
+   for (i=0; i<MAX_PULSES; i++)
+   {
+      if (pulses[i].active)
+      {
+         pulses[i].active = 0;
+         n++;
+      }
+   }
+   return n;
+}
+
+
+/**********************************************************
+ * Function unix_api_notify()
+ *
+ * Description: Send a state change event to all subscribed
+ *              clients. Clients which do not read their
+ *              events in time lose them.
+ *
+ * Parameters: serial (in)     - card serial number [optional]
+ *             num_relays (in) - number of relays on the card
+ *             states (in)     - new relay states
+ *
+ * Return: none
+ *********************************************************/
+void unix_api_notify(const char *serial, uint8_t num_relays, uint16_t states)
+{
+   unix_api_response_t ev;
+   int i;
+
+   memset(&ev, 0, sizeof(ev));
+   ev.version = UNIX_API_VERSION;
+   ev.type = UNIX_API_EVENT;
+   ev.num_relays = num_relays;
+   ev.states = states;
+   if (serial != NULL)
+      snprintf(ev.serial, sizeof(ev.serial), "%s", serial);
+
+   for (i=0; i<num_clients; i++)
+   {
+      if (clients[i].subscribed)
+         send(clients[i].fd, &ev, sizeof(ev), MSG_DONTWAIT | MSG_NOSIGNAL);
+   }
+}
+
+
+/**********************************************************
+ * Function unix_api_connect()
+ *
+ * Description: Connect to the unix socket of a running
+ *              daemon
+ *
+ * Parameters: path (in) - socket path
+ *
+ * Return: socket descriptor, negative errno value on error
+ *         (-ENOENT or -ECONNREFUSED if no daemon is running)
+ *********************************************************/
+int unix_api_connect(const char *path)
+{
+   struct sockaddr_un sun;
+   struct timeval tv = { UNIX_API_TIMEOUT, 0 };
+   int fd;
+
+   if (strlen(path) >= sizeof(sun.sun_path))
+      return -ENAMETOOLONG;
+   memset(&sun, 0, sizeof(sun));
+   sun.sun_family = AF_UNIX;
+   strcpy(sun.sun_path, path);
+
+   fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+   if (fd < 0)
+      return -errno;
+
+   if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0)
+   {
+      int err = errno;
+      close(fd);
+      return -err;
+   }
+   setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+   return fd;
+}
+
+
+/**********************************************************
+ * Function unix_api_request()
+ *
+ * Description: Send a request to the daemon and wait for
+ *              its response. Events received in the
+ *              meantime are discarded.
+ *
+ * Parameters: fd (in)     - socket descriptor
+ *             req (in)    - request message, version is
+ *                           filled in
+ *             resp (out)  - response message
+ *
+ * Return:  0 - success, result in resp->status
+ *         -1 - communication with the daemon failed
+ *********************************************************/
+int unix_api_request(int fd, unix_api_request_t *req, unix_api_response_t *resp)
+{
+   ssize_t len;
+
+   req->version = UNIX_API_VERSION;
+   if (send(fd, req, sizeof(*req), MSG_NOSIGNAL) != sizeof(*req))
+      return -1;
+
+   do
+   {
+      len = recv(fd, resp, sizeof(*resp), 0);
+      if (len != sizeof(*resp))
+         return -1;
+   }
+   while (resp->type != UNIX_API_RESPONSE || resp->seq != req->seq);
+
+   return 0;
+}
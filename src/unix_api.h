@@ -0,0 +1,261 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Unix domain socket API
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the definition of the binary protocol used by
+ *   local clients on the unix domain socket of the daemon, and the
+ *   declaration of the server and client functions.
+ *
+ *   The socket is of type SOCK_SEQPACKET, every request and response is
+ *   sent as a single message with a fixed size structure in host byte
+ *   order. Each request is answered by exactly one response carrying the
+ *   sequence number of the request. After a SUBSCRIBE request, an event
+ *   message is sent to the client whenever relay states are changed
+ *   through the daemon.
+ *
+ *   Relay states are passed as bitmaps, bit 0 corresponds to relay 1.
+ *   A LEASE request which only renews leases does not access the card,
+ *   its response contains the states of the relays in mask only.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef unix_api_h
+#define unix_api_h
+
+#include <stdint.h>
+#include <poll.h>
+
+#include "relay_drv.h"
+#include "history.h"
+
+#define UNIX_API_SOCKET_PATH "/run/crelay.sock"
+#define UNIX_API_VERSION     1
+#define UNIX_API_MAX_CLIENTS 32
+#define UNIX_API_MAX_FDS     (UNIX_API_MAX_CLIENTS+1)  /* clients and listening socket */
+#define UNIX_API_TIMEOUT     10  /* s, max. time a client waits for a response */
+
+/* Request commands */
+typedef enum
+{
+   UNIX_API_GET_MASK=1,   /* read the state of all relays */
+   UNIX_API_SET_MASK,     /* set the relays in mask to the given states */
+   UNIX_API_PULSE,        /* toggle the relays in mask for duration_ms */
+   UNIX_API_SUBSCRIBE,    /* receive an event on every state change */
+   UNIX_API_EMERGENCY_OFF,/* switch all relays of all cards off, see emergency.h */
+   UNIX_API_LEASE         /* set the relays in mask for duration_ms unless renewed, see lease.h */
+} unix_api_cmd_t;
+
+/* Message types sent by the daemon */
+#define UNIX_API_RESPONSE 0x80
+#define UNIX_API_EVENT    0x81
+
+typedef struct
+{
+   uint8_t  version;                 /* UNIX_API_VERSION */
+   uint8_t  cmd;                     /* unix_api_cmd_t */
+   uint16_t seq;                     /* returned in the response */
+   uint16_t mask;                    /* relays to set or pulse */
+   uint16_t states;                  /* new relay states (SET_MASK, LEASE) */
+   uint32_t duration_ms;             /* pulse duration, 0 for default, or lease duration */
+   char     serial[MAX_SERIAL_LEN];  /* card serial number, empty for first card */
+}
+unix_api_request_t;
+
+typedef struct
+{
+   uint8_t  version;                 /* UNIX_API_VERSION */
+   uint8_t  type;                    /* UNIX_API_RESPONSE or UNIX_API_EVENT */
+   uint16_t seq;                     /* sequence number of the request */
+   int16_t  status;                  /* 0 on success, negative errno value otherwise */
+   uint8_t  num_relays;              /* number of relays on the card */
+   uint8_t  reserved;
+   uint16_t states;                  /* relay states after the command */
+   uint16_t reserved2;
+   char     serial[MAX_SERIAL_LEN];  /* card serial number as in the request */
+}
+unix_api_response_t;
+
+
+/**********************************************************
+ * Function unix_api_init()
+ *
+ * Description: Create the unix domain socket and start
+ *              listening for local clients
+ *
+ * Parameters: path (in)   - socket path
+ *             users (in)  - comma separated list of user
+ *                           names or ids allowed to connect
+ *             groups (in) - comma separated list of group
+ *                           names or ids allowed to connect
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int unix_api_init(const char *path, const char *users, const char *groups);
+
+/**********************************************************
+ * Function unix_api_close()
+ *
+ * Description: Close all connections and remove the socket
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void unix_api_close(void);
+
+/**********************************************************
+ * Function unix_api_pollfds()
+ *
+ * Description: Fill in the descriptors of the listening
+ *              socket and the connected clients
+ *
+ * Parameters: fds (out) - poll descriptor array
+ *             max (in)  - size of array
+ *
+ * Return: number of descriptors filled in
+ *********************************************************/
+int unix_api_pollfds(struct pollfd *fds, int max);
+
+/**********************************************************
+ * Function unix_api_process()
+ *
+ * Description: Accept new clients and process the requests
+ *              signaled by poll()
+ *
+ * Parameters: fds (in) - descriptors filled in by
+ *                        unix_api_pollfds()
+ *             num (in) - number of descriptors
+ *
+ * Return: none
+ *********************************************************/
+void unix_api_process(struct pollfd *fds, int num);
+
+/**********************************************************
+ * Function unix_api_timeout()
+ *
+ * Description: Get the time until the next running pulse
+ *              has to be ended
+ *
+ * Parameters: none
+ *
+ * Return: timeout in ms for poll(), -1 if no pulse running
+ *********************************************************/
+int unix_api_timeout(void);
+
+/**********************************************************
+ * Function unix_api_timers()
+ *
+ * Description: End the pulses which are due
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void unix_api_timers(void);
+
+/**********************************************************
+ * Function unix_api_start_pulse()
+ *
+ * Description: Toggle relays and register the timer which
+ *              switches them back, the pulse is ended by
+ *              unix_api_timers() from the main loop
+ *
+ * Parameters: portname (in)    - communication port
+ *             serial (in)      - serial number, "" for the
+ *                                default card
+ *             mask (in)        - relays to toggle
+ *             duration_ms (in) - pulse duration, 0 for the
+ *                                configured duration
+ *             source (in)      - history source of the end
+ *                                of the pulse
+ *             id (in)          - source specific id
+ *             states (out)     - relay states after the
+ *                                toggle
+ *
+ * Return: 0 on success, negative errno value otherwise
+ *         (-EBUSY if too many pulses are running)
+ *********************************************************/
+int unix_api_start_pulse(char *portname, const char *serial, uint16_t mask, uint32_t duration_ms,
+                         history_source_t source, uint32_t id, uint16_t *states);
+
+/**********************************************************
+ * Function unix_api_cancel_pulses()
+ *
+ * Description: Drop the running pulses, the relays are not
+ *              switched back
+ *
+ * Parameters: none
+ *
+ * Return: number of pulses dropped
+ *********************************************************/
+int unix_api_cancel_pulses(void);
+
+/**********************************************************
+ * Function unix_api_notify()
+ *
+ * Description: Send a state change event to all subscribed
+ *              clients
+ *
+ * Parameters: serial (in)     - card serial number [optional]
+ *             num_relays (in) - number of relays on the card
+ *             states (in)     - new relay states
+ *
+ * Return: none
+ *********************************************************/
+void unix_api_notify(const char *serial, uint8_t num_relays, uint16_t states);
+
+/**********************************************************
+ * Function unix_api_connect()
+ *
+ * Description: Connect to the unix socket of a running
+ *              daemon
+ *
+ * Parameters: path (in) - socket path
+ *
+ * Return: socket descriptor, negative errno value on error
+ *         (-ENOENT or -ECONNREFUSED if no daemon is running)
+ *********************************************************/
+int unix_api_connect(const char *path);
+
+/**********************************************************
+ * Function unix_api_request()
+ *
+ * Description: Send a request to the daemon and wait for
+ *              its response
+ *
+ * Parameters: fd (in)     - socket descriptor
+ *             req (in)    - request message
+ *             resp (out)  - response message
+ *
+ * Return:  0 - success, result in resp->status
+ *         -1 - communication with the daemon failed
+ *********************************************************/
+int unix_api_request(int fd, unix_api_request_t *req, unix_api_response_t *resp);
+
+#endif
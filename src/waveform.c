@@ -0,0 +1,708 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Relay waveforms
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file implements the waveform player, see waveform.h.
+ *
+ *   The waveform thread only streams the samples to the card. When it
+ *   ends it writes a byte to a pipe, the main loop then records the final
+ *   states in the journal, history and statistics. The states in between
+ *   are not recorded, a PWM would fill the history in seconds.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <math.h>
+#include <syslog.h>
+#include <pthread.h>
+
+#include "relay_drv.h"
+#include "waveform.h"
+#include "interlock.h"
+#include "history.h"
+#include "crelay.h"
+#include "realtime.h"
+
+#define MAX_PATTERN_LEN 1024
+#define MAX_TOKENS      8
+
+/* Pattern line, times in ms until the sample rate is known */
+typedef struct
+{
+   uint16_t mask;
+   double   on_ms;
+   double   off_ms;
+   double   delay_ms;
+   uint32_t count;          /* 0: until the end of the waveform */
+   int      lineno;
+}
+wave_line_t;
+
+static wave_line_t g_lines[MAX_NUM_RELAYS];
+static int         g_num_lines;
+
+static char         g_portname[MAX_COM_PORT_NAME_LEN];
+static relay_type_t g_type;
+static uint8_t      g_num_relays;
+static uint16_t     g_states;      /* card states before the waveform */
+static uint16_t    *g_samples = NULL;
+static waveform_info_t g_info;
+static uint32_t     g_next_id = 1;
+
+static pthread_t  g_thread;
+static int        g_running = 0;   /* thread started, not joined yet */
+static int        g_finished = 0;  /* set by the thread at its end */
+static int        g_cancel = 0;
+static int        g_pipe[2] = {-1, -1};
+
+
+static uint64_t monotonic_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+/**********************************************************
+ * Internal function parse_ms()
+ *
+ * Description: Parse a time in ms
+ *
+ * Return: 0 on success, -1 if invalid
+ *********************************************************/
+static int parse_ms(const char *s, double *ms)
+{
+   char *end;
+
+   *ms = strtod(s, &end);
+   return (end == s || *end || *ms < 0 || *ms > 3600000) ? -1 : 0;
+}
+
+
+/**********************************************************
+ * Internal function to_samples()
+ *
+ * Description: Convert a time to a number of samples, a
+ *              time which is not zero must last at least
+ *              one sample
+ *
+ * Return: number of samples, -1 if too short
+ *********************************************************/
+static int64_t to_samples(double ms, uint32_t rate_hz)
+{
+   int64_t n = llround(ms*rate_hz/1000);
+
+   return (n == 0 && ms > 0) ? -1 : n;
+}
+
+
+/**********************************************************
+ * Internal function parse()
+ *
+ * Description: Parse a pattern into its lines
+ *
+ * Return: 0 on success, negative errno value otherwise
+ *********************************************************/
+static int parse(const char *pattern, uint32_t *rate_hz, double *length_ms, char *err, size_t errlen)
+{
+   char buf[MAX_PATTERN_LEN], *line, *save, *tok[MAX_TOKENS], *p, *end, *tsave;
+   uint16_t used = 0;
+   wave_line_t *wl;
+   double duty;
+   long relay;
+   int n, lineno = 0;
+
+   g_num_lines = 0;
+   *rate_hz = WAVEFORM_DEFAULT_RATE;
+   *length_ms = -1;
+   if (strlen(pattern) >= sizeof(buf))
+   {
+      snprintf(err, errlen, "pattern too long");
+      return -EINVAL;
+   }
+   strcpy(buf, pattern);
+
+   for (line=strtok_r(buf, ";\n", &save); line != NULL; line=strtok_r(NULL, ";\n", &save))
+   {
+      lineno++;
+      for (n=0, p=strtok_r(line, " \t\r", &tsave); p != NULL && n < MAX_TOKENS; p=strtok_r(NULL, " \t\r", &tsave))
+         tok[n++] = p;
+      if (n == 0)
+         continue;
+      if (p != NULL)
+      {
+         snprintf(err, errlen, "line %d: too many words", lineno);
+         return -EINVAL;
+      }
+
+      if (!strcmp(tok[0], "rate"))
+      {
+         *rate_hz = (n == 2) ? strtoul(tok[1], &end, 10) : 0;
+         if (n != 2 || *end || *rate_hz < WAVEFORM_MIN_RATE || *rate_hz > WAVEFORM_MAX_RATE)
+         {
+            snprintf(err, errlen, "line %d: rate must be %d to %d Hz", lineno, WAVEFORM_MIN_RATE, WAVEFORM_MAX_RATE);
+            return -EINVAL;
+         }
+         continue;
+      }
+      if (!strcmp(tok[0], "length"))
+      {
+         if (n != 2 || parse_ms(tok[1], length_ms) < 0)
+         {
+            snprintf(err, errlen, "line %d: invalid length", lineno);
+            return -EINVAL;
+         }
+         continue;
+      }
+
+      /* Relays */
+      wl = &g_lines[g_num_lines];
+      memset(wl, 0, sizeof(wave_line_t));
+      wl->lineno = lineno;
+      p = tok[0];
+      while (*p)
+      {
+         relay = strtol(p, &end, 10);
+         if (end == p || relay < FIRST_RELAY || relay >= FIRST_RELAY+MAX_NUM_RELAYS || (*end && *end != ','))
+         {
+            snprintf(err, errlen, "line %d: invalid relay number", lineno);
+            return -EINVAL;
+         }
+         wl->mask |= 1 << (relay-FIRST_RELAY);
+         p = (*end == ',') ? end+1 : end;
+      }
+      if (wl->mask & used)
+      {
+         snprintf(err, errlen, "line %d: relay used by another line", lineno);
+         return -EINVAL;
+      }
+      used |= wl->mask;
+
+      /* Optional delay at the end */
+      if (n >= 2 && !strcmp(tok[n-2], "delay"))
+      {
+         if (parse_ms(tok[n-1], &wl->delay_ms) < 0)
+         {
+            snprintf(err, errlen, "line %d: invalid delay", lineno);
+            return -EINVAL;
+         }
+         n -= 2;
+      }
+
+      if (n >= 2 && !strcmp(tok[1], "pulse") && (n == 4 || n == 5))
+      {
+         if (parse_ms(tok[2], &wl->on_ms) < 0 || wl->on_ms == 0 || parse_ms(tok[3], &wl->off_ms) < 0)
+         {
+            snprintf(err, errlen, "line %d: invalid pulse time", lineno);
+            return -EINVAL;
+         }
+         if (n == 5)
+         {
+            wl->count = strtoul(tok[4], &end, 10);
+            if (*end || wl->count == 0)
+            {
+               snprintf(err, errlen, "line %d: invalid pulse count", lineno);
+               return -EINVAL;
+            }
+         }
+      }
+      else if (n == 4 && !strcmp(tok[1], "pwm"))
+      {
+         duty = strtod(tok[3], &end);
+         if (parse_ms(tok[2], &wl->on_ms) < 0 || wl->on_ms == 0 || *end || duty < 0 || duty > 100)
+         {
+            snprintf(err, errlen, "line %d: invalid pwm period or duty cycle", lineno);
+            return -EINVAL;
+         }
+         wl->off_ms = wl->on_ms*(100-duty)/100;
+         wl->on_ms -= wl->off_ms;
+      }
+      else
+      {
+         snprintf(err, errlen, "line %d: expected relay[,relay...] pulse <on_ms> <off_ms> [count] "
+                  "or pwm <period_ms> <duty> [delay <ms>]", lineno);
+         return -EINVAL;
+      }
+      g_num_lines++;
+   }
+
+   if (g_num_lines == 0)
+   {
+      snprintf(err, errlen, "pattern has no relays");
+      return -EINVAL;
+   }
+   return 0;
+}
+
+
+/**********************************************************
+ * Internal function render()
+ *
+ * Description: Render the parsed lines into samples, the
+ *              last sample has the relays of the pattern
+ *              switched off
+ *
+ * Return: 0 on success, negative errno value otherwise
+ *********************************************************/
+static int render(uint32_t rate_hz, double length_ms, char *err, size_t errlen)
+{
+   wave_line_t *wl;
+   int64_t on, off, delay, end, total = 0;
+   uint64_t t, i, k;
+   uint16_t base;
+   int l;
+
+   for (l=0; l<g_num_lines; l++)
+   {
+      wl = &g_lines[l];
+      if (to_samples(wl->on_ms, rate_hz) < 0 || to_samples(wl->off_ms, rate_hz) < 0)
+      {
+         snprintf(err, errlen, "line %d: on or off time shorter than one sample", wl->lineno);
+         return -EINVAL;
+      }
+   }
+
+   /* Length of the waveform */
+   if (length_ms >= 0)
+   {
+      total = to_samples(length_ms, rate_hz);
+   }
+   else
+   {
+      for (l=0; l<g_num_lines; l++)
+      {
+         wl = &g_lines[l];
+         if (wl->count == 0)
+         {
+            snprintf(err, errlen, "line %d: repeats forever, length required", wl->lineno);
+            return -EINVAL;
+         }
+         end = llround(wl->delay_ms*rate_hz/1000) +
+               (to_samples(wl->on_ms, rate_hz) + to_samples(wl->off_ms, rate_hz))*(int64_t)wl->count;
+         if (end > total) total = end;
+      }
+   }
+   if (total <= 0 || total >= WAVEFORM_MAX_SAMPLES)
+   {
+      snprintf(err, errlen, "waveform must have 1 to %d samples", WAVEFORM_MAX_SAMPLES-1);
+      return -EINVAL;
+   }
+
+   if ((g_samples = malloc((total+1)*sizeof(uint16_t))) == NULL)
+   {
+      snprintf(err, errlen, "out of memory");
+      return -ENOMEM;
+   }
+   g_info.num_samples = total+1;
+   g_info.mask = 0;
+   for (l=0; l<g_num_lines; l++)
+      g_info.mask |= g_lines[l].mask;
+   base = g_states & ~g_info.mask;
+   for (i=0; i<=(uint64_t)total; i++)
+      g_samples[i] = base;
+
+   for (l=0; l<g_num_lines; l++)
+   {
+      wl = &g_lines[l];
+      on = to_samples(wl->on_ms, rate_hz);
+      off = to_samples(wl->off_ms, rate_hz);
+      delay = llround(wl->delay_ms*rate_hz/1000);
+      for (t=delay, k=0; t<(uint64_t)total && (wl->count == 0 || k < wl->count); t+=on+off, k++)
+      {
+         for (i=t; i<t+on && i<(uint64_t)total; i++)
+            g_samples[i] |= wl->mask;
+      }
+   }
+   return 0;
+}
+
+
+/**********************************************************
+ * Internal function waveform_thread()
+ *
+ * Description: Play the samples, switch the relays of the
+ *              pattern off if the waveform did not end
+ *
+ * Return: NULL
+ *********************************************************/
+static void* waveform_thread(void *arg)
+{
+   char *serial = g_info.serial[0] ? g_info.serial : NULL;
+   uint64_t t0;
+   char c = 0;
+   int rc;
+
+   realtime_thread("crelay-wave", 0);
+   t0 = monotonic_ns();
+   rc = crelay_play_waveform_type(g_type, g_portname, g_samples, g_info.num_samples,
+                                  g_info.rate_hz, &g_cancel, serial);
+   g_info.actual_ns = monotonic_ns() - t0;
+   g_info.played = (rc > 0) ? rc : 0;
+
+   if (rc < 0 || (uint32_t)rc < g_info.num_samples)
+   {
+      if (crelay_set_relay_mask_type(g_type, g_num_relays, g_portname, g_info.mask,
+                                     g_samples[g_info.num_samples-1] & g_info.mask, serial) < 0 && rc >= 0)
+         rc = -EIO;
+   }
+
+   g_info.rc = (rc < 0) ? rc : 0;
+   if (rc < 0)
+      g_info.state = WAVEFORM_FAILED;
+   else if (g_info.played < g_info.num_samples)
+      g_info.state = WAVEFORM_CANCELLED;
+   else
+      g_info.state = WAVEFORM_DONE;
+
+   __atomic_store_n(&g_finished, 1, __ATOMIC_RELEASE);
+   if (write(g_pipe[1], &c, 1) < 0) {}
+   return NULL;
+}
+
+
+/**********************************************************
+ * Function waveform_init()
+ *
+ * Description: Initialize the waveform player
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int waveform_init(void)
+{
+   if (pipe2(g_pipe, O_NONBLOCK|O_CLOEXEC) < 0)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Failed to init waveform player: %s\n", strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
+
+/**********************************************************
+ * Function waveform_close()
+ *
+ * Description: Cancel a running waveform and wait for its
+ *              thread to end
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void waveform_close(void)
+{
+   if (g_running)
+   {
+      waveform_cancel();
+      pthread_join(g_thread, NULL);
+      g_running = 0;
+   }
+   free(g_samples);
+   g_samples = NULL;
+   if (g_pipe[0] >= 0)
+   {
+      close(g_pipe[0]);
+      close(g_pipe[1]);
+   }
+   g_pipe[0] = g_pipe[1] = -1;
+}
+
+
+/**********************************************************
+ * Function waveform_start()
+ *
+ * Description: Render a pattern and start playing it
+ *
+ * Parameters: pattern (in) - waveform pattern
+ *             serial (in)  - card serial number, NULL or
+ *                            empty for the first card
+ *             err (out)    - error message
+ *             errlen (in)  - size of err
+ *
+ * Return: waveform id (>0) on success,
+ *         -EINVAL if the pattern is invalid,
+ *         -ENODEV if the card was not found,
+ *         -ENOTSUP if the card has no waveform mode,
+ *         -EPERM if the pattern breaks an interlock rule,
+ *         -EBUSY if a waveform is running
+ *********************************************************/
+int waveform_start(const char *pattern, const char *serial, char *err, size_t errlen)
+{
+   struct timespec ts;
+   double length_ms;
+   uint32_t rate_hz;
+   int rc;
+
+   if (g_pipe[0] < 0)
+   {
+      snprintf(err, errlen, "waveform player not running");
+      return -EINVAL;
+   }
+   if (g_running)
+   {
+      snprintf(err, errlen, "waveform %u is running", g_info.id);
+      return -EBUSY;
+   }
+   if (serial != NULL && strlen(serial) >= MAX_SERIAL_LEN)
+   {
+      snprintf(err, errlen, "serial number too long");
+      return -EINVAL;
+   }
+
+   free(g_samples);
+   g_samples = NULL;
+   memset(&g_info, 0, sizeof(g_info));
+   if ((rc = parse(pattern, &rate_hz, &length_ms, err, errlen)) < 0)
+      return rc;
+
+   /* Card and the states of the relays not in the pattern */
+   strcpy(g_info.serial, serial ? serial : "");
+   g_num_relays = FIRST_RELAY;
+   if (crelay_detect_relay_card(g_portname, &g_num_relays, g_info.serial[0] ? g_info.serial : NULL, NULL) < 0 ||
+       crelay_get_relay_mask(g_portname, &g_states, g_info.serial[0] ? g_info.serial : NULL) < 0)
+   {
+      snprintf(err, errlen, "card %s not found", g_info.serial[0] ? g_info.serial : "(default)");
+      return -ENODEV;
+   }
+   g_type = crelay_get_relay_card_type();
+   if (!crelay_waveform_supported(g_type))
+   {
+      snprintf(err, errlen, "card %s has no waveform mode", g_info.serial[0] ? g_info.serial : "(default)");
+      return -ENOTSUP;
+   }
+
+   g_info.rate_hz = rate_hz;
+   if ((rc = render(rate_hz, length_ms, err, errlen)) < 0)
+   {
+      free(g_samples);
+      g_samples = NULL;
+      g_info.num_samples = 0;
+      return rc;
+   }
+   if ((g_info.mask >> g_num_relays) != 0)
+   {
+      snprintf(err, errlen, "relay number out of range");
+      free(g_samples);
+      g_samples = NULL;
+      g_info.num_samples = 0;
+      return -EINVAL;
+   }
+   if (interlock_check_states(g_info.serial[0] ? g_info.serial : NULL, g_samples, g_info.num_samples) < 0)
+   {
+      snprintf(err, errlen, "pattern breaks interlock \"%s\"", interlock_violation());
+      free(g_samples);
+      g_samples = NULL;
+      g_info.num_samples = 0;
+      return -EPERM;
+   }
+
+   clock_gettime(CLOCK_REALTIME, &ts);
+   g_info.id = g_next_id++;
+   g_info.state = WAVEFORM_RUNNING;
+   g_info.start_ns = (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+   g_info.planned_ns = (uint64_t)g_info.num_samples*1000000000ULL/rate_hz;
+   g_cancel = g_finished = 0;
+
+   if (pthread_create(&g_thread, NULL, waveform_thread, NULL) != 0)
+   {
+      snprintf(err, errlen, "failed to start waveform thread");
+      g_info.state = WAVEFORM_FAILED;
+      return -EINVAL;
+   }
+   g_running = 1;
+   syslog(LOG_DAEMON | LOG_INFO, "Waveform %u started, %u samples at %u Hz\n", g_info.id,
+          g_info.num_samples, rate_hz);
+   return g_info.id;
+}
+
+
+/**********************************************************
+ * Function waveform_cancel()
+ *
+ * Description: Cancel the running waveform, the relays of
+ *              the pattern are switched off
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - no waveform running
+ *********************************************************/
+int waveform_cancel(void)
+{
+   if (!g_running || __atomic_load_n(&g_finished, __ATOMIC_ACQUIRE))
+      return -1;
+   __atomic_store_n(&g_cancel, 1, __ATOMIC_RELEASE);
+   return 0;
+}
+
+
+/**********************************************************
+ * Function waveform_stop()
+ *
+ * Description: Cancel the running waveform and wait until its
+ *              thread has ended, the writes done so far are
+ *              recorded
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - no waveform running
+ *********************************************************/
+int waveform_stop(void)
+{
+   struct pollfd fd;
+
+   if (waveform_cancel() < 0)
+      return -1;
+
+   /* The thread ends after its current card write at the latest */
+   fd.fd = g_pipe[0];
+   fd.events = POLLIN;
+   while (!__atomic_load_n(&g_finished, __ATOMIC_ACQUIRE))
+      poll(&fd, 1, 10);
+   waveform_process();
+   return 0;
+}
+
+
+/**********************************************************
+ * Function waveform_get()
+ *
+ * Description: Get the state of the running or last
+ *              waveform
+ *
+ * Parameters: info (out) - waveform state
+ *
+ * Return: none
+ *********************************************************/
+void waveform_get(waveform_info_t *info)
+{
+   /* The results are only valid once the thread is joined */
+   if (g_running)
+   {
+      memset(info, 0, sizeof(waveform_info_t));
+      info->id = g_info.id;
+      info->state = WAVEFORM_RUNNING;
+      strcpy(info->serial, g_info.serial);
+      info->mask = g_info.mask;
+      info->rate_hz = g_info.rate_hz;
+      info->num_samples = g_info.num_samples;
+      info->start_ns = g_info.start_ns;
+      info->planned_ns = g_info.planned_ns;
+   }
+   else
+   {
+      *info = g_info;
+   }
+}
+
+
+/**********************************************************
+ * Function waveform_state_name()
+ *
+ * Description: Get the name of a waveform state
+ *
+ * Parameters: state (in) - waveform state
+ *
+ * Return: state name
+ *********************************************************/
+const char* waveform_state_name(waveform_state_t state)
+{
+   static const char *names[] = {"idle", "running", "done", "failed", "cancelled"};
+
+   return (state <= WAVEFORM_CANCELLED) ? names[state] : "unknown";
+}
+
+
+/**********************************************************
+ * Function waveform_pollfd()
+ *
+ * Description: Get the file descriptor to be polled for
+ *              POLLIN by the main loop, it is readable
+ *              when the waveform has ended
+ *
+ * Parameters: none
+ *
+ * Return: file descriptor, -1 if not initialized
+ *********************************************************/
+int waveform_pollfd(void)
+{
+   return g_pipe[0];
+}
+
+
+/**********************************************************
+ * Function waveform_process()
+ *
+ * Description: Record the final relay states of an ended
+ *              waveform (history, statistics, shared
+ *              memory, local clients) and clean up
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void waveform_process(void)
+{
+   char buf[64];
+   uint16_t states;
+
+   while (read(g_pipe[0], buf, sizeof(buf)) > 0);
+   if (!g_running || !__atomic_load_n(&g_finished, __ATOMIC_ACQUIRE))
+      return;
+
+   pthread_join(g_thread, NULL);
+   g_running = 0;
+
+   if (g_info.state == WAVEFORM_FAILED)
+   {
+      syslog(LOG_DAEMON | LOG_ERR, "Waveform %u on card %s failed (%d) after %u samples\n", g_info.id,
+             g_info.serial[0] ? g_info.serial : "(default)", g_info.rc, g_info.played);
+   }
+   else
+   {
+      states = g_samples[g_info.num_samples-1];
+      publish_states(g_info.serial, g_num_relays, g_info.mask, states, HISTORY_SRC_WAVEFORM, g_info.id);
+      syslog(LOG_DAEMON | LOG_INFO, "Waveform %u %s, %u samples in %.1f ms\n", g_info.id,
+             waveform_state_name(g_info.state), g_info.played, g_info.actual_ns/1e6);
+   }
+   free(g_samples);
+   g_samples = NULL;
+}
@@ -0,0 +1,215 @@
+/******************************************************************************
+ *
+ * Relay card control utility: Relay waveforms
+ *
+ * Description:
+ *   This software is used to controls different type of relays cards.
+ *   This file contains the declaration of the waveform player, which
+ *   plays a timed multi-channel pattern (pulse trains, slow PWM of solid
+ *   state relays) on a card with a waveform mode, like the Sainsmart 4/8
+ *   channel card in FTDI bitbang mode.
+ *
+ *   Pattern syntax, lines separated by ';' or newlines:
+ *     rate <Hz>
+ *        sample rate, default 10000 (1000 to 100000)
+ *     length <ms>
+ *        length of the waveform, required if a line repeats forever
+ *     <relay>[,<relay>...] pulse <on_ms> <off_ms> [<count>] [delay <ms>]
+ *        pulse train, count pulses or until the end of the waveform
+ *     <relay>[,<relay>...] pwm <period_ms> <duty_%> [delay <ms>]
+ *        PWM until the end of the waveform
+ *
+ *   Example: "rate 10000; length 2000; 1 pwm 100 25; 2,3 pulse 5 45 10 delay 500"
+ *
+ *   The pattern is rendered into one sample per period of the sample rate
+ *   before it is started. Relays not used by the pattern keep their state,
+ *   relays used by it are off at the end, also when the waveform is
+ *   cancelled. The samples are then streamed to the card by a separate
+ *   thread, the card clocks them out to the relays by itself. Reads and
+ *   writes of the card fail with -EBUSY while it plays.
+ *
+ * Author:
+ *   crelay contributors
+ *
+ * Last modified:
+ *   18/10/2026
+ *
+ * Copyright 2026, crelay contributors
+ *
+ * This file is part of crelay.
+ *
+ * crelay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with crelay.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef waveform_h
+#define waveform_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "relay_drv.h"
+
+#define WAVEFORM_MAX_SAMPLES  (1<<20)
+#define WAVEFORM_DEFAULT_RATE 10000
+#define WAVEFORM_MIN_RATE     1000
+#define WAVEFORM_MAX_RATE     100000
+
+typedef enum
+{
+   WAVEFORM_IDLE=0,
+   WAVEFORM_RUNNING,
+   WAVEFORM_DONE,
+   WAVEFORM_FAILED,
+   WAVEFORM_CANCELLED
+} waveform_state_t;
+
+typedef struct
+{
+   uint32_t id;
+   waveform_state_t state;
+   char     serial[MAX_SERIAL_LEN];
+   uint16_t mask;           /* relays used by the pattern */
+   uint32_t rate_hz;
+   uint32_t num_samples;
+   uint32_t played;         /* samples played */
+   uint64_t start_ns;       /* CLOCK_REALTIME of the start */
+   uint64_t planned_ns;     /* duration of the waveform */
+   uint64_t actual_ns;      /* duration of the playback, incl. opening the card */
+   int      rc;             /* result of the playback */
+}
+waveform_info_t;
+
+
+/**********************************************************
+ * Function waveform_init()
+ *
+ * Description: Initialize the waveform player
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - fail
+ *********************************************************/
+int waveform_init(void);
+
+/**********************************************************
+ * Function waveform_close()
+ *
+ * Description: Cancel a running waveform and wait for its
+ *              thread to end
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void waveform_close(void);
+
+/**********************************************************
+ * Function waveform_start()
+ *
+ * Description: Render a pattern and start playing it
+ *
+ * Parameters: pattern (in) - waveform pattern
+ *             serial (in)  - card serial number, NULL or
+ *                            empty for the first card
+ *             err (out)    - error message
+ *             errlen (in)  - size of err
+ *
+ * Return: waveform id (>0) on success,
+ *         -EINVAL if the pattern is invalid,
+ *         -ENODEV if the card was not found,
+ *         -ENOTSUP if the card has no waveform mode,
+ *         -EPERM if the pattern breaks an interlock rule,
+ *         -EBUSY if a waveform is running
+ *********************************************************/
+int waveform_start(const char *pattern, const char *serial, char *err, size_t errlen);
+
+/**********************************************************
+ * Function waveform_cancel()
+ *
+ * Description: Cancel the running waveform, the relays of
+ *              the pattern are switched off
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - no waveform running
+ *********************************************************/
+int waveform_cancel(void);
+
+/**********************************************************
+ * Function waveform_stop()
+ *
+ * Description: Cancel the running waveform and wait until its
+ *              thread has ended, the writes done so far are
+ *              recorded
+ *
+ * Parameters: none
+ *
+ * Return:  0 - success
+ *         -1 - no waveform running
+ *********************************************************/
+int waveform_stop(void);
+
+/**********************************************************
+ * Function waveform_get()
+ *
+ * Description: Get the state of the running or last
+ *              waveform
+ *
+ * Parameters: info (out) - waveform state
+ *
+ * Return: none
+ *********************************************************/
+void waveform_get(waveform_info_t *info);
+
+/**********************************************************
+ * Function waveform_state_name()
+ *
+ * Description: Get the name of a waveform state
+ *
+ * Parameters: state (in) - waveform state
+ *
+ * Return: state name
+ *********************************************************/
+const char* waveform_state_name(waveform_state_t state);
+
+/**********************************************************
+ * Function waveform_pollfd()
+ *
+ * Description: Get the file descriptor to be polled for
+ *              POLLIN by the main loop, it is readable
+ *              when the waveform has ended
+ *
+ * Parameters: none
+ *
+ * Return: file descriptor, -1 if not initialized
+ *********************************************************/
+int waveform_pollfd(void);
+
+/**********************************************************
+ * Function waveform_process()
+ *
+ * Description: Record the final relay states of an ended
+ *              waveform (history, statistics, shared
+ *              memory, local clients) and clean up
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *********************************************************/
+void waveform_process(void);
+
+#endif